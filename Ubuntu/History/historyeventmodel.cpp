@@ -26,10 +26,16 @@
 #include "contactmatcher_p.h"
 #include <QDBusMetaType>
 #include <QDebug>
+#include <QSet>
 #include <QTimerEvent>
+#include <algorithm>
+
+// pages requested in advance, so that scrolling does not wait for the service
+static const int DefaultPrefetchPages = 1;
 
 HistoryEventModel::HistoryEventModel(QObject *parent) :
-    HistoryModel(parent), mCanFetchMore(true)
+    HistoryModel(parent), mCanFetchMore(true), mFetching(false), mIndexedRows(0), mPendingPages(0),
+    mViewExhausted(false), mPageSize(History::DefaultPageSize), mPrefetchPages(DefaultPrefetchPages)
 {
     // configure the roles
     mRoles = HistoryModel::roleNames();
@@ -206,29 +212,222 @@ bool HistoryEventModel::canFetchMore(const QModelIndex &parent) const
     return mCanFetchMore;
 }
 
+/**
+ * @brief Shows the next page of events
+ *
+ * If the page was already read ahead it is inserted right away, otherwise it is inserted
+ * once the service replies. In both cases the pages after it are requested in the background,
+ * up to prefetchPages of them.
+ */
 void HistoryEventModel::fetchMore(const QModelIndex &parent)
 {
     if (parent.isValid() || !mFilter || mView.isNull()) {
         return;
     }
 
-    History::Events events = fetchNextPage();
+    if (mFetching) {
+        return;
+    }
 
-    if (events.isEmpty()) {
-        mCanFetchMore = false;
-        Q_EMIT canFetchMoreChanged();
+    if (!mPrefetchedPages.isEmpty()) {
+        onPageFetched(mPrefetchedPages.takeFirst());
     } else {
-        Q_FOREACH(const History::Event &event, events) {
-            // watch for contact changes for the given identifiers
-            Q_FOREACH(const History::Participant &participant, event.participants()) {
-                watchContactInfo(event.accountId(), participant.identifier(), participant.properties());
+        mFetching = true;
+    }
+    prefetch();
+}
+
+/// requests one more page from the view, which is shown if fetchMore() is waiting for it or kept for later
+void HistoryEventModel::requestPage()
+{
+    History::EventView *view = mView.data();
+    mPendingPages++;
+    mView->nextPage([this, view](const History::Events &events) {
+        // the query was updated since the page was requested
+        if (view != mView.data()) {
+            return;
+        }
+
+        mPendingPages--;
+        if (events.isEmpty()) {
+            // the pages requested after this one will be empty too
+            mViewExhausted = true;
+            mFetching = false;
+        } else if (mFetching) {
+            mFetching = false;
+            onPageFetched(events);
+        } else {
+            mPrefetchedPages << events;
+        }
+        prefetch();
+    });
+}
+
+/// keeps prefetchPages pages read ahead, and stops fetching once all the pages were shown
+void HistoryEventModel::prefetch()
+{
+    if (mView.isNull()) {
+        return;
+    }
+
+    if (mViewExhausted) {
+        if (mCanFetchMore && mPrefetchedPages.isEmpty() && mPendingPages == 0) {
+            mCanFetchMore = false;
+            Q_EMIT canFetchMoreChanged();
+        }
+        return;
+    }
+
+    int wantedPages = mPrefetchPages + (mFetching ? 1 : 0);
+    while (mPrefetchedPages.count() + mPendingPages < wantedPages) {
+        requestPage();
+    }
+}
+
+/// removes events from the pages read ahead, so that they don't show up once those pages are inserted
+void HistoryEventModel::dropPrefetchedEvents(const History::Events &events)
+{
+    if (mPrefetchedPages.isEmpty()) {
+        return;
+    }
+
+    QSet<QString> keys;
+    Q_FOREACH(const History::Event &event, events) {
+        keys.insert(eventKey(event));
+    }
+
+    for (int i = mPrefetchedPages.count() - 1; i >= 0; --i) {
+        History::Events &page = mPrefetchedPages[i];
+        for (int j = page.count() - 1; j >= 0; --j) {
+            if (keys.contains(eventKey(page[j]))) {
+                page.removeAt(j);
             }
         }
+        if (page.isEmpty()) {
+            mPrefetchedPages.removeAt(i);
+        }
+    }
+    prefetch();
+}
 
-        beginInsertRows(QModelIndex(), mEvents.count(), mEvents.count() + events.count() - 1);
-        mEvents << events;
-        endInsertRows();
+/**
+ * @brief Inserts a non-empty page of events received after fetchMore()
+ *
+ * Events added to the model after the page was requested are skipped.
+ */
+void HistoryEventModel::onPageFetched(const History::Events &events)
+{
+    History::Events newEvents;
+    Q_FOREACH(const History::Event &event, events) {
+        if (mEventRows.contains(eventKey(event))) {
+            continue;
+        }
+        newEvents << event;
+
+        // watch for contact changes for the given identifiers
+        Q_FOREACH(const History::Participant &participant, event.participants()) {
+            watchContactInfo(event.accountId(), participant.identifier(), participant.properties());
+        }
+    }
+
+    if (newEvents.isEmpty()) {
+        return;
     }
+
+    int row = mEvents.count();
+    beginInsertRows(QModelIndex(), row, row + newEvents.count() - 1);
+    mEvents << newEvents;
+    for (int i = 0; i < newEvents.count(); ++i) {
+        mSortKeys << HistorySortKey();
+    }
+    indexInsertedEvents(row, newEvents);
+    endInsertRows();
+}
+
+QString HistoryEventModel::eventKey(const History::Event &event)
+{
+    return QString("%1#-#%2#-#%3#-#%4").arg(QString::number(event.type()), event.accountId(),
+                                             event.threadId(), event.eventId());
+}
+
+/**
+ * @brief Returns the row of the given event, or -1 if it is not loaded in the model
+ *
+ * Inserting or removing a row shifts all the rows below it, so instead of updating them
+ * on every change, their index entries are refreshed here the first time one is needed.
+ */
+int HistoryEventModel::rowForEvent(const History::Event &event) const
+{
+    QString key = eventKey(event);
+    QHash<QString, int>::const_iterator it = mEventRows.constFind(key);
+    if (it == mEventRows.constEnd()) {
+        return -1;
+    }
+    if (it.value() < mIndexedRows) {
+        return it.value();
+    }
+
+    for (int i = mIndexedRows; i < mEvents.count(); ++i) {
+        mEventRows[eventKey(mEvents[i])] = i;
+    }
+    mIndexedRows = mEvents.count();
+    return mEventRows.value(key, -1);
+}
+
+/// registers events just inserted in mEvents at the given row
+void HistoryEventModel::indexInsertedEvents(int row, const History::Events &events)
+{
+    bool appended = (row + events.count() == mEvents.count());
+    for (int i = 0; i < events.count(); ++i) {
+        mEventRows[eventKey(events[i])] = row + i;
+    }
+
+    if (!appended) {
+        mIndexedRows = qMin(mIndexedRows, row);
+    } else if (mIndexedRows == row) {
+        mIndexedRows = mEvents.count();
+    }
+}
+
+HistorySortKey HistoryEventModel::sortKeyForRow(int row) const
+{
+    HistorySortKey &key = mSortKeys[row];
+    if (key.isEmpty()) {
+        key = sortKeyForEvent(mEvents[row]);
+    }
+    return key;
+}
+
+History::Participants HistoryEventModel::participantsForRow(int row) const
+{
+    return mEvents[row].participants();
+}
+
+/// builds the sort key from the event fields, only going through its properties for the less common sort fields
+HistorySortKey HistoryEventModel::sortKeyForEvent(const History::Event &event) const
+{
+    HistorySortKey key;
+    QVariantMap properties;
+    key.reserve(sortFields().count());
+    Q_FOREACH(const SortField &field, sortFields()) {
+        if (field.name == History::FieldTimestamp) {
+            key << HistorySortValue(event.timestamp().toMSecsSinceEpoch());
+        } else if (field.name == History::FieldEventId) {
+            key << HistorySortValue(event.eventId());
+        } else if (field.name == History::FieldThreadId) {
+            key << HistorySortValue(event.threadId());
+        } else if (field.name == History::FieldAccountId) {
+            key << HistorySortValue(event.accountId());
+        } else if (field.name == History::FieldSenderId) {
+            key << HistorySortValue(event.senderId());
+        } else {
+            if (properties.isEmpty()) {
+                properties = event.properties();
+            }
+            key << sortValue(field, properties.value(field.name));
+        }
+    }
+    return key;
 }
 
 QHash<int, QByteArray> HistoryEventModel::roleNames() const
@@ -236,6 +435,41 @@ QHash<int, QByteArray> HistoryEventModel::roleNames() const
     return mRoles;
 }
 
+int HistoryEventModel::pageSize() const
+{
+    return mPageSize;
+}
+
+/// the size applies to the pages requested from now on, the ones already read ahead are kept
+void HistoryEventModel::setPageSize(int size)
+{
+    if (size <= 0 || size == mPageSize) {
+        return;
+    }
+
+    mPageSize = size;
+    if (!mView.isNull()) {
+        mView->setPageSize(size);
+    }
+    Q_EMIT pageSizeChanged();
+}
+
+int HistoryEventModel::prefetchPages() const
+{
+    return mPrefetchPages;
+}
+
+void HistoryEventModel::setPrefetchPages(int pages)
+{
+    if (pages < 0 || pages == mPrefetchPages) {
+        return;
+    }
+
+    mPrefetchPages = pages;
+    prefetch();
+    Q_EMIT prefetchPagesChanged();
+}
+
 bool HistoryEventModel::removeEvents(const QVariantList &eventsProperties)
 {
     History::Events events;
@@ -260,7 +494,12 @@ bool HistoryEventModel::removeEvents(const QVariantList &eventsProperties)
         return false;
     }
 
-    return History::Manager::instance()->removeEvents(events);
+    History::Manager::instance()->removeEventsAsync(events, this, [](bool success) {
+        if (!success) {
+            qWarning() << "Failed to remove events";
+        }
+    });
+    return true;
 }
 
 bool HistoryEventModel::writeEvents(const QVariantList &eventsProperties)
@@ -290,32 +529,44 @@ bool HistoryEventModel::writeEvents(const QVariantList &eventsProperties)
     return History::Manager::instance()->writeEvents(events);
 }
 
+/// the event is fetched and written back without blocking, so only failures to start the removal are returned
 bool HistoryEventModel::removeEventAttachment(const QString &accountId, const QString &threadId, const QString &eventId, int eventType, const QString &attachmentId)
 {
-    History::TextEvent textEvent;
-    History::Event event = History::Manager::instance()->getSingleEvent((History::EventType)eventType, accountId, threadId, eventId);
-    if (event.type() != History::EventTypeText) {
+    if (eventType != History::EventTypeText) {
         qWarning() << "Trying to remove an attachment from a non text event";
         return false;
     }
-    QVariantMap properties = event.properties();
-    QList<QVariantMap> attachmentProperties = qdbus_cast<QList<QVariantMap> >(properties[History::FieldAttachments]);
-    QList<QVariantMap> newAttachmentProperties;
-    int count = 0;
-    Q_FOREACH(const QVariantMap &map, attachmentProperties) {
-        if (map[History::FieldAttachmentId] != attachmentId) {
-            count++;
-            newAttachmentProperties << map;
+
+    History::Manager::instance()->getSingleEventAsync((History::EventType)eventType, accountId, threadId, eventId, this,
+                                                      [this, attachmentId](const History::Event &event) {
+        if (event.type() != History::EventTypeText) {
+            qWarning() << "Trying to remove an attachment from a non text event";
+            return;
         }
-    }
-    if (count == attachmentProperties.size()) {
-        qWarning() << "No attachment found for id " << attachmentId;
-        return false;
-    }
-    properties[History::FieldAttachments] = QVariant::fromValue(newAttachmentProperties);
-    textEvent = History::TextEvent::fromProperties(properties);
+        QVariantMap properties = event.properties();
+        QList<QVariantMap> attachmentProperties = qdbus_cast<QList<QVariantMap> >(properties[History::FieldAttachments]);
+        QList<QVariantMap> newAttachmentProperties;
+        int count = 0;
+        Q_FOREACH(const QVariantMap &map, attachmentProperties) {
+            if (map[History::FieldAttachmentId] != attachmentId) {
+                count++;
+                newAttachmentProperties << map;
+            }
+        }
+        if (count == attachmentProperties.size()) {
+            qWarning() << "No attachment found for id " << attachmentId;
+            return;
+        }
+        properties[History::FieldAttachments] = QVariant::fromValue(newAttachmentProperties);
+        History::TextEvent textEvent = History::TextEvent::fromProperties(properties);
 
-    return History::Manager::instance()->writeEvents(History::Events() << textEvent);
+        History::Manager::instance()->writeEventsAsync(History::Events() << textEvent, this, [](bool success) {
+            if (!success) {
+                qWarning() << "Failed to remove the attachment";
+            }
+        });
+    });
+    return true;
 }
 
 void HistoryEventModel::updateQuery()
@@ -324,6 +575,9 @@ void HistoryEventModel::updateQuery()
     if (!mEvents.isEmpty()) {
         beginRemoveRows(QModelIndex(), 0, mEvents.count() - 1);
         mEvents.clear();
+        mEventRows.clear();
+        mIndexedRows = 0;
+        mSortKeys.clear();
         endRemoveRows();
     }
 
@@ -333,7 +587,12 @@ void HistoryEventModel::updateQuery()
 
     if (!mView.isNull()) {
         mView->disconnect(this);
+        mView.clear();
     }
+    mFetching = false;
+    mPrefetchedPages.clear();
+    mPendingPages = 0;
+    mViewExhausted = false;
 
     if (mFilter && mFilter->filter().isValid()) {
         queryFilter = mFilter->filter();
@@ -347,6 +606,7 @@ void HistoryEventModel::updateQuery()
     }
 
     mView = History::Manager::instance()->queryEvents((History::EventType)mType, querySort, queryFilter);
+    mView->setPageSize(mPageSize);
     connect(mView.data(),
             SIGNAL(eventsAdded(History::Events)),
             SLOT(onEventsAdded(History::Events)));
@@ -377,42 +637,83 @@ void HistoryEventModel::updateQuery()
     fetchMore(QModelIndex());
 }
 
+/**
+ * @brief Inserts the events received from the view
+ *
+ * The events are sorted first, so that the ones landing on the same position of
+ * the model are inserted together in a single range.
+ */
 void HistoryEventModel::onEventsAdded(const History::Events &events)
 {
     if (!events.count()) {
         return;
     }
 
+    typedef QPair<HistorySortKey, History::Event> SortedEvent;
+    QList<SortedEvent> added;
+    QSet<QString> addedKeys;
     Q_FOREACH(const History::Event &event, events) {
         // if the event is already on the model, skip it
-        if (mEvents.contains(event)) {
+        QString key = eventKey(event);
+        if (mEventRows.contains(key) || addedKeys.contains(key)) {
             continue;
         }
+        addedKeys.insert(key);
+        added << qMakePair(sortKeyForEvent(event), event);
+    }
+
+    bool ascending = isAscending();
+    std::stable_sort(added.begin(), added.end(), [this, ascending](const SortedEvent &left, const SortedEvent &right) {
+        return ascending ? lessThan(left.first, right.first) : lessThan(right.first, left.first);
+    });
+
+    // take all the positions before changing the model, and insert the runs from the bottom
+    // up, so that the positions above the inserted rows stay valid
+    QList<int> positions;
+    Q_FOREACH(const SortedEvent &event, added) {
+        positions << positionForItem(event.first);
+    }
+
+    int end = added.count();
+    while (end > 0) {
+        int pos = positions[end - 1];
+        int start = end - 1;
+        while (start > 0 && positions[start - 1] == pos) {
+            --start;
+        }
 
-        int pos = positionForItem(event.properties());
-        beginInsertRows(QModelIndex(), pos, pos);
-        mEvents.insert(pos, event);
+        History::Events run;
+        beginInsertRows(QModelIndex(), pos, pos + end - start - 1);
+        for (int i = start; i < end; ++i) {
+            mEvents.insert(pos + i - start, added[i].second);
+            mSortKeys.insert(pos + i - start, added[i].first);
+            run << added[i].second;
+        }
+        indexInsertedEvents(pos, run);
         endInsertRows();
+        end = start;
     }
 }
 
 void HistoryEventModel::onEventsModified(const History::Events &events)
 {
     History::Events newEvents;
+    QList<int> changedRows;
     Q_FOREACH(const History::Event &event, events) {
-        int pos = mEvents.indexOf(event);
+        int pos = rowForEvent(event);
         if (pos >= 0) {
             mEvents[pos] = event;
-            QModelIndex idx = index(pos);
+            mSortKeys[pos] = HistorySortKey();
             if (event.type() == History::EventTypeText) {
                 History::TextEvent textEvent = event;
                 mAttachmentCache.remove(textEvent);
             }
-            Q_EMIT dataChanged(idx, idx);
+            changedRows << pos;
         } else {
             newEvents << event;
         }
     }
+    notifyRowsChanged(changedRows);
 
     // append the events that were not yet on the model
     if (!newEvents.isEmpty()) {
@@ -422,14 +723,35 @@ void HistoryEventModel::onEventsModified(const History::Events &events)
 
 void HistoryEventModel::onEventsRemoved(const History::Events &events)
 {
+    // look all the rows up before removing any, and remove them from the bottom up, so that
+    // the rows above the ones being removed stay indexed, one range of contiguous rows at a time
+    QList<int> rows;
     Q_FOREACH(const History::Event &event, events) {
-        int pos = mEvents.indexOf(event);
+        int pos = rowForEvent(event);
         if (pos >= 0) {
-            beginRemoveRows(QModelIndex(), pos, pos);
-            mEvents.removeAt(pos);
-            endRemoveRows();
+            rows << pos;
         }
     }
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    int i = 0;
+    while (i < rows.count()) {
+        int last = rows[i];
+        int first = last;
+        while (++i < rows.count() && rows[i] == first - 1) {
+            first = rows[i];
+        }
+
+        beginRemoveRows(QModelIndex(), first, last);
+        for (int pos = last; pos >= first; --pos) {
+            mEventRows.remove(eventKey(mEvents.takeAt(pos)));
+            mSortKeys.removeAt(pos);
+        }
+        mIndexedRows = qMin(mIndexedRows, first);
+        endRemoveRows();
+    }
+    dropPrefetchedEvents(events);
 
     // FIXME: there is a corner case here: if an event was not loaded yet, but was already
     // removed by another client, it will still show up when a new page is requested. Maybe it
@@ -454,8 +776,3 @@ void HistoryEventModel::onThreadsRemoved(const History::Threads &threads)
         }
     }
 }
-
-History::Events HistoryEventModel::fetchNextPage()
-{
-    return mView->nextPage();
-}
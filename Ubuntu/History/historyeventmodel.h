@@ -30,6 +30,8 @@
 class HistoryEventModel : public HistoryModel
 {
     Q_OBJECT
+    Q_PROPERTY(int pageSize READ pageSize WRITE setPageSize NOTIFY pageSizeChanged)
+    Q_PROPERTY(int prefetchPages READ prefetchPages WRITE setPrefetchPages NOTIFY prefetchPagesChanged)
     Q_ENUMS(EventRole)
 public:
     enum EventRole {
@@ -64,10 +66,19 @@ public:
 
     virtual QHash<int, QByteArray> roleNames() const;
 
+    int pageSize() const;
+    void setPageSize(int size);
+    int prefetchPages() const;
+    void setPrefetchPages(int pages);
+
     Q_INVOKABLE bool removeEvents(const QVariantList &eventsProperties);
     Q_INVOKABLE bool writeEvents(const QVariantList &eventsProperties);
     Q_INVOKABLE bool removeEventAttachment(const QString &accountId, const QString &threadId, const QString &eventId, int eventType, const QString &attachmentId);
 
+Q_SIGNALS:
+    void pageSizeChanged();
+    void prefetchPagesChanged();
+
 protected Q_SLOTS:
     virtual void updateQuery();
     virtual void onEventsAdded(const History::Events &events);
@@ -76,14 +87,36 @@ protected Q_SLOTS:
     virtual void onThreadsRemoved(const History::Threads &threads);
 
 protected:
-    History::Events fetchNextPage();
+    virtual void onPageFetched(const History::Events &events);
+    virtual HistorySortKey sortKeyForRow(int row) const;
+    virtual History::Participants participantsForRow(int row) const;
+    HistorySortKey sortKeyForEvent(const History::Event &event) const;
+    void dropPrefetchedEvents(const History::Events &events);
 
 private:
+    void requestPage();
+    void prefetch();
+    static QString eventKey(const History::Event &event);
+    int rowForEvent(const History::Event &event) const;
+    void indexInsertedEvents(int row, const History::Events &events);
+
     History::EventViewPtr mView;
     History::Events mEvents;
     bool mCanFetchMore;
+    bool mFetching;
+    // row of each loaded event, by eventKey(); rows from mIndexedRows on may be stale
+    mutable QHash<QString, int> mEventRows;
+    mutable int mIndexedRows;
+    // sort key of each row, computed the first time it is compared
+    mutable QList<HistorySortKey> mSortKeys;
     QHash<int, QByteArray> mRoles;
     mutable QMap<History::TextEvent, QList<QVariant> > mAttachmentCache;
+    // pages read ahead of fetchMore(), in the order they were received
+    QList<History::Events> mPrefetchedPages;
+    int mPendingPages;
+    bool mViewExhausted;
+    int mPageSize;
+    int mPrefetchPages;
 };
 
 #endif // HISTORYEVENTMODEL_H
@@ -25,6 +25,8 @@
 #include "sort.h"
 #include "historyqmlsort.h"
 #include "participant.h"
+#include <QSet>
+#include <algorithm>
 
 HistoryGroupedEventsModel::HistoryGroupedEventsModel(QObject *parent) :
     HistoryEventModel(parent)
@@ -73,14 +75,18 @@ QVariant HistoryGroupedEventsModel::data(const QModelIndex &index, int role) con
     return result;
 }
 
-void HistoryGroupedEventsModel::fetchMore(const QModelIndex &parent)
+HistorySortKey HistoryGroupedEventsModel::sortKeyForRow(int row) const
 {
-    if (!canFetchMore(parent)) {
-        return;
-    }
+    return sortKeyForEvent(mEventGroups[row].displayedEvent);
+}
 
-    History::Events events = fetchNextPage();
+History::Participants HistoryGroupedEventsModel::participantsForRow(int row) const
+{
+    return mEventGroups[row].displayedEvent.participants();
+}
 
+void HistoryGroupedEventsModel::onPageFetched(const History::Events &events)
+{
     // History already deliver us the events in the right order
     // but we might have added new entries in the added, removed, modified events.
     // still, it is less expensive to do a sequential search starting from the bottom
@@ -92,15 +98,18 @@ void HistoryGroupedEventsModel::fetchMore(const QModelIndex &parent)
             watchContactInfo(event.accountId(), participant.identifier(), participant.properties());
         }
         bool found = false;
+        HistorySortKey key = sortKeyForEvent(event);
         int pos = mEventGroups.count() -1;
         for (; pos >= 0; pos--) {
             HistoryEventGroup &group = mEventGroups[pos];
             if (areOfSameGroup(event, group.displayedEvent)) {
                 found = true;
-                addEventToGroup(event, group, pos);
+                if (addEventToGroup(event, group)) {
+                    QModelIndex idx(index(pos));
+                    Q_EMIT dataChanged(idx, idx);
+                }
                 break;
-            } else if (isAscending() ? lessThan(group.displayedEvent.properties(), event.properties()) :
-                       lessThan(event.properties(), group.displayedEvent.properties())) {
+            } else if (isAscending() ? lessThan(sortKeyForRow(pos), key) : lessThan(key, sortKeyForRow(pos))) {
                 break;
             }
         }
@@ -145,50 +154,168 @@ void HistoryGroupedEventsModel::onEventsAdded(const History::Events &events)
         return;
     }
 
+    typedef QPair<HistorySortKey, History::Event> SortedEvent;
+    QList<SortedEvent> sorted;
     Q_FOREACH(const History::Event &event, events) {
-        int pos = positionForItem(event.properties());
+        sorted << qMakePair(sortKeyForEvent(event), event);
+    }
+    bool ascending = isAscending();
+    std::stable_sort(sorted.begin(), sorted.end(), [this, ascending](const SortedEvent &left, const SortedEvent &right) {
+        return ascending ? lessThan(left.first, right.first) : lessThan(right.first, left.first);
+    });
+
+    // add the events to the existing groups first, keeping the new groups aside with the
+    // position they go to, so that the rows are only inserted once everything is placed
+    QList<int> changedRows;
+    QList<HistoryEventGroup> newGroups;
+    QList<int> newPositions;
+    Q_FOREACH(const SortedEvent &sortedEvent, sorted) {
+        const History::Event &event = sortedEvent.second;
+        int pos = positionForItem(sortedEvent.first);
+
+        // the event might belong to the group created for the previous one
+        if (!newGroups.isEmpty() && newPositions.last() == pos &&
+                areOfSameGroup(event, newGroups.last().displayedEvent)) {
+            addEventToGroup(event, newGroups.last());
+            continue;
+        }
 
         // check if the event belongs to the group at the position
         if (pos >= 0 && pos < mEventGroups.count()) {
             HistoryEventGroup &group = mEventGroups[pos];
             if (areOfSameGroup(event, group.displayedEvent)) {
-                addEventToGroup(event, group, pos);
+                if (addEventToGroup(event, group)) {
+                    changedRows << pos;
+                }
                 continue;
             }
         }
 
         // else, we just create a new group
-        beginInsertRows(QModelIndex(), pos, pos);
         HistoryEventGroup group;
         group.displayedEvent = event;
         group.events << event;
-        mEventGroups.insert(pos, group);
-        endInsertRows();
+        newGroups << group;
+        newPositions << pos;
+    }
+    notifyRowsChanged(changedRows);
+
+    // the new groups going to the same position are inserted together, from the bottom up
+    int end = newGroups.count();
+    while (end > 0) {
+        int pos = newPositions[end - 1];
+        int start = end - 1;
+        while (start > 0 && newPositions[start - 1] == pos) {
+            --start;
+        }
 
+        beginInsertRows(QModelIndex(), pos, pos + end - start - 1);
+        for (int i = start; i < end; ++i) {
+            mEventGroups.insert(pos + i - start, newGroups[i]);
+        }
+        endInsertRows();
+        end = start;
     }
 }
 
 void HistoryGroupedEventsModel::onEventsModified(const History::Events &events)
 {
     // FIXME: we are not yet handling events changing the property used for sorting
-    // so for now the behavior is to find the item and check if it needs inserting or
-    // updating in the group, which is exactly what onEventsAdded() does, so:
-    onEventsAdded(events);
+    // so for now the behavior is to find the item and update it in its group, and to
+    // insert the events not found the same way onEventsAdded() does
+    History::Events newEvents;
+    QList<int> changedRows;
+    Q_FOREACH(const History::Event &event, events) {
+        int pos = groupForEvent(event);
+        if (pos < 0) {
+            newEvents << event;
+            continue;
+        }
+
+        HistoryEventGroup &group = mEventGroups[pos];
+        group.events[group.events.indexOf(event)] = event;
+        if (group.displayedEvent == event) {
+            group.displayedEvent = event;
+        }
+        changedRows << pos;
+    }
+    notifyRowsChanged(changedRows);
+
+    if (!newEvents.isEmpty()) {
+        onEventsAdded(newEvents);
+    }
 }
 
+/**
+ * @brief Removes the events from their groups
+ *
+ * The groups left empty are removed once all the events were handled, one range of
+ * contiguous rows at a time, and the other groups that changed are notified together.
+ */
 void HistoryGroupedEventsModel::onEventsRemoved(const History::Events &events)
 {
+    // the empty groups keep their rows until the end, so that the positions found stay valid
+    QSet<int> rows;
     Q_FOREACH(const History::Event &event, events) {
-        int pos = positionForItem(event.properties());
-        if (pos < 0 || pos >= rowCount()) {
+        int pos = groupForEvent(event);
+        if (pos < 0) {
             continue;
         }
-        HistoryEventGroup &group = mEventGroups[pos];
-        if (!group.events.contains(event)) {
-            continue;
+        removeEventFromGroup(event, mEventGroups[pos]);
+        rows.insert(pos);
+    }
+
+    QList<int> changedRows;
+    QList<int> emptyRows;
+    Q_FOREACH(int row, rows) {
+        if (mEventGroups[row].events.isEmpty()) {
+            emptyRows << row;
+        } else {
+            changedRows << row;
         }
-        removeEventFromGroup(event, group, pos);
     }
+
+    std::sort(emptyRows.begin(), emptyRows.end(), std::greater<int>());
+    int i = 0;
+    while (i < emptyRows.count()) {
+        int last = emptyRows[i];
+        int first = last;
+        while (++i < emptyRows.count() && emptyRows[i] == first - 1) {
+            first = emptyRows[i];
+        }
+
+        beginRemoveRows(QModelIndex(), first, last);
+        for (int pos = last; pos >= first; --pos) {
+            mEventGroups.removeAt(pos);
+        }
+        endRemoveRows();
+
+        // the rows below the removed ones moved up
+        for (int j = 0; j < changedRows.count(); ++j) {
+            if (changedRows[j] > last) {
+                changedRows[j] -= last - first + 1;
+            }
+        }
+    }
+    notifyRowsChanged(changedRows);
+    dropPrefetchedEvents(events);
+}
+
+/**
+ * @brief Returns the row of the group holding the given event, or -1 if it is not in the model
+ *
+ * The groups are sorted by their displayed event, which comes before the other events of the
+ * group, so the group is either at the position of the event or above it.
+ */
+int HistoryGroupedEventsModel::groupForEvent(const History::Event &event) const
+{
+    int pos = qMin(positionForItem(sortKeyForEvent(event)), mEventGroups.count() - 1);
+    for (; pos >= 0; --pos) {
+        if (mEventGroups[pos].events.contains(event)) {
+            return pos;
+        }
+    }
+    return -1;
 }
 
 bool HistoryGroupedEventsModel::areOfSameGroup(const History::Event &event1, const History::Event &event2)
@@ -221,15 +348,16 @@ bool HistoryGroupedEventsModel::areOfSameGroup(const History::Event &event1, con
     return true;
 }
 
-void HistoryGroupedEventsModel::addEventToGroup(const History::Event &event, HistoryEventGroup &group, int row)
+/// adds the event to the group, returning whether the event displayed for the group changed
+bool HistoryGroupedEventsModel::addEventToGroup(const History::Event &event, HistoryEventGroup &group)
 {
     if (!group.events.contains(event)) {
         // insert the event in the correct position according to the sort criteria
         bool append = true;
+        HistorySortKey key = sortKeyForEvent(event);
         for (int i = 0; i < group.events.count(); ++i) {
-            History::Event &otherEvent = group.events[i];
-            if (isAscending() ? lessThan(event.properties(), otherEvent.properties()) :
-                                lessThan(otherEvent.properties(), event.properties())) {
+            HistorySortKey otherKey = sortKeyForEvent(group.events[i]);
+            if (isAscending() ? lessThan(key, otherKey) : lessThan(otherKey, key)) {
                 group.events.insert(i, event);
                 append = false;
                 break;
@@ -246,36 +374,34 @@ void HistoryGroupedEventsModel::addEventToGroup(const History::Event &event, His
     History::Event &firstEvent = group.events.first();
     if (group.displayedEvent != firstEvent) {
         group.displayedEvent = firstEvent;
-        QModelIndex idx(index(row));
-        Q_EMIT dataChanged(idx, idx);
+        return true;
     }
+    return false;
 }
 
-void HistoryGroupedEventsModel::removeEventFromGroup(const History::Event &event, HistoryEventGroup &group, int row)
+/// removes the event from the group, updating the displayed event. Empty groups are left to the caller
+void HistoryGroupedEventsModel::removeEventFromGroup(const History::Event &event, HistoryEventGroup &group)
 {
     if (group.events.contains(event)) {
         group.events.removeOne(event);
     }
 
     if (group.events.isEmpty()) {
-        beginRemoveRows(QModelIndex(), row, row);
-        mEventGroups.removeAt(row);
-        endRemoveRows();
         return;
     }
 
     if (group.displayedEvent == event) {
         // check what is the event that should be displayed
        group.displayedEvent =  group.events.first();
+        HistorySortKey displayedKey = sortKeyForEvent(group.displayedEvent);
         Q_FOREACH(const History::Event &other, group.events) {
-            if (isAscending() ? lessThan(other.properties(), group.displayedEvent.properties()) :
-                                lessThan(group.displayedEvent.properties(), other.properties())) {
+            HistorySortKey otherKey = sortKeyForEvent(other);
+            if (isAscending() ? lessThan(otherKey, displayedKey) : lessThan(displayedKey, otherKey)) {
                 group.displayedEvent = other;
+                displayedKey = otherKey;
             }
         }
     }
-    QModelIndex idx = index(row);
-    Q_EMIT dataChanged(idx, idx);
 }
 
 QVariant HistoryGroupedEventsModel::get(int row) const
@@ -48,7 +48,6 @@ public:
     // reimplemented from HistoryEventModel
     int rowCount(const QModelIndex &parent = QModelIndex()) const;
     QVariant data(const QModelIndex &index, int role) const;
-    Q_INVOKABLE void fetchMore(const QModelIndex &parent = QModelIndex());
     QHash<int, QByteArray> roleNames() const;
     Q_INVOKABLE QVariant get(int row) const;
 
@@ -65,9 +64,13 @@ protected Q_SLOTS:
     void onEventsRemoved(const History::Events &events);
 
 protected:
+    void onPageFetched(const History::Events &events);
+    HistorySortKey sortKeyForRow(int row) const;
+    History::Participants participantsForRow(int row) const;
+    int groupForEvent(const History::Event &event) const;
     bool areOfSameGroup(const History::Event &event1, const History::Event &event2);
-    void addEventToGroup(const History::Event &event, HistoryEventGroup &group, int row);
-    void removeEventFromGroup(const History::Event &event, HistoryEventGroup &group, int row);
+    bool addEventToGroup(const History::Event &event, HistoryEventGroup &group);
+    void removeEventFromGroup(const History::Event &event, HistoryEventGroup &group);
 
 private:
     QStringList mGroupingProperties;
@@ -82,13 +82,8 @@ QVariant HistoryGroupedThreadsModel::data(const QModelIndex &index, int role) co
     return result;
 }
 
-void HistoryGroupedThreadsModel::fetchMore(const QModelIndex &parent)
+void HistoryGroupedThreadsModel::onPageFetched(const History::Threads &threads)
 {
-    if (!canFetchMore(parent)) {
-        return;
-    }
-
-    const History::Threads &threads = fetchNextPage();
     Q_FOREACH(const History::Thread &thread, threads) {
         processThreadGrouping(thread);
 
@@ -98,11 +93,6 @@ void HistoryGroupedThreadsModel::fetchMore(const QModelIndex &parent)
         }
     }
     notifyDataChanged();
-
-    if (threads.isEmpty()) {
-        mCanFetchMore = false;
-        Q_EMIT canFetchMoreChanged();
-    }
 }
 
 QHash<int, QByteArray> HistoryGroupedThreadsModel::roleNames() const
@@ -119,6 +109,16 @@ QVariant HistoryGroupedThreadsModel::get(int row) const
     return data(index(row), ThreadsRole);
 }
 
+HistorySortKey HistoryGroupedThreadsModel::sortKeyForRow(int row) const
+{
+    return sortKeyForThread(mGroups[row].displayedThread);
+}
+
+History::Participants HistoryGroupedThreadsModel::participantsForRow(int row) const
+{
+    return mGroups[row].displayedThread.participants();
+}
+
 int HistoryGroupedThreadsModel::existingPositionForEntry(const History::Thread &thread) const
 {
     int pos = -1;
@@ -173,17 +173,17 @@ void HistoryGroupedThreadsModel::updateDisplayedThread(HistoryThreadGroup &group
     }
 
     History::Thread displayedThread = group.threads.first();
-    QVariantMap displayedProperties = displayedThread.properties();
+    HistorySortKey displayedKey = sortKeyForThread(displayedThread);
     Q_FOREACH(const History::Thread &other, group.threads) {
-        if (isAscending() ? lessThan(other.properties(), displayedProperties) :
-                            lessThan(displayedProperties, other.properties())) {
+        HistorySortKey otherKey = sortKeyForThread(other);
+        if (isAscending() ? lessThan(otherKey, displayedKey) : lessThan(displayedKey, otherKey)) {
             displayedThread = other;
-            displayedProperties = displayedThread.properties();
+            displayedKey = otherKey;
         }
     }
 
     // check if we need to update the order
-    int newPos = positionForItem(displayedProperties);
+    int newPos = positionForItem(displayedKey);
 
     // NOTE: only set the new displayedThread AFTER calling positionForItem
     group.displayedThread = displayedThread;
@@ -304,7 +304,7 @@ void HistoryGroupedThreadsModel::processThreadGrouping(const History::Thread &th
     // if the group is empty, we need to insert it into the map
     if (pos < 0) {
         HistoryThreadGroup group;
-        int newPos = positionForItem(groupedThread.properties());
+        int newPos = positionForItem(sortKeyForThread(groupedThread));
         group.threads = groupedThread.groupedThreads();
         group.displayedThread = groupedThread;
         beginInsertRows(QModelIndex(), newPos, newPos);
@@ -56,7 +56,6 @@ public:
 
     virtual int rowCount(const QModelIndex &parent = QModelIndex()) const;
     virtual QVariant data(const QModelIndex &index, int role) const;
-    Q_INVOKABLE void fetchMore(const QModelIndex &parent = QModelIndex());
     virtual QHash<int, QByteArray> roleNames() const;
     Q_INVOKABLE QVariant get(int row) const;
 
@@ -64,6 +63,9 @@ Q_SIGNALS:
     void groupingPropertyChanged();
 
 protected:
+    void onPageFetched(const History::Threads &threads);
+    HistorySortKey sortKeyForRow(int row) const;
+    History::Participants participantsForRow(int row) const;
     int existingPositionForEntry(const History::Thread &thread) const;
     void removeGroup(const HistoryThreadGroup &group);
     void updateDisplayedThread(HistoryThreadGroup &group);
@@ -32,10 +32,25 @@
 #include <QTimerEvent>
 #include <QCryptographicHash>
 #include <QDebug>
+#include <algorithm>
+
+bool HistorySortValue::operator<(const HistorySortValue &other) const
+{
+    if (mIsNumber != other.mIsNumber) {
+        return mIsNumber;
+    }
+    return mIsNumber ? mNumber < other.mNumber : mText < other.mText;
+}
+
+bool HistorySortValue::operator==(const HistorySortValue &other) const
+{
+    return mIsNumber == other.mIsNumber && mNumber == other.mNumber && mText == other.mText;
+}
 
 HistoryModel::HistoryModel(QObject *parent) :
     QAbstractListModel(parent), mFilter(0), mSort(new HistoryQmlSort(this)),
-    mType(EventTypeText), mMatchContacts(false), mUpdateTimer(0), mEventWritingTimer(0), mThreadWritingTimer(0), mWaitingForQml(false)
+    mType(EventTypeText), mMatchContacts(false), mUpdateTimer(0), mEventWritingTimer(0), mThreadWritingTimer(0), mWaitingForQml(false),
+    mContactRowsDirty(false), mContactChangeTimer(0), mNotifyingContacts(false)
 {
     // configure the roles
     mRoles[AccountIdRole] = "accountId";
@@ -51,6 +66,13 @@ HistoryModel::HistoryModel(QObject *parent) :
     connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SIGNAL(countChanged()));
     connect(this, SIGNAL(modelReset()), this, SIGNAL(countChanged()));
 
+    // keep track of the participants of each row for matching contact changes
+    connect(this, SIGNAL(rowsInserted(QModelIndex,int,int)), SLOT(onRowsInserted(QModelIndex,int,int)));
+    connect(this, SIGNAL(rowsRemoved(QModelIndex,int,int)), SLOT(onRowsRemoved(QModelIndex,int,int)));
+    connect(this, SIGNAL(rowsMoved(QModelIndex,int,int,QModelIndex,int)),
+            SLOT(onRowsMoved(QModelIndex,int,int,QModelIndex,int)));
+    connect(this, SIGNAL(dataChanged(QModelIndex,QModelIndex)), SLOT(onRowsChanged(QModelIndex,QModelIndex)));
+
     // reset the view when the service is stopped or started
     connect(History::Manager::instance(), SIGNAL(serviceRunningChanged()),
             this, SLOT(triggerQueryUpdate()));
@@ -247,10 +269,13 @@ void HistoryModel::setMatchContacts(bool value)
     } else {
         History::ContactMatcher::instance()->disconnect(this);
     }
+    resetContactIndex();
 
     // mark all indexes as changed
     if (rowCount() > 0) {
+        mNotifyingContacts = true;
         Q_EMIT dataChanged(index(0), index(rowCount()-1));
+        mNotifyingContacts = false;
     }
 }
 
@@ -353,7 +378,19 @@ void HistoryModel::requestThreadParticipants(const QVariantList &threads)
             theThreads << theThread;
         }
     }
-    History::Manager::instance()->requestThreadParticipants(theThreads);
+    if (theThreads.isEmpty()) {
+        return;
+    }
+
+    History::Manager::instance()->requestThreadParticipantsAsync(theThreads, this, [this](const History::Threads &threads) {
+        onThreadParticipantsFetched(threads);
+    });
+}
+
+/// called with the threads whose participants were requested, the models showing threads update their rows
+void HistoryModel::onThreadParticipantsFetched(const History::Threads &threads)
+{
+    Q_UNUSED(threads)
 }
 
 bool HistoryModel::writeTextInformationEvent(const QString &accountId, const QString &threadId, const QStringList &participants, const QString &message, int informationType, const QString &subject)
@@ -381,6 +418,7 @@ bool HistoryModel::writeTextInformationEvent(const QString &accountId, const QSt
     return History::Manager::instance()->writeEvents(events);
 }
 
+/// contact changes are matched against the rows in batches, see notifyContactChanges()
 void HistoryModel::onContactInfoChanged(const QString &accountId, const QString &identifier, const QVariantMap &contactInfo)
 {
     Q_UNUSED(contactInfo)
@@ -388,27 +426,196 @@ void HistoryModel::onContactInfoChanged(const QString &accountId, const QString
         return;
     }
 
-    QList<QModelIndex> changedIndexes;
+    mChangedContacts.insert(qMakePair(accountId, identifier));
+    if (!mContactChangeTimer) {
+        mContactChangeTimer = startTimer(100);
+    }
+}
+
+/**
+ * @brief Returns the key under which rows with the given participant are indexed
+ *
+ * Identifiers that compareIds() considers equal, whatever the account match flags,
+ * share the same key. Phone numbers too short to have a match key all share the
+ * empty key, and are always compared.
+ */
+QString HistoryModel::contactLookupKey(const QString &identifier)
+{
+    QString normalizedId = History::ContactMatcher::normalizeId(identifier);
+    QString matchKey = History::PhoneUtils::phoneNumberMatchKey(normalizedId);
+    if (matchKey.isNull()) {
+        return normalizedId.toLower();
+    }
+    return matchKey;
+}
+
+HistoryModel::RowContacts HistoryModel::contactsForRow(int row) const
+{
+    return contactsForParticipants(participantsForRow(row));
+}
+
+HistoryModel::RowContacts HistoryModel::contactsForParticipants(const History::Participants &participants)
+{
+    RowContacts contacts;
+    Q_FOREACH(const History::Participant &participant, participants) {
+        contacts << qMakePair(contactLookupKey(participant.identifier()),
+                              History::ContactMatcher::normalizeId(participant.identifier()));
+    }
+    return contacts;
+}
+
+void HistoryModel::resetContactIndex()
+{
+    mRowContacts.clear();
+    mContactRows.clear();
+    mContactRowsDirty = false;
+    if (!mMatchContacts) {
+        mChangedContacts.clear();
+        return;
+    }
+
     int count = rowCount();
-    for (int i = 0; i < count; ++i) {
-        // WARNING: do not use mEvents directly to verify which indexes to change as there is the
-        // HistoryGroupedEventsModel which is based on this model and handles the items in a different way
-        QModelIndex idx = index(i);
-        QVariantMap properties = idx.data(PropertiesRole).toMap();
-        History::Participants participants = History::Participants::fromVariantList(properties[History::FieldParticipants].toList());
-        Q_FOREACH(const History::Participant &participant, participants) {
+    for (int row = 0; row < count; ++row) {
+        mRowContacts << contactsForRow(row);
+    }
+    mContactRowsDirty = true;
+}
+
+void HistoryModel::onRowsInserted(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (!mMatchContacts) {
+        return;
+    }
+
+    bool appended = (first == mRowContacts.count());
+    for (int row = first; row <= last; ++row) {
+        RowContacts contacts = contactsForRow(row);
+        mRowContacts.insert(row, contacts);
+        if (appended && !mContactRowsDirty) {
+            for (int i = 0; i < contacts.count(); ++i) {
+                mContactRows.insert(contacts[i].first, row);
+            }
+        }
+    }
+
+    // rows inserted in the middle move all the rows below them
+    if (!appended) {
+        mContactRowsDirty = true;
+    }
+}
+
+void HistoryModel::onRowsRemoved(const QModelIndex &parent, int first, int last)
+{
+    Q_UNUSED(parent)
+    if (!mMatchContacts) {
+        return;
+    }
+
+    for (int row = last; row >= first; --row) {
+        mRowContacts.removeAt(row);
+    }
+    mContactRowsDirty = true;
+}
+
+void HistoryModel::onRowsMoved(const QModelIndex &parent, int start, int end, const QModelIndex &destination, int row)
+{
+    Q_UNUSED(parent)
+    Q_UNUSED(destination)
+    if (!mMatchContacts) {
+        return;
+    }
+
+    QList<RowContacts> moved = mRowContacts.mid(start, end - start + 1);
+    for (int i = end; i >= start; --i) {
+        mRowContacts.removeAt(i);
+    }
+    int target = row > end ? row - moved.count() : row;
+    for (int i = 0; i < moved.count(); ++i) {
+        mRowContacts.insert(target + i, moved[i]);
+    }
+    mContactRowsDirty = true;
+}
+
+void HistoryModel::onRowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight)
+{
+    // the rows changed because of a contact change keep the same participants
+    if (!mMatchContacts || mNotifyingContacts) {
+        return;
+    }
+
+    // most changes, like delivery reports, keep the participants, and their keys are not computed again
+    for (int row = topLeft.row(); row <= bottomRight.row() && row < mRowContacts.count(); ++row) {
+        History::Participants participants = participantsForRow(row);
+        const RowContacts &current = mRowContacts[row];
+        bool changed = (participants.count() != current.count());
+        for (int i = 0; !changed && i < participants.count(); ++i) {
+            changed = (History::ContactMatcher::normalizeId(participants[i].identifier()) != current[i].second);
+        }
+        if (changed) {
+            mRowContacts[row] = contactsForParticipants(participants);
+            mContactRowsDirty = true;
+        }
+    }
+}
+
+/**
+ * @brief Emits dataChanged() for the rows having a participant whose contact info changed
+ *
+ * Only the rows indexed under the same lookup key as the changed identifiers are compared,
+ * and the changed rows are notified in as few contiguous ranges as possible.
+ */
+void HistoryModel::notifyContactChanges()
+{
+    if (mContactRowsDirty) {
+        mContactRows.clear();
+        for (int row = 0; row < mRowContacts.count(); ++row) {
+            Q_FOREACH(const RowContact &contact, mRowContacts[row]) {
+                mContactRows.insert(contact.first, row);
+            }
+        }
+        mContactRowsDirty = false;
+    }
+
+    QSet<int> changedRows;
+    typedef QPair<QString, QString> ChangedContact;
+    Q_FOREACH(const ChangedContact &changed, mChangedContacts) {
+        QList<int> candidates = mContactRows.values(contactLookupKey(changed.second));
+        candidates << mContactRows.values(QString(""));
+        Q_FOREACH(int row, candidates) {
+            if (changedRows.contains(row)) {
+                continue;
+            }
             // FIXME: right now we might be grouping threads from different accounts, so we are not enforcing
             // the accountId to be the same as the one from the contact info, but maybe we need to do that
             // in the future?
-            if (History::Utils::compareIds(accountId, History::ContactMatcher::normalizeId(participant.identifier()), identifier)) {
-                changedIndexes << idx;
+            Q_FOREACH(const RowContact &contact, mRowContacts[row]) {
+                if (History::Utils::compareIds(changed.first, contact.second, changed.second)) {
+                    changedRows.insert(row);
+                    break;
+                }
             }
         }
     }
+    mChangedContacts.clear();
+
+    mNotifyingContacts = true;
+    notifyRowsChanged(changedRows.toList());
+    mNotifyingContacts = false;
+}
 
-    // now emit the dataChanged signal to all changed indexes
-    Q_FOREACH(const QModelIndex &idx, changedIndexes) {
-        Q_EMIT dataChanged(idx, idx);
+/// emits dataChanged() once for each contiguous range of the given rows
+void HistoryModel::notifyRowsChanged(QList<int> rows)
+{
+    std::sort(rows.begin(), rows.end());
+    int i = 0;
+    while (i < rows.count()) {
+        int first = rows[i];
+        int last = first;
+        while (++i < rows.count() && rows[i] <= last + 1) {
+            last = rows[i];
+        }
+        Q_EMIT dataChanged(index(first), index(last));
     }
 }
 
@@ -425,6 +632,7 @@ void HistoryModel::timerEvent(QTimerEvent *event)
         if (!mWaitingForQml) {
             killTimer(mUpdateTimer);
             mUpdateTimer = 0;
+            updateSortFields();
             updateQuery();
         }
     } else if (event->timerId() == mEventWritingTimer) {
@@ -435,9 +643,18 @@ void HistoryModel::timerEvent(QTimerEvent *event)
             return;
         }
 
-        if (History::Manager::instance()->writeEvents(mEventWritingQueue)) {
-            mEventWritingQueue.clear();
-        }
+        // events that fail to be written go back to the queue to be retried with the next write
+        History::Events events = mEventWritingQueue;
+        mEventWritingQueue.clear();
+        History::Manager::instance()->writeEventsAsync(events, this, [this, events](bool success) {
+            if (!success) {
+                mEventWritingQueue = events + mEventWritingQueue;
+            }
+        });
+    } else if (event->timerId() == mContactChangeTimer) {
+        killTimer(mContactChangeTimer);
+        mContactChangeTimer = 0;
+        notifyContactChanges();
     } else if (event->timerId() == mThreadWritingTimer) {
         killTimer(mThreadWritingTimer);
         mThreadWritingTimer = 0;
@@ -446,28 +663,115 @@ void HistoryModel::timerEvent(QTimerEvent *event)
             return;
         }
 
-        History::Manager::instance()->markThreadsAsRead(mThreadWritingQueue);
+        // as with the events, the threads that fail to be marked are retried with the next ones
+        History::Threads threads = mThreadWritingQueue;
         mThreadWritingQueue.clear();
+        History::Manager::instance()->markThreadsAsReadAsync(threads, this, [this, threads](bool success) {
+            if (!success) {
+                mThreadWritingQueue = threads + mThreadWritingQueue;
+            }
+        });
     }
 }
 
-bool HistoryModel::lessThan(const QVariantMap &left, const QVariantMap &right) const
+/// the sort fields, parsed when the query is updated so that the rows are always sorted by them
+const QList<HistoryModel::SortField> &HistoryModel::sortFields() const
+{
+    return mSortFields;
+}
+
+void HistoryModel::updateSortFields()
+{
+    mSortFields.clear();
+    if (!mSort) {
+        return;
+    }
+
+    Q_FOREACH(const QString &name, mSort->sortField().split(",", QString::SkipEmptyParts)) {
+        SortField field;
+        field.name = name.trimmed();
+        field.timestamp = (field.name == History::FieldTimestamp ||
+                           field.name == History::FieldLastEventTimestamp ||
+                           field.name == History::FieldReadTimestamp);
+        mSortFields << field;
+    }
+}
+
+/**
+ * @brief Converts a property value into a sort value
+ *
+ * Timestamps come either as QDateTime or as ISO date strings, depending on the item
+ * they were taken from, so they are compared as milliseconds since the epoch.
+ */
+HistorySortValue HistoryModel::sortValue(const SortField &field, const QVariant &value)
+{
+    if (field.timestamp) {
+        QDateTime timestamp = value.type() == QVariant::DateTime ? value.toDateTime()
+                                                                 : QDateTime::fromString(value.toString(), Qt::ISODate);
+        return HistorySortValue(timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : 0);
+    }
+
+    switch (value.type()) {
+    case QVariant::Bool:
+    case QVariant::Int:
+    case QVariant::UInt:
+    case QVariant::LongLong:
+    case QVariant::ULongLong:
+        return HistorySortValue(value.toLongLong());
+    default:
+        return HistorySortValue(value.toString());
+    }
+}
+
+HistorySortKey HistoryModel::sortKey(const QVariantMap &properties) const
+{
+    HistorySortKey key;
+    key.reserve(mSortFields.count());
+    Q_FOREACH(const SortField &field, mSortFields) {
+        key << sortValue(field, properties.value(field.name));
+    }
+    return key;
+}
+
+/**
+ * @brief Returns the sort key of the item in the given row
+ *
+ * The default implementation goes through the properties of the row, models that
+ * have direct access to their items should reimplement it.
+ */
+HistorySortKey HistoryModel::sortKeyForRow(int row) const
 {
-    QStringList sortFields = sort()->sortField().split(",");
+    return sortKey(index(row).data(PropertiesRole).toMap());
+}
 
-    while(!sortFields.isEmpty()) {
-        QString sortField = sortFields.takeFirst().trimmed();
-        QVariant leftValue = left.value(sortField, QVariant());
-        QVariant rightValue = right.value(sortField, QVariant());
+/// the participants of the item in the given row. Models holding the items reimplement it to skip building their properties
+History::Participants HistoryModel::participantsForRow(int row) const
+{
+    QVariantMap properties = index(row).data(PropertiesRole).toMap();
+    return History::Participants::fromVariantList(properties[History::FieldParticipants].toList());
+}
 
-        if (leftValue != rightValue) {
-            return leftValue < rightValue;
+bool HistoryModel::lessThan(const HistorySortKey &left, const HistorySortKey &right)
+{
+    for (int i = 0; i < left.count() && i < right.count(); ++i) {
+        if (left[i] != right[i]) {
+            return left[i] < right[i];
         }
     }
     return false;
 }
 
+bool HistoryModel::lessThan(const QVariantMap &left, const QVariantMap &right) const
+{
+    return lessThan(sortKey(left), sortKey(right));
+}
+
 int HistoryModel::positionForItem(const QVariantMap &item) const
+{
+    return positionForItem(sortKey(item));
+}
+
+int HistoryModel::positionForItem(const HistorySortKey &key) const
 {
     // do a binary search for the item position on the list
     int lowerBound = 0;
@@ -478,13 +782,13 @@ int HistoryModel::positionForItem(const QVariantMap &item) const
 
     while (true) {
         int pos = (upperBound + lowerBound) / 2;
-        const QVariantMap posItem = index(pos).data(PropertiesRole).toMap();
+        const HistorySortKey posKey = sortKeyForRow(pos);
         if (lowerBound == pos) {
-            if (isAscending() ? lessThan(item, posItem) : lessThan(posItem, item)) {
+            if (isAscending() ? lessThan(key, posKey) : lessThan(posKey, key)) {
                 return pos;
             }
         }
-        if (isAscending() ? lessThan(posItem, item) : lessThan(item, posItem)) {
+        if (isAscending() ? lessThan(posKey, key) : lessThan(key, posKey)) {
             lowerBound = pos + 1;          // its in the upper
             if (lowerBound > upperBound) {
                 return pos += 1;
@@ -578,6 +882,7 @@ void HistoryModel::componentComplete()
         killTimer(mUpdateTimer);
         mUpdateTimer = 0;
     }
+    updateSortFields();
     updateQuery();
 }
 
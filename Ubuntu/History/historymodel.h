@@ -28,9 +28,33 @@
 #include "historyqmlfilter.h"
 #include "historyqmlsort.h"
 #include <QAbstractListModel>
+#include <QMultiHash>
+#include <QSet>
+#include <QVector>
 #include <QStringList>
 #include <QQmlParserStatus>
 
+/// a value of a sort field, converted once so that comparing it is cheap
+class HistorySortValue
+{
+public:
+    HistorySortValue() : mIsNumber(false), mNumber(0) { }
+    explicit HistorySortValue(qint64 number) : mIsNumber(true), mNumber(number) { }
+    explicit HistorySortValue(const QString &text) : mIsNumber(false), mNumber(0), mText(text) { }
+
+    bool operator<(const HistorySortValue &other) const;
+    bool operator==(const HistorySortValue &other) const;
+    bool operator!=(const HistorySortValue &other) const { return !(*this == other); }
+
+private:
+    bool mIsNumber;
+    qint64 mNumber;
+    QString mText;
+};
+
+/// the values of the sort fields of an item, in the order the fields are sorted by
+typedef QVector<HistorySortValue> HistorySortKey;
+
 class HistoryModel : public QAbstractListModel, public QQmlParserStatus
 {
     Q_OBJECT
@@ -202,24 +226,62 @@ protected Q_SLOTS:
     void watchContactInfo(const QString &accountId, const QString &identifier, const QVariantMap &currentInfo);
 
 protected:
+    struct SortField {
+        QString name;
+        bool timestamp;
+    };
+
     virtual void timerEvent(QTimerEvent *event);
+    const QList<SortField> &sortFields() const;
+    static HistorySortValue sortValue(const SortField &field, const QVariant &value);
+    HistorySortKey sortKey(const QVariantMap &properties) const;
+    virtual HistorySortKey sortKeyForRow(int row) const;
+    virtual History::Participants participantsForRow(int row) const;
+    static bool lessThan(const HistorySortKey &left, const HistorySortKey &right);
     bool lessThan(const QVariantMap &left, const QVariantMap &right) const;
     int positionForItem(const QVariantMap &item) const;
+    int positionForItem(const HistorySortKey &key) const;
     bool isAscending() const;
+    void notifyRowsChanged(QList<int> rows);
+    virtual void onThreadParticipantsFetched(const History::Threads &threads);
+    static QString contactLookupKey(const QString &identifier);
 
     HistoryQmlFilter *mFilter;
     HistoryQmlSort *mSort;
     EventType mType;
     bool mMatchContacts;
 
+private Q_SLOTS:
+    void onRowsInserted(const QModelIndex &parent, int first, int last);
+    void onRowsRemoved(const QModelIndex &parent, int first, int last);
+    void onRowsMoved(const QModelIndex &parent, int start, int end, const QModelIndex &destination, int row);
+    void onRowsChanged(const QModelIndex &topLeft, const QModelIndex &bottomRight);
+
 private:
+    // a participant of a row, as a pair of lookup key and normalized identifier
+    typedef QPair<QString, QString> RowContact;
+    typedef QList<RowContact> RowContacts;
+
+    void updateSortFields();
+    RowContacts contactsForRow(int row) const;
+    static RowContacts contactsForParticipants(const History::Participants &participants);
+    void resetContactIndex();
+    void notifyContactChanges();
+
     QHash<int, QByteArray> mRoles;
+    QList<SortField> mSortFields;
     History::Events mEventWritingQueue;
     int mEventWritingTimer;
     History::Threads mThreadWritingQueue;
     int mThreadWritingTimer;
     int mUpdateTimer;
     bool mWaitingForQml;
+    QList<RowContacts> mRowContacts;
+    QMultiHash<QString, int> mContactRows;
+    bool mContactRowsDirty;
+    QSet<QPair<QString, QString> > mChangedContacts;
+    int mContactChangeTimer;
+    bool mNotifyingContacts;
 };
 
 #endif // HISTORYMODEL_H
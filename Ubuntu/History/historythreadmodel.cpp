@@ -27,12 +27,13 @@
 #include <QDBusMetaType>
 
 #include <QDebug>
+#include <algorithm>
 
 Q_DECLARE_METATYPE(History::TextEventAttachments)
 Q_DECLARE_METATYPE(QList<QVariantMap>)
 
 HistoryThreadModel::HistoryThreadModel(QObject *parent) :
-    HistoryModel(parent), mCanFetchMore(true), mGroupThreads(false)
+    HistoryModel(parent), mCanFetchMore(true), mFetching(false), mGroupThreads(false), mIndexedRows(0)
 {
     qRegisterMetaType<QList<QVariantMap> >();
     qDBusRegisterMetaType<QList<QVariantMap> >();
@@ -210,15 +211,23 @@ void HistoryThreadModel::fetchMore(const QModelIndex &parent)
         return;
     }
 
-    History::Threads threads = fetchNextPage();
-    if (threads.isEmpty()) {
-        mCanFetchMore = false;
-        Q_EMIT canFetchMoreChanged();
-    } else {
-        beginInsertRows(QModelIndex(), mThreads.count(), mThreads.count() + threads.count() - 1);
-        mThreads << threads;
-        endInsertRows();
+    // only one page is requested at a time, the next fetchMore() call comes after it got in
+    if (mFetching) {
+        return;
     }
+
+    mFetching = true;
+    mThreadView->nextPage([this](const History::Threads &threads) {
+        mFetching = false;
+        if (threads.isEmpty()) {
+            mCanFetchMore = false;
+            Q_EMIT canFetchMoreChanged();
+            return;
+        }
+
+        fetchParticipantsIfNeeded(threads);
+        onPageFetched(threads);
+    });
 }
 
 QHash<int, QByteArray> HistoryThreadModel::roleNames() const
@@ -242,7 +251,12 @@ bool HistoryThreadModel::removeThreads(const QVariantList &threadsProperties)
         return false;
     }
 
-    return History::Manager::instance()->removeThreads(threads);
+    History::Manager::instance()->removeThreadsAsync(threads, this, [](bool success) {
+        if (!success) {
+            qWarning() << "Failed to remove threads";
+        }
+    });
+    return true;
 }
 
 void HistoryThreadModel::updateQuery()
@@ -251,15 +265,20 @@ void HistoryThreadModel::updateQuery()
     if (!mThreads.isEmpty()) {
         beginRemoveRows(QModelIndex(), 0, mThreads.count() - 1);
         mThreads.clear();
+        mThreadRows.clear();
+        mIndexedRows = 0;
         endRemoveRows();
     }
 
     History::Filter queryFilter;
     History::Sort querySort;
 
+    // pages still being fetched from the previous view are dropped together with it
     if (!mThreadView.isNull()) {
         mThreadView->disconnect(this);
+        mThreadView.clear();
     }
+    mFetching = false;
 
     if (mFilter) {
         queryFilter = mFilter->filter();
@@ -312,7 +331,7 @@ void HistoryThreadModel::updateQuery()
 
 void HistoryThreadModel::onThreadParticipantsChanged(const History::Thread &thread, const History::Participants &added, const History::Participants &removed, const History::Participants &modified)
 {
-    int pos = mThreads.indexOf(thread);
+    int pos = rowForThread(thread);
     if (pos >= 0) {
         mThreads[pos].removeParticipants(removed);
         mThreads[pos].removeParticipants(modified);
@@ -343,7 +362,16 @@ void HistoryThreadModel::fetchParticipantsIfNeeded(const History::Threads &threa
     if (filtered.isEmpty()) {
         return;
     }
-    History::Manager::instance()->requestThreadParticipants(filtered);
+    History::Manager::instance()->requestThreadParticipantsAsync(filtered, this, [this](const History::Threads &threads) {
+        onThreadParticipantsFetched(threads);
+    });
+}
+
+void HistoryThreadModel::onThreadParticipantsFetched(const History::Threads &threads)
+{
+    Q_FOREACH(const History::Thread &thread, threads) {
+        onThreadParticipantsChanged(thread, History::Participants(), History::Participants(), thread.participants());
+    }
 }
 
 void HistoryThreadModel::onThreadsAdded(const History::Threads &threads)
@@ -354,13 +382,14 @@ void HistoryThreadModel::onThreadsAdded(const History::Threads &threads)
 
     Q_FOREACH(const History::Thread &thread, threads) {
         // if the thread is already inserted, skip it
-        if (mThreads.contains(thread)) {
+        if (mThreadRows.contains(threadKey(thread))) {
             continue;
         }
 
-        int pos = positionForItem(thread.properties());
+        int pos = positionForItem(sortKeyForThread(thread));
         beginInsertRows(QModelIndex(), pos, pos);
         mThreads.insert(pos, thread);
+        indexInsertedThreads(pos, History::Threads() << thread);
         endInsertRows();
     }
     fetchParticipantsIfNeeded(threads);
@@ -371,7 +400,7 @@ void HistoryThreadModel::onThreadsModified(const History::Threads &threads)
     History::Threads newThreads;
 
     Q_FOREACH(const History::Thread &thread, threads) {
-        int pos = mThreads.indexOf(thread);
+        int pos = rowForThread(thread);
         if (pos >= 0) {
             mThreads[pos] = thread;
             QModelIndex idx = index(pos);
@@ -390,23 +419,111 @@ void HistoryThreadModel::onThreadsModified(const History::Threads &threads)
 
 void HistoryThreadModel::onThreadsRemoved(const History::Threads &threads)
 {
+    // removing from the bottom up keeps the rows above the removed ones indexed
+    QList<int> rows;
     Q_FOREACH(const History::Thread &thread, threads) {
-        int pos = mThreads.indexOf(thread);
+        int pos = rowForThread(thread);
         if (pos >= 0) {
-            beginRemoveRows(QModelIndex(), pos, pos);
-            mThreads.removeAt(pos);
-            endRemoveRows();
+            rows << pos;
         }
     }
+    std::sort(rows.begin(), rows.end(), std::greater<int>());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    Q_FOREACH(int pos, rows) {
+        beginRemoveRows(QModelIndex(), pos, pos);
+        mThreadRows.remove(threadKey(mThreads.takeAt(pos)));
+        mIndexedRows = qMin(mIndexedRows, pos);
+        endRemoveRows();
+    }
 
     // FIXME: there is a corner case here: if a thread was not loaded yet, but was already
     // removed by another client, it will still show up when a new page is requested. Maybe it
     // should be handle internally in History::ThreadView?
 }
 
-History::Threads HistoryThreadModel::fetchNextPage()
+/**
+ * @brief Adds a page of threads fetched from the view to the model
+ *
+ * The page arrives asynchronously after fetchMore(), and is never empty.
+ */
+void HistoryThreadModel::onPageFetched(const History::Threads &threads)
 {
-    History::Threads threads = mThreadView->nextPage();
-    fetchParticipantsIfNeeded(threads);
-    return threads;
+    int row = mThreads.count();
+    beginInsertRows(QModelIndex(), row, row + threads.count() - 1);
+    mThreads << threads;
+    indexInsertedThreads(row, threads);
+    endInsertRows();
+}
+
+HistorySortKey HistoryThreadModel::sortKeyForRow(int row) const
+{
+    return sortKeyForThread(mThreads[row]);
+}
+
+History::Participants HistoryThreadModel::participantsForRow(int row) const
+{
+    return mThreads[row].participants();
+}
+
+/// builds the sort key from the thread fields, falling back to its properties for the ones without an accessor
+HistorySortKey HistoryThreadModel::sortKeyForThread(const History::Thread &thread) const
+{
+    HistorySortKey key;
+    QVariantMap properties;
+    key.reserve(sortFields().count());
+    Q_FOREACH(const SortField &field, sortFields()) {
+        if (field.name == History::FieldLastEventTimestamp || field.name == History::FieldTimestamp) {
+            key << HistorySortValue(thread.timestamp().toMSecsSinceEpoch());
+        } else if (field.name == History::FieldThreadId) {
+            key << HistorySortValue(thread.threadId());
+        } else if (field.name == History::FieldAccountId) {
+            key << HistorySortValue(thread.accountId());
+        } else {
+            if (properties.isEmpty()) {
+                properties = thread.properties();
+            }
+            key << sortValue(field, properties.value(field.name));
+        }
+    }
+    return key;
+}
+
+QString HistoryThreadModel::threadKey(const History::Thread &thread)
+{
+    return QString("%1#-#%2#-#%3").arg(QString::number(thread.type()), thread.accountId(), thread.threadId());
+}
+
+/// returns the row of the given thread, or -1 if it is not loaded, refreshing the stale rows if needed
+int HistoryThreadModel::rowForThread(const History::Thread &thread) const
+{
+    QString key = threadKey(thread);
+    QHash<QString, int>::const_iterator it = mThreadRows.constFind(key);
+    if (it == mThreadRows.constEnd()) {
+        return -1;
+    }
+    if (it.value() < mIndexedRows) {
+        return it.value();
+    }
+
+    for (int i = mIndexedRows; i < mThreads.count(); ++i) {
+        mThreadRows[threadKey(mThreads[i])] = i;
+    }
+    mIndexedRows = mThreads.count();
+    return mThreadRows.value(key, -1);
+}
+
+/// registers threads just inserted in mThreads at the given row
+void HistoryThreadModel::indexInsertedThreads(int row, const History::Threads &threads)
+{
+    for (int i = 0; i < threads.count(); ++i) {
+        mThreadRows[threadKey(threads[i])] = row + i;
+    }
+
+    // rows below the inserted ones moved down
+    if (row + threads.count() < mThreads.count()) {
+        mIndexedRows = qMin(mIndexedRows, row);
+    } else if (mIndexedRows == row) {
+        mIndexedRows = mThreads.count();
+    }
 }
@@ -65,7 +65,7 @@ public:
     QVariant threadData(const History::Thread &thread, int role) const;
 
     bool canFetchMore(const QModelIndex &parent = QModelIndex()) const;
-    void fetchMore(const QModelIndex &parent);
+    void fetchMore(const QModelIndex &parent = QModelIndex());
 
     virtual QHash<int, QByteArray> roleNames() const;
 
@@ -80,13 +80,25 @@ protected Q_SLOTS:
 
 protected:
     void fetchParticipantsIfNeeded(const History::Threads &threads);
-    History::Threads fetchNextPage();
+    virtual void onThreadParticipantsFetched(const History::Threads &threads);
+    virtual void onPageFetched(const History::Threads &threads);
+    virtual HistorySortKey sortKeyForRow(int row) const;
+    virtual History::Participants participantsForRow(int row) const;
+    HistorySortKey sortKeyForThread(const History::Thread &thread) const;
     bool mCanFetchMore;
+    bool mFetching;
     bool mGroupThreads;
 
 private:
+    static QString threadKey(const History::Thread &thread);
+    int rowForThread(const History::Thread &thread) const;
+    void indexInsertedThreads(int row, const History::Threads &threads);
+
     History::ThreadViewPtr mThreadView;
     History::Threads mThreads;
+    // row of each loaded thread, by threadKey(); rows from mIndexedRows on may be stale
+    mutable QHash<QString, int> mThreadRows;
+    mutable int mIndexedRows;
     QHash<int, QByteArray> mRoles;
     mutable QMap<History::TextEvent, QList<QVariant> > mAttachmentCache;
 };
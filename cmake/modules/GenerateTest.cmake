@@ -75,14 +75,14 @@ function(generate_test TESTNAME)
             execute_process(COMMAND mktemp -d OUTPUT_VARIABLE TMPDIR)
             string(REPLACE "\n" "" TMPDIR ${TMPDIR})
 
-            if (NOT DEFINED ARG_ENVIRONMENT)
-                set(ARG_ENVIRONMENT HOME=${TMPDIR}
-                                    HISTORY_PLUGIN_PATH=${CMAKE_BINARY_DIR}/plugins/sqlite
-                                    HISTORY_SQLITE_DBPATH=:memory:
-                                    HISTORY_LOCK_FILE=${TMPDIR}/history-service.lock
-                                    MC_ACCOUNT_DIR=${TMPDIR}
-                                    MC_MANAGER_DIR=${TMPDIR})
-            endif ()
+            # variables passed in ENVIRONMENT are added to (or override) the defaults
+            set(ARG_ENVIRONMENT HOME=${TMPDIR}
+                                HISTORY_PLUGIN_PATH=${CMAKE_BINARY_DIR}/plugins/sqlite
+                                HISTORY_SQLITE_DBPATH=:memory:
+                                HISTORY_LOCK_FILE=${TMPDIR}/history-service.lock
+                                MC_ACCOUNT_DIR=${TMPDIR}
+                                MC_MANAGER_DIR=${TMPDIR}
+                                ${ARG_ENVIRONMENT})
             if (${ARG_USE_XVFB})
                 SET(XVFB_RUN ${XVFB_RUN_BIN} -a -s "-screen 0 1024x768x24")
             endif ()
@@ -31,6 +31,7 @@
 #include "plugineventview.h"
 #include "textevent.h"
 
+#include <QDBusConnectionInterface>
 #include <QStandardPaths>
 #include <QCryptographicHash>
 #include <TelepathyQt/CallChannel>
@@ -44,6 +45,10 @@ Q_DECLARE_METATYPE(RolesMap)
 
 const constexpr static int AdminRole = 2;
 
+// incoming and outgoing messages arriving within this window are written in a single transaction
+const constexpr static int DefaultWriteQueueInterval = 50;
+const constexpr static int DefaultWriteQueueMaxBatch = 100;
+
 enum ChannelGroupChangeReason
 {
     ChannelGroupChangeReasonNone = 0,
@@ -111,10 +116,26 @@ bool foundInThread(const Tp::ContactPtr& contact, QVariantMap thread)
 }
 
 HistoryDaemon::HistoryDaemon(QObject *parent)
-    : QObject(parent), mCallObserver(this), mTextObserver(this)
+    : QObject(parent), mCallObserver(this), mTextObserver(this), mWriteQueueEventCount(0),
+      mWriteQueueMaxBatch(DefaultWriteQueueMaxBatch),
+      mClientWatcher(QString(), QDBusConnection::sessionBus(), QDBusServiceWatcher::WatchForUnregistration)
 {
     qRegisterMetaType<HandleRolesMap>();
     qDBusRegisterMetaType<HandleRolesMap>();
+
+    // the write queue can be tuned (or disabled with an interval of 0) from the environment
+    bool ok = false;
+    int interval = qgetenv("HISTORY_WRITE_QUEUE_INTERVAL").toInt(&ok);
+    setWriteQueueInterval(ok ? interval : DefaultWriteQueueInterval);
+    int maxBatch = qgetenv("HISTORY_WRITE_QUEUE_MAX_BATCH").toInt(&ok);
+    if (ok) {
+        setWriteQueueMaxBatch(maxBatch);
+    }
+    mWriteQueueTimer.setSingleShot(true);
+    connect(&mWriteQueueTimer, SIGNAL(timeout()), SLOT(flushWriteQueue()));
+    connect(QCoreApplication::instance(), SIGNAL(aboutToQuit()), SLOT(flushWriteQueue()));
+    connect(&mClientWatcher, SIGNAL(serviceUnregistered(QString)), SLOT(onClientUnregistered(QString)));
+
     // get the first plugin
     if (!History::PluginManager::instance()->plugins().isEmpty()) {
         mBackend = History::PluginManager::instance()->plugins().first();
@@ -369,12 +390,16 @@ QList<QVariantMap> HistoryDaemon::participantsForThreads(const QList<QVariantMap
     return mBackend->participantsForThreads(threadIds);
 }
 
-QString HistoryDaemon::queryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties)
+QString HistoryDaemon::queryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties,
+                                    const QString &client)
 {
     if (!mBackend) {
         return QString::null;
     }
 
+    // queued writes need to reach the database before it is used
+    flushWriteQueue();
+
     History::Sort theSort = History::Sort::fromProperties(sort);
     History::Filter theFilter = History::Filter::fromProperties(filter);
     History::PluginThreadView *view = mBackend->queryThreads((History::EventType)type, theSort, theFilter, properties);
@@ -383,17 +408,24 @@ QString HistoryDaemon::queryThreads(int type, const QVariantMap &sort, const QVa
         return QString::null;
     }
 
-    // FIXME: maybe we should keep a list of views to manually remove them at some point?
-    view->setParent(this);
+    addClientView(view, client);
+
+    // the clients of the view get the changes that match its filter on the view path
+    view->setFilter((History::EventType)type, theFilter);
+    connect(&mDBus, SIGNAL(ThreadsAdded(QList<QVariantMap>)), view, SLOT(notifyThreadsAdded(QList<QVariantMap>)));
+    connect(&mDBus, SIGNAL(ThreadsModified(QList<QVariantMap>)), view, SLOT(notifyThreadsModified(QList<QVariantMap>)));
+    connect(&mDBus, SIGNAL(ThreadsRemoved(QList<QVariantMap>)), view, SLOT(notifyThreadsRemoved(QList<QVariantMap>)));
     return view->objectPath();
 }
 
-QString HistoryDaemon::queryEvents(int type, const QVariantMap &sort, const QVariantMap &filter)
+QString HistoryDaemon::queryEvents(int type, const QVariantMap &sort, const QVariantMap &filter, const QString &client)
 {
     if (!mBackend) {
         return QString::null;
     }
 
+    flushWriteQueue();
+
     History::Sort theSort = History::Sort::fromProperties(sort);
     History::Filter theFilter = History::Filter::fromProperties(filter);
     History::PluginEventView *view = mBackend->queryEvents((History::EventType)type, theSort, theFilter);
@@ -402,17 +434,65 @@ QString HistoryDaemon::queryEvents(int type, const QVariantMap &sort, const QVar
         return QString::null;
     }
 
-    // FIXME: maybe we should keep a list of views to manually remove them at some point?
-    view->setParent(this);
+    addClientView(view, client);
+
+    view->setFilter((History::EventType)type, theFilter);
+    connect(&mDBus, SIGNAL(EventsAdded(QList<QVariantMap>)), view, SLOT(notifyEventsAdded(QList<QVariantMap>)));
+    connect(&mDBus, SIGNAL(EventsModified(QList<QVariantMap>)), view, SLOT(notifyEventsModified(QList<QVariantMap>)));
+    connect(&mDBus, SIGNAL(EventsRemoved(QList<QVariantMap>)), view, SLOT(notifyEventsRemoved(QList<QVariantMap>)));
+    connect(&mDBus, SIGNAL(ThreadsRemoved(QList<QVariantMap>)), view, SLOT(notifyThreadsRemoved(QList<QVariantMap>)));
     return view->objectPath();
 }
 
+/// keeps the view until it is destroyed, or until the client that queried it leaves the bus
+void HistoryDaemon::addClientView(QObject *view, const QString &client)
+{
+    view->setParent(this);
+    if (client.isEmpty()) {
+        return;
+    }
+
+    if (!mClientViews.contains(client)) {
+        mClientWatcher.addWatchedService(client);
+        // the client might have left before it was watched
+        if (!QDBusConnection::sessionBus().interface()->isServiceRegistered(client)) {
+            mClientWatcher.removeWatchedService(client);
+            view->deleteLater();
+            return;
+        }
+    }
+
+    // forget the views the client already destroyed
+    QMultiHash<QString, QPointer<QObject> >::iterator it = mClientViews.find(client);
+    while (it != mClientViews.end() && it.key() == client) {
+        if (it.value().isNull()) {
+            it = mClientViews.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    mClientViews.insert(client, view);
+}
+
+void HistoryDaemon::onClientUnregistered(const QString &client)
+{
+    mClientWatcher.removeWatchedService(client);
+    Q_FOREACH(const QPointer<QObject> &view, mClientViews.values(client)) {
+        if (view) {
+            view->deleteLater();
+        }
+    }
+    mClientViews.remove(client);
+}
+
 QVariantMap HistoryDaemon::getSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties)
 {
     if (!mBackend) {
         return QVariantMap();
     }
 
+    flushWriteQueue();
+
     return mBackend->getSingleThread((History::EventType)type, accountId, threadId, properties);
 }
 
@@ -422,6 +502,8 @@ QVariantMap HistoryDaemon::getSingleEvent(int type, const QString &accountId, co
         return QVariantMap();
     }
 
+    flushWriteQueue();
+
     return mBackend->getSingleEvent((History::EventType)type, accountId, threadId, eventId);
 }
 
@@ -431,69 +513,193 @@ bool HistoryDaemon::writeEvents(const QList<QVariantMap> &events, const QVariant
         return false;
     }
 
-    QList<QVariantMap> newEvents;
-    QList<QVariantMap> modifiedEvents;
-    QMap<QString, QVariantMap> threads;
+    // events queued before these ones need to be written first
+    flushWriteQueue();
 
+    QList<History::EventWriteResult> results;
     mBackend->beginBatchOperation();
+    if (!storeEvents(events, results)) {
+        mBackend->rollbackBatchOperation();
+        return false;
+    }
+    mBackend->endBatchOperation();
+
+    if (notify) {
+        notifyEventsWritten(events, results, properties);
+    }
+    return true;
+}
+
+void HistoryDaemon::queueEvents(const QList<QVariantMap> &events, const QVariantMap &properties)
+{
+    if (mWriteQueueTimer.interval() == 0) {
+        writeEvents(events, properties);
+        return;
+    }
+
+    PendingWrite write;
+    write.events = events;
+    write.properties = properties;
+    mWriteQueue << write;
+    mWriteQueueEventCount += events.count();
+
+    if (mWriteQueueEventCount >= mWriteQueueMaxBatch) {
+        flushWriteQueue();
+    } else if (!mWriteQueueTimer.isActive()) {
+        mWriteQueueTimer.start();
+    }
+}
+
+void HistoryDaemon::flushWriteQueue()
+{
+    mWriteQueueTimer.stop();
+    if (mWriteQueue.isEmpty() || !mBackend) {
+        return;
+    }
+
+    QList<PendingWrite> queue = mWriteQueue;
+    mWriteQueue.clear();
+    mWriteQueueEventCount = 0;
+
+    // write everything that was queued in one transaction, in the order it arrived
+    QList<QList<History::EventWriteResult> > results;
+    bool success = mBackend->beginBatchOperation();
+    Q_FOREACH(const PendingWrite &write, queue) {
+        QList<History::EventWriteResult> writeResults;
+        if (!success || !storeEvents(write.events, writeResults)) {
+            success = false;
+            break;
+        }
+        results << writeResults;
+    }
+
+    if (!success) {
+        // do not let one bad event drop the others: write them one by one instead
+        mBackend->rollbackBatchOperation();
+        Q_FOREACH(const PendingWrite &write, queue) {
+            if (!writeEvents(write.events, write.properties)) {
+                qWarning() << "Failed to write queued events:" << write.events;
+            }
+        }
+        return;
+    }
+    mBackend->endBatchOperation();
 
+    // consecutive writes for the same channel are notified together so that their threads are only loaded once
+    int first = 0;
+    while (first < queue.count()) {
+        QList<QVariantMap> events;
+        QList<History::EventWriteResult> eventResults;
+        int last = first;
+        while (last < queue.count() && queue[last].properties == queue[first].properties) {
+            events << queue[last].events;
+            eventResults << results[last];
+            ++last;
+        }
+        notifyEventsWritten(events, eventResults, queue[first].properties);
+        first = last;
+    }
+}
+
+int HistoryDaemon::writeQueueInterval() const
+{
+    return mWriteQueueTimer.interval();
+}
+
+void HistoryDaemon::setWriteQueueInterval(int msecs)
+{
+    mWriteQueueTimer.setInterval(qMax(msecs, 0));
+    if (msecs <= 0) {
+        flushWriteQueue();
+    }
+}
+
+int HistoryDaemon::writeQueueMaxBatch() const
+{
+    return mWriteQueueMaxBatch;
+}
+
+void HistoryDaemon::setWriteQueueMaxBatch(int events)
+{
+    mWriteQueueMaxBatch = qMax(events, 1);
+    if (mWriteQueueEventCount >= mWriteQueueMaxBatch) {
+        flushWriteQueue();
+    }
+}
+
+bool HistoryDaemon::storeEvents(const QList<QVariantMap> &events, QList<History::EventWriteResult> &results)
+{
     Q_FOREACH(const QVariantMap &event, events) {
         History::EventType type = (History::EventType) event[History::FieldType].toInt();
-        History::EventWriteResult result;
+        History::EventWriteResult result = History::EventWriteError;
 
-        // get the threads for the events to notify their modifications
-        QString accountId = event[History::FieldAccountId].toString();
-        QString threadId = event[History::FieldThreadId].toString();
-        QVariantMap savedEvent = event;
-
-        // and finally write the event
         switch (type) {
         case History::EventTypeText:
-            result = mBackend->writeTextEvent(savedEvent);
+            result = mBackend->writeTextEvent(event);
             break;
         case History::EventTypeVoice:
-            result = mBackend->writeVoiceEvent(savedEvent);
+            result = mBackend->writeVoiceEvent(event);
             break;
         }
 
-        // only get the thread AFTER the event is written to make sure it is up-to-date
-        QVariantMap thread = getSingleThread(type, accountId, threadId, properties);
-        QString hash = hashThread(thread);
-        threads[hash] = thread;
+        if (result == History::EventWriteError) {
+            return false;
+        }
+        results << result;
+    }
+    return true;
+}
+
+void HistoryDaemon::notifyEventsWritten(const QList<QVariantMap> &events, const QList<History::EventWriteResult> &results, const QVariantMap &properties)
+{
+    QList<QVariantMap> newEvents;
+    QList<QVariantMap> modifiedEvents;
+    QMap<QString, QVariantMap> threads;
 
-        // set the participants field in the event
-        if (type == History::EventTypeVoice) {
-            savedEvent[History::FieldParticipants] = thread[History::FieldParticipants];
+    // get the threads for the events to notify their modifications.
+    // only get them AFTER the events are written to make sure they are up-to-date
+    Q_FOREACH(const QVariantMap &event, events) {
+        QString hash = hashThread(event);
+        if (threads.contains(hash)) {
+            continue;
+        }
+        threads[hash] = mBackend->getSingleThread((History::EventType) event[History::FieldType].toInt(),
+                                                  event[History::FieldAccountId].toString(),
+                                                  event[History::FieldThreadId].toString(),
+                                                  properties);
+    }
+    Q_FOREACH(const QString &hash, threads.keys()) {
+        if (threads[hash].isEmpty()) {
+            threads.remove(hash);
         }
+    }
 
+    for (int i = 0; i < events.count(); ++i) {
+        QVariantMap savedEvent = events[i];
+
+        // set the participants field in the event
+        if (savedEvent[History::FieldType].toInt() == History::EventTypeVoice) {
+            savedEvent[History::FieldParticipants] = threads.value(hashThread(savedEvent))[History::FieldParticipants];
+        }
 
         // check if the event was a new one or a modification to an existing one
-        switch (result) {
-        case History::EventWriteCreated:
+        if (results[i] == History::EventWriteCreated) {
             newEvents << savedEvent;
-            break;
-        case History::EventWriteModified:
+        } else {
             modifiedEvents << savedEvent;
-            break;
-        case History::EventWriteError:
-            mBackend->rollbackBatchOperation();
-            return false;
         }
     }
 
-    mBackend->endBatchOperation();
-
     // and last but not least, notify the results
-    if (!newEvents.isEmpty() && notify) {
+    if (!newEvents.isEmpty()) {
         mDBus.notifyEventsAdded(newEvents);
     }
-    if (!modifiedEvents.isEmpty() && notify) {
+    if (!modifiedEvents.isEmpty()) {
         mDBus.notifyEventsModified(modifiedEvents);
     }
-    if (!threads.isEmpty() && notify) {
+    if (!threads.isEmpty()) {
         mDBus.notifyThreadsModified(threads.values());
     }
-    return true;
 }
 
 bool HistoryDaemon::removeEvents(const QList<QVariantMap> &events)
@@ -502,6 +708,8 @@ bool HistoryDaemon::removeEvents(const QList<QVariantMap> &events)
         return false;
     }
 
+    flushWriteQueue();
+
     mBackend->beginBatchOperation();
 
     Q_FOREACH(const QVariantMap &event, events) {
@@ -575,6 +783,8 @@ void HistoryDaemon::markThreadsAsRead(const QList<QVariantMap> &threads)
         return;
     }
 
+    flushWriteQueue();
+
     QList<QVariantMap> modifiedThreads;
    
     Q_FOREACH(const QVariantMap &thread, threads) {
@@ -598,6 +808,8 @@ bool HistoryDaemon::removeThreads(const QList<QVariantMap> &threads)
         return false;
     }
 
+    flushWriteQueue();
+
     // If the thread has events
     mBackend->beginBatchOperation();
     Q_FOREACH(const QVariantMap &thread, threads) {
@@ -1131,7 +1343,7 @@ void HistoryDaemon::onMessageReceived(const Tp::TextChannelPtr textChannel, cons
     event[History::FieldSubject] = subject;
     event[History::FieldAttachments] = QVariant::fromValue(attachments);
 
-    writeEvents(QList<QVariantMap>() << event, properties);
+    queueEvents(QList<QVariantMap>() << event, properties);
 
     // if this messages supersedes another one, remove the original message
     if (!message.supersededToken().isEmpty()) {
@@ -1248,7 +1460,7 @@ void HistoryDaemon::onMessageSent(const Tp::TextChannelPtr textChannel, const Tp
     event[History::FieldSubject] = "";
     event[History::FieldAttachments] = QVariant::fromValue(attachments);
 
-    writeEvents(QList<QVariantMap>() << event, properties);
+    queueEvents(QList<QVariantMap>() << event, properties);
 }
 
 History::MatchFlags HistoryDaemon::matchFlagsForChannel(const Tp::ChannelPtr &channel)
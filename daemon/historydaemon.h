@@ -23,8 +23,12 @@
 #define HISTORYDAEMON_H
 
 #include <QCoreApplication>
+#include <QDBusServiceWatcher>
+#include <QMultiHash>
 #include <QObject>
+#include <QPointer>
 #include <QSharedPointer>
+#include <QTimer>
 #include "types.h"
 #include "textchannelobserver.h"
 #include "callchannelobserver.h"
@@ -54,17 +58,27 @@ public:
                                       History::MatchFlags matchFlags = History::MatchCaseSensitive,
                                       bool create = true);
     QList<QVariantMap> participantsForThreads(const QList<QVariantMap> &threadIds);
-    QString queryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties);
-    QString queryEvents(int type, const QVariantMap &sort, const QVariantMap &filter);
+    QString queryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties,
+                         const QString &client = QString());
+    QString queryEvents(int type, const QVariantMap &sort, const QVariantMap &filter, const QString &client = QString());
     QVariantMap getSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties);
     QVariantMap getSingleEvent(int type, const QString &accountId, const QString &threadId, const QString &eventId);
     QVariantMap getSingleEventFromTextChannel(const Tp::TextChannelPtr textChannel, const QString &messageId);
 
     bool writeEvents(const QList<QVariantMap> &events, const QVariantMap &properties, bool notify = true);
+    void queueEvents(const QList<QVariantMap> &events, const QVariantMap &properties);
     bool removeEvents(const QList<QVariantMap> &events);
     bool removeThreads(const QList<QVariantMap> &threads);
     void markThreadsAsRead(const QList<QVariantMap> &threads);
 
+    int writeQueueInterval() const;
+    void setWriteQueueInterval(int msecs);
+    int writeQueueMaxBatch() const;
+    void setWriteQueueMaxBatch(int events);
+
+public Q_SLOTS:
+    void flushWriteQueue();
+
 private Q_SLOTS:
     void onObserverCreated();
     void onCallEnded(const Tp::CallChannelPtr &channel, bool missed);
@@ -77,18 +91,23 @@ private Q_SLOTS:
                                const Tp::Contacts &groupRemotePendingMembersAdded, const Tp::Contacts &groupMembersRemoved,
                                const Tp::Channel::GroupMemberChangeDetails &details);
     void onRolesChanged(const HandleRolesMap &added, const HandleRolesMap &removed);
+    void onClientUnregistered(const QString &client);
 
 protected:
     History::MatchFlags matchFlagsForChannel(const Tp::ChannelPtr &channel);
     void updateRoomParticipants(const Tp::TextChannelPtr channel, bool notify = true);
     void updateRoomRoles(const Tp::TextChannelPtr &channel, const RolesMap &rolesMap, bool notify = true);
     QString hashThread(const QVariantMap &thread);
+    bool storeEvents(const QList<QVariantMap> &events, QList<History::EventWriteResult> &results);
+    void notifyEventsWritten(const QList<QVariantMap> &events, const QList<History::EventWriteResult> &results, const QVariantMap &properties);
     static QVariantMap getInterfaceProperties(const Tp::AbstractInterface *interface);
     void updateRoomProperties(const Tp::TextChannelPtr &channel, const QVariantMap &properties, bool notify = true);
     void updateRoomProperties(const QString &accountId, const QString &threadId, History::EventType type, const QVariantMap &properties, const QStringList &invalidated, bool notify = true);
 
     void writeInformationEvent(const QVariantMap &thread, History::InformationType type, const QString &subject = QString(), const QString &sender = QString("self"), const QString &text = QString(), bool notify = true);
 
+    void addClientView(QObject *view, const QString &client);
+
     void writeRoomChangesInformationEvents(const QVariantMap &thread, const QVariantMap &interfaceProperties);
     void writeRolesInformationEvents(const QVariantMap &thread, const Tp::ChannelPtr &channel, const RolesMap &rolesMap);
     void writeRolesChangesInformationEvents(const QVariantMap &thread, const Tp::ChannelPtr &channel, const RolesMap &rolesMap);
@@ -98,12 +117,23 @@ protected:
 private:
     HistoryDaemon(QObject *parent = 0);
 
+    struct PendingWrite {
+        QList<QVariantMap> events;
+        QVariantMap properties;
+    };
+
     CallChannelObserver mCallObserver;
     TextChannelObserver mTextObserver;
     QMap<QString, History::MatchFlags> mProtocolFlags;
     History::PluginPtr mBackend;
     HistoryServiceDBus mDBus;
     QMap<QString, RolesMap> mRolesMap;
+    QList<PendingWrite> mWriteQueue;
+    int mWriteQueueEventCount;
+    int mWriteQueueMaxBatch;
+    QTimer mWriteQueueTimer;
+    QDBusServiceWatcher mClientWatcher;
+    QMultiHash<QString, QPointer<QObject> > mClientViews;
 };
 
 #endif
@@ -23,9 +23,13 @@
 #include "historyservicedbus.h"
 #include "historyserviceadaptor.h"
 #include "types.h"
+#include "wireformat_p.h"
 
 Q_DECLARE_METATYPE(QList< QVariantMap >)
 
+// the most items sent in a single signal, bursts bigger than this are split
+static const int maxSignalPayload = 200;
+
 HistoryServiceDBus::HistoryServiceDBus(QObject *parent) :
     QObject(parent), mAdaptor(0), mSignalsTimer(-1)
 {
@@ -47,37 +51,70 @@ bool HistoryServiceDBus::connectToBus()
 
 void HistoryServiceDBus::notifyThreadsAdded(const QList<QVariantMap> &threads)
 {
-    mThreadsAdded << threads;
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        QString key = pendingThreadKey(thread);
+        // a thread removed and created again needs to reach the clients in that order
+        if (mThreadsRemoved.positions.contains(key)) {
+            processSignals();
+        }
+        addPending(mThreadsAdded, key, thread);
+    }
     triggerSignals();
 }
 
 void HistoryServiceDBus::notifyThreadsModified(const QList<QVariantMap> &threads)
 {
-    mThreadsModified << threads;
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        QString key = pendingThreadKey(thread);
+        if (!replacePending(mThreadsAdded, key, thread)) {
+            addPending(mThreadsModified, key, thread);
+        }
+    }
     triggerSignals();
 }
 
 void HistoryServiceDBus::notifyThreadsRemoved(const QList<QVariantMap> &threads)
 {
-    mThreadsRemoved << threads;
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        QString key = pendingThreadKey(thread);
+        dropPending(mThreadsAdded, key);
+        dropPending(mThreadsModified, key);
+        addPending(mThreadsRemoved, key, thread);
+    }
     triggerSignals();
 }
 
 void HistoryServiceDBus::notifyEventsAdded(const QList<QVariantMap> &events)
 {
-    mEventsAdded << events;
+    Q_FOREACH(const QVariantMap &event, events) {
+        QString key = pendingEventKey(event);
+        if (mEventsRemoved.positions.contains(key)) {
+            processSignals();
+        }
+        addPending(mEventsAdded, key, event);
+    }
     triggerSignals();
 }
 
 void HistoryServiceDBus::notifyEventsModified(const QList<QVariantMap> &events)
 {
-    mEventsModified << events;
+    Q_FOREACH(const QVariantMap &event, events) {
+        QString key = pendingEventKey(event);
+        if (!replacePending(mEventsAdded, key, event)) {
+            addPending(mEventsModified, key, event);
+        }
+    }
     triggerSignals();
 }
 
 void HistoryServiceDBus::notifyEventsRemoved(const QList<QVariantMap> &events)
 {
-    mEventsRemoved << events;
+    Q_FOREACH(const QVariantMap &event, events) {
+        QString key = pendingEventKey(event);
+        dropPending(mEventsAdded, key);
+        dropPending(mEventsModified, key);
+        addPending(mEventsRemoved, key, event);
+    }
     triggerSignals();
 }
 
@@ -145,12 +182,13 @@ bool HistoryServiceDBus::RemoveEvents(const QList<QVariantMap> &events)
 
 QString HistoryServiceDBus::QueryThreads(int type, const QVariantMap &sort, const QVariantMap &filter, const QVariantMap &properties)
 {
-    return HistoryDaemon::instance()->queryThreads(type, sort, filter, properties);
+    // the views of a client are removed when it leaves the bus
+    return HistoryDaemon::instance()->queryThreads(type, sort, filter, properties, calledFromDBus() ? message().service() : QString());
 }
 
 QString HistoryServiceDBus::QueryEvents(int type, const QVariantMap &sort, const QVariantMap &filter)
 {
-    return HistoryDaemon::instance()->queryEvents(type, sort, filter);
+    return HistoryDaemon::instance()->queryEvents(type, sort, filter, calledFromDBus() ? message().service() : QString());
 }
 
 QVariantMap HistoryServiceDBus::GetSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties)
@@ -163,6 +201,11 @@ QVariantMap HistoryServiceDBus::GetSingleEvent(int type, const QString &accountI
     return HistoryDaemon::instance()->getSingleEvent(type, accountId, threadId, eventId);
 }
 
+int HistoryServiceDBus::WireFormatVersion()
+{
+    return History::WireFormat::CurrentVersion;
+}
+
 void HistoryServiceDBus::timerEvent(QTimerEvent *event)
 {
     if (event->timerId() == mSignalsTimer) {
@@ -172,64 +215,89 @@ void HistoryServiceDBus::timerEvent(QTimerEvent *event)
     }
 }
 
-void HistoryServiceDBus::filterDuplicatesAndAdd(QList<QVariantMap> &targetList, const QList<QVariantMap> newItems, const QStringList &propertiesToCompare)
+/// threads carry the id of their last event, so only the fields identifying the thread are used
+QString HistoryServiceDBus::pendingThreadKey(const QVariantMap &thread)
 {
-    Q_FOREACH (const QVariantMap &item, newItems) {
-        Q_FOREACH(const QVariantMap &existing, targetList) {
-            bool found = true;
-            Q_FOREACH(const QString &prop, propertiesToCompare) {
-                if (item[prop] != existing[prop]) {
-                    found = false;
-                    break;
-                }
-            }
+    QString key = QString::number(thread[History::FieldType].toInt());
+    key += "#-#" + thread[History::FieldAccountId].toString();
+    key += "#-#" + thread[History::FieldThreadId].toString();
+    return key;
+}
 
-            if (!found) {
-                targetList << item;
-            }
-        }
-    }
+QString HistoryServiceDBus::pendingEventKey(const QVariantMap &event)
+{
+    return pendingThreadKey(event) + "#-#" + event[History::FieldEventId].toString();
 }
 
-void HistoryServiceDBus::triggerSignals()
+void HistoryServiceDBus::addPending(PendingItems &pending, const QString &key, const QVariantMap &item)
 {
-    if (mSignalsTimer >= 0) {
-        killTimer(mSignalsTimer);
+    if (replacePending(pending, key, item)) {
+        return;
     }
 
-    mSignalsTimer = startTimer(100);
+    pending.positions[key] = pending.items.insert(pending.items.end(), item);
 }
 
-void HistoryServiceDBus::processSignals()
+bool HistoryServiceDBus::replacePending(PendingItems &pending, const QString &key, const QVariantMap &item)
 {
-    if (!mThreadsAdded.isEmpty()) {
-        Q_EMIT ThreadsAdded(mThreadsAdded);
-        mThreadsAdded.clear();
+    QHash<QString, QLinkedList<QVariantMap>::iterator>::const_iterator it = pending.positions.constFind(key);
+    if (it == pending.positions.constEnd()) {
+        return false;
     }
 
-    if (!mThreadsModified.isEmpty()) {
-        Q_EMIT ThreadsModified(mThreadsModified);
-        mThreadsModified.clear();
+    *it.value() = item;
+    return true;
+}
+
+void HistoryServiceDBus::dropPending(PendingItems &pending, const QString &key)
+{
+    QHash<QString, QLinkedList<QVariantMap>::iterator>::iterator it = pending.positions.find(key);
+    if (it == pending.positions.end()) {
+        return;
     }
 
-    if (!mThreadsRemoved.isEmpty()) {
-        Q_EMIT ThreadsRemoved(mThreadsRemoved);
-        mThreadsRemoved.clear();
+    pending.items.erase(it.value());
+    pending.positions.erase(it);
+}
+
+void HistoryServiceDBus::emitPending(PendingItems &pending, PayloadSignal signal)
+{
+    QList<QVariantMap> items;
+    Q_FOREACH(const QVariantMap &item, pending.items) {
+        items << item;
     }
+    pending.items.clear();
+    pending.positions.clear();
 
-    if (!mEventsAdded.isEmpty()) {
-        Q_EMIT EventsAdded(mEventsAdded);
-        mEventsAdded.clear();
+    for (int i = 0; i < items.count(); i += maxSignalPayload) {
+        (this->*signal)(items.mid(i, maxSignalPayload));
     }
+}
 
-    if (!mEventsModified.isEmpty()) {
-        Q_EMIT EventsModified(mEventsModified);
-        mEventsModified.clear();
+void HistoryServiceDBus::triggerSignals()
+{
+    if (mSignalsTimer >= 0) {
+        killTimer(mSignalsTimer);
+        mSignalsTimer = -1;
     }
 
-    if (!mEventsRemoved.isEmpty()) {
-        Q_EMIT EventsRemoved(mEventsRemoved);
-        mEventsRemoved.clear();
+    // the timer is restarted on every change, so a long burst is flushed once enough piled up
+    if (mThreadsAdded.items.count() >= maxSignalPayload || mThreadsModified.items.count() >= maxSignalPayload ||
+            mThreadsRemoved.items.count() >= maxSignalPayload || mEventsAdded.items.count() >= maxSignalPayload ||
+            mEventsModified.items.count() >= maxSignalPayload || mEventsRemoved.items.count() >= maxSignalPayload) {
+        processSignals();
+        return;
     }
+
+    mSignalsTimer = startTimer(100);
 }
 
+void HistoryServiceDBus::processSignals()
+{
+    emitPending(mThreadsAdded, &HistoryServiceDBus::ThreadsAdded);
+    emitPending(mThreadsModified, &HistoryServiceDBus::ThreadsModified);
+    emitPending(mThreadsRemoved, &HistoryServiceDBus::ThreadsRemoved);
+    emitPending(mEventsAdded, &HistoryServiceDBus::EventsAdded);
+    emitPending(mEventsModified, &HistoryServiceDBus::EventsModified);
+    emitPending(mEventsRemoved, &HistoryServiceDBus::EventsRemoved);
+}
@@ -23,6 +23,8 @@
 #define HISTORYSERVICEDBUS_H
 
 #include <QDBusContext>
+#include <QHash>
+#include <QLinkedList>
 #include <QObject>
 #include "types.h"
 
@@ -70,6 +72,7 @@ public:
     QString QueryEvents(int type, const QVariantMap &sort, const QVariantMap &filter);
     QVariantMap GetSingleThread(int type, const QString &accountId, const QString &threadId, const QVariantMap &properties);
     QVariantMap GetSingleEvent(int type, const QString &accountId, const QString &threadId, const QString &eventId);
+    int WireFormatVersion();
 
 Q_SIGNALS:
     // signals that will be relayed into the bus
@@ -89,18 +92,31 @@ protected:
     void timerEvent(QTimerEvent *event) override;
 
 protected Q_SLOTS:
-    void filterDuplicatesAndAdd(QList<QVariantMap> &targetList, const QList<QVariantMap> newItems, const QStringList &propertiesToCompare);
     void triggerSignals();
     void processSignals();
 
 private:
+    /// items waiting to be signalled, keyed so that a later update of an item replaces the earlier one
+    struct PendingItems {
+        QLinkedList<QVariantMap> items;
+        QHash<QString, QLinkedList<QVariantMap>::iterator> positions;
+    };
+    typedef void (HistoryServiceDBus::*PayloadSignal)(const QList<QVariantMap> &);
+
+    static QString pendingThreadKey(const QVariantMap &thread);
+    static QString pendingEventKey(const QVariantMap &event);
+    static void addPending(PendingItems &pending, const QString &key, const QVariantMap &item);
+    static bool replacePending(PendingItems &pending, const QString &key, const QVariantMap &item);
+    static void dropPending(PendingItems &pending, const QString &key);
+    void emitPending(PendingItems &pending, PayloadSignal signal);
+
     HistoryServiceAdaptor *mAdaptor;
-    QList<QVariantMap> mThreadsAdded;
-    QList<QVariantMap> mThreadsModified;
-    QList<QVariantMap> mThreadsRemoved;
-    QList<QVariantMap> mEventsAdded;
-    QList<QVariantMap> mEventsModified;
-    QList<QVariantMap> mEventsRemoved;
+    PendingItems mThreadsAdded;
+    PendingItems mThreadsModified;
+    PendingItems mThreadsRemoved;
+    PendingItems mEventsAdded;
+    PendingItems mEventsModified;
+    PendingItems mEventsRemoved;
     int mSignalsTimer;
 };
 
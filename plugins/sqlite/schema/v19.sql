@@ -0,0 +1,10 @@
+CREATE INDEX threads_thread_index ON threads (accountId, threadId, type);
+CREATE INDEX thread_participants_thread_index ON thread_participants (accountId, threadId, type);
+CREATE INDEX thread_participants_participant_index ON thread_participants (participantId, type, accountId);
+CREATE INDEX thread_participants_normalized_index ON thread_participants (normalizedId, type, accountId);
+CREATE INDEX text_events_timestamp_index ON text_events (accountId, threadId, timestamp, eventId);
+CREATE INDEX text_events_event_index ON text_events (accountId, threadId, eventId);
+CREATE INDEX text_event_attachments_event_index ON text_event_attachments (accountId, threadId, eventId);
+CREATE INDEX voice_events_timestamp_index ON voice_events (accountId, threadId, timestamp, eventId);
+CREATE INDEX voice_events_event_index ON voice_events (accountId, threadId, eventId);
+CREATE INDEX chat_room_info_thread_index ON chat_room_info (accountId, threadId, type);
@@ -0,0 +1,2 @@
+ALTER TABLE threads ADD COLUMN participantsHash varchar(40);
+CREATE INDEX threads_participants_index ON threads (accountId, type, participantsHash);
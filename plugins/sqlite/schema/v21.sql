@@ -0,0 +1,3 @@
+ALTER TABLE thread_participants ADD COLUMN matchKey varchar(16);
+UPDATE thread_participants SET matchKey = phoneNumberMatchKey(normalizedId);
+CREATE INDEX thread_participants_match_key_index ON thread_participants (accountId, type, matchKey);
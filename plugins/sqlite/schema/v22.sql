@@ -0,0 +1 @@
+CREATE INDEX thread_participants_match_key_type_index ON thread_participants (matchKey, type);
@@ -0,0 +1,17 @@
+CREATE TABLE thread_groups (
+    accountId varchar(255),
+    threadId varchar(255),
+    type tinyint,
+    groupAccountId varchar(255),
+    groupThreadId varchar(255)
+);
+CREATE UNIQUE INDEX thread_groups_thread_index ON thread_groups (accountId, threadId, type);
+CREATE INDEX thread_groups_group_index ON thread_groups (groupAccountId, groupThreadId, type);
+CREATE TRIGGER thread_groups_delete_trigger AFTER DELETE ON threads
+FOR EACH ROW
+BEGIN
+    DELETE FROM thread_groups WHERE
+        accountId=old.accountId AND
+        threadId=old.threadId AND
+        type=old.type;
+END;
@@ -0,0 +1 @@
+CREATE INDEX threads_timestamp_index ON threads (type, lastEventTimestamp);
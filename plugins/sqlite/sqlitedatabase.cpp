@@ -22,6 +22,7 @@
 #include "phoneutils_p.h"
 #include "sqlite3.h"
 #include "sqlitedatabase.h"
+#include "sqlitereader.h"
 #include "types.h"
 #include "utils_p.h"
 #include <QStandardPaths>
@@ -32,6 +33,17 @@
 #include <QFile>
 #include <QDir>
 #include <QDateTime>
+#include <QCryptographicHash>
+
+// the write-ahead log is checkpointed once no transaction was committed for this long,
+// unless HISTORY_SQLITE_CHECKPOINT_INTERVAL is set
+static const int checkpointIdleInterval = 5000;
+// and sqlite checkpoints by itself if it grows past this many pages without the daemon being idle
+static const int checkpointMaxPages = 10000;
+// those checkpoints don't shrink the log file, it is truncated down to this size when it is reused
+static const int walSizeLimit = 4 * 1024 * 1024;
+// number of read-only connections used by the views when HISTORY_SQLITE_READERS is not set
+static const int defaultReaderCount = 2;
 
 Q_DECLARE_OPAQUE_POINTER(sqlite3*)
 Q_DECLARE_METATYPE(sqlite3*)
@@ -59,9 +71,24 @@ void normalizeId(sqlite3_context *context, int argc, sqlite3_value **argv)
     sqlite3_result_text(context, strdup(normalizedId.toUtf8().data()), -1, &free);
 }
 
+void phoneNumberMatchKey(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    QString phoneNumber((const char*)sqlite3_value_text(argv[0]));
+    QString matchKey = History::PhoneUtils::phoneNumberMatchKey(phoneNumber);
+    if (matchKey.isNull()) {
+        sqlite3_result_null(context);
+        return;
+    }
+    sqlite3_result_text(context, strdup(matchKey.toUtf8().data()), -1, &free);
+}
+
 SQLiteDatabase::SQLiteDatabase(QObject *parent) :
-    QObject(parent), mSchemaVersion(0)
+    QObject(parent), mSchemaVersion(0), mTransactionDepth(0), mStorageProfile(ProfileRollbackJournal),
+    mReaderCount(0), mNextReader(0)
 {
+    mCheckpointTimer.setSingleShot(true);
+    connect(&mCheckpointTimer, SIGNAL(timeout()), SLOT(checkpoint()));
+
     initializeDatabase();
 }
 
@@ -88,6 +115,12 @@ bool SQLiteDatabase::initializeDatabase()
         mDatabasePath = dir.absoluteFilePath("history.sqlite");
     }
 
+    mStorageProfile = storageProfileFromName(qgetenv("HISTORY_SQLITE_PROFILE"));
+
+    bool ok = false;
+    int checkpointInterval = qgetenv("HISTORY_SQLITE_CHECKPOINT_INTERVAL").toInt(&ok);
+    mCheckpointTimer.setInterval(ok ? checkpointInterval : checkpointIdleInterval);
+
     mDatabase = QSqlDatabase::addDatabase("QSQLITE");
     mDatabase.setDatabaseName(mDatabasePath);
 
@@ -99,6 +132,14 @@ bool SQLiteDatabase::initializeDatabase()
         return false;
     }
 
+    // readers can only run alongside the writer on a database file using the write-ahead log
+    if (mDatabasePath != ":memory:" && mStorageProfile == ProfileWriteAheadLog) {
+        mReaderCount = qgetenv("HISTORY_SQLITE_READERS").toInt(&ok);
+        if (!ok) {
+            mReaderCount = defaultReaderCount;
+        }
+    }
+
     return true;
 }
 
@@ -107,25 +148,72 @@ QSqlDatabase SQLiteDatabase::database() const
     return mDatabase;
 }
 
+/// transactions can be nested: only the outermost one is actually started and committed,
+/// so that writes done inside a batch operation end up in a single commit.
 bool SQLiteDatabase::beginTransation()
 {
-    return mDatabase.transaction();
+    if (mTransactionDepth++ > 0) {
+        return true;
+    }
+
+    if (!mDatabase.transaction()) {
+        mTransactionDepth = 0;
+        return false;
+    }
+    return true;
 }
 
 bool SQLiteDatabase::finishTransaction()
 {
-    return mDatabase.commit();
+    if (mTransactionDepth > 1) {
+        mTransactionDepth--;
+        return true;
+    }
+
+    mTransactionDepth = 0;
+    if (!mDatabase.commit()) {
+        return false;
+    }
+
+    // restarting the timer on every commit makes the checkpoint only run when the daemon is idle
+    if (mStorageProfile == ProfileWriteAheadLog) {
+        mCheckpointTimer.start();
+    }
+    return true;
 }
 
+/// rolling back a nested transaction rolls back the outermost one
 bool SQLiteDatabase::rollbackTransaction()
 {
+    mTransactionDepth = 0;
     return mDatabase.rollback();
 }
 
+/// returns a query prepared with the given statement. The statement is only compiled the
+/// first time, later calls get the same query back, ready to have new values bound.
+QSqlQuery SQLiteDatabase::preparedQuery(const QString &queryText)
+{
+    QHash<QString, QSqlQuery>::const_iterator it = mPreparedQueries.constFind(queryText);
+    if (it != mPreparedQueries.constEnd()) {
+        return it.value();
+    }
+
+    QSqlQuery query(mDatabase);
+    if (!query.prepare(queryText)) {
+        qCritical() << "Failed to prepare query:" << query.lastError() << queryText;
+        return query;
+    }
+
+    mPreparedQueries[queryText] = query;
+    return query;
+}
+
 /// this method is to be used mainly by unit tests in order to clean up the database between
 /// tests.
 bool SQLiteDatabase::reopen()
 {
+    mPreparedQueries.clear();
+    mTransactionDepth = 0;
     mDatabase.close();
     mDatabase.open();
 
@@ -189,31 +277,42 @@ void trace(void *something, const char *query)
     qDebug() << "SQLITE TRACE:" << query;
 }
 
-bool SQLiteDatabase::createOrUpdateDatabase()
+/// registers the custom sqlite functions used by the queries on the given connection
+void SQLiteDatabase::registerFunctions(QSqlDatabase &database)
 {
-    bool create = !QFile(mDatabasePath).exists();
-
-    if (!mDatabase.open()) {
-        return false;
-    }
-
     // create the comparePhoneNumbers custom sqlite functions
-    sqlite3 *handle = database().driver()->handle().value<sqlite3*>();
+    sqlite3 *handle = database.driver()->handle().value<sqlite3*>();
     sqlite3_create_function(handle, "comparePhoneNumbers", 2, SQLITE_ANY, NULL, &comparePhoneNumbers, NULL, NULL);
     sqlite3_create_function(handle, "compareNormalizedPhoneNumbers", 2, SQLITE_ANY, NULL, &compareNormalizedPhoneNumbers, NULL, NULL);
 
     // and also create the normalizeId function
     sqlite3_create_function(handle, "normalizeId", 2, SQLITE_ANY, NULL, &normalizeId, NULL, NULL);
 
+    // and the function used to fill the phone number match keys of existing participants
+    sqlite3_create_function(handle, "phoneNumberMatchKey", 1, SQLITE_ANY, NULL, &phoneNumberMatchKey, NULL, NULL);
+
 #ifdef TRACE_SQLITE
     sqlite3_trace(handle, &trace, NULL);
 #endif
+}
+
+bool SQLiteDatabase::createOrUpdateDatabase()
+{
+    bool create = !QFile(mDatabasePath).exists();
+
+    if (!mDatabase.open()) {
+        return false;
+    }
+
+    registerFunctions(mDatabase);
 
     parseVersionInfo();
 
+    if (!applyStorageProfile(mDatabase, mStorageProfile)) {
+        qWarning() << "Failed to apply the storage profile, using the sqlite defaults";
+    }
+
     QSqlQuery query(mDatabase);
-    // use memory to create temporary tables
-    query.exec("PRAGMA temp_store = MEMORY");
 
     QStringList statements;
     int existingVersion = 0;
@@ -283,6 +382,14 @@ bool SQLiteDatabase::createOrUpdateDatabase()
                 }
             }
         }
+        // v20 - participants hash used to find threads by participants
+        if (existingVersion < 20) {
+            if (!generateParticipantsHashes()) {
+                qCritical() << "Failed to generate the participants hashes.";
+                rollbackTransaction();
+                return false;
+            }
+        }
     }
 
     finishTransaction();
@@ -290,6 +397,140 @@ bool SQLiteDatabase::createOrUpdateDatabase()
     return true;
 }
 
+/**
+ * @brief Generates a key identifying a set of participants regardless of their order
+ *
+ * Phone numbers are hashed by their match key, so matching numbers written in different
+ * formats (with or without the country code, for instance) produce the same hash. Other
+ * identifiers are hashed case insensitively. Different participants can share a hash, so
+ * the threads found by it still need their participants to be compared.
+ * @param normalizedIds the normalized identifiers of the participants
+ * @return the hash to be stored in the participantsHash column of the threads table
+ */
+QString SQLiteDatabase::participantsHash(const QStringList &normalizedIds)
+{
+    QStringList keys;
+    Q_FOREACH(const QString &normalizedId, normalizedIds) {
+        QString matchKey = History::PhoneUtils::phoneNumberMatchKey(normalizedId);
+        keys << (matchKey.isEmpty() ? normalizedId.toLower() : matchKey);
+    }
+    keys.sort();
+    return QString(QCryptographicHash::hash(keys.join("\n").toUtf8(), QCryptographicHash::Md5).toHex());
+}
+
+SQLiteDatabase::StorageProfile SQLiteDatabase::storageProfile() const
+{
+    return mStorageProfile;
+}
+
+/**
+ * @brief Parses the value of the HISTORY_SQLITE_PROFILE environment variable
+ * @param name "rollback" (the default) for the classic rollback journal, or "wal" to opt in to the write-ahead log
+ */
+SQLiteDatabase::StorageProfile SQLiteDatabase::storageProfileFromName(const QString &name)
+{
+    if (name == "wal") {
+        return ProfileWriteAheadLog;
+    }
+    if (!name.isEmpty() && name != "rollback") {
+        qWarning() << "Unknown storage profile" << name << "using rollback instead";
+    }
+    return ProfileRollbackJournal;
+}
+
+/**
+ * @brief Sets the pragmas of the given storage profile on an open connection
+ *
+ * The write-ahead log lets readers run while a transaction is being committed and only
+ * syncs on checkpoints, so it is combined with synchronous=NORMAL, memory-mapped reads and
+ * a bigger page cache. Checkpoints are run by checkpoint() when the daemon is idle, and the
+ * log file is kept from growing for good by the checkpoints sqlite runs by itself.
+ * Read-only connections only get the cache settings, the journal belongs to the writer.
+ */
+bool SQLiteDatabase::applyStorageProfile(QSqlDatabase &database, StorageProfile profile, bool readOnly)
+{
+    QStringList pragmas;
+    // use memory to create temporary tables
+    pragmas << "PRAGMA temp_store = MEMORY";
+
+    switch (profile) {
+    case ProfileRollbackJournal:
+        if (!readOnly) {
+            pragmas << "PRAGMA journal_mode = DELETE"
+                    << "PRAGMA synchronous = FULL";
+        }
+        pragmas << "PRAGMA mmap_size = 0"
+                << "PRAGMA cache_size = -2000";
+        break;
+    case ProfileWriteAheadLog:
+        if (!readOnly) {
+            pragmas << "PRAGMA journal_mode = WAL"
+                    << "PRAGMA synchronous = NORMAL"
+                    << QString("PRAGMA wal_autocheckpoint = %1").arg(checkpointMaxPages)
+                    << QString("PRAGMA journal_size_limit = %1").arg(walSizeLimit);
+        }
+        pragmas << "PRAGMA mmap_size = 67108864"
+                << "PRAGMA cache_size = -8000";
+        break;
+    }
+
+    QSqlQuery query(database);
+    Q_FOREACH(const QString &pragma, pragmas) {
+        if (!query.exec(pragma)) {
+            qCritical() << "Error:" << query.lastError() << query.lastQuery();
+            return false;
+        }
+    }
+    return true;
+}
+
+/// returns the next reader of the pool, or 0 if the queries need to run on the main connection
+SQLiteReader *SQLiteDatabase::reader()
+{
+    // the readers are started on first use, and again after closeReaders()
+    if (mReaders.isEmpty()) {
+        for (int i = 0; i < mReaderCount; ++i) {
+            mReaders << new SQLiteReader(mDatabasePath, mStorageProfile, this);
+        }
+        if (mReaders.isEmpty()) {
+            return 0;
+        }
+    }
+
+    mNextReader = (mNextReader + 1) % mReaders.count();
+    return mReaders[mNextReader];
+}
+
+/// closes the read connections and waits for their threads to finish
+void SQLiteDatabase::closeReaders()
+{
+    qDeleteAll(mReaders);
+    mReaders.clear();
+    mNextReader = 0;
+}
+
+/// the read connections do not see the changes of a transaction until it is committed
+bool SQLiteDatabase::inTransaction() const
+{
+    return mTransactionDepth > 0;
+}
+
+/// copies the pages of the write-ahead log back to the database and truncates the log file
+bool SQLiteDatabase::checkpoint()
+{
+    if (mStorageProfile != ProfileWriteAheadLog || mTransactionDepth > 0) {
+        return false;
+    }
+
+    // this runs when the daemon is idle, so waiting for the readers to finish their queries is fine
+    QSqlQuery query(mDatabase);
+    if (!query.exec("PRAGMA wal_checkpoint(TRUNCATE)")) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return false;
+    }
+    return true;
+}
+
 QStringList SQLiteDatabase::parseSchemaFile(const QString &fileName)
 {
     QFile schema(fileName);
@@ -456,3 +697,48 @@ bool SQLiteDatabase::convertOfonoGroupChatToRoom()
     query.clear();
 }
 
+bool SQLiteDatabase::generateParticipantsHashes()
+{
+    QSqlQuery query(database());
+    if (!query.exec("SELECT accountId, threadId, type, normalizedId FROM thread_participants ORDER BY accountId, threadId, type")) {
+        qWarning() << "Failed to read the thread participants:" << query.lastError();
+        return false;
+    }
+
+    QList<QVariantMap> threads;
+    QVariantMap thread;
+    QStringList normalizedIds;
+    while (query.next()) {
+        if (thread.isEmpty() || thread[History::FieldAccountId] != query.value(0) ||
+                thread[History::FieldThreadId] != query.value(1) || thread[History::FieldType] != query.value(2)) {
+            if (!thread.isEmpty()) {
+                thread["participantsHash"] = participantsHash(normalizedIds);
+                threads << thread;
+            }
+            thread[History::FieldAccountId] = query.value(0);
+            thread[History::FieldThreadId] = query.value(1);
+            thread[History::FieldType] = query.value(2);
+            normalizedIds.clear();
+        }
+        normalizedIds << query.value(3).toString();
+    }
+    if (!thread.isEmpty()) {
+        thread["participantsHash"] = participantsHash(normalizedIds);
+        threads << thread;
+    }
+    query.clear();
+
+    query.prepare("UPDATE threads SET participantsHash=:participantsHash WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    Q_FOREACH (const QVariantMap &thread, threads) {
+        query.bindValue(":participantsHash", thread["participantsHash"]);
+        query.bindValue(":accountId", thread[History::FieldAccountId]);
+        query.bindValue(":threadId", thread[History::FieldThreadId]);
+        query.bindValue(":type", thread[History::FieldType]);
+        if (!query.exec()) {
+            qWarning() << "Failed to update the participants hash:" << query.lastError();
+            return false;
+        }
+    }
+
+    return true;
+}
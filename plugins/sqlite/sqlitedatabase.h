@@ -22,13 +22,24 @@
 #ifndef SQLITEDATABASE_H
 #define SQLITEDATABASE_H
 
+#include <QHash>
 #include <QObject>
 #include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QTimer>
+
+class SQLiteReader;
 
 class SQLiteDatabase : public QObject
 {
     Q_OBJECT
 public:
+    /// how the database file is journaled and synced, selected with HISTORY_SQLITE_PROFILE
+    enum StorageProfile {
+        ProfileRollbackJournal,
+        ProfileWriteAheadLog
+    };
+
     static SQLiteDatabase *instance();
 
     bool initializeDatabase();
@@ -38,12 +49,28 @@ public:
     bool finishTransaction();
     bool rollbackTransaction();
 
+    QSqlQuery preparedQuery(const QString &queryText);
+
     bool reopen();
 
     QString dumpSchema() const;
     QStringList parseSchemaFile(const QString &fileName);
     bool runMultipleStatements(const QStringList &statements, bool useTransaction = true);
 
+    static QString participantsHash(const QStringList &normalizedIds);
+
+    StorageProfile storageProfile() const;
+    static StorageProfile storageProfileFromName(const QString &name);
+    static bool applyStorageProfile(QSqlDatabase &database, StorageProfile profile, bool readOnly = false);
+    static void registerFunctions(QSqlDatabase &database);
+
+    SQLiteReader *reader();
+    void closeReaders();
+    bool inTransaction() const;
+
+public Q_SLOTS:
+    bool checkpoint();
+
 protected:
     bool createOrUpdateDatabase();
     void parseVersionInfo();
@@ -51,13 +78,20 @@ protected:
     // data upgrade functions
     bool changeTimestampsToUtc();
     bool convertOfonoGroupChatToRoom();
+    bool generateParticipantsHashes();
 
 private:
     explicit SQLiteDatabase(QObject *parent = 0);
     QString mDatabasePath;
     QSqlDatabase mDatabase;
     int mSchemaVersion;
-    
+    int mTransactionDepth;
+    QHash<QString, QSqlQuery> mPreparedQueries;
+    StorageProfile mStorageProfile;
+    QTimer mCheckpointTimer;
+    QList<SQLiteReader*> mReaders;
+    int mReaderCount;
+    int mNextReader;
 };
 
 #endif // SQLITEDATABASE_H
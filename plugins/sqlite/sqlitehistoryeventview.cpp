@@ -23,88 +23,227 @@
 #include "sqlitedatabase.h"
 #include "sqlitehistoryplugin.h"
 #include "sort.h"
+#include "types.h"
 #include <QDateTime>
 #include <QDebug>
-#include <QSqlError>
+
+// fields that can be used as keys for keyset paging. They are never NULL and
+// are returned unmodified by sqlQueryForEvents(), so the values from the last row
+// can be used to build the condition for the next page.
+static const QStringList keysetFields = QStringList() << History::FieldAccountId
+                                                      << History::FieldThreadId
+                                                      << History::FieldEventId
+                                                      << History::FieldTimestamp;
 
 SQLiteHistoryEventView::SQLiteHistoryEventView(SQLiteHistoryPlugin *plugin,
                                              History::EventType type,
                                              const History::Sort &sort,
                                              const History::Filter &filter)
     : History::PluginEventView(), mType(type), mSort(sort), mFilter(filter),
-      mQuery(SQLiteDatabase::instance()->database()), mPageSize(15), mPlugin(plugin), mOffset(0), mValid(true)
+      mPlugin(plugin), mOffset(0), mValid(true), mKeysetPaging(true),
+      mReader(SQLiteDatabase::instance()->reader()), mCreateJob(0), mPageJob(0), mPendingPages(0)
 {
-    mTemporaryTable = QString("eventview%1%2").arg(QString::number((qulonglong)this), QDateTime::currentDateTimeUtc().toString("yyyyMMddhhmmsszzz"));
-    mQuery.setForwardOnly(true);
+    if (mReader) {
+        connect(mReader, SIGNAL(finished(int,SQLiteReadResult)), SLOT(onReaderFinished(int,SQLiteReadResult)));
+    }
 
     // FIXME: validate the filter
-    QVariantMap filterValues;
-    QString condition = mPlugin->filterToString(filter, filterValues);
-    QString order;
+    mCondition = mPlugin->filterToString(filter, mFilterValues);
+
+    QStringList sortFields;
     if (!sort.sortField().isNull()) {
         // WORKAROUND: Supports multiple fields by split it using ','
         Q_FOREACH(const QString& field, sort.sortField().split(",")) {
-            order += QString("%1 %2, ")
-                    .arg(field.trimmed())
-                    .arg(sort.sortOrder() == Qt::AscendingOrder ? "ASC" : "DESC");
+            sortFields << field.trimmed();
+            if (!keysetFields.contains(field.trimmed())) {
+                mKeysetPaging = false;
+            }
         }
+    }
 
-        order = QString("ORDER BY %1").arg(order.mid(0, order.lastIndexOf(",")));
-        // FIXME: check case sensitiviy
+    if (mKeysetPaging) {
+        // the primary key fields are appended so that the order is total and no events
+        // get skipped or repeated between pages
+        mKeyFields = sortFields;
+        Q_FOREACH(const QString &field, QStringList() << History::FieldAccountId << History::FieldThreadId << History::FieldEventId) {
+            if (!mKeyFields.contains(field)) {
+                mKeyFields << field;
+            }
+        }
+        sortFields = mKeyFields;
     }
 
-    QString queryText = QString("CREATE TEMP TABLE %1 AS ").arg(mTemporaryTable);
-    queryText += mPlugin->sqlQueryForEvents(type, condition, order);
+    QString order;
+    Q_FOREACH(const QString &field, sortFields) {
+        order += QString("%1 %2, ")
+                .arg(field)
+                .arg(sort.sortOrder() == Qt::AscendingOrder ? "ASC" : "DESC");
+    }
+    if (!order.isEmpty()) {
+        mOrder = QString("ORDER BY %1").arg(order.mid(0, order.lastIndexOf(",")));
+        // FIXME: check case sensitiviy
+    }
 
-    if (!mQuery.prepare(queryText)) {
-        mValid = false;
-        Q_EMIT Invalidated();
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+    // pages are queried directly from the events table, nothing else to do here
+    if (mKeysetPaging) {
         return;
     }
 
-    Q_FOREACH(const QString &key, filterValues.keys()) {
-        mQuery.bindValue(key, filterValues[key]);
+    mTemporaryTable = QString("eventview%1%2").arg(QString::number((qulonglong)this), QDateTime::currentDateTimeUtc().toString("yyyyMMddhhmmsszzz"));
+    QString queryText = QString("CREATE TEMP TABLE %1 AS ").arg(mTemporaryTable);
+    queryText += mPlugin->sqlQueryForEvents(type, mCondition, mOrder);
+
+    if (mReader) {
+        mCreateJob = mReader->enqueue(queryText, mFilterValues);
+        return;
     }
 
-    if (!mQuery.exec()) {
+    if (!execute(queryText, mFilterValues).success) {
         mValid = false;
         Q_EMIT Invalidated();
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
-        return;
     }
 }
 
 SQLiteHistoryEventView::~SQLiteHistoryEventView()
 {
-    if (!mQuery.exec(QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable))) {
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+    if (mTemporaryTable.isEmpty()) {
+        return;
+    }
+
+    QString queryText = QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable);
+    if (mReader) {
+        mReader->enqueue(queryText);
         return;
     }
+    execute(queryText);
 }
 
 QList<QVariantMap> SQLiteHistoryEventView::NextPage()
 {
-    QList<QVariantMap> events;
+    if (!mReader || !calledFromDBus()) {
+        QVariantMap bindValues;
+        QString queryText = nextPageQuery(bindValues);
+        return parsePage(execute(queryText, bindValues));
+    }
+
+    // the keyset of a page depends on the previous one, so they are fetched one at a time
+    delayNextPage();
+    if (++mPendingPages == 1) {
+        fetchNextPage();
+    }
+    return QList<QVariantMap>();
+}
+
+bool SQLiteHistoryEventView::IsValid() const
+{
+    return mValid;
+}
+
+/**
+ * @brief Generates the condition selecting the rows that come after the last returned one
+ *
+ * SQLite versions we need to support don't have row values, so the comparison
+ * (k1, k2, k3) > (v1, v2, v3) is expanded into k1 >= v1 AND (k1 > v1 OR (k1 = v1 AND k2 > v2) OR ...).
+ * The redundant first term allows SQLite to use an index on the leading sort field.
+ * @param bindValues the map to append the values to be bound to
+ * @return the condition to be used in the WHERE clause
+ */
+QString SQLiteHistoryEventView::keysetCondition(QVariantMap &bindValues) const
+{
+    QString op = mSort.sortOrder() == Qt::AscendingOrder ? ">" : "<";
+    QStringList alternatives;
+    QStringList equalities;
 
-    // now prepare for selecting from it
-    mQuery.prepare(QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
-                                                                      QString::number(mPageSize), QString::number(mOffset)));
-    if (!mQuery.exec()) {
+    for (int i = 0; i < mKeyFields.count(); ++i) {
+        QString bindId = QString(":keysetValue%1").arg(bindValues.count());
+        bindValues[bindId] = mLastKey[i];
+        alternatives << QString("(%1%2 %3 %4)").arg(equalities.isEmpty() ? QString() : equalities.join(" AND ") + " AND ",
+                                                    mKeyFields[i], op, bindId);
+
+        bindId = QString(":keysetValue%1").arg(bindValues.count());
+        bindValues[bindId] = mLastKey[i];
+        equalities << QString("%1=%2").arg(mKeyFields[i], bindId);
+    }
+
+    QString bindId = QString(":keysetValue%1").arg(bindValues.count());
+    bindValues[bindId] = mLastKey.first();
+    return QString("(%1 %2= %3 AND (%4))").arg(mKeyFields.first(), op, bindId, alternatives.join(" OR "));
+}
+
+SQLiteReadResult SQLiteHistoryEventView::execute(const QString &queryText, const QVariantMap &bindValues)
+{
+    if (mReader) {
+        return mReader->execute(queryText, bindValues);
+    }
+
+    QSqlDatabase database = SQLiteDatabase::instance()->database();
+    return SQLiteReader::exec(database, queryText, bindValues);
+}
+
+QString SQLiteHistoryEventView::nextPageQuery(QVariantMap &bindValues)
+{
+    if (!mKeysetPaging) {
+        QString queryText = QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
+                                                                              QString::number(pageSize()), QString::number(mOffset));
+        mOffset += pageSize();
+        return queryText;
+    }
+
+    bindValues = mFilterValues;
+    QString condition = mCondition;
+    if (!mLastKey.isEmpty()) {
+        QString keyset = keysetCondition(bindValues);
+        condition = condition.isEmpty() ? keyset : QString("(%1) AND %2").arg(condition, keyset);
+    }
+
+    QString queryText = mPlugin->sqlQueryForEvents(mType, condition, mOrder);
+    queryText += QString(" LIMIT %1").arg(QString::number(pageSize()));
+    return queryText;
+}
+
+QList<QVariantMap> SQLiteHistoryEventView::parsePage(const SQLiteReadResult &result)
+{
+    if (!result.success) {
         mValid = false;
         Q_EMIT Invalidated();
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
-        return events;
+        return QList<QVariantMap>();
     }
 
-    events = mPlugin->parseEventResults(mType, mQuery);
-    mOffset += mPageSize;
-    mQuery.clear();
+    QSqlRecord lastRecord;
+    QList<QVariantMap> events = mPlugin->parseEventResults(mType, result.rows, &lastRecord);
+
+    // store the raw values of the last row to use as the starting point of the next page
+    if (mKeysetPaging && !lastRecord.isEmpty()) {
+        mLastKey.clear();
+        Q_FOREACH(const QString &field, mKeyFields) {
+            mLastKey << lastRecord.value(field);
+        }
+    }
 
     return events;
 }
 
-bool SQLiteHistoryEventView::IsValid() const
+void SQLiteHistoryEventView::fetchNextPage()
 {
-    return mQuery.isActive();
+    QVariantMap bindValues;
+    QString queryText = nextPageQuery(bindValues);
+    mPageJob = mReader->enqueue(queryText, bindValues);
+}
+
+void SQLiteHistoryEventView::onReaderFinished(int job, const SQLiteReadResult &result)
+{
+    if (job == mCreateJob && !result.success) {
+        mValid = false;
+        Q_EMIT Invalidated();
+        return;
+    }
+
+    if (job != mPageJob) {
+        return;
+    }
+
+    sendNextPage(parsePage(result));
+    if (--mPendingPages > 0) {
+        fetchNextPage();
+    }
 }
@@ -26,7 +26,9 @@
 #include "filter.h"
 #include "types.h"
 #include "sort.h"
-#include <QSqlQuery>
+#include "sqlitereader.h"
+#include <QPointer>
+#include <QStringList>
 
 class SQLiteHistoryPlugin;
 
@@ -45,18 +47,38 @@ public:
     bool IsValid() const;
 
 protected:
+    QString keysetCondition(QVariantMap &bindValues) const;
+    SQLiteReadResult execute(const QString &queryText, const QVariantMap &bindValues = QVariantMap());
+    QString nextPageQuery(QVariantMap &bindValues);
+    QList<QVariantMap> parsePage(const SQLiteReadResult &result);
+    void fetchNextPage();
 
+private Q_SLOTS:
+    void onReaderFinished(int job, const SQLiteReadResult &result);
 
 private:
     History::EventType mType;
     History::Sort mSort;
     History::Filter mFilter;
-    QSqlQuery mQuery;
-    int mPageSize;
     SQLiteHistoryPlugin *mPlugin;
     QString mTemporaryTable;
     int mOffset;
     bool mValid;
+
+    // keyset paging: instead of materializing the results in a temporary table,
+    // each page is fetched with a condition that starts after the last row returned
+    bool mKeysetPaging;
+    QString mCondition;
+    QString mOrder;
+    QVariantMap mFilterValues;
+    QStringList mKeyFields;
+    QVariantList mLastKey;
+
+    // see SQLiteHistoryThreadView
+    QPointer<SQLiteReader> mReader;
+    int mCreateJob;
+    int mPageJob;
+    int mPendingPages;
 };
 
 #endif // SQLITEHISTORYEVENTVIEW_H
@@ -39,6 +39,10 @@
 
 static const QLatin1String timestampFormat("yyyy-MM-ddTHH:mm:ss.zzz");
 
+// maximum number of threads or events matched by a single batched query.
+// keeps the number of bound values well below SQLITE_MAX_VARIABLE_NUMBER
+static const int maxRowsPerQuery = 100;
+
 QString generateThreadMapKey(const QString &accountId, const QString &threadId)
 {
     return accountId + threadId;
@@ -49,31 +53,253 @@ QString generateThreadMapKey(const History::Thread &thread)
     return generateThreadMapKey(thread.accountId(), thread.threadId());
 }
 
+QString generateEventMapKey(const QVariantMap &event)
+{
+    // the separator keeps ids that are prefixes of one another from producing the same key
+    return QString("%1#-#%2#-#%3").arg(event[History::FieldAccountId].toString(),
+                                       event[History::FieldThreadId].toString(),
+                                       event[History::FieldEventId].toString());
+}
+
+/**
+ * @brief Generates the key indexing the threads that might be grouped together
+ *
+ * Threads whose participants match share the same key, so only the conversations
+ * containing threads with that key need to be compared.
+ * @param thread the thread to generate the key for
+ * @return the key or a null string if some participant has no reliable phone number key
+ */
+QString generateConversationGroupKey(const History::Thread &thread)
+{
+    QStringList matchKeys;
+    Q_FOREACH(const QString &identifier, thread.participants().identifiers()) {
+        QString matchKey = History::PhoneUtils::phoneNumberMatchKey(identifier);
+        if (matchKey.isEmpty()) {
+            return QString::null;
+        }
+        matchKeys << matchKey;
+    }
+    matchKeys.sort();
+    return QString::number(thread.chatType()) + ":" + matchKeys.join(",");
+}
+
+/**
+ * @brief Generates the key indexing the threads without a group key by one of their participants
+ *
+ * Participants without a phone number key only match identical identifiers, so the identifier
+ * itself is used for them.
+ * @param identifier the participant identifier
+ * @return the key
+ */
+QString generateParticipantIndexKey(const QString &identifier)
+{
+    QString matchKey = History::PhoneUtils::phoneNumberMatchKey(identifier);
+    if (matchKey.isEmpty()) {
+        matchKey = identifier;
+    }
+    return "participant:" + matchKey;
+}
+
+void bindTextEventValues(QSqlQuery &query, const QVariantMap &event)
+{
+    query.bindValue(":accountId", event[History::FieldAccountId]);
+    query.bindValue(":threadId", event[History::FieldThreadId]);
+    query.bindValue(":eventId", event[History::FieldEventId]);
+    query.bindValue(":senderId", event[History::FieldSenderId]);
+    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
+    query.bindValue(":newEvent", event[History::FieldNewEvent]);
+    query.bindValue(":message", event[History::FieldMessage]);
+    query.bindValue(":messageType", event[History::FieldMessageType]);
+    query.bindValue(":messageStatus", event[History::FieldMessageStatus]);
+    query.bindValue(":readTimestamp", event[History::FieldReadTimestamp].toDateTime().toUTC());
+    query.bindValue(":subject", event[History::FieldSubject].toString());
+    query.bindValue(":informationType", event[History::FieldInformationType].toInt());
+}
+
+void bindVoiceEventValues(QSqlQuery &query, const QVariantMap &event)
+{
+    query.bindValue(":accountId", event[History::FieldAccountId]);
+    query.bindValue(":threadId", event[History::FieldThreadId]);
+    query.bindValue(":eventId", event[History::FieldEventId]);
+    query.bindValue(":senderId", event[History::FieldSenderId]);
+    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
+    query.bindValue(":newEvent", event[History::FieldNewEvent]);
+    query.bindValue(":duration", event[History::FieldDuration]);
+    query.bindValue(":missed", event[History::FieldMissed]);
+    query.bindValue(":remoteParticipant", event[History::FieldRemoteParticipant]);
+}
+
 SQLiteHistoryPlugin::SQLiteHistoryPlugin(QObject *parent) :
-    QObject(parent), mInitialised(false)
+    QObject(parent), mGroupedThreadsCacheView(0), mBatchDepth(0), mInitialised(false)
 {
     // just trigger the database creation or update
     SQLiteDatabase::instance();
 }
 
+SQLiteHistoryPlugin::~SQLiteHistoryPlugin()
+{
+    // the reader threads are not left running after the plugin is gone
+    SQLiteDatabase::instance()->closeReaders();
+}
+
 bool SQLiteHistoryPlugin::initialised()
 {
     return mInitialised;
 }
 
+/**
+ * @brief Starts building the cache of grouped threads
+ *
+ * When every text thread already has its conversation saved in thread_groups, nothing is rebuilt:
+ * the conversations are loaded from the saved groups the first time they are needed.
+ * Otherwise, as on the first start after an upgrade, the threads are added to the cache one page
+ * at a time from the event loop, so that requests can be served in the meantime. In both cases
+ * grouped queries load the threads they return together with their possible matches, see
+ * cacheThreadWithMatches().
+ */
 void SQLiteHistoryPlugin::updateGroupedThreadsCache()
 {
-    History::PluginThreadView *view = queryThreads(History::EventTypeText, History::Sort("timestamp", Qt::DescendingOrder), History::Filter());
+    loadThreadGroups();
+
+    if (threadGroupsComplete()) {
+        mInitialised = true;
+        qDebug() << "---- HistoryService: loaded" << mThreadGroups.count() << "saved conversation groups";
+        return;
+    }
+
+    delete mGroupedThreadsCacheView;
+    mGroupedThreadsCacheView = queryThreads(History::EventTypeText, History::Sort("timestamp", Qt::DescendingOrder), History::Filter());
+    mGroupedThreadsCacheView->setParent(this);
+    mGroupedThreadsCacheTime.start();
+    QMetaObject::invokeMethod(this, "addNextPageToCache", Qt::QueuedConnection);
+}
+
+void SQLiteHistoryPlugin::addNextPageToCache()
+{
+    if (!mGroupedThreadsCacheView) {
+        return;
+    }
+
+    QList<QVariantMap> page;
+    if (mGroupedThreadsCacheView->IsValid()) {
+        page = mGroupedThreadsCacheView->NextPage();
+    }
+
+    if (page.isEmpty()) {
+        delete mGroupedThreadsCacheView;
+        mGroupedThreadsCacheView = 0;
+        // the grouped views filter on thread_groups from now on, so it needs to be complete
+        saveThreadGroups();
+        mMatchedThreadKeys.clear();
+        mRemovedThreadKeys.clear();
+        mInitialised = true;
+        qDebug() << "---- HistoryService: finished generating grouped threads cache. elapsed time:" << mGroupedThreadsCacheTime.elapsed() << "ms";
+        return;
+    }
+
+    // the page was read from a snapshot: threads that were cached or removed since then
+    // are already up-to-date in the cache
     QList<QVariantMap> threads;
-    while (view->IsValid()) {
-        QList<QVariantMap> page = view->NextPage();
-        if (page.size() > 0) {
-            threads += page;
-        } else {
-            break;
+    Q_FOREACH(const QVariantMap &thread, page) {
+        const QString threadKey = generateThreadMapKey(thread[History::FieldAccountId].toString(),
+                                                       thread[History::FieldThreadId].toString());
+        if (!mConversationsCacheKeys.contains(threadKey) && !mRemovedThreadKeys.contains(threadKey)) {
+            threads << thread;
+        }
+    }
+    // the changes to the persisted groups are saved once per page
+    addThreadsToCache(threads);
+    saveThreadGroups();
+
+    QMetaObject::invokeMethod(this, "addNextPageToCache", Qt::QueuedConnection);
+}
+
+/**
+ * @brief Adds a text thread and all the threads it might be grouped with to the cache
+ *
+ * This makes sure the conversation containing the given thread is complete without loading
+ * the whole cache. Any thread it might be grouped with shares all of its participants, so once a
+ * thread was added this way, the threads matching the ones added with it are in the cache too.
+ * @param accountId the account of the thread
+ * @param threadId the id of the thread
+ */
+void SQLiteHistoryPlugin::cacheThreadWithMatches(const QString &accountId, const QString &threadId)
+{
+    const QString threadKey = generateThreadMapKey(accountId, threadId);
+    // while the cache is being built, the pages add threads without their matches
+    if (mMatchedThreadKeys.contains(threadKey) ||
+            (!mGroupedThreadsCacheView && mConversationsCacheKeys.contains(threadKey))) {
+        return;
+    }
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    query.prepare(sqlQueryForThreadMatches());
+    query.bindValue(":type", (int) History::EventTypeText);
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    query.bindValue(":threadType", (int) History::EventTypeText);
+    query.bindValue(":keylessAccountId", accountId);
+    query.bindValue(":keylessThreadId", threadId);
+    query.bindValue(":keylessType", (int) History::EventTypeText);
+    if (!query.exec()) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return;
+    }
+
+    QList<QPair<QString, QString> > threadIds;
+    threadIds << qMakePair(accountId, threadId);
+    while (query.next()) {
+        QPair<QString, QString> match = qMakePair(query.value(0).toString(), query.value(1).toString());
+        if (!threadIds.contains(match)) {
+            threadIds << match;
+        }
+    }
+    query.clear();
+
+    QList<QVariantMap> threads;
+    for (int i = 0; i < threadIds.count(); ++i) {
+        if (mConversationsCacheKeys.contains(generateThreadMapKey(threadIds[i].first, threadIds[i].second))) {
+            continue;
+        }
+        QVariantMap thread = getSingleThread(History::EventTypeText, threadIds[i].first, threadIds[i].second);
+        if (!thread.isEmpty()) {
+            threads << thread;
         }
     }
     addThreadsToCache(threads);
+    mMatchedThreadKeys.insert(threadKey);
+}
+
+/**
+ * @brief Returns the query listing the text threads that share a participant with a given thread
+ *
+ * Participants with a phone number key are matched by key, the others by their normalized id.
+ */
+QString SQLiteHistoryPlugin::sqlQueryForThreadMatches() const
+{
+    return "SELECT DISTINCT accountId, threadId FROM thread_participants WHERE type=:type AND (matchKey IN "
+           "(SELECT matchKey FROM thread_participants WHERE accountId=:accountId AND threadId=:threadId "
+           " AND type=:threadType AND matchKey!='') OR normalizedId IN "
+           "(SELECT normalizedId FROM thread_participants WHERE accountId=:keylessAccountId AND threadId=:keylessThreadId "
+           " AND type=:keylessType AND IFNULL(matchKey, '')=''))";
+}
+
+/**
+ * @brief Updates the cache after threads were written and saves the conversations that changed
+ *
+ * The conversations of the threads are loaded first, so that the threads are grouped with
+ * the right ones even when they were not cached yet.
+ * @param threads the threads as stored in the database
+ */
+void SQLiteHistoryPlugin::updateCachedThreads(const QList<QVariantMap> &threads)
+{
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        if (thread[History::FieldType].toInt() == History::EventTypeText) {
+            cacheThreadWithMatches(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString());
+        }
+    }
+    addThreadsToCache(threads);
+    saveThreadGroups();
 }
 
 void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
@@ -99,6 +325,7 @@ void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
             // never group non phone accounts
             mConversationsCache[threadKey] = History::Threads() << thread;
             mConversationsCacheKeys[threadKey] = threadKey;
+            mChangedThreadGroups.insert(threadKey);
             continue;
         }
         // find conversation grouping this thread
@@ -115,17 +342,42 @@ void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
             updateDisplayedThread(conversationKey);
             continue;
         }
-        // if not found, we have to iterate the list and compare phone numbers
+        // if not found, look for a conversation with matching participants. Threads that match
+        // share the same group key, so only the conversations indexed under it need to be compared.
+        // The threads with participants too short to have a key are indexed by participant instead,
+        // and only the ones sharing the first participant are compared
+        QStringList conversationKeys;
+        const QString groupKey = generateConversationGroupKey(thread);
+        const QStringList participants = thread.participants().identifiers();
+        // if the thread was persisted as part of a conversation that is already cached, that one
+        // is compared first. The participants are still compared, as they might have changed
+        const QString persistedKey = mThreadGroups.value(threadKey);
+        if (!persistedKey.isEmpty() && persistedKey != threadKey && mConversationsCacheKeys.contains(persistedKey)) {
+            conversationKeys << mConversationsCacheKeys[persistedKey];
+        }
+        if (!participants.isEmpty()) {
+            conversationKeys += indexedConversations(generateParticipantIndexKey(participants.first()));
+        }
+        if (!groupKey.isNull()) {
+            conversationKeys += indexedConversations(groupKey);
+        }
+        conversationKeys.removeDuplicates();
+        if (groupKey.isNull()) {
+            Q_FOREACH(const QString &participant, participants) {
+                mConversationsCacheIndex[generateParticipantIndexKey(participant)] << threadKey;
+            }
+        } else {
+            mConversationsCacheIndex[groupKey] << threadKey;
+        }
+
         bool found = false;
-        QMap<QString, History::Threads>::iterator it = mConversationsCache.begin();
-        while (it != mConversationsCache.end()) {
-            const QString &conversationKey = it.key();
-            History::Threads groupedThreads = it.value();
+        Q_FOREACH(const QString &conversationKey, conversationKeys) {
+            History::Threads groupedThreads = mConversationsCache[conversationKey];
             Q_FOREACH(const History::Thread &groupedThread, groupedThreads) {
                 if (!History::Utils::shouldGroupThread(groupedThread) || thread.chatType() != groupedThread.chatType()) {
                     continue;
                 }
-                found = History::Utils::compareNormalizedParticipants(thread.participants().identifiers(), groupedThread.participants().identifiers(), History::MatchPhoneNumber);
+                found = History::Utils::compareNormalizedParticipants(participants, groupedThread.participants().identifiers(), History::MatchPhoneNumber);
                 if (found) {
                     Q_FOREACH(const History::Thread &groupedThread, groupedThreads) {
                         mConversationsCacheKeys.remove(generateThreadMapKey(groupedThread));
@@ -138,13 +390,41 @@ void SQLiteHistoryPlugin::addThreadsToCache(const QList<QVariantMap> &threads)
             if (found) {
                 break;
             }
-            it++;
         }
         if (!found) {
             mConversationsCache[threadKey] = History::Threads() << thread;
             mConversationsCacheKeys[threadKey] = threadKey;
+            mChangedThreadGroups.insert(threadKey);
+        }
+    }
+}
+
+/**
+ * @brief Returns the conversations containing threads indexed under the given group key
+ *
+ * Threads removed from the cache are only dropped from the index here.
+ * @param groupKey the key generated by generateConversationGroupKey() or generateParticipantIndexKey()
+ * @return the keys of the conversations
+ */
+QStringList SQLiteHistoryPlugin::indexedConversations(const QString &groupKey)
+{
+    QStringList conversationKeys;
+    QHash<QString, QStringList>::iterator indexIt = mConversationsCacheIndex.find(groupKey);
+    if (indexIt == mConversationsCacheIndex.end()) {
+        return conversationKeys;
+    }
+
+    QStringList::iterator it = indexIt.value().begin();
+    while (it != indexIt.value().end()) {
+        const QString conversationKey = mConversationsCacheKeys.value(*it);
+        if (conversationKey.isEmpty()) {
+            it = indexIt.value().erase(it);
+            continue;
         }
+        conversationKeys << conversationKey;
+        ++it;
     }
+    return conversationKeys;
 }
 
 bool SQLiteHistoryPlugin::lessThan(const QVariantMap &left, const QVariantMap &right) const
@@ -175,12 +455,153 @@ void SQLiteHistoryPlugin::updateDisplayedThread(const QString &displayedThreadKe
     Q_FOREACH(const History::Thread &groupedThread, threads) {
         mConversationsCacheKeys[generateThreadMapKey(groupedThread)] = newDisplayedThreadKey;
     }
+
+    mChangedThreadGroups.insert(newDisplayedThreadKey);
+}
+
+/**
+ * @brief Loads the conversation groups saved to the database
+ */
+void SQLiteHistoryPlugin::loadThreadGroups()
+{
+    mThreadGroups.clear();
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    query.prepare("SELECT accountId, threadId, groupAccountId, groupThreadId FROM thread_groups WHERE type=:type");
+    query.bindValue(":type", (int) History::EventTypeText);
+    if (!query.exec()) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return;
+    }
+
+    while (query.next()) {
+        mThreadGroups[generateThreadMapKey(query.value(0).toString(), query.value(1).toString())] =
+                generateThreadMapKey(query.value(2).toString(), query.value(3).toString());
+    }
+}
+
+/**
+ * @brief Returns whether every text thread has its conversation saved in thread_groups
+ */
+bool SQLiteHistoryPlugin::threadGroupsComplete()
+{
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    query.prepare("SELECT 1 FROM threads WHERE type=:type AND NOT EXISTS (SELECT 1 FROM thread_groups "
+                  "WHERE thread_groups.accountId=threads.accountId AND thread_groups.threadId=threads.threadId "
+                  "AND thread_groups.type=threads.type) LIMIT 1");
+    query.bindValue(":type", (int) History::EventTypeText);
+    if (!query.exec()) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return false;
+    }
+    return !query.next();
+}
+
+/**
+ * @brief Saves the conversations that changed in the cache since they were last saved
+ *
+ * The cache is also updated when reading, but the groups are only written from the write paths.
+ */
+void SQLiteHistoryPlugin::saveThreadGroups()
+{
+    // the conversations might have been regrouped since the threads were flagged
+    QSet<QString> conversationKeys;
+    Q_FOREACH(const QString &threadKey, mChangedThreadGroups) {
+        const QString conversationKey = mConversationsCacheKeys.value(threadKey);
+        if (!conversationKey.isEmpty()) {
+            conversationKeys.insert(conversationKey);
+        }
+    }
+    mChangedThreadGroups.clear();
+    if (conversationKeys.isEmpty()) {
+        return;
+    }
+
+    bool transaction = SQLiteDatabase::instance()->beginTransation();
+    Q_FOREACH(const QString &conversationKey, conversationKeys) {
+        saveThreadGroup(conversationKey);
+    }
+    if (transaction) {
+        SQLiteDatabase::instance()->finishTransaction();
+    }
+}
+
+/**
+ * @brief Saves to the database which conversation the cached threads belong to
+ *
+ * Only the threads whose conversation changed since the last time it was saved are written.
+ * @param conversationKey the key of the thread displayed for the conversation
+ */
+void SQLiteHistoryPlugin::saveThreadGroup(const QString &conversationKey)
+{
+    History::Threads threads = mConversationsCache.value(conversationKey);
+    History::Thread displayedThread;
+    Q_FOREACH(const History::Thread &thread, threads) {
+        if (generateThreadMapKey(thread) == conversationKey) {
+            displayedThread = thread;
+            break;
+        }
+    }
+    if (displayedThread.isNull()) {
+        return;
+    }
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    Q_FOREACH(const History::Thread &thread, threads) {
+        const QString threadKey = generateThreadMapKey(thread);
+        if (mThreadGroups.value(threadKey) == conversationKey) {
+            continue;
+        }
+        query.prepare("INSERT OR REPLACE INTO thread_groups (accountId, threadId, type, groupAccountId, groupThreadId) "
+                      "VALUES (:accountId, :threadId, :type, :groupAccountId, :groupThreadId)");
+        query.bindValue(":accountId", thread.accountId());
+        query.bindValue(":threadId", thread.threadId());
+        query.bindValue(":type", (int) thread.type());
+        query.bindValue(":groupAccountId", displayedThread.accountId());
+        query.bindValue(":groupThreadId", displayedThread.threadId());
+        if (!query.exec()) {
+            qCritical() << "Error:" << query.lastError() << query.lastQuery();
+            return;
+        }
+        mThreadGroups[threadKey] = conversationKey;
+    }
+}
+
+/**
+ * @brief Returns the condition listing only the thread displayed for each conversation
+ *
+ * The condition relies on the persisted conversation groups, so it is only used once every
+ * text thread has its conversation saved.
+ * @param type the type of the threads being queried
+ * @param properties the properties of the thread view
+ * @return the SQL condition or a null string if the threads are not grouped
+ */
+QString SQLiteHistoryPlugin::groupedThreadsCondition(History::EventType type, const QVariantMap &properties) const
+{
+    if (!mInitialised || type != History::EventTypeText ||
+            properties[History::FieldGroupingProperty].toString() != History::FieldParticipants) {
+        return QString::null;
+    }
+
+    // spaces around the operators keep sqlQueryForThreads() from prefixing the columns
+    return "EXISTS (SELECT 1 FROM thread_groups WHERE thread_groups.accountId = threads.accountId "
+           "AND thread_groups.threadId = threads.threadId AND thread_groups.type = threads.type "
+           "AND thread_groups.groupAccountId = threads.accountId AND thread_groups.groupThreadId = threads.threadId)";
 }
 
 void SQLiteHistoryPlugin::removeThreadFromCache(const QVariantMap &properties)
 {
     History::Thread thread = History::Thread::fromProperties(properties);
     QString threadKey = generateThreadMapKey(thread);
+
+    // the thread_groups entry is removed together with the thread
+    mThreadGroups.remove(threadKey);
+
+    // make sure the cache being built does not bring the thread back
+    mMatchedThreadKeys.remove(threadKey);
+    if (mGroupedThreadsCacheView) {
+        mRemovedThreadKeys.insert(threadKey);
+    }
  
     if (thread.type() != History::EventTypeText || !History::Utils::shouldGroupThread(thread)) {
         mConversationsCache.remove(threadKey);
@@ -205,29 +626,13 @@ void SQLiteHistoryPlugin::removeThreadFromCache(const QVariantMap &properties)
             mConversationsCache[threadKey] = threads;
             updateDisplayedThread(threadKey);
         }
-    } else {
-        // check if it belongs to an existing grouped thread;
-        QMap<QString, History::Threads>::iterator it = mConversationsCache.begin();
-        while (it != mConversationsCache.end()) {
-            const QString &threadKey = it.key();
-            History::Threads threads = it.value();
-            int pos = threads.indexOf(thread);
-            if (pos != -1) {
-                const QString &threadKey = generateThreadMapKey(thread);
-                mConversationsCache.remove(threadKey);
-                mConversationsCacheKeys.remove(threadKey);
-                if (threads.size() == 1) {
-                   return;
-                } else {
-                    threads.removeAll(thread);
-                    const QString &newThreadKey = generateThreadMapKey(threads.first());
-                    mConversationsCache[newThreadKey] = threads;
-                    updateDisplayedThread(newThreadKey);
-                    return;
-                }
-            }
-            it++;
-        }
+    } else if (mConversationsCacheKeys.contains(threadKey)) {
+        // or remove it from the conversation it is grouped in
+        const QString conversationKey = mConversationsCacheKeys.take(threadKey);
+        History::Threads threads = mConversationsCache[conversationKey];
+        threads.removeAll(thread);
+        mConversationsCache[conversationKey] = threads;
+        updateDisplayedThread(conversationKey);
     }
 }
 
@@ -283,11 +688,10 @@ void SQLiteHistoryPlugin::generateContactCache()
         History::ContactMatcher::instance()->contactInfo(accountId, participantId, true, properties);
     }
 
-    updateGroupedThreadsCache();
-
     qDebug() << "---- HistoryService: finished generating contact cache. elapsed time:" << time.elapsed() << "ms";
 
-    mInitialised = true;
+    // the plugin is only flagged as initialised once every thread has its conversation saved
+    updateGroupedThreadsCache();
 }
 
 // Reader
@@ -316,7 +720,7 @@ QVariantMap SQLiteHistoryPlugin::markThreadAsRead(const QVariantMap &thread)
     }
 
     // first check if the thread actually has anything to change
-    query.prepare("SELECT unreadCount from threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    query.prepare(sqlQueryForUnreadCount());
     query.bindValue(":accountId", thread[History::FieldAccountId].toString());
     query.bindValue(":threadId", thread[History::FieldThreadId].toString());
     query.bindValue(":type", (uint)History::EventTypeText);
@@ -332,7 +736,7 @@ QVariantMap SQLiteHistoryPlugin::markThreadAsRead(const QVariantMap &thread)
         return QVariantMap();
     }
 
-    query.prepare("UPDATE text_events SET newEvent=:newEvent WHERE accountId=:accountId AND threadId=:threadId AND newEvent=1");
+    query.prepare(sqlQueryForMarkThreadAsRead());
     query.bindValue(":accountId", thread[History::FieldAccountId].toString());
     query.bindValue(":threadId", thread[History::FieldThreadId].toString());
     query.bindValue(":newEvent", false);
@@ -347,7 +751,7 @@ QVariantMap SQLiteHistoryPlugin::markThreadAsRead(const QVariantMap &thread)
                                                  thread[History::FieldThreadId].toString(),
                                                  QVariantMap());
     if (!existingThread.isEmpty()) {
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
+        updateCachedThreads(QList<QVariantMap>() << existingThread);
         return existingThread;
     }
 
@@ -399,37 +803,38 @@ QString SQLiteHistoryPlugin::threadIdForProperties(const QString &accountId, His
 QList<QVariantMap> SQLiteHistoryPlugin::participantsForThreads(const QList<QVariantMap> &threadIds)
 {
     QList<QVariantMap> results;
-    Q_FOREACH(const QVariantMap &thread, threadIds) {
-        QString accountId = thread[History::FieldAccountId].toString();
-        QString threadId = thread[History::FieldThreadId].toString();
-        History::EventType type = (History::EventType)thread[History::FieldType].toUInt();
-        QVariantMap result = thread;
-
-        QSqlQuery query;
-        query.prepare("SELECT normalizedId, alias, state, roles FROM thread_participants "
-                      "WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
-        query.bindValue(":accountId", accountId);
-        query.bindValue(":threadId", threadId);
-        query.bindValue(":type", type);
-        QVariantList participants;
-        if (!query.exec()) {
-            qWarning() << "Failed to retrieve participants. Error:" << query.lastError().text() << query.lastQuery();
-            results << result;
+
+    // fetch the participants for a batch of threads at once and then distribute them
+    for (int start = 0; start < threadIds.count(); start += maxRowsPerQuery) {
+        QList<QVariantMap> batch = threadIds.mid(start, maxRowsPerQuery);
+        QVariantMap bindValues;
+        SQLiteReadResult result = readRows(sqlQueryForParticipants(batch, bindValues), bindValues);
+        if (!result.success) {
+            qWarning() << "Failed to retrieve participants.";
+            results << batch;
             continue;
         }
 
-        while (query.next()) {
+        QMap<QString, QVariantList> participants;
+        Q_FOREACH(const QSqlRecord &record, result.rows) {
+            QString accountId = record.value(0).toString();
+            QString threadKey = generateThreadMapKey(accountId, record.value(1).toString()) + QString::number(record.value(2).toUInt());
             QVariantMap participant;
-            QString identifier = query.value(0).toString();
+            QString identifier = record.value(3).toString();
             participant[History::FieldIdentifier] = identifier;
-            participant[History::FieldAlias] = query.value(1);
-            participant[History::FieldParticipantState] = query.value(2);
-            participant[History::FieldParticipantRoles] = query.value(3);
-            participants << History::ContactMatcher::instance()->contactInfo(accountId, identifier, true, participant);
+            participant[History::FieldAlias] = record.value(4);
+            participant[History::FieldParticipantState] = record.value(5);
+            participant[History::FieldParticipantRoles] = record.value(6);
+            participants[threadKey] << History::ContactMatcher::instance()->contactInfo(accountId, identifier, true, participant);
         }
 
-        result[History::FieldParticipants] = participants;
-        results << result;
+        Q_FOREACH(const QVariantMap &thread, batch) {
+            QVariantMap result = thread;
+            QString threadKey = generateThreadMapKey(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString())
+                              + QString::number(thread[History::FieldType].toUInt());
+            result[History::FieldParticipants] = participants.value(threadKey);
+            results << result;
+        }
     }
     return results;
 }
@@ -446,25 +851,21 @@ QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
     bool phoneCompare = (matchFlags & History::MatchPhoneNumber);
     QSqlQuery query(SQLiteDatabase::instance()->database());
 
-    // select all the threads the first participant is listed in, and from that list
-    // check if any of the threads has all the other participants listed
-    // FIXME: find a better way to do this
-    QString queryString("SELECT threadId FROM thread_participants WHERE %1 AND type=:type AND accountId=:accountId "
-                        "AND (SELECT chatType FROM threads WHERE threads.threadId=thread_participants.threadId AND "
-                        "      threads.type=thread_participants.type)!=:chatType");
-
-    // FIXME: for now we just compare differently when using MatchPhoneNumber
-    QString firstParticipant = participants.first();
+    QStringList normalizedParticipants;
     if (phoneCompare) {
-        queryString = queryString.arg("compareNormalizedPhoneNumbers(normalizedId, :participantId)");
-        firstParticipant = History::PhoneUtils::normalizePhoneNumber(firstParticipant);
+        Q_FOREACH(const QString &participant, participants) {
+            normalizedParticipants << History::PhoneUtils::normalizePhoneNumber(participant);
+        }
     } else {
-        queryString = queryString.arg("participantId=:participantId");
+        normalizedParticipants = participants;
     }
-    query.prepare(queryString);
-    query.bindValue(":participantId", firstParticipant);
-    query.bindValue(":type", type);
+
+    // find the threads by the hash of their participants. This is an indexed lookup, and as matching
+    // phone numbers get the same hash, there is no thread to find when it returns nothing
+    query.prepare(sqlQueryForThreadsWithHash());
     query.bindValue(":accountId", accountId);
+    query.bindValue(":type", type);
+    query.bindValue(":participantsHash", SQLiteDatabase::participantsHash(normalizedParticipants));
     // we don't want to accidentally return a chat room for a multi-recipient conversation
     query.bindValue(":chatType", (int)History::ChatTypeRoom);
 
@@ -477,28 +878,46 @@ QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
     while (query.next()) {
         threadIds << query.value(0).toString();
     }
+    query.clear();
 
-    QString existingThread;
-    QStringList normalizedParticipants;
-    if (phoneCompare) {
-        Q_FOREACH(const QString &participant, participants) {
-            normalizedParticipants << History::PhoneUtils::normalizePhoneNumber(participant);
-        }
-    } else {
-        normalizedParticipants = participants;
+    if (threadIds.isEmpty()) {
+        return QVariantMap();
     }
 
-    // now for each threadId, check if all the other participants are listed
+    QString existingThread = findThreadWithParticipants(accountId, type, threadIds, normalizedParticipants, matchFlags);
+    if (existingThread.isEmpty()) {
+        return QVariantMap();
+    }
+    return getSingleThread(type, accountId, existingThread);
+}
+
+/**
+ * @brief Checks which of the given threads has exactly the given participants
+ * @param accountId the account the threads belong to
+ * @param type the type of the threads
+ * @param threadIds the candidate threads
+ * @param normalizedParticipants the participants to look for. If phone matching is used, they must be normalized
+ * @param matchFlags the flags used to compare the participants
+ * @return the id of the first matching thread or a null string if none matches
+ */
+QString SQLiteHistoryPlugin::findThreadWithParticipants(const QString &accountId,
+                                                        History::EventType type,
+                                                        const QStringList &threadIds,
+                                                        const QStringList &normalizedParticipants,
+                                                        History::MatchFlags matchFlags)
+{
+    bool phoneCompare = (matchFlags & History::MatchPhoneNumber);
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+
+    // for each threadId, check if all the other participants are listed
     Q_FOREACH(const QString &threadId, threadIds) {
-        queryString = "SELECT %1 FROM thread_participants WHERE "
-                      "threadId=:threadId AND type=:type AND accountId=:accountId";
-        query.prepare(queryString.arg(phoneCompare ? "normalizedId" : "participantId"));
+        query.prepare(sqlQueryForThreadParticipantIds(phoneCompare));
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
         query.bindValue(":accountId", accountId);
         if (!query.exec()) {
             qCritical() << "Error:" << query.lastError() << query.lastQuery();
-            return QVariantMap();
+            return QString::null;
         }
 
         QStringList threadParticipants;
@@ -511,14 +930,12 @@ QVariantMap SQLiteHistoryPlugin::threadForParticipants(const QString &accountId,
             continue;
         }
 
-        bool found = History::Utils::compareNormalizedParticipants(threadParticipants, normalizedParticipants, matchFlags);
-        if (found) {
-            existingThread = threadId;
-            break;
+        if (History::Utils::compareNormalizedParticipants(threadParticipants, normalizedParticipants, matchFlags)) {
+            return threadId;
         }
     }
 
-    return getSingleThread(type, accountId, existingThread);
+    return QString::null;
 }
 
 QList<QVariantMap> SQLiteHistoryPlugin::eventsForThread(const QVariantMap &thread)
@@ -552,6 +969,9 @@ QVariantMap SQLiteHistoryPlugin::getSingleThread(History::EventType type, const
     }
     if (grouped) {
         const QString &threadKey = generateThreadMapKey(accountId, threadId);
+        if (type == History::EventTypeText) {
+            cacheThreadWithMatches(accountId, threadId);
+        }
         // we have to find which conversation this thread belongs to
         if (mConversationsCacheKeys.contains(threadKey)) {
             // found the thread.
@@ -571,9 +991,7 @@ QVariantMap SQLiteHistoryPlugin::getSingleThread(History::EventType type, const
         return result;
     }
 
-    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\"").arg(accountId, threadId);
-    QString queryText = sqlQueryForThreads(type, condition, QString::null);
-    queryText += " LIMIT 1";
+    QString queryText = sqlQueryForSingleThread(type, accountId, threadId);
 
     QSqlQuery query(SQLiteDatabase::instance()->database());
     if (!query.exec(queryText)) {
@@ -594,9 +1012,7 @@ QVariantMap SQLiteHistoryPlugin::getSingleEvent(History::EventType type, const Q
 {
     QVariantMap result;
 
-    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\" AND eventId=\"%3\"").arg(accountId, threadId, eventId);
-    QString queryText = sqlQueryForEvents(type, condition, QString::null);
-    queryText += " LIMIT 1";
+    QString queryText = sqlQueryForSingleEvent(type, accountId, threadId, eventId);
 
     QSqlQuery query(SQLiteDatabase::instance()->database());
     if (!query.exec(queryText)) {
@@ -633,18 +1049,23 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
     }
 
     // and insert the participants
+    QStringList normalizedIds;
     Q_FOREACH(const QVariant &participantVariant, participants) {
         QVariantMap participant = participantVariant.toMap();
-        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
-                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
+        // normalized the same way as when the thread was created, so that the hash still finds it
+        QString normalizedId = History::Utils::normalizeId(accountId, participant["identifier"].toString());
+        normalizedIds << normalizedId;
+        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles, matchKey)"
+                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles, :matchKey)");
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
         query.bindValue(":participantId", participant["identifier"].toString());
-        query.bindValue(":normalizedId", participant["identifier"].toString());
+        query.bindValue(":normalizedId", normalizedId);
         query.bindValue(":alias", participant["alias"].toString());
         query.bindValue(":state", participant["state"].toUInt());
         query.bindValue(":roles", participant["roles"].toUInt());
+        query.bindValue(":matchKey", History::PhoneUtils::phoneNumberMatchKey(normalizedId));
         if (!query.exec()) {
             qCritical() << "Error:" << query.lastError() << query.lastQuery();
             SQLiteDatabase::instance()->rollbackTransaction();
@@ -652,6 +1073,17 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
         }
     }
 
+    query.prepare("UPDATE threads SET participantsHash=:participantsHash WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    query.bindValue(":participantsHash", SQLiteDatabase::participantsHash(normalizedIds));
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    query.bindValue(":type", type);
+    if (!query.exec()) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        SQLiteDatabase::instance()->rollbackTransaction();
+        return false;
+    }
+
     if (!SQLiteDatabase::instance()->finishTransaction()) {
         qCritical() << "Failed to commit the transaction.";
         return false;
@@ -663,7 +1095,10 @@ bool SQLiteHistoryPlugin::updateRoomParticipants(const QString &accountId, const
                                                  QVariantMap());
 
     if (!existingThread.isEmpty()) {
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
+        // the participants decide the conversation, so the thread is grouped again from scratch
+        // instead of being updated in the conversation it belonged to
+        removeThreadFromCache(existingThread);
+        updateCachedThreads(QList<QVariantMap>() << existingThread);
     }
 
     return true;
@@ -702,7 +1137,7 @@ bool SQLiteHistoryPlugin::updateRoomParticipantsRoles(const QString &accountId,
                                                  QVariantMap());
 
     if (!existingThread.isEmpty()) {
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
+        updateCachedThreads(QList<QVariantMap>() << existingThread);
     }
 
     return true;
@@ -799,7 +1234,7 @@ bool SQLiteHistoryPlugin::updateRoomInfo(const QString &accountId, const QString
                                                  QVariantMap());
 
     if (!existingThread.isEmpty()) {
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
+        updateCachedThreads(QList<QVariantMap>() << existingThread);
     }
 
     return true;
@@ -879,9 +1314,14 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
         threadId = QString("broadcast:%1").arg(QString(QCryptographicHash::hash(participants.identifiers().join(";").toLocal8Bit(),QCryptographicHash::Md5).toHex()));;
     }
 
+    QStringList normalizedIds;
+    Q_FOREACH(const History::Participant &participant, participants) {
+        normalizedIds << History::Utils::normalizeId(accountId, participant.identifier());
+    }
+
     QSqlQuery query(SQLiteDatabase::instance()->database());
-    query.prepare("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, lastEventTimestamp)"
-                  "VALUES (:accountId, :threadId, :type, :count, :unreadCount, :chatType, :lastEventTimestamp)");
+    query.prepare("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, lastEventTimestamp, participantsHash)"
+                  "VALUES (:accountId, :threadId, :type, :count, :unreadCount, :chatType, :lastEventTimestamp, :participantsHash)");
     query.bindValue(":accountId", accountId);
     query.bindValue(":threadId", threadId);
     query.bindValue(":type", (int) type);
@@ -890,6 +1330,7 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
     query.bindValue(":chatType", (int) chatType);
     // make sure threads are created with an up-to-date timestamp
     query.bindValue(":lastEventTimestamp", QDateTime::currentDateTimeUtc().toString(timestampFormat));
+    query.bindValue(":participantsHash", SQLiteDatabase::participantsHash(normalizedIds));
     if (!query.exec()) {
         qCritical() << "Error:" << query.lastError() << query.lastQuery();
         SQLiteDatabase::instance()->rollbackTransaction();
@@ -897,17 +1338,19 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
     }
 
     // and insert the participants
-    Q_FOREACH(const History::Participant &participant, participants) {
-        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles)"
-                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles)");
+    for (int i = 0; i < participants.count(); ++i) {
+        const History::Participant &participant = participants[i];
+        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, alias, state, roles, matchKey)"
+                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :alias, :state, :roles, :matchKey)");
         query.bindValue(":accountId", accountId);
         query.bindValue(":threadId", threadId);
         query.bindValue(":type", type);
         query.bindValue(":participantId", participant.identifier());
-        query.bindValue(":normalizedId", History::Utils::normalizeId(accountId, participant.identifier()));
+        query.bindValue(":normalizedId", normalizedIds[i]);
         query.bindValue(":alias", participant.alias());
         query.bindValue(":state", participant.state());
         query.bindValue(":roles", participant.roles());
+        query.bindValue(":matchKey", History::PhoneUtils::phoneNumberMatchKey(normalizedIds[i]));
         if (!query.exec()) {
             qCritical() << "Error:" << query.lastError() << query.lastQuery();
             SQLiteDatabase::instance()->rollbackTransaction();
@@ -938,7 +1381,7 @@ QVariantMap SQLiteHistoryPlugin::createThreadForProperties(const QString &accoun
     thread[History::FieldUnreadCount] = 0;
     thread[History::FieldChatType] = (int)chatType;
 
-    addThreadsToCache(QList<QVariantMap>() << thread);
+    updateCachedThreads(QList<QVariantMap>() << thread);
 
     return thread;
 }
@@ -954,9 +1397,14 @@ QVariantMap SQLiteHistoryPlugin::createThreadForParticipants(const QString &acco
 
 bool SQLiteHistoryPlugin::removeThread(const QVariantMap &thread)
 {
+    // the other threads of the conversation need to be cached to be saved under their new displayed thread
+    if (thread[History::FieldType].toInt() == History::EventTypeText) {
+        cacheThreadWithMatches(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString());
+    }
+
     QSqlQuery query(SQLiteDatabase::instance()->database());
 
-    query.prepare("DELETE FROM threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    query.prepare(sqlQueryForRemoveThread());
     query.bindValue(":accountId", thread[History::FieldAccountId]);
     query.bindValue(":threadId", thread[History::FieldThreadId]);
     query.bindValue(":type", thread[History::FieldType]);
@@ -967,49 +1415,34 @@ bool SQLiteHistoryPlugin::removeThread(const QVariantMap &thread)
     }
 
     removeThreadFromCache(thread);
+    saveThreadGroups();
 
     return true;
 }
 
 History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    // check if the event exists
-    QVariantMap existingEvent = getSingleEvent((History::EventType) event[History::FieldType].toInt(),
-                                               event[History::FieldAccountId].toString(),
-                                               event[History::FieldThreadId].toString(),
-                                               event[History::FieldEventId].toString());
+    History::EventType type = (History::EventType) event[History::FieldType].toInt();
+    QString accountId = event[History::FieldAccountId].toString();
+    QString threadId = event[History::FieldThreadId].toString();
 
     SQLiteDatabase::instance()->beginTransation();
 
-    History::EventWriteResult result;
-    if (existingEvent.isEmpty()) {
-        // create new
-        query.prepare("INSERT INTO text_events (accountId, threadId, eventId, senderId, timestamp, newEvent, message, messageType, messageStatus, readTimestamp, subject, informationType)"
-                      "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :message, :messageType, :messageStatus, :readTimestamp, :subject, :informationType)");
+    // update the event in case it exists already, and only insert it if there was nothing to update.
+    // this saves reading the event back just to find out which of the two is needed.
+    History::EventWriteResult result = History::EventWriteModified;
+    QSqlQuery query = SQLiteDatabase::instance()->preparedQuery("UPDATE text_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, message=:message, messageType=:messageType, "
+                                                                "messageStatus=:messageStatus, readTimestamp=:readTimestamp, subject=:subject, informationType=:informationType WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    bindTextEventValues(query, event);
+    if (query.exec() && query.numRowsAffected() == 0) {
+        query = SQLiteDatabase::instance()->preparedQuery("INSERT INTO text_events (accountId, threadId, eventId, senderId, timestamp, newEvent, message, messageType, messageStatus, readTimestamp, subject, informationType)"
+                                                          "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :message, :messageType, :messageStatus, :readTimestamp, :subject, :informationType)");
+        bindTextEventValues(query, event);
+        query.exec();
         result = History::EventWriteCreated;
-    } else {
-        // update existing event
-        query.prepare("UPDATE text_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, message=:message, messageType=:messageType, informationType=:informationType, "
-                      "messageStatus=:messageStatus, readTimestamp=:readTimestamp, subject=:subject, informationType=:informationType WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
-        result = History::EventWriteModified;
     }
 
-    query.bindValue(":accountId", event[History::FieldAccountId]);
-    query.bindValue(":threadId", event[History::FieldThreadId]);
-    query.bindValue(":eventId", event[History::FieldEventId]);
-    query.bindValue(":senderId", event[History::FieldSenderId]);
-    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
-    query.bindValue(":newEvent", event[History::FieldNewEvent]);
-    query.bindValue(":message", event[History::FieldMessage]);
-    query.bindValue(":messageType", event[History::FieldMessageType]);
-    query.bindValue(":messageStatus", event[History::FieldMessageStatus]);
-    query.bindValue(":readTimestamp", event[History::FieldReadTimestamp].toDateTime().toUTC());
-    query.bindValue(":subject", event[History::FieldSubject].toString());
-    query.bindValue(":informationType", event[History::FieldInformationType].toInt());
-
-    if (!query.exec()) {
+    if (query.lastError().isValid()) {
         qCritical() << "Failed to save the text event: Error:" << query.lastError() << query.lastQuery();
         SQLiteDatabase::instance()->rollbackTransaction();
         return History::EventWriteError;
@@ -1020,8 +1453,8 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
     if (messageType == History::MessageTypeMultiPart) {
         // if the writing is an update, we need to remove the previous attachments
         if (result == History::EventWriteModified) {
-            query.prepare("DELETE FROM text_event_attachments WHERE accountId=:accountId AND threadId=:threadId "
-                          "AND eventId=:eventId");
+            query = SQLiteDatabase::instance()->preparedQuery("DELETE FROM text_event_attachments WHERE accountId=:accountId AND threadId=:threadId "
+                                                              "AND eventId=:eventId");
             query.bindValue(":accountId", event[History::FieldAccountId]);
             query.bindValue(":threadId", event[History::FieldThreadId]);
             query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1033,8 +1466,8 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
         }
         // save the attachments
         QList<QVariantMap> attachments = qdbus_cast<QList<QVariantMap> >(event[History::FieldAttachments]);
+        query = SQLiteDatabase::instance()->preparedQuery("INSERT INTO text_event_attachments VALUES (:accountId, :threadId, :eventId, :attachmentId, :contentType, :filePath, :status)");
         Q_FOREACH(const QVariantMap &attachment, attachments) {
-            query.prepare("INSERT INTO text_event_attachments VALUES (:accountId, :threadId, :eventId, :attachmentId, :contentType, :filePath, :status)");
             query.bindValue(":accountId", attachment[History::FieldAccountId]);
             query.bindValue(":threadId", attachment[History::FieldThreadId]);
             query.bindValue(":eventId", attachment[History::FieldEventId]);
@@ -1056,12 +1489,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
     }
 
     if (result == History::EventWriteModified || result == History::EventWriteCreated) {
-        QVariantMap existingThread = getSingleThread((History::EventType) event[History::FieldType].toInt(),
-                                                     event[History::FieldAccountId].toString(),
-                                                     event[History::FieldThreadId].toString(),
-                                                     QVariantMap());
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
-
+        threadChanged(type, accountId, threadId);
     }
 
     return result;
@@ -1069,9 +1497,7 @@ History::EventWriteResult SQLiteHistoryPlugin::writeTextEvent(const QVariantMap
 
 bool SQLiteHistoryPlugin::removeTextEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    query.prepare("DELETE FROM text_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    QSqlQuery query = SQLiteDatabase::instance()->preparedQuery(sqlQueryForRemoveEvent(History::EventTypeText));
     query.bindValue(":accountId", event[History::FieldAccountId]);
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1081,53 +1507,30 @@ bool SQLiteHistoryPlugin::removeTextEvent(const QVariantMap &event)
         return false;
     }
 
-    QVariantMap existingThread = getSingleThread((History::EventType) event[History::FieldType].toInt(),
-                                                 event[History::FieldAccountId].toString(),
-                                                 event[History::FieldThreadId].toString(),
-                                                 QVariantMap());
-    if (!existingThread.isEmpty()) {
-        addThreadsToCache(QList<QVariantMap>() << existingThread);
-    }
+    threadChanged((History::EventType) event[History::FieldType].toInt(),
+                  event[History::FieldAccountId].toString(),
+                  event[History::FieldThreadId].toString());
 
     return true;
 }
 
 History::EventWriteResult SQLiteHistoryPlugin::writeVoiceEvent(const QVariantMap &event)
 {
-    QSqlQuery query(SQLiteDatabase::instance()->database());
-
-    // check if the event exists
-    QVariantMap existingEvent = getSingleEvent((History::EventType) event[History::FieldType].toInt(),
-                                               event[History::FieldAccountId].toString(),
-                                               event[History::FieldThreadId].toString(),
-                                               event[History::FieldEventId].toString());
-
-    History::EventWriteResult result;
-    if (existingEvent.isEmpty()) {
-        // create new
-        query.prepare("INSERT INTO voice_events (accountId, threadId, eventId, senderId, timestamp, newEvent, duration, missed, remoteParticipant) "
-                      "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :duration, :missed, :remoteParticipant)");
+    // same as for text events: try to update first and only insert if the event is not there yet
+    History::EventWriteResult result = History::EventWriteModified;
+    QSqlQuery query = SQLiteDatabase::instance()->preparedQuery("UPDATE voice_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, duration=:duration, "
+                                                                "missed=:missed, remoteParticipant=:remoteParticipant "
+                                                                "WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    bindVoiceEventValues(query, event);
+    if (query.exec() && query.numRowsAffected() == 0) {
+        query = SQLiteDatabase::instance()->preparedQuery("INSERT INTO voice_events (accountId, threadId, eventId, senderId, timestamp, newEvent, duration, missed, remoteParticipant) "
+                                                          "VALUES (:accountId, :threadId, :eventId, :senderId, :timestamp, :newEvent, :duration, :missed, :remoteParticipant)");
+        bindVoiceEventValues(query, event);
+        query.exec();
         result = History::EventWriteCreated;
-    } else {
-        // update existing event
-        query.prepare("UPDATE voice_events SET senderId=:senderId, timestamp=:timestamp, newEvent=:newEvent, duration=:duration, "
-                      "missed=:missed, remoteParticipant=:remoteParticipant "
-                      "WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
-
-        result = History::EventWriteModified;
     }
 
-    query.bindValue(":accountId", event[History::FieldAccountId]);
-    query.bindValue(":threadId", event[History::FieldThreadId]);
-    query.bindValue(":eventId", event[History::FieldEventId]);
-    query.bindValue(":senderId", event[History::FieldSenderId]);
-    query.bindValue(":timestamp", event[History::FieldTimestamp].toDateTime().toUTC());
-    query.bindValue(":newEvent", event[History::FieldNewEvent]);
-    query.bindValue(":duration", event[History::FieldDuration]);
-    query.bindValue(":missed", event[History::FieldMissed]);
-    query.bindValue(":remoteParticipant", event[History::FieldRemoteParticipant]);
-
-    if (!query.exec()) {
+    if (query.lastError().isValid()) {
         qCritical() << "Failed to save the voice event: Error:" << query.lastError() << query.lastQuery();
         result = History::EventWriteError;
     }
@@ -1139,7 +1542,7 @@ bool SQLiteHistoryPlugin::removeVoiceEvent(const QVariantMap &event)
 {
     QSqlQuery query(SQLiteDatabase::instance()->database());
 
-    query.prepare("DELETE FROM voice_events WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId");
+    query.prepare(sqlQueryForRemoveEvent(History::EventTypeVoice));
     query.bindValue(":accountId", event[History::FieldAccountId]);
     query.bindValue(":threadId", event[History::FieldThreadId]);
     query.bindValue(":eventId", event[History::FieldEventId]);
@@ -1154,19 +1557,72 @@ bool SQLiteHistoryPlugin::removeVoiceEvent(const QVariantMap &event)
 
 bool SQLiteHistoryPlugin::beginBatchOperation()
 {
-    return SQLiteDatabase::instance()->beginTransation();
+    if (!SQLiteDatabase::instance()->beginTransation()) {
+        return false;
+    }
+
+    mBatchDepth++;
+    return true;
 }
 
 bool SQLiteHistoryPlugin::endBatchOperation()
 {
-    return SQLiteDatabase::instance()->finishTransaction();
+    bool result = SQLiteDatabase::instance()->finishTransaction();
+    if (mBatchDepth > 0 && --mBatchDepth == 0) {
+        if (result) {
+            updateChangedThreads();
+        } else {
+            mChangedThreads.clear();
+        }
+    }
+    return result;
 }
 
 bool SQLiteHistoryPlugin::rollbackBatchOperation()
 {
+    mBatchDepth = 0;
+    mChangedThreads.clear();
     return SQLiteDatabase::instance()->rollbackTransaction();
 }
 
+/**
+ * @brief Refresh a thread in the grouping cache after its events changed.
+ *
+ * Inside a batch operation the refresh is postponed until the batch is committed,
+ * so that a thread is only loaded once no matter how many of its events were written.
+ */
+void SQLiteHistoryPlugin::threadChanged(History::EventType type, const QString &accountId, const QString &threadId)
+{
+    QVariantMap thread;
+    thread[History::FieldType] = type;
+    thread[History::FieldAccountId] = accountId;
+    thread[History::FieldThreadId] = threadId;
+    mChangedThreads[QString::number(type) + generateThreadMapKey(accountId, threadId)] = thread;
+
+    if (mBatchDepth == 0) {
+        updateChangedThreads();
+    }
+}
+
+void SQLiteHistoryPlugin::updateChangedThreads()
+{
+    QList<QVariantMap> threads;
+    Q_FOREACH(const QVariantMap &changedThread, mChangedThreads) {
+        QVariantMap thread = getSingleThread((History::EventType) changedThread[History::FieldType].toInt(),
+                                             changedThread[History::FieldAccountId].toString(),
+                                             changedThread[History::FieldThreadId].toString(),
+                                             QVariantMap());
+        if (!thread.isEmpty()) {
+            threads << thread;
+        }
+    }
+    mChangedThreads.clear();
+
+    if (!threads.isEmpty()) {
+        updateCachedThreads(threads);
+    }
+}
+
 QString SQLiteHistoryPlugin::sqlQueryForThreads(History::EventType type, const QString &condition, const QString &order)
 {
     QString modifiedCondition = condition;
@@ -1220,19 +1676,27 @@ QString SQLiteHistoryPlugin::sqlQueryForThreads(History::EventType type, const Q
 }
 
 QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType type, QSqlQuery &query, const QVariantMap &properties)
+{
+    QList<QSqlRecord> rows;
+    while (query.next()) {
+        rows << query.record();
+    }
+    return parseThreadResults(type, rows, properties);
+}
+
+/// parses thread rows already fetched, possibly by one of the read connections
+QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType type, const QList<QSqlRecord> &rows, const QVariantMap &properties)
 {
     QList<QVariantMap> threads;
     QList<QVariantMap> threadsWithoutParticipants;
-    QSqlQuery attachmentsQuery(SQLiteDatabase::instance()->database());
-    QList<QVariantMap> attachments;
     bool grouped = false;
     if (properties.contains(History::FieldGroupingProperty)) {
         grouped = properties[History::FieldGroupingProperty].toString() == History::FieldParticipants;
     }
-    while (query.next()) {
+    Q_FOREACH(const QSqlRecord &record, rows) {
         QVariantMap thread;
-        QString accountId = query.value(0).toString();
-        QString threadId = query.value(1).toString();
+        QString accountId = record.value(0).toString();
+        QString threadId = record.value(1).toString();
         if (threadId.trimmed().isEmpty()) {
             continue;
         }
@@ -1241,9 +1705,12 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
         thread[History::FieldThreadId] = threadId;
         if (grouped) {
             const QString &threadKey = generateThreadMapKey(accountId, threadId);
-            if (mInitialised && type == History::EventTypeText && 
-                !mConversationsCache.contains(threadKey)) {
-                continue;
+            if (type == History::EventTypeText) {
+                cacheThreadWithMatches(accountId, threadId);
+                // threads grouped under another one are not listed
+                if (!mConversationsCache.contains(threadKey)) {
+                    continue;
+                }
             }
             QVariantList groupedThreads;
             if (mConversationsCache.contains(threadKey)) {
@@ -1254,124 +1721,67 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseThreadResults(History::EventType ty
             thread[History::FieldGroupedThreads] = QVariant::fromValue(groupedThreads);
         }
 
-        thread[History::FieldEventId] = query.value(2);
-        thread[History::FieldCount] = query.value(3);
-        thread[History::FieldUnreadCount] = query.value(4);
+        thread[History::FieldEventId] = record.value(2);
+        thread[History::FieldCount] = record.value(3);
+        thread[History::FieldUnreadCount] = record.value(4);
 
         // the generic event fields
-        thread[History::FieldSenderId] = query.value(6);
-        thread[History::FieldTimestamp] = toLocalTimeString(query.value(5).toDateTime());
-        thread[History::FieldNewEvent] = query.value(7).toBool();
+        thread[History::FieldSenderId] = record.value(6);
+        thread[History::FieldTimestamp] = toLocalTimeString(record.value(5).toDateTime());
+        thread[History::FieldNewEvent] = record.value(7).toBool();
 
         // the next step is to get the last event
         switch (type) {
         case History::EventTypeText:
-            attachmentsQuery.prepare("SELECT attachmentId, contentType, filePath, status FROM text_event_attachments "
-                                "WHERE accountId=:accountId and threadId=:threadId and eventId=:eventId");
-            attachmentsQuery.bindValue(":accountId", query.value(0));
-            attachmentsQuery.bindValue(":threadId", query.value(1));
-            attachmentsQuery.bindValue(":eventId", query.value(2));
-            if (!attachmentsQuery.exec()) {
-                qCritical() << "Error:" << attachmentsQuery.lastError() << attachmentsQuery.lastQuery();
-            }
+            thread[History::FieldMessage] = record.value(8);
+            thread[History::FieldMessageType] = record.value(9);
+            thread[History::FieldMessageStatus] = record.value(10);
+            thread[History::FieldReadTimestamp] = toLocalTimeString(record.value(11).toDateTime());
+            thread[History::FieldChatType] = record.value(12).toUInt();
 
-            while (attachmentsQuery.next()) {
-                QVariantMap attachment;
-                attachment[History::FieldAccountId] = query.value(0);
-                attachment[History::FieldThreadId] = query.value(1);
-                attachment[History::FieldEventId] = query.value(2);
-                attachment[History::FieldAttachmentId] = attachmentsQuery.value(0);
-                attachment[History::FieldContentType] = attachmentsQuery.value(1);
-                attachment[History::FieldFilePath] = attachmentsQuery.value(2);
-                attachment[History::FieldStatus] = attachmentsQuery.value(3);
-                attachments << attachment;
+            // the chat room info, attachments and participants are fetched for the whole page below
+            threads << thread;
+            break;
+        case History::EventTypeVoice:
+            thread[History::FieldMissed] = record.value(9);
+            thread[History::FieldDuration] = record.value(8);
+            thread[History::FieldRemoteParticipant] = History::ContactMatcher::instance()->contactInfo(accountId, record.value(10).toString(), true);
+            threads << thread;
+            break;
+        }
+    }
 
-            }
-            attachmentsQuery.clear();
-            if (attachments.size() > 0) {
-                thread[History::FieldAttachments] = QVariant::fromValue(attachments);
-                attachments.clear();
-            }
-            thread[History::FieldMessage] = query.value(8);
-            thread[History::FieldMessageType] = query.value(9);
-            thread[History::FieldMessageStatus] = query.value(10);
-            thread[History::FieldReadTimestamp] = toLocalTimeString(query.value(11).toDateTime());
-            thread[History::FieldChatType] = query.value(12).toUInt();
+    if (type == History::EventTypeText) {
+        QMap<QString, QList<QVariantMap> > attachments = attachmentsForEvents(threads);
 
+        QList<QVariantMap> rooms;
+        Q_FOREACH(const QVariantMap &thread, threads) {
             if (thread[History::FieldChatType].toInt() == History::ChatTypeRoom) {
-                QVariantMap chatRoomInfo;
-                QSqlQuery query1(SQLiteDatabase::instance()->database());
+                rooms << thread;
+            }
+        }
+        QMap<QString, QVariantMap> chatRoomInfo = chatRoomInfoForThreads(rooms);
 
-                query1.prepare("SELECT roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, subject, actor, timestamp, joined, selfRoles FROM chat_room_info WHERE accountId=:accountId AND threadId=:threadId AND type=:type LIMIT 1");
-                query1.bindValue(":accountId", thread[History::FieldAccountId]);
-                query1.bindValue(":threadId", thread[History::FieldThreadId]);
-                query1.bindValue(":type", thread[History::FieldType].toInt());
+        QList<QVariantMap> threadsWithParticipants;
+        Q_FOREACH(QVariantMap thread, threads) {
+            const QList<QVariantMap> &threadAttachments = attachments.value(generateEventMapKey(thread));
+            if (!threadAttachments.isEmpty()) {
+                thread[History::FieldAttachments] = QVariant::fromValue(threadAttachments);
+            }
 
-                if (!query1.exec()) {
-                    qCritical() << "Failed to get chat room info for thread: Error:" << query1.lastError() << query1.lastQuery();
-                    break;
-                }
-                query1.next();
-
-                if (query1.value(0).isValid())
-                    chatRoomInfo["RoomName"] = query1.value(0);
-                if (query1.value(1).isValid())
-                    chatRoomInfo["Server"] = query1.value(1);
-                if (query1.value(2).isValid())
-                    chatRoomInfo["Creator"] = query1.value(2);
-                if (query1.value(3).isValid())
-                    chatRoomInfo["CreationTimestamp"] = toLocalTimeString(query1.value(3).toDateTime());
-                if (query1.value(4).isValid())
-                    chatRoomInfo["Anonymous"] = query1.value(4).toBool();
-                if (query1.value(5).isValid())
-                    chatRoomInfo["InviteOnly"] = query1.value(5).toBool();
-                if (query1.value(6).isValid())
-                    chatRoomInfo["Limit"] = query1.value(6).toInt();
-                if (query1.value(7).isValid())
-                    chatRoomInfo["Moderated"] = query1.value(7).toBool();
-                if (query1.value(8).isValid())
-                    chatRoomInfo["Title"] = query1.value(8);
-                if (query1.value(9).isValid())
-                    chatRoomInfo["Description"] = query1.value(9);
-                if (query1.value(10).isValid())
-                    chatRoomInfo["Persistent"] = query1.value(10).toBool();
-                if (query1.value(11).isValid())
-                    chatRoomInfo["Private"] = query1.value(11).toBool();
-                if (query1.value(12).isValid())
-                    chatRoomInfo["PasswordProtected"] = query1.value(12).toBool();
-                if (query1.value(13).isValid())
-                    chatRoomInfo["Password"] = query1.value(13);
-                if (query1.value(14).isValid())
-                    chatRoomInfo["PasswordHint"] = query1.value(14);
-                if (query1.value(15).isValid())
-                    chatRoomInfo["CanUpdateConfiguration"] = query1.value(15).toBool();
-                if (query1.value(16).isValid())
-                    chatRoomInfo["Subject"] = query1.value(16);
-                if (query1.value(17).isValid())
-                    chatRoomInfo["Actor"] = query1.value(17);
-                if (query1.value(18).isValid())
-                    chatRoomInfo["Timestamp"] = toLocalTimeString(query1.value(18).toDateTime());
-                if (query1.value(19).isValid())
-                    chatRoomInfo["Joined"] = query1.value(19).toBool();
-                if (query1.value(20).isValid())
-                    chatRoomInfo["SelfRoles"] = query1.value(20).toInt();
-
-                thread[History::FieldChatRoomInfo] = chatRoomInfo;
+            History::ChatType chatType = (History::ChatType) thread[History::FieldChatType].toUInt();
+            if (chatType == History::ChatTypeRoom) {
+                thread[History::FieldChatRoomInfo] = chatRoomInfo.value(generateThreadMapKey(thread[History::FieldAccountId].toString(),
+                                                                                             thread[History::FieldThreadId].toString()));
             }
-            if (!History::Utils::shouldIncludeParticipants(History::Thread::fromProperties(thread))) {
-                thread.remove(History::FieldParticipants);
+
+            if (!History::Utils::shouldIncludeParticipants(thread[History::FieldAccountId].toString(), chatType)) {
                 threadsWithoutParticipants << thread;
             } else {
-                threads << thread;
+                threadsWithParticipants << thread;
             }
-            break;
-        case History::EventTypeVoice:
-            thread[History::FieldMissed] = query.value(9);
-            thread[History::FieldDuration] = query.value(8);
-            thread[History::FieldRemoteParticipant] = History::ContactMatcher::instance()->contactInfo(accountId, query.value(10).toString(), true);
-            threads << thread;
-            break;
         }
+        threads = threadsWithParticipants;
     }
 
     // get the participants
@@ -1412,15 +1822,33 @@ QString SQLiteHistoryPlugin::sqlQueryForEvents(History::EventType type, const QS
     return queryText;
 }
 
-QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType type, QSqlQuery &query)
+QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType type, QSqlQuery &query, QSqlRecord *lastRecord)
 {
-    QList<QVariantMap> events;
+    QList<QSqlRecord> rows;
     while (query.next()) {
+        rows << query.record();
+    }
+    return parseEventResults(type, rows, lastRecord);
+}
+
+/// parses event rows already fetched, possibly by one of the read connections
+QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType type, const QList<QSqlRecord> &rows, QSqlRecord *lastRecord)
+{
+    QList<QVariantMap> events;
+    QList<int> multiPartEvents;
+
+    // keep the raw values of the last row for the views using keyset paging
+    if (lastRecord && !rows.isEmpty()) {
+        *lastRecord = rows.last();
+    }
+
+    Q_FOREACH(const QSqlRecord &record, rows) {
+
         QVariantMap event;
         History::MessageType messageType;
-        QString accountId = query.value(0).toString();
-        QString threadId = query.value(1).toString();
-        QString eventId = query.value(2).toString();
+        QString accountId = record.value(0).toString();
+        QString threadId = record.value(1).toString();
+        QString eventId = record.value(2).toString();
 
         // ignore events that don't have a threadId or an eventId
         if (threadId.trimmed().isEmpty() || eventId.trimmed().isEmpty()) {
@@ -1431,65 +1859,280 @@ QList<QVariantMap> SQLiteHistoryPlugin::parseEventResults(History::EventType typ
         event[History::FieldAccountId] = accountId;
         event[History::FieldThreadId] = threadId;
         event[History::FieldEventId] = eventId;
-        event[History::FieldSenderId] = query.value(3);
-        event[History::FieldTimestamp] = toLocalTimeString(query.value(4).toDateTime());
-        event[History::FieldNewEvent] = query.value(5).toBool();
+        event[History::FieldSenderId] = record.value(3);
+        event[History::FieldTimestamp] = toLocalTimeString(record.value(4).toDateTime());
+        event[History::FieldNewEvent] = record.value(5).toBool();
         if (type != History::EventTypeText) {
-            QStringList participants = query.value(6).toString().split("|,|");
+            QStringList participants = record.value(6).toString().split("|,|");
             event[History::FieldParticipants] = History::ContactMatcher::instance()->contactInfo(accountId, participants, true);
         }
 
         switch (type) {
         case History::EventTypeText:
-            messageType = (History::MessageType) query.value(8).toInt();
+            messageType = (History::MessageType) record.value(8).toInt();
             if (messageType == History::MessageTypeMultiPart)  {
-                QSqlQuery attachmentsQuery(SQLiteDatabase::instance()->database());
-                attachmentsQuery.prepare("SELECT attachmentId, contentType, filePath, status FROM text_event_attachments "
-                                    "WHERE accountId=:accountId and threadId=:threadId and eventId=:eventId");
-                attachmentsQuery.bindValue(":accountId", accountId);
-                attachmentsQuery.bindValue(":threadId", threadId);
-                attachmentsQuery.bindValue(":eventId", eventId);
-                if (!attachmentsQuery.exec()) {
-                    qCritical() << "Error:" << attachmentsQuery.lastError() << attachmentsQuery.lastQuery();
-                }
-
-                QList<QVariantMap> attachments;
-                while (attachmentsQuery.next()) {
-                    QVariantMap attachment;
-                    attachment[History::FieldAccountId] = accountId;
-                    attachment[History::FieldThreadId] = threadId;
-                    attachment[History::FieldEventId] = eventId;
-                    attachment[History::FieldAttachmentId] = attachmentsQuery.value(0);
-                    attachment[History::FieldContentType] = attachmentsQuery.value(1);
-                    attachment[History::FieldFilePath] = attachmentsQuery.value(2);
-                    attachment[History::FieldStatus] = attachmentsQuery.value(3);
-                    attachments << attachment;
-
-                }
-                attachmentsQuery.clear();
-                event[History::FieldAttachments] = QVariant::fromValue(attachments);
+                // the attachments are fetched for the whole page at once below
+                multiPartEvents << events.count();
             }
-            event[History::FieldMessage] = query.value(7);
-            event[History::FieldMessageType] = query.value(8);
-            event[History::FieldMessageStatus] = query.value(9);
-            event[History::FieldReadTimestamp] = toLocalTimeString(query.value(10).toDateTime());
-            if (!query.value(11).toString().isEmpty()) {
-                event[History::FieldSubject] = query.value(11).toString();
+            event[History::FieldMessage] = record.value(7);
+            event[History::FieldMessageType] = record.value(8);
+            event[History::FieldMessageStatus] = record.value(9);
+            event[History::FieldReadTimestamp] = toLocalTimeString(record.value(10).toDateTime());
+            if (!record.value(11).toString().isEmpty()) {
+                event[History::FieldSubject] = record.value(11).toString();
             }
-            event[History::FieldInformationType] = query.value(12).toInt();
+            event[History::FieldInformationType] = record.value(12).toInt();
             break;
         case History::EventTypeVoice:
-            event[History::FieldDuration] = query.value(7).toInt();
-            event[History::FieldMissed] = query.value(8);
-            event[History::FieldRemoteParticipant] = query.value(9).toString();
+            event[History::FieldDuration] = record.value(7).toInt();
+            event[History::FieldMissed] = record.value(8);
+            event[History::FieldRemoteParticipant] = record.value(9).toString();
             break;
         }
 
         events << event;
     }
+
+    if (!multiPartEvents.isEmpty()) {
+        QList<QVariantMap> eventsWithAttachments;
+        Q_FOREACH(int index, multiPartEvents) {
+            eventsWithAttachments << events[index];
+        }
+
+        QMap<QString, QList<QVariantMap> > attachments = attachmentsForEvents(eventsWithAttachments);
+        Q_FOREACH(int index, multiPartEvents) {
+            events[index][History::FieldAttachments] = QVariant::fromValue(attachments.value(generateEventMapKey(events[index])));
+        }
+    }
+
     return events;
 }
 
+/**
+ * @brief Fetches the attachments of multiple text events using as few queries as possible
+ * @param events the events to get the attachments for. Only the accountId, threadId and eventId are used
+ * @return the attachments of each event, indexed by the key generated by generateEventMapKey()
+ */
+QMap<QString, QList<QVariantMap> > SQLiteHistoryPlugin::attachmentsForEvents(const QList<QVariantMap> &events)
+{
+    QMap<QString, QList<QVariantMap> > results;
+
+    for (int start = 0; start < events.count(); start += maxRowsPerQuery) {
+        QVariantMap bindValues;
+        SQLiteReadResult result = readRows(sqlQueryForAttachments(events.mid(start, maxRowsPerQuery), bindValues), bindValues);
+        Q_FOREACH(const QSqlRecord &record, result.rows) {
+            QVariantMap attachment;
+            attachment[History::FieldAccountId] = record.value(0);
+            attachment[History::FieldThreadId] = record.value(1);
+            attachment[History::FieldEventId] = record.value(2);
+            attachment[History::FieldAttachmentId] = record.value(3);
+            attachment[History::FieldContentType] = record.value(4);
+            attachment[History::FieldFilePath] = record.value(5);
+            attachment[History::FieldStatus] = record.value(6);
+            results[generateEventMapKey(attachment)] << attachment;
+        }
+    }
+
+    return results;
+}
+
+/**
+ * @brief Fetches the chat room info of multiple threads using as few queries as possible
+ * @param threads the room threads to get the info for. Only the accountId, threadId and type are used
+ * @return the chat room info of each thread, indexed by the key generated by generateThreadMapKey()
+ */
+QMap<QString, QVariantMap> SQLiteHistoryPlugin::chatRoomInfoForThreads(const QList<QVariantMap> &threads)
+{
+    QMap<QString, QVariantMap> results;
+
+    for (int start = 0; start < threads.count(); start += maxRowsPerQuery) {
+        QVariantMap bindValues;
+        SQLiteReadResult result = readRows(sqlQueryForChatRoomInfo(threads.mid(start, maxRowsPerQuery), bindValues), bindValues);
+        if (!result.success) {
+            qCritical() << "Failed to get chat room info for threads.";
+            continue;
+        }
+
+        Q_FOREACH(const QSqlRecord &record, result.rows) {
+            const QString &threadKey = generateThreadMapKey(record.value(0).toString(), record.value(1).toString());
+            // there should be only one entry per thread, so keep the first one like a LIMIT 1 would
+            if (results.contains(threadKey)) {
+                continue;
+            }
+
+            QVariantMap chatRoomInfo;
+            if (record.value(2).isValid())
+                chatRoomInfo["RoomName"] = record.value(2);
+            if (record.value(3).isValid())
+                chatRoomInfo["Server"] = record.value(3);
+            if (record.value(4).isValid())
+                chatRoomInfo["Creator"] = record.value(4);
+            if (record.value(5).isValid())
+                chatRoomInfo["CreationTimestamp"] = toLocalTimeString(record.value(5).toDateTime());
+            if (record.value(6).isValid())
+                chatRoomInfo["Anonymous"] = record.value(6).toBool();
+            if (record.value(7).isValid())
+                chatRoomInfo["InviteOnly"] = record.value(7).toBool();
+            if (record.value(8).isValid())
+                chatRoomInfo["Limit"] = record.value(8).toInt();
+            if (record.value(9).isValid())
+                chatRoomInfo["Moderated"] = record.value(9).toBool();
+            if (record.value(10).isValid())
+                chatRoomInfo["Title"] = record.value(10);
+            if (record.value(11).isValid())
+                chatRoomInfo["Description"] = record.value(11);
+            if (record.value(12).isValid())
+                chatRoomInfo["Persistent"] = record.value(12).toBool();
+            if (record.value(13).isValid())
+                chatRoomInfo["Private"] = record.value(13).toBool();
+            if (record.value(14).isValid())
+                chatRoomInfo["PasswordProtected"] = record.value(14).toBool();
+            if (record.value(15).isValid())
+                chatRoomInfo["Password"] = record.value(15);
+            if (record.value(16).isValid())
+                chatRoomInfo["PasswordHint"] = record.value(16);
+            if (record.value(17).isValid())
+                chatRoomInfo["CanUpdateConfiguration"] = record.value(17).toBool();
+            if (record.value(18).isValid())
+                chatRoomInfo["Subject"] = record.value(18);
+            if (record.value(19).isValid())
+                chatRoomInfo["Actor"] = record.value(19);
+            if (record.value(20).isValid())
+                chatRoomInfo["Timestamp"] = toLocalTimeString(record.value(20).toDateTime());
+            if (record.value(21).isValid())
+                chatRoomInfo["Joined"] = record.value(21).toBool();
+            if (record.value(22).isValid())
+                chatRoomInfo["SelfRoles"] = record.value(22).toInt();
+
+            results[threadKey] = chatRoomInfo;
+        }
+    }
+
+    return results;
+}
+
+/**
+ * @brief Runs a query on one of the read connections and returns the resulting rows
+ *
+ * The main connection is used instead when there are no readers, or while a transaction is
+ * open, as its changes are not visible to the readers until they are committed.
+ */
+SQLiteReadResult SQLiteHistoryPlugin::readRows(const QString &queryText, const QVariantMap &bindValues)
+{
+    SQLiteReader *reader = SQLiteDatabase::instance()->inTransaction() ? 0 : SQLiteDatabase::instance()->reader();
+    if (reader) {
+        return reader->execute(queryText, bindValues);
+    }
+
+    QSqlDatabase database = SQLiteDatabase::instance()->database();
+    return SQLiteReader::exec(database, queryText, bindValues);
+}
+
+/**
+ * @brief Generates the query fetching the participants of a batch of threads
+ * @param threads the threads to get the participants for. Only the accountId, threadId and type are used
+ * @param bindValues the map to append the values to be bound to
+ */
+QString SQLiteHistoryPlugin::sqlQueryForParticipants(const QList<QVariantMap> &threads, QVariantMap &bindValues) const
+{
+    QStringList conditions;
+    for (int i = 0; i < threads.count(); ++i) {
+        conditions << QString("(accountId=:accountId%1 AND threadId=:threadId%1 AND type=:type%1)").arg(i);
+        bindValues[QString(":accountId%1").arg(i)] = threads[i][History::FieldAccountId].toString();
+        bindValues[QString(":threadId%1").arg(i)] = threads[i][History::FieldThreadId].toString();
+        bindValues[QString(":type%1").arg(i)] = threads[i][History::FieldType].toUInt();
+    }
+
+    return QString("SELECT accountId, threadId, type, normalizedId, alias, state, roles FROM thread_participants "
+                   "WHERE %1").arg(conditions.join(" OR "));
+}
+
+/**
+ * @brief Generates the query fetching the attachments of a batch of text events
+ * @param events the events to get the attachments for. Only the accountId, threadId and eventId are used
+ * @param bindValues the map to append the values to be bound to
+ */
+QString SQLiteHistoryPlugin::sqlQueryForAttachments(const QList<QVariantMap> &events, QVariantMap &bindValues) const
+{
+    QStringList conditions;
+    for (int i = 0; i < events.count(); ++i) {
+        conditions << QString("(accountId=:accountId%1 AND threadId=:threadId%1 AND eventId=:eventId%1)").arg(i);
+        bindValues[QString(":accountId%1").arg(i)] = events[i][History::FieldAccountId];
+        bindValues[QString(":threadId%1").arg(i)] = events[i][History::FieldThreadId];
+        bindValues[QString(":eventId%1").arg(i)] = events[i][History::FieldEventId];
+    }
+
+    return QString("SELECT accountId, threadId, eventId, attachmentId, contentType, filePath, status "
+                   "FROM text_event_attachments WHERE %1").arg(conditions.join(" OR "));
+}
+
+/**
+ * @brief Generates the query fetching the chat room info of a batch of threads
+ * @param threads the room threads to get the info for. Only the accountId, threadId and type are used
+ * @param bindValues the map to append the values to be bound to
+ */
+QString SQLiteHistoryPlugin::sqlQueryForChatRoomInfo(const QList<QVariantMap> &threads, QVariantMap &bindValues) const
+{
+    QStringList conditions;
+    for (int i = 0; i < threads.count(); ++i) {
+        conditions << QString("(accountId=:accountId%1 AND threadId=:threadId%1 AND type=:type%1)").arg(i);
+        bindValues[QString(":accountId%1").arg(i)] = threads[i][History::FieldAccountId];
+        bindValues[QString(":threadId%1").arg(i)] = threads[i][History::FieldThreadId];
+        bindValues[QString(":type%1").arg(i)] = threads[i][History::FieldType].toInt();
+    }
+
+    return QString("SELECT accountId, threadId, roomName, server, creator, creationTimestamp, anonymous, inviteOnly, participantLimit, moderated, "
+                   "title, description, persistent, private, passwordProtected, password, passwordHint, canUpdateConfiguration, "
+                   "subject, actor, timestamp, joined, selfRoles FROM chat_room_info WHERE %1").arg(conditions.join(" OR "));
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForSingleThread(History::EventType type, const QString &accountId, const QString &threadId)
+{
+    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\"").arg(accountId, threadId);
+    return sqlQueryForThreads(type, condition, QString::null) + " LIMIT 1";
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForSingleEvent(History::EventType type, const QString &accountId, const QString &threadId, const QString &eventId)
+{
+    QString condition = QString("accountId=\"%1\" AND threadId=\"%2\" AND eventId=\"%3\"").arg(accountId, threadId, eventId);
+    return sqlQueryForEvents(type, condition, QString::null) + " LIMIT 1";
+}
+
+/// the query looking up the threads of an account by the hash of their participants
+QString SQLiteHistoryPlugin::sqlQueryForThreadsWithHash() const
+{
+    return "SELECT threadId FROM threads WHERE accountId=:accountId AND type=:type AND "
+           "participantsHash=:participantsHash AND chatType!=:chatType";
+}
+
+/// the query listing the participants of a thread, by their normalized ids when phone numbers are compared
+QString SQLiteHistoryPlugin::sqlQueryForThreadParticipantIds(bool normalized) const
+{
+    return QString("SELECT %1 FROM thread_participants WHERE threadId=:threadId AND type=:type AND accountId=:accountId")
+            .arg(normalized ? "normalizedId" : "participantId");
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForUnreadCount() const
+{
+    return "SELECT unreadCount from threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type";
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForMarkThreadAsRead() const
+{
+    return "UPDATE text_events SET newEvent=:newEvent WHERE accountId=:accountId AND threadId=:threadId AND newEvent=1";
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForRemoveThread() const
+{
+    return "DELETE FROM threads WHERE accountId=:accountId AND threadId=:threadId AND type=:type";
+}
+
+QString SQLiteHistoryPlugin::sqlQueryForRemoveEvent(History::EventType type) const
+{
+    return QString("DELETE FROM %1 WHERE accountId=:accountId AND threadId=:threadId AND eventId=:eventId")
+            .arg(type == History::EventTypeText ? "text_events" : "voice_events");
+}
+
 QString SQLiteHistoryPlugin::toLocalTimeString(const QDateTime &timestamp)
 {
     return QDateTime(timestamp.date(), timestamp.time(), Qt::UTC).toLocalTime().toString(timestampFormat);
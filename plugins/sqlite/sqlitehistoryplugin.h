@@ -25,7 +25,11 @@
 #include "plugin.h"
 #include "thread.h"
 #include <QObject>
+#include <QSet>
+#include <QTime>
 #include <QSqlQuery>
+#include <QSqlRecord>
+#include "sqlitereader.h"
 
 class SQLiteHistoryReader;
 class SQLiteHistoryWriter;
@@ -40,6 +44,7 @@ class SQLiteHistoryPlugin : public QObject, History::Plugin
     Q_INTERFACES(History::Plugin)
 public:
     explicit SQLiteHistoryPlugin(QObject *parent = 0);
+    ~SQLiteHistoryPlugin();
 
     bool initialised();
 
@@ -92,26 +97,70 @@ public:
     // functions to be used internally
     QString sqlQueryForThreads(History::EventType type, const QString &condition, const QString &order);
     QList<QVariantMap> parseThreadResults(History::EventType type, QSqlQuery &query, const QVariantMap &properties = QVariantMap());
+    QList<QVariantMap> parseThreadResults(History::EventType type, const QList<QSqlRecord> &rows, const QVariantMap &properties = QVariantMap());
 
     QString sqlQueryForEvents(History::EventType type, const QString &condition, const QString &order);
-    QList<QVariantMap> parseEventResults(History::EventType type, QSqlQuery &query);
+    QList<QVariantMap> parseEventResults(History::EventType type, QSqlQuery &query, QSqlRecord *lastRecord = 0);
+    QList<QVariantMap> parseEventResults(History::EventType type, const QList<QSqlRecord> &rows, QSqlRecord *lastRecord = 0);
 
     static QString toLocalTimeString(const QDateTime &timestamp);
 
     QString filterToString(const History::Filter &filter, QVariantMap &bindValues, const QString &propertyPrefix = QString::null) const;
     QString escapeFilterValue(const QString &value) const;
+    QString groupedThreadsCondition(History::EventType type, const QVariantMap &properties) const;
+    QString sqlQueryForThreadMatches() const;
+    QString sqlQueryForParticipants(const QList<QVariantMap> &threads, QVariantMap &bindValues) const;
+    QString sqlQueryForAttachments(const QList<QVariantMap> &events, QVariantMap &bindValues) const;
+    QString sqlQueryForChatRoomInfo(const QList<QVariantMap> &threads, QVariantMap &bindValues) const;
+    QString sqlQueryForSingleThread(History::EventType type, const QString &accountId, const QString &threadId);
+    QString sqlQueryForSingleEvent(History::EventType type, const QString &accountId, const QString &threadId, const QString &eventId);
+    QString sqlQueryForThreadsWithHash() const;
+    QString sqlQueryForThreadParticipantIds(bool normalized) const;
+    QString sqlQueryForUnreadCount() const;
+    QString sqlQueryForMarkThreadAsRead() const;
+    QString sqlQueryForRemoveThread() const;
+    QString sqlQueryForRemoveEvent(History::EventType type) const;
 
     void generateContactCache();
+    void updateGroupedThreadsCache();
+
+private Q_SLOTS:
+    void addNextPageToCache();
 
 private:
     bool lessThan(const QVariantMap &left, const QVariantMap &right) const;
-    void updateGroupedThreadsCache();
+    QString findThreadWithParticipants(const QString &accountId,
+                                       History::EventType type,
+                                       const QStringList &threadIds,
+                                       const QStringList &normalizedParticipants,
+                                       History::MatchFlags matchFlags);
     void updateDisplayedThread(const QString &displayedThreadKey);
     void addThreadsToCache(const QList<QVariantMap> &threads);
+    void cacheThreadWithMatches(const QString &accountId, const QString &threadId);
+    void updateCachedThreads(const QList<QVariantMap> &threads);
+    QStringList indexedConversations(const QString &groupKey);
     void removeThreadFromCache(const QVariantMap &thread);
+    void loadThreadGroups();
+    void threadChanged(History::EventType type, const QString &accountId, const QString &threadId);
+    void updateChangedThreads();
+    bool threadGroupsComplete();
+    void saveThreadGroups();
+    void saveThreadGroup(const QString &conversationKey);
+    SQLiteReadResult readRows(const QString &queryText, const QVariantMap &bindValues);
+    QMap<QString, QList<QVariantMap> > attachmentsForEvents(const QList<QVariantMap> &events);
+    QMap<QString, QVariantMap> chatRoomInfoForThreads(const QList<QVariantMap> &threads);
     QVariantMap cachedThreadProperties(const History::Thread &thread) const;
     QMap<QString, History::Threads> mConversationsCache;
     QMap<QString, QString> mConversationsCacheKeys;
+    QHash<QString, QStringList> mConversationsCacheIndex;
+    History::PluginThreadView *mGroupedThreadsCacheView;
+    QSet<QString> mMatchedThreadKeys;
+    QSet<QString> mRemovedThreadKeys;
+    QHash<QString, QString> mThreadGroups;
+    QSet<QString> mChangedThreadGroups;
+    QMap<QString, QVariantMap> mChangedThreads;
+    int mBatchDepth;
+    QTime mGroupedThreadsCacheTime;
     bool mInitialised;
 };
 
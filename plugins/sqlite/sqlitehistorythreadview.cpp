@@ -25,7 +25,6 @@
 #include "sort.h"
 #include <QDateTime>
 #include <QDebug>
-#include <QSqlError>
 
 SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
                                                  History::EventType type,
@@ -33,14 +32,20 @@ SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
                                                  const History::Filter &filter,
                                                  const QVariantMap &properties)
     : History::PluginThreadView(), mPlugin(plugin), mType(type), mSort(sort),
-      mFilter(filter), mPageSize(15), mQuery(SQLiteDatabase::instance()->database()), mOffset(0), mValid(true), mQueryProperties(properties)
+      mFilter(filter), mOffset(0), mValid(true), mQueryProperties(properties),
+      mReader(SQLiteDatabase::instance()->reader()), mCreateJob(0), mPageJob(0), mPendingPages(0)
 {
     mTemporaryTable = QString("threadview%1%2").arg(QString::number((qulonglong)this), QDateTime::currentDateTimeUtc().toString("yyyyMMddhhmmsszzz"));
-    mQuery.setForwardOnly(true);
 
     // FIXME: validate the filter
     QVariantMap filterValues;
     QString condition = mPlugin->filterToString(filter, filterValues);
+
+    // grouped views only list the thread displayed for each conversation
+    QString groupedCondition = mPlugin->groupedThreadsCondition(type, properties);
+    if (!groupedCondition.isEmpty()) {
+        condition = condition.isEmpty() ? groupedCondition : QString("(%1) AND %2").arg(condition, groupedCondition);
+    }
     QString order;
     if (!sort.sortField().isNull()) {
         // WORKAROUND: Supports multiple fields by split it using ','
@@ -57,56 +62,91 @@ SQLiteHistoryThreadView::SQLiteHistoryThreadView(SQLiteHistoryPlugin *plugin,
     QString queryText = QString("CREATE TEMP TABLE %1 AS ").arg(mTemporaryTable);
     queryText += mPlugin->sqlQueryForThreads(type, condition, order);
 
-    if (!mQuery.prepare(queryText)) {
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
-        mValid = false;
-        Q_EMIT Invalidated();
+    // create the temporary table without waiting for it on the reader
+    if (mReader) {
+        connect(mReader, SIGNAL(finished(int,SQLiteReadResult)), SLOT(onReaderFinished(int,SQLiteReadResult)));
+        mCreateJob = mReader->enqueue(queryText, filterValues);
         return;
     }
 
-    Q_FOREACH(const QString &key, filterValues.keys()) {
-        mQuery.bindValue(key, filterValues[key]);
-    }
-
-    // create the temporary table
-    if (!mQuery.exec()) {
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+    if (!execute(queryText, filterValues).success) {
         mValid = false;
         Q_EMIT Invalidated();
-        return;
     }
 }
 
 SQLiteHistoryThreadView::~SQLiteHistoryThreadView()
 {
-    if (!mQuery.exec(QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable))) {
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+    QString queryText = QString("DROP TABLE IF EXISTS %1").arg(mTemporaryTable);
+    if (mReader) {
+        mReader->enqueue(queryText);
         return;
     }
+    execute(queryText);
 }
 
 QList<QVariantMap> SQLiteHistoryThreadView::NextPage()
 {
-    QList<QVariantMap> threads;
+    if (!mReader || !calledFromDBus()) {
+        return parsePage(execute(nextPageQuery()));
+    }
+
+    // pages are fetched one at a time, in the order they were requested
+    delayNextPage();
+    if (++mPendingPages == 1) {
+        mPageJob = mReader->enqueue(nextPageQuery());
+    }
+    return QList<QVariantMap>();
+}
+
+bool SQLiteHistoryThreadView::IsValid() const
+{
+    return mValid;
+}
+
+SQLiteReadResult SQLiteHistoryThreadView::execute(const QString &queryText, const QVariantMap &bindValues)
+{
+    if (mReader) {
+        return mReader->execute(queryText, bindValues);
+    }
 
-    // now prepare for selecting from it
-    mQuery.prepare(QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
-                                                                      QString::number(mPageSize), QString::number(mOffset)));
-    if (!mQuery.exec()) {
-        qCritical() << "Error:" << mQuery.lastError() << mQuery.lastQuery();
+    QSqlDatabase database = SQLiteDatabase::instance()->database();
+    return SQLiteReader::exec(database, queryText, bindValues);
+}
+
+QString SQLiteHistoryThreadView::nextPageQuery()
+{
+    QString queryText = QString("SELECT * FROM %1 LIMIT %2 OFFSET %3").arg(mTemporaryTable,
+                                                                          QString::number(pageSize()), QString::number(mOffset));
+    mOffset += pageSize();
+    return queryText;
+}
+
+QList<QVariantMap> SQLiteHistoryThreadView::parsePage(const SQLiteReadResult &result)
+{
+    if (!result.success) {
         mValid = false;
         Q_EMIT Invalidated();
-        return threads;
+        return QList<QVariantMap>();
     }
 
-    threads = mPlugin->parseThreadResults(mType, mQuery, mQueryProperties);
-    mOffset += mPageSize;
-    mQuery.clear();
-
-    return threads;
+    return mPlugin->parseThreadResults(mType, result.rows, mQueryProperties);
 }
 
-bool SQLiteHistoryThreadView::IsValid() const
+void SQLiteHistoryThreadView::onReaderFinished(int job, const SQLiteReadResult &result)
 {
-    return mValid;
+    if (job == mCreateJob && !result.success) {
+        mValid = false;
+        Q_EMIT Invalidated();
+        return;
+    }
+
+    if (job != mPageJob) {
+        return;
+    }
+
+    sendNextPage(parsePage(result));
+    if (--mPendingPages > 0) {
+        mPageJob = mReader->enqueue(nextPageQuery());
+    }
 }
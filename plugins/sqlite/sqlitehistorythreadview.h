@@ -26,7 +26,8 @@
 #include "filter.h"
 #include "types.h"
 #include "sort.h"
-#include <QSqlQuery>
+#include "sqlitereader.h"
+#include <QPointer>
 
 class SQLiteHistoryPlugin;
 
@@ -44,17 +45,30 @@ public:
     QList<QVariantMap> NextPage();
     bool IsValid() const;
 
+protected:
+    SQLiteReadResult execute(const QString &queryText, const QVariantMap &bindValues = QVariantMap());
+    QString nextPageQuery();
+    QList<QVariantMap> parsePage(const SQLiteReadResult &result);
+
+private Q_SLOTS:
+    void onReaderFinished(int job, const SQLiteReadResult &result);
+
 private:
     History::EventType mType;
     History::Sort mSort;
     History::Filter mFilter;
-    QSqlQuery mQuery;
-    int mPageSize;
     SQLiteHistoryPlugin *mPlugin;
     QString mTemporaryTable;
     int mOffset;
     bool mValid;
     QVariantMap mQueryProperties;
+
+    // when the database has read connections, the queries run on one of them and
+    // the pages requested over DBus are sent when they are ready
+    QPointer<SQLiteReader> mReader;
+    int mCreateJob;
+    int mPageJob;
+    int mPendingPages;
 };
 
 #endif // SQLITEHISTORYTHREADVIEW_H
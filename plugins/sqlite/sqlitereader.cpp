@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "sqlitereader.h"
+#include <QDebug>
+#include <QSqlError>
+#include <QSqlQuery>
+
+SQLiteReader::SQLiteReader(const QString &databasePath, SQLiteDatabase::StorageProfile profile, QObject *parent)
+    : QObject(parent), mWorker(new SQLiteReaderWorker(databasePath, profile)), mNextJob(0)
+{
+    qRegisterMetaType<SQLiteReadResult>();
+
+    mWorker->moveToThread(&mThread);
+    connect(&mThread, SIGNAL(finished()), mWorker, SLOT(deleteLater()));
+    connect(mWorker, SIGNAL(finished(int,SQLiteReadResult)), SIGNAL(finished(int,SQLiteReadResult)));
+    mThread.start();
+}
+
+SQLiteReader::~SQLiteReader()
+{
+    QMetaObject::invokeMethod(mWorker, "close", Qt::BlockingQueuedConnection);
+    mThread.quit();
+    mThread.wait();
+}
+
+/**
+ * @brief Queues a query to be run on the reader's thread
+ * @return the id of the job, passed to finished() together with the results
+ */
+int SQLiteReader::enqueue(const QString &queryText, const QVariantMap &bindValues)
+{
+    int job = ++mNextJob;
+    QMetaObject::invokeMethod(mWorker, "run", Qt::QueuedConnection,
+                              Q_ARG(int, job), Q_ARG(QString, queryText), Q_ARG(QVariantMap, bindValues));
+    return job;
+}
+
+/// runs a query on the reader's thread, after the queued ones, and waits for its results
+SQLiteReadResult SQLiteReader::execute(const QString &queryText, const QVariantMap &bindValues)
+{
+    SQLiteReadResult result;
+    QMetaObject::invokeMethod(mWorker, "execute", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(SQLiteReadResult, result),
+                              Q_ARG(QString, queryText), Q_ARG(QVariantMap, bindValues));
+    return result;
+}
+
+/**
+ * @brief Runs a query on the given connection and copies the resulting rows
+ *
+ * The rows are copied so that they can be used after the query is gone, possibly
+ * on another thread.
+ */
+SQLiteReadResult SQLiteReader::exec(QSqlDatabase &database, const QString &queryText, const QVariantMap &bindValues)
+{
+    SQLiteReadResult result;
+    QSqlQuery query(database);
+    query.setForwardOnly(true);
+
+    if (!query.prepare(queryText)) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return result;
+    }
+
+    Q_FOREACH(const QString &key, bindValues.keys()) {
+        query.bindValue(key, bindValues[key]);
+    }
+
+    if (!query.exec()) {
+        qCritical() << "Error:" << query.lastError() << query.lastQuery();
+        return result;
+    }
+
+    while (query.next()) {
+        result.rows << query.record();
+    }
+    result.success = true;
+    return result;
+}
+
+SQLiteReaderWorker::SQLiteReaderWorker(const QString &databasePath, SQLiteDatabase::StorageProfile profile)
+    : QObject(), mDatabasePath(databasePath), mProfile(profile)
+{
+    mConnectionName = QString("reader%1").arg(QString::number((qulonglong)this));
+}
+
+void SQLiteReaderWorker::run(int job, const QString &queryText, const QVariantMap &bindValues)
+{
+    Q_EMIT finished(job, execute(queryText, bindValues));
+}
+
+SQLiteReadResult SQLiteReaderWorker::execute(const QString &queryText, const QVariantMap &bindValues)
+{
+    if (!open()) {
+        return SQLiteReadResult();
+    }
+
+    QSqlDatabase database = QSqlDatabase::database(mConnectionName, false);
+    return SQLiteReader::exec(database, queryText, bindValues);
+}
+
+void SQLiteReaderWorker::close()
+{
+    if (!QSqlDatabase::contains(mConnectionName)) {
+        return;
+    }
+
+    QSqlDatabase::database(mConnectionName, false).close();
+    QSqlDatabase::removeDatabase(mConnectionName);
+}
+
+/// connections can only be used on the thread that created them, so this is done on the first query
+bool SQLiteReaderWorker::open()
+{
+    if (QSqlDatabase::contains(mConnectionName)) {
+        return true;
+    }
+
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", mConnectionName);
+    database.setDatabaseName(mDatabasePath);
+    database.setConnectOptions("QSQLITE_OPEN_READONLY");
+    if (!database.open()) {
+        qCritical() << "Failed to open the read connection:" << database.lastError();
+        database = QSqlDatabase();
+        QSqlDatabase::removeDatabase(mConnectionName);
+        return false;
+    }
+
+    SQLiteDatabase::registerFunctions(database);
+    SQLiteDatabase::applyStorageProfile(database, mProfile, true);
+    return true;
+}
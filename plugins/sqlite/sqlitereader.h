@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SQLITEREADER_H
+#define SQLITEREADER_H
+
+#include "sqlitedatabase.h"
+#include <QObject>
+#include <QSqlDatabase>
+#include <QSqlRecord>
+#include <QThread>
+#include <QVariantMap>
+
+struct SQLiteReadResult
+{
+    SQLiteReadResult() : success(false) { }
+
+    bool success;
+    QList<QSqlRecord> rows;
+};
+
+Q_DECLARE_METATYPE(SQLiteReadResult)
+
+class SQLiteReaderWorker;
+
+/**
+ * @brief A read-only connection to the database running its queries on its own thread
+ *
+ * The queries sent to a reader run one after the other, in the order they were sent,
+ * so temporary tables created by one query can be used by the next ones.
+ */
+class SQLiteReader : public QObject
+{
+    Q_OBJECT
+public:
+    SQLiteReader(const QString &databasePath, SQLiteDatabase::StorageProfile profile, QObject *parent = 0);
+    ~SQLiteReader();
+
+    int enqueue(const QString &queryText, const QVariantMap &bindValues = QVariantMap());
+    SQLiteReadResult execute(const QString &queryText, const QVariantMap &bindValues = QVariantMap());
+
+    static SQLiteReadResult exec(QSqlDatabase &database, const QString &queryText, const QVariantMap &bindValues = QVariantMap());
+
+Q_SIGNALS:
+    void finished(int job, const SQLiteReadResult &result);
+
+private:
+    QThread mThread;
+    SQLiteReaderWorker *mWorker;
+    int mNextJob;
+};
+
+class SQLiteReaderWorker : public QObject
+{
+    Q_OBJECT
+public:
+    SQLiteReaderWorker(const QString &databasePath, SQLiteDatabase::StorageProfile profile);
+
+public Q_SLOTS:
+    void run(int job, const QString &queryText, const QVariantMap &bindValues);
+    SQLiteReadResult execute(const QString &queryText, const QVariantMap &bindValues);
+    void close();
+
+Q_SIGNALS:
+    void finished(int job, const SQLiteReadResult &result);
+
+private:
+    bool open();
+
+    QString mDatabasePath;
+    QString mConnectionName;
+    SQLiteDatabase::StorageProfile mProfile;
+};
+
+#endif // SQLITEREADER_H
@@ -22,6 +22,12 @@
 #include "event.h"
 #include "event_p.h"
 
+// events are shared between copies and only detached when modified
+template<> History::EventPrivate *QExplicitlySharedDataPointer<History::EventPrivate>::clone()
+{
+    return d->clone();
+}
+
 namespace History
 {
 
@@ -93,7 +99,7 @@ Event::Event()
  * \param other The item to be copied;
  */
 Event::Event(const Event &other)
-    : d_ptr(other.d_ptr->clone())
+    : d_ptr(other.d_ptr)
 {
 }
 
@@ -121,7 +127,8 @@ Event& Event::operator=(const Event &other)
         return *this;
     }
 
-    d_ptr = QSharedPointer<EventPrivate>(other.d_ptr->clone());
+    d_ptr = other.d_ptr;
+    return *this;
 }
 
 /*!
@@ -187,6 +194,7 @@ bool Event::newEvent() const
  */
 void Event::setNewEvent(bool value)
 {
+    d_ptr.detach();
     Q_D(Event);
     d->newEvent = value;
 }
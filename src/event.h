@@ -23,6 +23,7 @@
 #define HISTORY_EVENT_H
 
 #include <QDateTime>
+#include <QExplicitlySharedDataPointer>
 #include <QScopedPointer>
 #include <QString>
 #include <QStringList>
@@ -62,7 +63,7 @@ public:
 
 protected:
     Event(EventPrivate &p);
-    QSharedPointer<EventPrivate> d_ptr;
+    QExplicitlySharedDataPointer<EventPrivate> d_ptr;
 };
 
 typedef QList<Event> Events;
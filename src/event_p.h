@@ -23,6 +23,7 @@
 #define HISTORY_EVENT_P_H
 
 #include <QDateTime>
+#include <QSharedData>
 #include <QString>
 #include <QStringList>
 #include "types.h"
@@ -33,18 +34,18 @@
 
 #define HISTORY_EVENT_DEFINE_COPY(Class, Type) \
     Class::Class(const Event &other) { \
-        if (other.type() == Type) { d_ptr = QSharedPointer<Class##Private>(reinterpret_cast<Class##Private*>(EventPrivate::getD(other)->clone())); } \
-        else { d_ptr = QSharedPointer<Class##Private>(new Class##Private()); } \
+        if (other.type() == Type) { d_ptr = EventPrivate::getD(other); } \
+        else { d_ptr = new Class##Private(); } \
     } \
     Class& Class::operator=(const Event &other) { \
-        if (other.type() == Type) { d_ptr = QSharedPointer<Class##Private>(reinterpret_cast<Class##Private*>(EventPrivate::getD(other)->clone())); } \
+        if (other.type() == Type) { d_ptr = EventPrivate::getD(other); } \
         return  *this; \
     }
 
 namespace History
 {
 
-class EventPrivate
+class EventPrivate : public QSharedData
 {
 public:
     EventPrivate();
@@ -69,11 +70,14 @@ public:
     bool newEvent;
     Participants participants;
 
-    static const QSharedPointer<EventPrivate>& getD(const Event& other) { return other.d_ptr; }
+    static const QExplicitlySharedDataPointer<EventPrivate>& getD(const Event& other) { return other.d_ptr; }
 
     HISTORY_EVENT_DECLARE_CLONE(Event)
 };
 
 }
 
+// the private classes are polymorphic, so detaching needs to go through clone()
+template<> History::EventPrivate *QExplicitlySharedDataPointer<History::EventPrivate>::clone();
+
 #endif // HISTORY_EVENT_P_H
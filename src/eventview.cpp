@@ -24,11 +24,16 @@
 #include "event.h"
 #include "filter.h"
 #include "manager.h"
+#include "managerdbus_p.h"
 #include "sort.h"
 #include "textevent.h"
 #include "voiceevent.h"
-#include <QDBusInterface>
-#include <QDBusReply>
+#include "wireformat_p.h"
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusPendingReply>
+#include <QDebug>
+#include <QTimer>
 
 namespace History
 {
@@ -38,55 +43,234 @@ namespace History
 EventViewPrivate::EventViewPrivate(History::EventType theType,
                                    const History::Sort &theSort,
                                    const History::Filter &theFilter)
-    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0)
+    : type(theType), sort(theSort), filter(theFilter), valid(true), pageSize(DefaultPageSize), queryWatcher(0),
+      pageWireFormat(WireFormat::VersionMap), versionWatcher(0), subscribed(false)
 {
 }
 
-Events EventViewPrivate::filteredEvents(const Events &events)
+QDBusMessage EventViewPrivate::viewCall(const QString &method) const
 {
-    bool filterNull = filter.isNull();
+    return QDBusMessage::createMethodCall(History::DBusService, objectPath, History::EventViewInterface, method);
+}
+
+QDBusMessage EventViewPrivate::pageCall(int wireFormat) const
+{
+    if (wireFormat == WireFormat::VersionMap) {
+        return viewCall("NextPage");
+    }
+
+    QDBusMessage message = viewCall("NextPageBinary");
+    message << wireFormat;
+    return message;
+}
+
+void EventViewPrivate::waitForQuery()
+{
+    if (versionWatcher) {
+        versionWatcher->waitForFinished();
+        _d_versionFinished();
+    }
+    if (queryWatcher) {
+        queryWatcher->waitForFinished();
+        _d_queryFinished();
+    }
+}
+
+void EventViewPrivate::requestPage(const EventView::PageCallback &callback)
+{
+    Q_Q(EventView);
+
+    if (!valid) {
+        QTimer::singleShot(0, q, [callback]() { callback(Events()); });
+        return;
+    }
+
+    int wireFormat = pageWireFormat;
+    QDBusPendingCall call = QDBusConnection::sessionBus().asyncCall(pageCall(wireFormat));
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, [this, callback, wireFormat](QDBusPendingCallWatcher *watcher) {
+        Events events = pageFromReply(watcher->reply(), wireFormat);
+        watcher->deleteLater();
+        callback(events);
+    });
+}
+
+Events EventViewPrivate::pageFromReply(const QDBusMessage &reply, int wireFormat)
+{
+    Q_Q(EventView);
+    Events events;
+
+    if (reply.type() != QDBusMessage::ReplyMessage) {
+        valid = false;
+        Q_EMIT q->invalidated();
+        return events;
+    }
+
+    if (wireFormat != WireFormat::VersionMap) {
+        return WireFormat::decodeEvents(QDBusPendingReply<QByteArray>(reply).value());
+    }
+
+    return eventsFromProperties(QDBusPendingReply<QList<QVariantMap> >(reply).value());
+}
 
-    Events filtered;
-    Q_FOREACH(const Event &event, events) {
-        if (event.type() != type) {
-            continue;
+Events EventViewPrivate::eventsFromProperties(const QList<QVariantMap> &eventsProperties)
+{
+    Events events;
+    Q_FOREACH(const QVariantMap &properties, eventsProperties) {
+        Event event;
+        switch (type) {
+        case EventTypeText:
+            event = TextEvent::fromProperties(properties);
+            break;
+        case EventTypeVoice:
+            event = VoiceEvent::fromProperties(properties);
+            break;
         }
 
-        if (filterNull || filter.match(event.properties())) {
-            filtered << event;
+        if (!event.isNull()) {
+            events << event;
         }
     }
 
-    return filtered;
+    return events;
 }
 
-void EventViewPrivate::_d_eventsAdded(const Events &events)
+/// connects the change signals of the view on the given path, or of all the views if it is empty
+void EventViewPrivate::connectChanges(const QString &path, const char *slot, bool connect)
 {
     Q_Q(EventView);
-
-    Events filtered = filteredEvents(events);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->eventsAdded(filtered);
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    QStringList names;
+    names << "EventsAdded" << "EventsModified" << "EventsRemoved" << "ThreadsRemoved";
+    Q_FOREACH(const QString &name, names) {
+        if (connect) {
+            connection.connect(History::DBusService, path, History::EventViewInterface, name, q, slot);
+        } else {
+            connection.disconnect(History::DBusService, path, History::EventViewInterface, name, q, slot);
+        }
     }
 }
 
-void EventViewPrivate::_d_eventsModified(const Events &events)
+void EventViewPrivate::changeSignalled(const QDBusMessage &message)
 {
     Q_Q(EventView);
+    if (message.arguments().isEmpty()) {
+        return;
+    }
 
-    Events filtered = filteredEvents(events);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->eventsModified(filtered);
+    QList<QVariantMap> items = qdbus_cast<QList<QVariantMap> >(message.arguments().first());
+    if (message.member() == "EventsAdded") {
+        Q_EMIT q->eventsAdded(eventsFromProperties(items));
+    } else if (message.member() == "EventsModified") {
+        Q_EMIT q->eventsModified(eventsFromProperties(items));
+    } else if (message.member() == "EventsRemoved") {
+        Q_EMIT q->eventsRemoved(eventsFromProperties(items));
+    } else if (message.member() == "ThreadsRemoved") {
+        Threads threads;
+        Q_FOREACH(const QVariantMap &properties, items) {
+            Thread thread = Thread::fromProperties(properties);
+            if (!thread.isNull()) {
+                threads << thread;
+            }
+        }
+        Q_EMIT q->threadsRemoved(threads);
     }
 }
 
-void EventViewPrivate::_d_eventsRemoved(const Events &events)
+void EventViewPrivate::_d_queryFinished()
 {
     Q_Q(EventView);
+    if (!queryWatcher) {
+        return;
+    }
+
+    QDBusPendingReply<QString> reply = *queryWatcher;
+    queryWatcher->deleteLater();
+    queryWatcher = 0;
+
+    if (reply.isError()) {
+        valid = false;
+        connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), false);
+    } else {
+        objectPath = reply.value();
+
+        // only the changes matching the filter of the view are signalled on its path
+        connectChanges(objectPath, SLOT(_d_viewChanged(QDBusMessage)), true);
+        Q_FOREACH(const QDBusMessage &message, queryChanges) {
+            if (message.path() == objectPath) {
+                changeSignalled(message);
+            }
+        }
+
+        // the changes signalled before the reply to a call on the view path were received
+        // through the signals of all the views, the ones after it arrive on the view path
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(viewCall("IsValid")), q);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this, watcher]() {
+            watcher->deleteLater();
+            _d_subscribed();
+        });
+
+        // sent before the pending pages so that they already use the requested size
+        if (pageSize != DefaultPageSize) {
+            QDBusConnection::sessionBus().asyncCall(viewCall("SetPageSize") << pageSize);
+        }
+    }
+    queryChanges.clear();
 
-    Events filtered = filteredEvents(events);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->eventsRemoved(filtered);
+    if (!versionWatcher) {
+        flushPendingPages();
+    }
+}
+
+void EventViewPrivate::_d_versionFinished()
+{
+    if (!versionWatcher) {
+        return;
+    }
+
+    pageWireFormat = ManagerDBus::wireFormatVersionFromReply(*versionWatcher);
+    versionWatcher->deleteLater();
+    versionWatcher = 0;
+
+    if (!queryWatcher) {
+        flushPendingPages();
+    }
+}
+
+/// requests the pages asked for before the view got created and the wire format was known
+void EventViewPrivate::flushPendingPages()
+{
+    QList<EventView::PageCallback> pages = pendingPages;
+    pendingPages.clear();
+    Q_FOREACH(const EventView::PageCallback &callback, pages) {
+        requestPage(callback);
+    }
+}
+
+void EventViewPrivate::_d_subscribed()
+{
+    subscribed = true;
+    connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), false);
+}
+
+void EventViewPrivate::_d_queryChanged(const QDBusMessage &message)
+{
+    if (subscribed) {
+        return;
+    }
+
+    // the path of the view is not known yet
+    if (objectPath.isEmpty()) {
+        queryChanges << message;
+    } else if (message.path() == objectPath) {
+        changeSignalled(message);
+    }
+}
+
+void EventViewPrivate::_d_viewChanged(const QDBusMessage &message)
+{
+    if (subscribed) {
+        changeSignalled(message);
     }
 }
 
@@ -103,80 +287,91 @@ EventView::EventView(EventType type, const History::Sort &sort, const History::F
         return;
     }
 
-    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
-
-    QDBusReply<QString> reply = interface.call("QueryEvents",
-                                               (int) type,
-                                               sort.properties(),
-                                               filter.properties());
-    if (!reply.isValid()) {
-        Q_EMIT invalidated();
-        d_ptr->valid = false;
-        return;
+    // the view could signal changes before its path is returned, so the signals of all the views
+    // are received until then
+    d_ptr->connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), true);
+
+    QDBusMessage message = QDBusMessage::createMethodCall(History::DBusService, History::DBusObjectPath,
+                                                          History::DBusInterface, "QueryEvents");
+    message << (int) type << sort.properties() << filter.properties();
+    d_ptr->queryWatcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(d_ptr->queryWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+        d_ptr->_d_queryFinished();
+    });
+
+    // the wire format of the pages is negotiated along with the query, so that the pages never wait for it
+    d_ptr->pageWireFormat = ManagerDBus::cachedWireFormatVersion();
+    if (d_ptr->pageWireFormat < 0) {
+        d_ptr->versionWatcher = new QDBusPendingCallWatcher(ManagerDBus::requestWireFormatVersion(), this);
+        connect(d_ptr->versionWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+            d_ptr->_d_versionFinished();
+        });
     }
-
-    d_ptr->objectPath = reply.value();
-    d_ptr->dbus = new QDBusInterface(History::DBusService, d_ptr->objectPath, History::EventViewInterface,
-                                     QDBusConnection::sessionBus(), this);
-
-    connect(Manager::instance(),
-            SIGNAL(eventsAdded(History::Events)),
-            SLOT(_d_eventsAdded(History::Events)));
-    connect(Manager::instance(),
-            SIGNAL(eventsModified(History::Events)),
-            SLOT(_d_eventsModified(History::Events)));
-    connect(Manager::instance(),
-            SIGNAL(eventsRemoved(History::Events)),
-            SLOT(_d_eventsRemoved(History::Events)));
-    // we don't filter thread signals
-    connect(Manager::instance(),
-            SIGNAL(threadsRemoved(History::Threads)),
-            SIGNAL(threadsRemoved(History::Threads)));
 }
 
 EventView::~EventView()
 {
     Q_D(EventView);
-    if (d->valid) {
-        d->dbus->call("Destroy");
+    if (d->queryWatcher) {
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(*d->queryWatcher, Manager::instance());
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, [](QDBusPendingCallWatcher *watcher) {
+            QDBusPendingReply<QString> reply = *watcher;
+            if (reply.isValid()) {
+                QDBusConnection::sessionBus().asyncCall(QDBusMessage::createMethodCall(History::DBusService, reply.value(),
+                                                                                       History::EventViewInterface, "Destroy"));
+            }
+            watcher->deleteLater();
+        });
+    } else if (d->valid) {
+        QDBusConnection::sessionBus().asyncCall(d->viewCall("Destroy"));
     }
 }
 
 QList<Event> EventView::nextPage()
 {
     Q_D(EventView);
-    QList<Event> events;
-
+    d->waitForQuery();
     if (!d->valid) {
-        return events;
+        return QList<Event>();
     }
 
-    QDBusReply<QList<QVariantMap> > reply = d->dbus->call("NextPage");
+    return d->pageFromReply(QDBusConnection::sessionBus().call(d->pageCall(d->pageWireFormat)), d->pageWireFormat);
+}
 
-    if (!reply.isValid()) {
-        d->valid = false;
-        Q_EMIT invalidated();
-        return events;
+/**
+ * @brief Requests the next page of events without blocking
+ *
+ * Works like ThreadView::nextPage(const PageCallback&).
+ */
+void EventView::nextPage(const PageCallback &callback)
+{
+    Q_D(EventView);
+    if (d->queryWatcher || d->versionWatcher) {
+        d->pendingPages << callback;
+        return;
     }
 
-    QList<QVariantMap> eventsProperties = reply.value();
-    Q_FOREACH(const QVariantMap &properties, eventsProperties) {
-        Event event;
-        switch (d->type) {
-        case EventTypeText:
-            event = TextEvent::fromProperties(properties);
-            break;
-        case EventTypeVoice:
-            event = VoiceEvent::fromProperties(properties);
-            break;
-        }
+    d->requestPage(callback);
+}
 
-        if (!event.isNull()) {
-            events << event;
-        }
+/**
+ * @brief Sets the number of events returned by each of the next pages
+ *
+ * The pages requested before this call keep the previous size. Sizes above
+ * MaxPageSize are clamped to it.
+ */
+void EventView::setPageSize(int size)
+{
+    Q_D(EventView);
+    if (size <= 0 || size == d->pageSize) {
+        return;
     }
 
-    return events;
+    size = qMin(size, MaxPageSize);
+    d->pageSize = size;
+    if (!d->queryWatcher && d->valid) {
+        QDBusConnection::sessionBus().asyncCall(d->viewCall("SetPageSize") << size);
+    }
 }
 
 bool EventView::isValid() const
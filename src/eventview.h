@@ -27,7 +27,9 @@
 #include "thread.h"
 #include "filter.h"
 #include "sort.h"
+#include <QDBusMessage>
 #include <QObject>
+#include <functional>
 
 namespace History
 {
@@ -39,12 +41,16 @@ class EventView : public QObject
     Q_OBJECT
     Q_DECLARE_PRIVATE(EventView)
 public:
+    typedef std::function<void(const History::Events &events)> PageCallback;
+
     EventView(History::EventType type,
               const History::Sort &sort,
               const History::Filter &filter);
     virtual ~EventView();
 
     QList<Event> nextPage();
+    void nextPage(const PageCallback &callback);
+    void setPageSize(int size);
     bool isValid() const;
 
 Q_SIGNALS:
@@ -55,9 +61,8 @@ Q_SIGNALS:
     void invalidated();
 
 private:
-    Q_PRIVATE_SLOT(d_func(), void _d_eventsAdded(const History::Events &events))
-    Q_PRIVATE_SLOT(d_func(), void _d_eventsModified(const History::Events &events))
-    Q_PRIVATE_SLOT(d_func(), void _d_eventsRemoved(const History::Events &events))
+    Q_PRIVATE_SLOT(d_func(), void _d_queryChanged(const QDBusMessage &message))
+    Q_PRIVATE_SLOT(d_func(), void _d_viewChanged(const QDBusMessage &message))
     QScopedPointer<EventViewPrivate> d_ptr;
 };
 
@@ -25,7 +25,9 @@
 #include "types.h"
 #include "filter.h"
 #include "sort.h"
-#include <QDBusInterface>
+#include "eventview.h"
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 
 namespace History
 {
@@ -44,14 +46,30 @@ namespace History
         Filter filter;
         QString objectPath;
         bool valid;
-        QDBusInterface *dbus;
+        int pageSize;
+        QDBusPendingCallWatcher *queryWatcher;
+        QList<EventView::PageCallback> pendingPages;
+        int pageWireFormat;
+        QDBusPendingCallWatcher *versionWatcher;
+        bool subscribed;
+        QList<QDBusMessage> queryChanges;
 
-        Events filteredEvents(const Events &events);
+        Events eventsFromProperties(const QList<QVariantMap> &eventsProperties);
+        QDBusMessage viewCall(const QString &method) const;
+        QDBusMessage pageCall(int wireFormat) const;
+        void waitForQuery();
+        void requestPage(const EventView::PageCallback &callback);
+        Events pageFromReply(const QDBusMessage &reply, int wireFormat);
+        void connectChanges(const QString &path, const char *slot, bool connect);
+        void changeSignalled(const QDBusMessage &message);
+        void flushPendingPages();
 
         // private slots
-        void _d_eventsAdded(const History::Events &events);
-        void _d_eventsModified(const History::Events &events);
-        void _d_eventsRemoved(const History::Events &events);
+        void _d_queryFinished();
+        void _d_versionFinished();
+        void _d_subscribed();
+        void _d_queryChanged(const QDBusMessage &message);
+        void _d_viewChanged(const QDBusMessage &message);
 
         EventView *q_ptr;
     };
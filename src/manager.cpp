@@ -29,6 +29,7 @@
 #include "threadview.h"
 #include "voiceevent.h"
 #include <QDebug>
+#include <QMetaMethod>
 #include <QDBusConnection>
 #include <QDBusConnectionInterface>
 #include <QDBusReply>
@@ -80,11 +81,13 @@ Manager::Manager()
     // watch for the service going up and down
     connect(&d->serviceWatcher, &QDBusServiceWatcher::serviceRegistered, [&](const QString &serviceName) {
         qDebug() << "HistoryService: service registered:" << serviceName;
+        ManagerDBus::resetWireFormatVersion();
         this->d_ptr->serviceRunning = true;
         Q_EMIT this->serviceRunningChanged();
     });
     connect(&d->serviceWatcher, &QDBusServiceWatcher::serviceUnregistered, [&](const QString &serviceName) {
         qDebug() << "HistoryService: service unregistered:" << serviceName;
+        ManagerDBus::resetWireFormatVersion();
         this->d_ptr->serviceRunning = false;
         Q_EMIT this->serviceRunningChanged();
     });
@@ -114,6 +117,12 @@ void Manager::markThreadsAsRead(const History::Threads &threads)
     d->dbus->markThreadsAsRead(threads);
 }
 
+/**
+ * @brief Creates a view on the threads matching the given filter
+ *
+ * The view is created on the service asynchronously, so this call does not block; use the
+ * callback version of ThreadView::nextPage() to keep the pages from blocking as well.
+ */
 ThreadViewPtr Manager::queryThreads(EventType type,
                                     const Sort &sort,
                                     const Filter &filter,
@@ -192,6 +201,100 @@ bool Manager::writeEvents(const Events &events)
     return d->dbus->writeEvents(events);
 }
 
+/**
+ * @brief Fetches a single event without blocking
+ * @param context The callback is only called while this object is alive
+ * @param callback Called with the event, or a null event if it was not found
+ */
+void Manager::getSingleEventAsync(EventType type, const QString &accountId, const QString &threadId, const QString &eventId,
+                                  QObject *context, const EventCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->getSingleEventAsync(type, accountId, threadId, eventId, context, callback);
+}
+
+void Manager::threadForParticipantsAsync(const QString &accountId,
+                                         EventType type,
+                                         const QStringList &participants,
+                                         MatchFlags matchFlags,
+                                         bool create,
+                                         QObject *context,
+                                         const ThreadCallback &callback)
+{
+    Q_D(Manager);
+
+    QVariantMap properties;
+    properties[History::FieldParticipantIds] = participants;
+    if (participants.size() == 1) {
+        properties[History::FieldChatType] = History::ChatTypeContact;
+    }
+    d->dbus->threadForPropertiesAsync(accountId, type, properties, matchFlags, create, context, callback);
+}
+
+void Manager::threadForPropertiesAsync(const QString &accountId,
+                                       EventType type,
+                                       const QVariantMap &properties,
+                                       MatchFlags matchFlags,
+                                       bool create,
+                                       QObject *context,
+                                       const ThreadCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->threadForPropertiesAsync(accountId, type, properties, matchFlags, create, context, callback);
+}
+
+void Manager::getSingleThreadAsync(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties,
+                                   QObject *context, const ThreadCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->getSingleThreadAsync(type, accountId, threadId, properties, context, callback);
+}
+
+/**
+ * @brief Writes events without blocking
+ * @param callback Called with the result of the write once the service is done
+ */
+void Manager::writeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->writeEventsAsync(events, context, callback);
+}
+
+/**
+ * @brief Fetches the participants of the given threads without blocking
+ * @param callback Called with the threads filled with their participants
+ *
+ * Unlike requestThreadParticipants(), the result only goes to the callback and
+ * @ref threadParticipantsChanged is not emitted.
+ */
+void Manager::requestThreadParticipantsAsync(const Threads &threads, QObject *context, const ThreadsCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->requestThreadParticipantsAsync(threads, context, callback);
+}
+
+/**
+ * @brief Removes threads without blocking
+ * @param callback Called with the result of the removal once the service is done
+ */
+void Manager::removeThreadsAsync(const Threads &threads, QObject *context, const ResultCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->removeThreadsAsync(threads, context, callback);
+}
+
+void Manager::removeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->removeEventsAsync(events, context, callback);
+}
+
+void Manager::markThreadsAsReadAsync(const Threads &threads, QObject *context, const ResultCallback &callback)
+{
+    Q_D(Manager);
+    d->dbus->markThreadsAsReadAsync(threads, context, callback);
+}
+
 bool Manager::removeThreads(const Threads &threads)
 {
     Q_D(Manager);
@@ -204,6 +307,12 @@ bool Manager::removeEvents(const Events &events)
     return d->dbus->removeEvents(events);
 }
 
+void Manager::connectNotify(const QMetaMethod &signal)
+{
+    Q_D(Manager);
+    d->dbus->listenTo(signal.name());
+}
+
 bool Manager::isServiceRunning() const
 {
     Q_D(const Manager);
@@ -24,6 +24,7 @@
 
 #include <QObject>
 #include <QString>
+#include <functional>
 #include "types.h"
 #include "event.h"
 #include "filter.h"
@@ -35,6 +36,11 @@ namespace History
 
 class ManagerPrivate;
 
+typedef std::function<void(const History::Thread &thread)> ThreadCallback;
+typedef std::function<void(const History::Threads &threads)> ThreadsCallback;
+typedef std::function<void(const History::Event &event)> EventCallback;
+typedef std::function<void(bool success)> ResultCallback;
+
 class Manager : public QObject
 {
     Q_OBJECT
@@ -70,6 +76,32 @@ public:
     Thread getSingleThread(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties = QVariantMap());
 
     bool writeEvents(const History::Events &events);
+
+    // asynchronous variants of the calls above, the callback is dropped if the context object goes away first
+    void getSingleEventAsync(EventType type, const QString &accountId, const QString &threadId, const QString &eventId,
+                             QObject *context, const EventCallback &callback);
+    void threadForParticipantsAsync(const QString &accountId,
+                                    EventType type,
+                                    const QStringList &participants,
+                                    History::MatchFlags matchFlags,
+                                    bool create,
+                                    QObject *context,
+                                    const ThreadCallback &callback);
+    void threadForPropertiesAsync(const QString &accountId,
+                                  EventType type,
+                                  const QVariantMap &properties,
+                                  History::MatchFlags matchFlags,
+                                  bool create,
+                                  QObject *context,
+                                  const ThreadCallback &callback);
+    void getSingleThreadAsync(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties,
+                              QObject *context, const ThreadCallback &callback);
+    void writeEventsAsync(const History::Events &events, QObject *context, const ResultCallback &callback);
+    void requestThreadParticipantsAsync(const History::Threads &threads, QObject *context, const ThreadsCallback &callback);
+    void removeThreadsAsync(const Threads &threads, QObject *context, const ResultCallback &callback);
+    void removeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback);
+    void markThreadsAsReadAsync(const History::Threads &threads, QObject *context, const ResultCallback &callback);
+
     bool removeThreads(const Threads &threads);
     bool removeEvents(const Events &events);
 
@@ -89,6 +121,9 @@ Q_SIGNALS:
 
     void serviceRunningChanged();
 
+protected:
+    void connectNotify(const QMetaMethod &signal) override;
+
 private:
     Manager();
     QScopedPointer<ManagerPrivate> d_ptr;
@@ -25,8 +25,11 @@
 #include "thread.h"
 #include "textevent.h"
 #include "voiceevent.h"
+#include "wireformat_p.h"
 #include <QDBusReply>
 #include <QDBusMetaType>
+#include <QDBusPendingReply>
+#include <QTimer>
 
 #include <QDebug>
 
@@ -35,6 +38,11 @@ Q_DECLARE_METATYPE(QList< QVariantMap >)
 namespace History
 {
 
+// the wire format agreed with the running service, -1 when not negotiated yet
+static int negotiatedWireFormat = -1;
+// the negotiation in progress, shared by the views created before it is done
+static QDBusPendingCall *wireFormatCall = 0;
+
 ManagerDBus::ManagerDBus(QObject *parent) :
     QObject(parent), mAdaptor(0), mInterface(DBusService,
                                              DBusObjectPath,
@@ -42,28 +50,51 @@ ManagerDBus::ManagerDBus(QObject *parent) :
 {
     qDBusRegisterMetaType<QList<QVariantMap> >();
     qRegisterMetaType<QList<QVariantMap> >();
+}
+
+/**
+ * @brief Starts listening to the service wide signal behind the given Manager signal
+ *
+ * Views get their changes on their own object paths, so the service wide signals are only
+ * listened to once someone connects to the Manager signals. This keeps processes that only
+ * hold views from being woken up by every change in the database.
+ */
+void ManagerDBus::listenTo(const QByteArray &managerSignal)
+{
+    if (mListening.contains(managerSignal)) {
+        return;
+    }
 
-    // listen for signals coming from the bus
     QDBusConnection connection = QDBusConnection::sessionBus();
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsAdded",
-                       this, SLOT(onThreadsAdded(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsModified",
-                       this, SLOT(onThreadsModified(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsRemoved",
-                       this, SLOT(onThreadsRemoved(QList<QVariantMap>)));
-
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadParticipantsChanged",
-                       this, SLOT(onThreadParticipantsChanged(QVariantMap,
-                                                        QList<QVariantMap>,
-                                                        QList<QVariantMap>,
-                                                        QList<QVariantMap>)));
-
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsAdded",
-                       this, SLOT(onEventsAdded(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsModified",
-                       this, SLOT(onEventsModified(QList<QVariantMap>)));
-    connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsRemoved",
-                       this, SLOT(onEventsRemoved(QList<QVariantMap>)));
+    if (managerSignal == "threadsAdded") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsAdded",
+                           this, SLOT(onThreadsAdded(QList<QVariantMap>)));
+    } else if (managerSignal == "threadsModified") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsModified",
+                           this, SLOT(onThreadsModified(QList<QVariantMap>)));
+    } else if (managerSignal == "threadsRemoved") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadsRemoved",
+                           this, SLOT(onThreadsRemoved(QList<QVariantMap>)));
+    } else if (managerSignal == "threadParticipantsChanged") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "ThreadParticipantsChanged",
+                           this, SLOT(onThreadParticipantsChanged(QVariantMap,
+                                                                  QList<QVariantMap>,
+                                                                  QList<QVariantMap>,
+                                                                  QList<QVariantMap>)));
+    } else if (managerSignal == "eventsAdded") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsAdded",
+                           this, SLOT(onEventsAdded(QList<QVariantMap>)));
+    } else if (managerSignal == "eventsModified") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsModified",
+                           this, SLOT(onEventsModified(QList<QVariantMap>)));
+    } else if (managerSignal == "eventsRemoved") {
+        connection.connect(DBusService, DBusObjectPath, DBusInterface, "EventsRemoved",
+                           this, SLOT(onEventsRemoved(QList<QVariantMap>)));
+    } else {
+        return;
+    }
+
+    mListening << managerSignal;
 }
 
 Thread ManagerDBus::threadForParticipants(const QString &accountId,
@@ -95,7 +126,6 @@ Thread ManagerDBus::threadForProperties(const QString &accountId,
                                         bool create)
 {
     Thread thread;
-    // FIXME: move to async call if possible
     QDBusReply<QVariantMap> reply = mInterface.call("ThreadForProperties", accountId, (int) type, properties, (int)matchFlags, create);
     if (reply.isValid()) {
         QVariantMap properties = reply.value();
@@ -188,6 +218,214 @@ Event ManagerDBus::getSingleEvent(EventType type, const QString &accountId, cons
     return event;
 }
 
+void ManagerDBus::threadForPropertiesAsync(const QString &accountId,
+                                           EventType type,
+                                           const QVariantMap &properties,
+                                           MatchFlags matchFlags,
+                                           bool create,
+                                           QObject *context,
+                                           const ThreadCallback &callback)
+{
+    QDBusPendingCall call = mInterface.asyncCall("ThreadForProperties", accountId, (int) type, properties, (int)matchFlags, create);
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        callback(reply.isValid() ? Thread::fromProperties(reply.value()) : Thread());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::writeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback)
+{
+    QList<QVariantMap> eventMap = eventsToProperties(events);
+    if (eventMap.isEmpty()) {
+        QTimer::singleShot(0, context ? context : this, [callback]() { callback(false); });
+        return;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("WriteEvents", QVariant::fromValue(eventMap));
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<bool> reply = *watcher;
+        callback(reply.isValid() && reply.value());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::getSingleThreadAsync(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties,
+                                       QObject *context, const ThreadCallback &callback)
+{
+    QDBusPendingCall call = mInterface.asyncCall("GetSingleThread", (int)type, accountId, threadId, properties);
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        callback(reply.isValid() ? Thread::fromProperties(reply.value()) : Thread());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::getSingleEventAsync(EventType type, const QString &accountId, const QString &threadId, const QString &eventId,
+                                      QObject *context, const EventCallback &callback)
+{
+    QDBusPendingCall call = mInterface.asyncCall("GetSingleEvent", (int)type, accountId, threadId, eventId);
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [this, callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QVariantMap> reply = *watcher;
+        callback(reply.isValid() ? eventFromProperties(reply.value()) : Event());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::requestThreadParticipantsAsync(const Threads &threads, QObject *context, const ThreadsCallback &callback)
+{
+    QList<QVariantMap> ids;
+    Q_FOREACH(const Thread &thread, threads) {
+        QVariantMap id;
+        id[History::FieldAccountId] = thread.accountId();
+        id[History::FieldThreadId] = thread.threadId();
+        id[History::FieldType] = thread.type();
+        ids << id;
+    }
+    if (ids.isEmpty()) {
+        QTimer::singleShot(0, context ? context : this, [callback]() { callback(Threads()); });
+        return;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("ParticipantsForThreads", QVariant::fromValue(ids));
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [this, callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<QList<QVariantMap> > reply = *watcher;
+        callback(reply.isValid() ? threadsFromProperties(reply.value()) : Threads());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::removeThreadsAsync(const Threads &threads, QObject *context, const ResultCallback &callback)
+{
+    QList<QVariantMap> threadMap = threadsToProperties(threads);
+    if (threadMap.isEmpty()) {
+        QTimer::singleShot(0, context ? context : this, [callback]() { callback(false); });
+        return;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("RemoveThreads", QVariant::fromValue(threadMap));
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<bool> reply = *watcher;
+        callback(reply.isValid() && reply.value());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::removeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback)
+{
+    QList<QVariantMap> eventMap = eventsToProperties(events);
+    if (eventMap.isEmpty()) {
+        QTimer::singleShot(0, context ? context : this, [callback]() { callback(false); });
+        return;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("RemoveEvents", QVariant::fromValue(eventMap));
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<bool> reply = *watcher;
+        callback(reply.isValid() && reply.value());
+        watcher->deleteLater();
+    });
+}
+
+void ManagerDBus::markThreadsAsReadAsync(const Threads &threads, QObject *context, const ResultCallback &callback)
+{
+    QList<QVariantMap> threadMap = threadsToProperties(threads);
+    if (threadMap.isEmpty()) {
+        QTimer::singleShot(0, context ? context : this, [callback]() { callback(false); });
+        return;
+    }
+
+    QDBusPendingCall call = mInterface.asyncCall("MarkThreadsAsRead", QVariant::fromValue(threadMap));
+    connect(watchCall(call, context), &QDBusPendingCallWatcher::finished, [callback](QDBusPendingCallWatcher *watcher) {
+        QDBusPendingReply<> reply = *watcher;
+        callback(!reply.isError());
+        watcher->deleteLater();
+    });
+}
+
+/**
+ * @brief Watches a pending call on behalf of the given context object
+ *
+ * The watcher is a child of the context, so the reply is ignored if the context is
+ * destroyed before it arrives.
+ */
+QDBusPendingCallWatcher *ManagerDBus::watchCall(const QDBusPendingCall &call, QObject *context)
+{
+    return new QDBusPendingCallWatcher(call, context ? context : this);
+}
+
+/**
+ * @brief Negotiate the wire format to use when fetching pages from the service views.
+ *
+ * The result is cached until the service goes away; services that do not know about
+ * wire formats get the a{sv} map form. This blocks until the service replies, the
+ * asynchronous page requests use requestWireFormatVersion() instead.
+ * @return The highest wire format version both sides support.
+ */
+int ManagerDBus::wireFormatVersion()
+{
+    if (negotiatedWireFormat >= 0) {
+        return negotiatedWireFormat;
+    }
+
+    QDBusMessage message = QDBusMessage::createMethodCall(DBusService, DBusObjectPath, DBusInterface, "WireFormatVersion");
+    return wireFormatVersionFromReply(QDBusPendingReply<int>(QDBusConnection::sessionBus().call(message)));
+}
+
+/// the negotiated wire format, or -1 if it was not negotiated yet
+int ManagerDBus::cachedWireFormatVersion()
+{
+    return negotiatedWireFormat;
+}
+
+/**
+ * @brief Starts negotiating the wire format without blocking
+ *
+ * The calls made while a negotiation is in progress share it. Pass the reply to
+ * wireFormatVersionFromReply() once it arrives.
+ */
+QDBusPendingCall ManagerDBus::requestWireFormatVersion()
+{
+    if (!wireFormatCall) {
+        QDBusMessage message = QDBusMessage::createMethodCall(DBusService, DBusObjectPath, DBusInterface, "WireFormatVersion");
+        wireFormatCall = new QDBusPendingCall(QDBusConnection::sessionBus().asyncCall(message));
+    }
+    return *wireFormatCall;
+}
+
+/**
+ * @brief Caches the wire format from a finished negotiation
+ * @return The negotiated version, or the a{sv} map form if the service could not be reached,
+ * in which case the next view tries again.
+ */
+int ManagerDBus::wireFormatVersionFromReply(const QDBusPendingCall &call)
+{
+    delete wireFormatCall;
+    wireFormatCall = 0;
+
+    QDBusPendingReply<int> reply = call;
+    if (reply.isValid()) {
+        negotiatedWireFormat = qMin(reply.value(), (int)WireFormat::CurrentVersion);
+        if (!WireFormat::isSupported(negotiatedWireFormat)) {
+            negotiatedWireFormat = WireFormat::VersionMap;
+        }
+    } else if (reply.error().type() == QDBusError::UnknownMethod) {
+        negotiatedWireFormat = WireFormat::VersionMap;
+    } else {
+        // the service is not reachable right now, try again next time
+        return WireFormat::VersionMap;
+    }
+
+    return negotiatedWireFormat;
+}
+
+void ManagerDBus::resetWireFormatVersion()
+{
+    negotiatedWireFormat = -1;
+    delete wireFormatCall;
+    wireFormatCall = 0;
+}
+
 void ManagerDBus::onThreadsAdded(const QList<QVariantMap> &threads)
 {
     Q_EMIT threadsAdded(threadsFromProperties(threads));
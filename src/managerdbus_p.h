@@ -23,9 +23,12 @@
 #define MANAGERDBUS_P_H
 
 #include <QDBusInterface>
+#include <QDBusPendingCallWatcher>
 #include <QObject>
+#include <QSet>
 #include "types.h"
 #include "event.h"
+#include "manager.h"
 #include "thread.h"
 
 class HistoryServiceAdaptor;
@@ -58,6 +61,31 @@ public:
     Event getSingleEvent(EventType type, const QString &accountId, const QString &threadId, const QString &eventId);
     void markThreadsAsRead(const History::Threads &threads);
 
+    void threadForPropertiesAsync(const QString &accountId,
+                                  EventType type,
+                                  const QVariantMap &properties,
+                                  History::MatchFlags matchFlags,
+                                  bool create,
+                                  QObject *context,
+                                  const ThreadCallback &callback);
+    void writeEventsAsync(const History::Events &events, QObject *context, const ResultCallback &callback);
+    void getSingleThreadAsync(EventType type, const QString &accountId, const QString &threadId, const QVariantMap &properties,
+                              QObject *context, const ThreadCallback &callback);
+    void getSingleEventAsync(EventType type, const QString &accountId, const QString &threadId, const QString &eventId,
+                             QObject *context, const EventCallback &callback);
+    void requestThreadParticipantsAsync(const History::Threads &threads, QObject *context, const ThreadsCallback &callback);
+    void removeThreadsAsync(const Threads &threads, QObject *context, const ResultCallback &callback);
+    void removeEventsAsync(const Events &events, QObject *context, const ResultCallback &callback);
+    void markThreadsAsReadAsync(const History::Threads &threads, QObject *context, const ResultCallback &callback);
+
+    void listenTo(const QByteArray &managerSignal);
+
+    static int wireFormatVersion();
+    static int cachedWireFormatVersion();
+    static QDBusPendingCall requestWireFormatVersion();
+    static int wireFormatVersionFromReply(const QDBusPendingCall &call);
+    static void resetWireFormatVersion();
+
 Q_SIGNALS:
     // signals that will be triggered after processing bus signals
     void threadsAdded(const History::Threads &threads);
@@ -85,6 +113,8 @@ protected Q_SLOTS:
     void onEventsRemoved(const QList<QVariantMap> &events);
 
 protected:
+    QDBusPendingCallWatcher *watchCall(const QDBusPendingCall &call, QObject *context);
+
     Threads threadsFromProperties(const QList<QVariantMap> &threadsProperties);
     QList<QVariantMap> threadsToProperties(const Threads &threads);
 
@@ -95,6 +125,7 @@ protected:
 private:
     HistoryServiceAdaptor *mAdaptor;
     QDBusInterface mInterface;
+    QSet<QByteArray> mListening;
 };
 
 }
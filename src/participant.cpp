@@ -59,7 +59,7 @@ Participant::Participant(const QString &accountId, const QString &identifier, co
 }
 
 Participant::Participant(const Participant &other)
-    : d_ptr(new ParticipantPrivate(*other.d_ptr))
+    : d_ptr(other.d_ptr)
 {
 }
 
@@ -68,7 +68,7 @@ Participant &Participant::operator=(const Participant &other)
     if (&other == this) {
         return *this;
     }
-    d_ptr = QSharedPointer<ParticipantPrivate>(new ParticipantPrivate(*other.d_ptr));
+    d_ptr = other.d_ptr;
     return *this;
 }
 
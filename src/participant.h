@@ -24,7 +24,7 @@
 
 #include <QDBusArgument>
 #include <QList>
-#include <QSharedPointer>
+#include <QExplicitlySharedDataPointer>
 #include <QString>
 #include <QVariantList>
 #include <QVariantMap>
@@ -69,7 +69,7 @@ public:
     static Participant fromProperties(const QVariantMap &properties);
 
 protected:
-    QSharedPointer<ParticipantPrivate> d_ptr;
+    QExplicitlySharedDataPointer<ParticipantPrivate> d_ptr;
 };
 
 // define the participants list with toVariantList() and fromVariantList() helpers
@@ -22,6 +22,7 @@
 #ifndef HISTORY_PARTICIPANT_P_H
 #define HISTORY_PARTICIPANT_P_H
 
+#include <QSharedData>
 #include <QString>
 #include <QVariantMap>
 
@@ -30,7 +31,7 @@ namespace History
 
 class Participant;
 
-class ParticipantPrivate
+class ParticipantPrivate : public QSharedData
 {
 public:
     explicit ParticipantPrivate();
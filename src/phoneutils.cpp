@@ -27,12 +27,35 @@
 #include <phonenumbers/phonenumbermatcher.h>
 #include <phonenumbers/phonenumberutil.h>
 
+#include <QCache>
 #include <QLocale>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QDebug>
 
 namespace History
 {
 
+// numbers are only compared by libphonenumber when they have at least this many digits,
+// so that is also the size of the key used to find matching candidates
+static const int matchKeyLength = 7;
+
+// the number of parsed identifiers kept in memory
+static const int parseCacheSize = 1000;
+
+struct ParsedPhoneNumber
+{
+    bool isPhoneNumber;
+    QString normalized;
+    // the digits of the national significant number, empty if the identifier could not be parsed
+    QString nationalNumber;
+};
+
+static QMutex parseCacheMutex;
+static QCache<QString, ParsedPhoneNumber> parseCache(parseCacheSize);
+static int parseCacheHits = 0;
+static int parseCacheMisses = 0;
+
 PhoneUtils::PhoneUtils(QObject *parent) :
     QObject(parent)
 {
@@ -40,24 +63,25 @@ PhoneUtils::PhoneUtils(QObject *parent) :
 
 QString PhoneUtils::region()
 {
-    QString countryCode = QLocale::system().name().split("_").last();
-    if (countryCode.size() < 2) {
-        // fallback to US if no valid country code was provided, otherwise libphonenumber
-        // will fail to parse any numbers
-        return QString("US");
-    }
-    return countryCode;
+    // the system locale does not change while the process runs, so there is no need
+    // to query it every time a number is parsed
+    static const QString region = [] {
+        QString countryCode = QLocale::system().name().split("_").last();
+        if (countryCode.size() < 2) {
+            // fallback to US if no valid country code was provided, otherwise libphonenumber
+            // will fail to parse any numbers
+            return QString("US");
+        }
+        return countryCode;
+    }();
+    return region;
 }
 
 QString PhoneUtils::normalizePhoneNumber(const QString &phoneNumber)
 {
-    static i18n::phonenumbers::PhoneNumberUtil *phonenumberUtil = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
-    if (!isPhoneNumber(phoneNumber)) {
-        return phoneNumber;
-    }
-    std::string number = phoneNumber.toStdString();
-    phonenumberUtil->NormalizeDiallableCharsOnly(&number);
-    return QString::fromStdString(number);
+    QString normalized;
+    parsePhoneNumber(phoneNumber, &normalized);
+    return normalized;
 }
 
 bool PhoneUtils::comparePhoneNumbers(const QString &phoneNumberA, const QString &phoneNumberB)
@@ -91,9 +115,97 @@ bool PhoneUtils::compareNormalizedPhoneNumbers(const QString &numberA, const QSt
     return (match > i18n::phonenumbers::PhoneNumberUtil::NO_MATCH);
 }
 
+/**
+ * @brief Computes a key that is shared by all the phone numbers libphonenumber considers a match
+ *
+ * The key is made of the last digits of the national significant number, so it does not depend
+ * on the country code, the national prefix or the formatting used to write the number.
+ * @param phoneNumber the normalized phone number
+ * @return the key, an empty string if the number is too short to have a reliable key or
+ * a null string if the identifier has no digits at all
+ */
+QString PhoneUtils::phoneNumberMatchKey(const QString &phoneNumber)
+{
+    QString digits;
+
+    // the number is parsed through the cache, as keys are computed for every row of the models
+    if (!parsePhoneNumber(phoneNumber, 0, &digits)) {
+        Q_FOREACH(const QChar &character, phoneNumber) {
+            if (character.isDigit()) {
+                digits += character;
+            }
+        }
+        if (digits.isEmpty()) {
+            return QString::null;
+        }
+    }
+
+    if (digits.size() < matchKeyLength) {
+        return QString("");
+    }
+    return digits.right(matchKeyLength);
+}
+
 bool PhoneUtils::isPhoneNumber(const QString &phoneNumber)
 {
+    return parsePhoneNumber(phoneNumber);
+}
+
+int PhoneUtils::cacheHits()
+{
+    QMutexLocker locker(&parseCacheMutex);
+    return parseCacheHits;
+}
+
+int PhoneUtils::cacheMisses()
+{
+    QMutexLocker locker(&parseCacheMutex);
+    return parseCacheMisses;
+}
+
+void PhoneUtils::clearCache()
+{
+    QMutexLocker locker(&parseCacheMutex);
+    parseCache.clear();
+    parseCacheHits = 0;
+    parseCacheMisses = 0;
+}
+
+/**
+ * @brief Parses the given identifier, reusing the result of previous calls when possible
+ *
+ * The results are kept in a bounded cache that evicts the least recently used entries.
+ * @param phoneNumber the identifier to parse
+ * @param normalized if not null, receives the normalized number, or the identifier itself
+ * if it is not a phone number
+ * @param nationalNumber if not null, receives the digits of the national significant number
+ * @return whether the identifier is a phone number
+ */
+bool PhoneUtils::parsePhoneNumber(const QString &phoneNumber, QString *normalized, QString *nationalNumber)
+{
+    QString key = region() + ":" + phoneNumber;
+    {
+        QMutexLocker locker(&parseCacheMutex);
+        ParsedPhoneNumber *cached = parseCache.object(key);
+        if (cached) {
+            parseCacheHits++;
+            if (normalized) {
+                *normalized = cached->normalized;
+            }
+            if (nationalNumber) {
+                *nationalNumber = cached->nationalNumber;
+            }
+            return cached->isPhoneNumber;
+        }
+        parseCacheMisses++;
+    }
+
+    // parse the number without holding the lock, as that is the expensive part
     static i18n::phonenumbers::PhoneNumberUtil *phonenumberUtil = i18n::phonenumbers::PhoneNumberUtil::GetInstance();
+    ParsedPhoneNumber *parsed = new ParsedPhoneNumber;
+    parsed->isPhoneNumber = false;
+    parsed->normalized = phoneNumber;
+
     i18n::phonenumbers::PhoneNumber number;
     i18n::phonenumbers::PhoneNumberUtil::ErrorType error;
     error = phonenumberUtil->Parse(phoneNumber.toStdString(), region().toStdString(), &number);
@@ -101,19 +213,36 @@ bool PhoneUtils::isPhoneNumber(const QString &phoneNumber)
     switch(error) {
     case i18n::phonenumbers::PhoneNumberUtil::INVALID_COUNTRY_CODE_ERROR:
         qWarning() << "Invalid country code for:" << phoneNumber;
-        return false;
+        break;
     case i18n::phonenumbers::PhoneNumberUtil::NOT_A_NUMBER:
         qWarning() << "The phone number is not a valid number:" << phoneNumber;
-        return false;
+        break;
     case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_AFTER_IDD:
     case i18n::phonenumbers::PhoneNumberUtil::TOO_SHORT_NSN:
     case i18n::phonenumbers::PhoneNumberUtil::TOO_LONG_NSN:
         qWarning() << "Invalid phone number" << phoneNumber;
-        return false;
-    default:
+        break;
+    default: {
+        parsed->isPhoneNumber = true;
+        std::string normalizedNumber = phoneNumber.toStdString();
+        phonenumberUtil->NormalizeDiallableCharsOnly(&normalizedNumber);
+        parsed->normalized = QString::fromStdString(normalizedNumber);
+        parsed->nationalNumber = QString::number(number.national_number());
         break;
     }
-    return true;
+    }
+
+    bool isPhoneNumber = parsed->isPhoneNumber;
+    if (normalized) {
+        *normalized = parsed->normalized;
+    }
+    if (nationalNumber) {
+        *nationalNumber = parsed->nationalNumber;
+    }
+
+    QMutexLocker locker(&parseCacheMutex);
+    parseCache.insert(key, parsed);
+    return isPhoneNumber;
 }
 
 }
@@ -38,8 +38,15 @@ public:
     Q_INVOKABLE static bool compareNormalizedPhoneNumbers(const QString &numberA, const QString &numberB);
     Q_INVOKABLE static bool isPhoneNumber(const QString &identifier);
     Q_INVOKABLE static QString normalizePhoneNumber(const QString &identifier);
+    static QString phoneNumberMatchKey(const QString &phoneNumber);
+
+    // statistics of the cache of parsed identifiers
+    static int cacheHits();
+    static int cacheMisses();
+    static void clearCache();
 private:
     static QString region();
+    static bool parsePhoneNumber(const QString &phoneNumber, QString *normalized = 0, QString *nationalNumber = 0);
 };
 
 }
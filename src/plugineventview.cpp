@@ -23,6 +23,7 @@
 #include "plugineventview_p.h"
 #include "plugineventviewadaptor.h"
 #include "types.h"
+#include "wireformat_p.h"
 #include <QDBusConnection>
 #include <QDebug>
 
@@ -31,10 +32,31 @@ Q_DECLARE_METATYPE(QList< QVariantMap >)
 namespace History {
 
 PluginEventViewPrivate::PluginEventViewPrivate()
-    : adaptor(0)
+    : adaptor(0), requestedVersion(WireFormat::VersionMap), pageSize(DefaultPageSize), subscribed(false), type(EventTypeNull)
 {
 }
 
+QList<QVariantMap> PluginEventViewPrivate::filtered(const QList<QVariantMap> &items) const
+{
+    QList<QVariantMap> result;
+    if (!subscribed) {
+        return result;
+    }
+
+    bool filterNull = filter.isNull();
+    Q_FOREACH(const QVariantMap &item, items) {
+        if (item[FieldType].toInt() != type) {
+            continue;
+        }
+
+        if (filterNull || filter.match(item)) {
+            result << item;
+        }
+    }
+
+    return result;
+}
+
 PluginEventView::PluginEventView(QObject *parent) :
     QObject(parent), d_ptr(new PluginEventViewPrivate())
 {
@@ -51,6 +73,11 @@ PluginEventView::PluginEventView(QObject *parent) :
 PluginEventView::~PluginEventView()
 {
     Q_D(PluginEventView);
+    // callers waiting for a delayed page would otherwise only get a timeout
+    while (!d->pendingPages.isEmpty()) {
+        QDBusMessage call = d->pendingPages.takeFirst().message;
+        QDBusConnection::sessionBus().send(call.createErrorReply(QDBusError::Failed, "The view was destroyed"));
+    }
     QDBusConnection::sessionBus().unregisterObject(d->objectPath);
 }
 
@@ -60,15 +87,135 @@ void PluginEventView::Destroy()
     deleteLater();
 }
 
+QByteArray PluginEventView::NextPageBinary(int version)
+{
+    if (version == WireFormat::VersionMap || !WireFormat::isSupported(version)) {
+        sendErrorReply(QDBusError::NotSupported, QString("Unsupported wire format version %1").arg(version));
+        return QByteArray();
+    }
+
+    Q_D(PluginEventView);
+    d->requestedVersion = version;
+    QList<QVariantMap> page = NextPage();
+    d->requestedVersion = WireFormat::VersionMap;
+
+    // the page is going to be sent by sendNextPage()
+    if (isDelayedReply()) {
+        return QByteArray();
+    }
+    return WireFormat::encodeEvents(page, version);
+}
+
+/// same as PluginThreadView::delayNextPage(): the page is sent later with sendNextPage()
+void PluginEventView::delayNextPage()
+{
+    Q_D(PluginEventView);
+    setDelayedReply(true);
+    PluginEventViewPrivate::PendingPage page = {message(), d->requestedVersion, d->pageSize};
+    d->pendingPages << page;
+}
+
+void PluginEventView::sendNextPage(const QList<QVariantMap> &page)
+{
+    Q_D(PluginEventView);
+    if (d->pendingPages.isEmpty()) {
+        qWarning() << "No pending call to send the page to";
+        return;
+    }
+
+    PluginEventViewPrivate::PendingPage call = d->pendingPages.takeFirst();
+    QVariant reply;
+    if (call.version == WireFormat::VersionMap) {
+        reply = QVariant::fromValue(page);
+    } else {
+        reply = WireFormat::encodeEvents(page, call.version);
+    }
+    QDBusConnection::sessionBus().send(call.message.createReply(reply));
+}
+
 bool PluginEventView::IsValid() const
 {
     return true;
 }
 
+/**
+ * @brief Sets the number of items returned by the next pages
+ *
+ * The pages already requested keep the size they were requested with, even if they
+ * are still waiting to be fetched. Sizes above MaxPageSize are clamped to it.
+ */
+void PluginEventView::SetPageSize(int size)
+{
+    Q_D(PluginEventView);
+    if (size <= 0) {
+        qWarning() << "Invalid page size:" << size;
+        return;
+    }
+    if (size > MaxPageSize) {
+        qWarning() << "Page size" << size << "is too big, using" << MaxPageSize;
+        size = MaxPageSize;
+    }
+    d->pageSize = size;
+}
+
+/// the size of the next page to be returned: the oldest one waiting, or else the current page size
+int PluginEventView::pageSize() const
+{
+    Q_D(const PluginEventView);
+    if (!d->pendingPages.isEmpty()) {
+        return d->pendingPages.first().pageSize;
+    }
+    return d->pageSize;
+}
+
 QString PluginEventView::objectPath() const
 {
     Q_D(const PluginEventView);
     return d->objectPath;
 }
 
+/// see PluginThreadView::setFilter()
+void PluginEventView::setFilter(EventType type, const Filter &filter)
+{
+    Q_D(PluginEventView);
+    d->subscribed = true;
+    d->type = type;
+    d->filter = filter;
+}
+
+void PluginEventView::notifyEventsAdded(const QList<QVariantMap> &events)
+{
+    Q_D(PluginEventView);
+    QList<QVariantMap> matching = d->filtered(events);
+    if (!matching.isEmpty()) {
+        Q_EMIT EventsAdded(matching);
+    }
+}
+
+void PluginEventView::notifyEventsModified(const QList<QVariantMap> &events)
+{
+    Q_D(PluginEventView);
+    QList<QVariantMap> matching = d->filtered(events);
+    if (!matching.isEmpty()) {
+        Q_EMIT EventsModified(matching);
+    }
+}
+
+void PluginEventView::notifyEventsRemoved(const QList<QVariantMap> &events)
+{
+    Q_D(PluginEventView);
+    QList<QVariantMap> matching = d->filtered(events);
+    if (!matching.isEmpty()) {
+        Q_EMIT EventsRemoved(matching);
+    }
+}
+
+void PluginEventView::notifyThreadsRemoved(const QList<QVariantMap> &threads)
+{
+    Q_D(PluginEventView);
+    if (d->subscribed) {
+        Q_EMIT ThreadsRemoved(threads);
+    }
+}
+
 }
@@ -26,6 +26,8 @@
 #include <QDBusContext>
 #include <QScopedPointer>
 #include <QVariantMap>
+#include "filter.h"
+#include "types.h"
 
 namespace History {
 
@@ -41,14 +43,32 @@ public:
 
     // DBus exposed methods
     Q_NOREPLY void Destroy();
+    Q_NOREPLY void SetPageSize(int size);
     virtual QList<QVariantMap> NextPage() = 0;
+    QByteArray NextPageBinary(int version);
     virtual bool IsValid() const;
 
     // other methods
     QString objectPath() const;
+    int pageSize() const;
+    void setFilter(EventType type, const Filter &filter);
+
+public Q_SLOTS:
+    void notifyEventsAdded(const QList<QVariantMap> &events);
+    void notifyEventsModified(const QList<QVariantMap> &events);
+    void notifyEventsRemoved(const QList<QVariantMap> &events);
+    void notifyThreadsRemoved(const QList<QVariantMap> &threads);
+
+protected:
+    void delayNextPage();
+    void sendNextPage(const QList<QVariantMap> &page);
 
 Q_SIGNALS:
     void Invalidated();
+    void EventsAdded(const QList<QVariantMap> &events);
+    void EventsModified(const QList<QVariantMap> &events);
+    void EventsRemoved(const QList<QVariantMap> &events);
+    void ThreadsRemoved(const QList<QVariantMap> &threads);
 
 private:
     QScopedPointer<PluginEventViewPrivate> d_ptr;
@@ -22,7 +22,11 @@
 #ifndef PLUGINEVENTVIEW_P_H
 #define PLUGINEVENTVIEW_P_H
 
+#include <QDBusMessage>
+#include <QPair>
 #include <QScopedPointer>
+#include "filter.h"
+#include "types.h"
 
 class EventViewAdaptor;
 
@@ -35,6 +39,20 @@ public:
 
     EventViewAdaptor *adaptor;
     QString objectPath;
+    int requestedVersion;
+    int pageSize;
+    // the pages requested over DBus that are answered later, with the size they were requested with
+    struct PendingPage {
+        QDBusMessage message;
+        int version;
+        int pageSize;
+    };
+    QList<PendingPage> pendingPages;
+    bool subscribed;
+    EventType type;
+    Filter filter;
+
+    QList<QVariantMap> filtered(const QList<QVariantMap> &items) const;
 };
 
 }
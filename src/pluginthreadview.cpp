@@ -23,6 +23,7 @@
 #include "pluginthreadview_p.h"
 #include "pluginthreadviewadaptor.h"
 #include "types.h"
+#include "wireformat_p.h"
 #include <QDBusConnection>
 #include <QDebug>
 
@@ -31,10 +32,31 @@ Q_DECLARE_METATYPE(QList< QVariantMap >)
 namespace History {
 
 PluginThreadViewPrivate::PluginThreadViewPrivate()
-    : adaptor(0)
+    : adaptor(0), requestedVersion(WireFormat::VersionMap), pageSize(DefaultPageSize), subscribed(false), type(EventTypeNull)
 {
 }
 
+QList<QVariantMap> PluginThreadViewPrivate::filtered(const QList<QVariantMap> &items) const
+{
+    QList<QVariantMap> result;
+    if (!subscribed) {
+        return result;
+    }
+
+    bool filterNull = filter.isNull();
+    Q_FOREACH(const QVariantMap &item, items) {
+        if (item[FieldType].toInt() != type) {
+            continue;
+        }
+
+        if (filterNull || filter.match(item)) {
+            result << item;
+        }
+    }
+
+    return result;
+}
+
 PluginThreadView::PluginThreadView(QObject *parent) :
     QObject(parent), d_ptr(new PluginThreadViewPrivate())
 {
@@ -51,6 +73,11 @@ PluginThreadView::PluginThreadView(QObject *parent) :
 PluginThreadView::~PluginThreadView()
 {
     Q_D(PluginThreadView);
+    // callers waiting for a delayed page would otherwise only get a timeout
+    while (!d->pendingPages.isEmpty()) {
+        QDBusMessage call = d->pendingPages.takeFirst().message;
+        QDBusConnection::sessionBus().send(call.createErrorReply(QDBusError::Failed, "The view was destroyed"));
+    }
     QDBusConnection::sessionBus().unregisterObject(d->objectPath);
 }
 
@@ -60,15 +87,137 @@ void PluginThreadView::Destroy()
     deleteLater();
 }
 
+QByteArray PluginThreadView::NextPageBinary(int version)
+{
+    if (version == WireFormat::VersionMap || !WireFormat::isSupported(version)) {
+        sendErrorReply(QDBusError::NotSupported, QString("Unsupported wire format version %1").arg(version));
+        return QByteArray();
+    }
+
+    Q_D(PluginThreadView);
+    d->requestedVersion = version;
+    QList<QVariantMap> page = NextPage();
+    d->requestedVersion = WireFormat::VersionMap;
+
+    // the page is going to be sent by sendNextPage()
+    if (isDelayedReply()) {
+        return QByteArray();
+    }
+    return WireFormat::encodeThreads(page, version);
+}
+
+/**
+ * @brief Lets NextPage() answer the DBus call being processed later
+ *
+ * Views fetching their pages asynchronously call this from NextPage() and then
+ * pass the pages to sendNextPage(), in the same order the calls were made.
+ */
+void PluginThreadView::delayNextPage()
+{
+    Q_D(PluginThreadView);
+    setDelayedReply(true);
+    PluginThreadViewPrivate::PendingPage page = {message(), d->requestedVersion, d->pageSize};
+    d->pendingPages << page;
+}
+
+void PluginThreadView::sendNextPage(const QList<QVariantMap> &page)
+{
+    Q_D(PluginThreadView);
+    if (d->pendingPages.isEmpty()) {
+        qWarning() << "No pending call to send the page to";
+        return;
+    }
+
+    PluginThreadViewPrivate::PendingPage call = d->pendingPages.takeFirst();
+    QVariant reply;
+    if (call.version == WireFormat::VersionMap) {
+        reply = QVariant::fromValue(page);
+    } else {
+        reply = WireFormat::encodeThreads(page, call.version);
+    }
+    QDBusConnection::sessionBus().send(call.message.createReply(reply));
+}
+
 bool PluginThreadView::IsValid() const
 {
     return true;
 }
 
+/**
+ * @brief Sets the number of items returned by the next pages
+ *
+ * The pages already requested keep the size they were requested with, even if they
+ * are still waiting to be fetched. Sizes above MaxPageSize are clamped to it.
+ */
+void PluginThreadView::SetPageSize(int size)
+{
+    Q_D(PluginThreadView);
+    if (size <= 0) {
+        qWarning() << "Invalid page size:" << size;
+        return;
+    }
+    if (size > MaxPageSize) {
+        qWarning() << "Page size" << size << "is too big, using" << MaxPageSize;
+        size = MaxPageSize;
+    }
+    d->pageSize = size;
+}
+
+/// the size of the next page to be returned: the oldest one waiting, or else the current page size
+int PluginThreadView::pageSize() const
+{
+    Q_D(const PluginThreadView);
+    if (!d->pendingPages.isEmpty()) {
+        return d->pendingPages.first().pageSize;
+    }
+    return d->pageSize;
+}
+
 QString PluginThreadView::objectPath() const
 {
     Q_D(const PluginThreadView);
     return d->objectPath;
 }
 
+/**
+ * @brief Sets which changes are signalled on the object path of this view
+ *
+ * Views that are not given a filter do not signal any changes. Clients listen to these
+ * signals instead of the service wide ones, so they are not woken up by unrelated changes.
+ */
+void PluginThreadView::setFilter(EventType type, const Filter &filter)
+{
+    Q_D(PluginThreadView);
+    d->subscribed = true;
+    d->type = type;
+    d->filter = filter;
+}
+
+void PluginThreadView::notifyThreadsAdded(const QList<QVariantMap> &threads)
+{
+    Q_D(PluginThreadView);
+    QList<QVariantMap> matching = d->filtered(threads);
+    if (!matching.isEmpty()) {
+        Q_EMIT ThreadsAdded(matching);
+    }
+}
+
+void PluginThreadView::notifyThreadsModified(const QList<QVariantMap> &threads)
+{
+    Q_D(PluginThreadView);
+    QList<QVariantMap> matching = d->filtered(threads);
+    if (!matching.isEmpty()) {
+        Q_EMIT ThreadsModified(matching);
+    }
+}
+
+void PluginThreadView::notifyThreadsRemoved(const QList<QVariantMap> &threads)
+{
+    Q_D(PluginThreadView);
+    QList<QVariantMap> matching = d->filtered(threads);
+    if (!matching.isEmpty()) {
+        Q_EMIT ThreadsRemoved(matching);
+    }
+}
+
 }
@@ -26,6 +26,8 @@
 #include <QDBusContext>
 #include <QScopedPointer>
 #include <QVariantMap>
+#include "filter.h"
+#include "types.h"
 
 namespace History {
 
@@ -41,14 +43,30 @@ public:
 
     // DBus exposed methods
     Q_NOREPLY void Destroy();
+    Q_NOREPLY void SetPageSize(int size);
     virtual QList<QVariantMap> NextPage() = 0;
+    QByteArray NextPageBinary(int version);
     virtual bool IsValid() const;
 
     // other methods
     QString objectPath() const;
+    int pageSize() const;
+    void setFilter(EventType type, const Filter &filter);
+
+public Q_SLOTS:
+    void notifyThreadsAdded(const QList<QVariantMap> &threads);
+    void notifyThreadsModified(const QList<QVariantMap> &threads);
+    void notifyThreadsRemoved(const QList<QVariantMap> &threads);
+
+protected:
+    void delayNextPage();
+    void sendNextPage(const QList<QVariantMap> &page);
 
 Q_SIGNALS:
     void Invalidated();
+    void ThreadsAdded(const QList<QVariantMap> &threads);
+    void ThreadsModified(const QList<QVariantMap> &threads);
+    void ThreadsRemoved(const QList<QVariantMap> &threads);
 
 private:
     QScopedPointer<PluginThreadViewPrivate> d_ptr;
@@ -139,6 +139,7 @@ MessageStatus TextEvent::messageStatus() const
 
 void TextEvent::setMessageStatus(const MessageStatus &value)
 {
+    d_ptr.detach();
     Q_D(TextEvent);
     d->messageStatus = value;
 }
@@ -151,6 +152,7 @@ QDateTime TextEvent::readTimestamp() const
 
 void TextEvent::setReadTimestamp(const QDateTime &value)
 {
+    d_ptr.detach();
     Q_D(TextEvent);
     d->readTimestamp = value;
 }
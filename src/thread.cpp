@@ -81,7 +81,7 @@ Thread::Thread(const QString &accountId,
 }
 
 Thread::Thread(const Thread &other)
-    : d_ptr(new ThreadPrivate(*other.d_ptr))
+    : d_ptr(other.d_ptr)
 {
 }
 
@@ -94,7 +94,7 @@ Thread &Thread::operator=(const Thread &other)
     if (&other == this) {
         return *this;
     }
-    d_ptr = QSharedPointer<ThreadPrivate>(new ThreadPrivate(*other.d_ptr));
+    d_ptr = other.d_ptr;
     return *this;
 }
 
@@ -194,6 +194,7 @@ bool Thread::operator<(const Thread &other) const
 
 void Thread::removeParticipants(const Participants &participants)
 {
+    d_ptr.detach();
     Q_D(Thread);
     Q_FOREACH(const Participant &participant, participants) {
         d->participants.removeAll(participant);
@@ -202,6 +203,7 @@ void Thread::removeParticipants(const Participants &participants)
 
 void Thread::addParticipants(const Participants &participants)
 {
+    d_ptr.detach();
     Q_D(Thread);
     Q_FOREACH(const Participant &participant, participants) {
         d->participants.append(participant);
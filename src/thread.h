@@ -24,6 +24,7 @@
 
 #include <QDBusArgument>
 #include <QDateTime>
+#include <QExplicitlySharedDataPointer>
 #include <QScopedPointer>
 #include <QStringList>
 #include <QVariantMap>
@@ -85,7 +86,7 @@ public:
     static Thread fromProperties(const QVariantMap &properties);
 
 protected:
-    QSharedPointer<ThreadPrivate> d_ptr;
+    QExplicitlySharedDataPointer<ThreadPrivate> d_ptr;
 };
 
 const QDBusArgument &operator>>(const QDBusArgument &argument, Threads &threads);
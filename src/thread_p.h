@@ -22,6 +22,7 @@
 #ifndef HISTORY_THREAD_P_H
 #define HISTORY_THREAD_P_H
 
+#include <QSharedData>
 #include <QString>
 #include "types.h"
 
@@ -30,7 +31,7 @@ namespace History
 
 class Thread;
 
-class ThreadPrivate
+class ThreadPrivate : public QSharedData
 {
 public:
     explicit ThreadPrivate();
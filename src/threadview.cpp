@@ -23,11 +23,15 @@
 #include "threadview_p.h"
 #include "filter.h"
 #include "manager.h"
+#include "managerdbus_p.h"
 #include "sort.h"
 #include "thread.h"
-#include <QDBusInterface>
-#include <QDBusReply>
+#include "wireformat_p.h"
+#include <QDBusArgument>
+#include <QDBusConnection>
+#include <QDBusPendingReply>
 #include <QDebug>
+#include <QTimer>
 
 namespace History
 {
@@ -37,7 +41,8 @@ namespace History
 ThreadViewPrivate::ThreadViewPrivate(History::EventType theType,
                                      const History::Sort &theSort,
                                      const History::Filter &theFilter)
-    : type(theType), sort(theSort), filter(theFilter), valid(true), dbus(0)
+    : type(theType), sort(theSort), filter(theFilter), valid(true), pageSize(DefaultPageSize), queryWatcher(0),
+      pageWireFormat(WireFormat::VersionMap), versionWatcher(0), subscribed(false)
 {
 }
 
@@ -59,33 +64,213 @@ Threads ThreadViewPrivate::filteredThreads(const Threads &threads)
     return filtered;
 }
 
-void ThreadViewPrivate::_d_threadsAdded(const History::Threads &threads)
+QDBusMessage ThreadViewPrivate::viewCall(const QString &method) const
+{
+    return QDBusMessage::createMethodCall(History::DBusService, objectPath, History::ThreadViewInterface, method);
+}
+
+QDBusMessage ThreadViewPrivate::pageCall(int wireFormat) const
+{
+    if (wireFormat == WireFormat::VersionMap) {
+        return viewCall("NextPage");
+    }
+
+    QDBusMessage message = viewCall("NextPageBinary");
+    message << wireFormat;
+    return message;
+}
+
+/// blocks until the service has created the view and the wire format is known, for the synchronous calls
+void ThreadViewPrivate::waitForQuery()
+{
+    if (versionWatcher) {
+        versionWatcher->waitForFinished();
+        _d_versionFinished();
+    }
+    if (queryWatcher) {
+        queryWatcher->waitForFinished();
+        _d_queryFinished();
+    }
+}
+
+void ThreadViewPrivate::requestPage(const ThreadView::PageCallback &callback)
 {
     Q_Q(ThreadView);
 
-    Threads filtered = filteredThreads(threads);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->threadsAdded(filtered);
+    if (!valid) {
+        QTimer::singleShot(0, q, [callback]() { callback(Threads()); });
+        return;
     }
+
+    int wireFormat = pageWireFormat;
+    QDBusPendingCall call = QDBusConnection::sessionBus().asyncCall(pageCall(wireFormat));
+    QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(call, q);
+    QObject::connect(watcher, &QDBusPendingCallWatcher::finished, [this, callback, wireFormat](QDBusPendingCallWatcher *watcher) {
+        Threads threads = pageFromReply(watcher->reply(), wireFormat);
+        watcher->deleteLater();
+        callback(threads);
+    });
 }
 
-void ThreadViewPrivate::_d_threadsModified(const Threads &threads)
+Threads ThreadViewPrivate::pageFromReply(const QDBusMessage &reply, int wireFormat)
 {
     Q_Q(ThreadView);
+    Threads threads;
 
-    Threads filtered = filteredThreads(threads);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->threadsModified(filtered);
+    if (reply.type() != QDBusMessage::ReplyMessage) {
+        qDebug() << "Error:" << reply.errorMessage();
+        valid = false;
+        Q_EMIT q->invalidated();
+        return threads;
+    }
+
+    if (wireFormat != WireFormat::VersionMap) {
+        return WireFormat::decodeThreads(QDBusPendingReply<QByteArray>(reply).value());
+    }
+
+    return threadsFromProperties(QDBusPendingReply<QList<QVariantMap> >(reply).value());
+}
+
+Threads ThreadViewPrivate::threadsFromProperties(const QList<QVariantMap> &threadsProperties)
+{
+    Threads threads;
+    Q_FOREACH(const QVariantMap &properties, threadsProperties) {
+        Thread thread = Thread::fromProperties(properties);
+        if (!thread.isNull()) {
+            threads << thread;
+        }
     }
+
+    return threads;
 }
 
-void ThreadViewPrivate::_d_threadsRemoved(const Threads &threads)
+/// see EventViewPrivate::connectChanges()
+void ThreadViewPrivate::connectChanges(const QString &path, const char *slot, bool connect)
 {
     Q_Q(ThreadView);
+    QDBusConnection connection = QDBusConnection::sessionBus();
+    QStringList names;
+    names << "ThreadsAdded" << "ThreadsModified" << "ThreadsRemoved";
+    Q_FOREACH(const QString &name, names) {
+        if (connect) {
+            connection.connect(History::DBusService, path, History::ThreadViewInterface, name, q, slot);
+        } else {
+            connection.disconnect(History::DBusService, path, History::ThreadViewInterface, name, q, slot);
+        }
+    }
+}
 
-    Threads filtered = filteredThreads(threads);
-    if (!filtered.isEmpty()) {
-        Q_EMIT q->threadsRemoved(filtered);
+// the service only signals the changes matching the filter of the view on its object path
+void ThreadViewPrivate::changeSignalled(const QDBusMessage &message)
+{
+    Q_Q(ThreadView);
+    if (message.arguments().isEmpty()) {
+        return;
+    }
+
+    Threads threads = threadsFromProperties(qdbus_cast<QList<QVariantMap> >(message.arguments().first()));
+    if (message.member() == "ThreadsAdded") {
+        Q_EMIT q->threadsAdded(threads);
+    } else if (message.member() == "ThreadsModified") {
+        Q_EMIT q->threadsModified(threads);
+    } else if (message.member() == "ThreadsRemoved") {
+        Q_EMIT q->threadsRemoved(threads);
+    }
+}
+
+void ThreadViewPrivate::_d_queryFinished()
+{
+    Q_Q(ThreadView);
+    if (!queryWatcher) {
+        return;
+    }
+
+    QDBusPendingReply<QString> reply = *queryWatcher;
+    queryWatcher->deleteLater();
+    queryWatcher = 0;
+
+    // as when the service is not running, a failed query only makes the view invalid
+    if (reply.isError()) {
+        qDebug() << "Error:" << reply.error();
+        valid = false;
+        connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), false);
+    } else {
+        objectPath = reply.value();
+
+        connectChanges(objectPath, SLOT(_d_viewChanged(QDBusMessage)), true);
+        Q_FOREACH(const QDBusMessage &message, queryChanges) {
+            if (message.path() == objectPath) {
+                changeSignalled(message);
+            }
+        }
+
+        // see EventViewPrivate::_d_queryFinished()
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(viewCall("IsValid")), q);
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, q, [this, watcher]() {
+            watcher->deleteLater();
+            _d_subscribed();
+        });
+
+        // sent before the pending pages so that they already use the requested size
+        if (pageSize != DefaultPageSize) {
+            QDBusConnection::sessionBus().asyncCall(viewCall("SetPageSize") << pageSize);
+        }
+    }
+    queryChanges.clear();
+
+    if (!versionWatcher) {
+        flushPendingPages();
+    }
+}
+
+void ThreadViewPrivate::_d_versionFinished()
+{
+    if (!versionWatcher) {
+        return;
+    }
+
+    pageWireFormat = ManagerDBus::wireFormatVersionFromReply(*versionWatcher);
+    versionWatcher->deleteLater();
+    versionWatcher = 0;
+
+    if (!queryWatcher) {
+        flushPendingPages();
+    }
+}
+
+/// requests the pages asked for before the view got created and the wire format was known
+void ThreadViewPrivate::flushPendingPages()
+{
+    QList<ThreadView::PageCallback> pages = pendingPages;
+    pendingPages.clear();
+    Q_FOREACH(const ThreadView::PageCallback &callback, pages) {
+        requestPage(callback);
+    }
+}
+
+void ThreadViewPrivate::_d_subscribed()
+{
+    subscribed = true;
+    connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), false);
+}
+
+void ThreadViewPrivate::_d_queryChanged(const QDBusMessage &message)
+{
+    if (subscribed) {
+        return;
+    }
+
+    if (objectPath.isEmpty()) {
+        queryChanges << message;
+    } else if (message.path() == objectPath) {
+        changeSignalled(message);
+    }
+}
+
+void ThreadViewPrivate::_d_viewChanged(const QDBusMessage &message)
+{
+    if (subscribed) {
+        changeSignalled(message);
     }
 }
 
@@ -117,33 +302,26 @@ ThreadView::ThreadView(History::EventType type,
         return;
     }
 
-    QDBusInterface interface(History::DBusService, History::DBusObjectPath, History::DBusInterface);
-
-    QDBusReply<QString> reply = interface.call("QueryThreads",
-                                               (int) type,
-                                               sort.properties(),
-                                               filter.properties(),
-                                               properties);
-    if (!reply.isValid()) {
-        Q_EMIT invalidated();
-        d_ptr->valid = false;
-        return;
+    // the view is created asynchronously on the service side, the page requests wait for it
+    d_ptr->connectChanges(QString(), SLOT(_d_queryChanged(QDBusMessage)), true);
+    QDBusMessage message = QDBusMessage::createMethodCall(History::DBusService, History::DBusObjectPath,
+                                                          History::DBusInterface, "QueryThreads");
+    message << (int) type << sort.properties() << filter.properties() << properties;
+    d_ptr->queryWatcher = new QDBusPendingCallWatcher(QDBusConnection::sessionBus().asyncCall(message), this);
+    connect(d_ptr->queryWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+        d_ptr->_d_queryFinished();
+    });
+
+    // the wire format of the pages is negotiated along with the query, so that the pages never wait for it
+    d_ptr->pageWireFormat = ManagerDBus::cachedWireFormatVersion();
+    if (d_ptr->pageWireFormat < 0) {
+        d_ptr->versionWatcher = new QDBusPendingCallWatcher(ManagerDBus::requestWireFormatVersion(), this);
+        connect(d_ptr->versionWatcher, &QDBusPendingCallWatcher::finished, this, [this]() {
+            d_ptr->_d_versionFinished();
+        });
     }
 
-    d_ptr->objectPath = reply.value();
-
-    d_ptr->dbus = new QDBusInterface(History::DBusService, d_ptr->objectPath, History::ThreadViewInterface,
-                                     QDBusConnection::sessionBus(), this);
-
-    connect(Manager::instance(),
-            SIGNAL(threadsAdded(History::Threads)),
-            SLOT(_d_threadsAdded(History::Threads)));
-    connect(Manager::instance(),
-            SIGNAL(threadsModified(History::Threads)),
-            SLOT(_d_threadsModified(History::Threads)));
-    connect(Manager::instance(),
-            SIGNAL(threadsRemoved(History::Threads)),
-            SLOT(_d_threadsRemoved(History::Threads)));
+    // participants requested with Manager::requestThreadParticipants() arrive through the manager
     connect(Manager::instance(),
             SIGNAL(threadParticipantsChanged(History::Thread, History::Participants, History::Participants, History::Participants)),
             SLOT(_d_threadParticipantsChanged(History::Thread, History::Participants, History::Participants, History::Participants)));
@@ -152,37 +330,73 @@ ThreadView::ThreadView(History::EventType type,
 ThreadView::~ThreadView()
 {
     Q_D(ThreadView);
-    if (d->valid) {
-        d->dbus->call("Destroy");
+    if (d->queryWatcher) {
+        // the view still needs to be destroyed on the service once it gets created
+        QDBusPendingCallWatcher *watcher = new QDBusPendingCallWatcher(*d->queryWatcher, Manager::instance());
+        QObject::connect(watcher, &QDBusPendingCallWatcher::finished, [](QDBusPendingCallWatcher *watcher) {
+            QDBusPendingReply<QString> reply = *watcher;
+            if (reply.isValid()) {
+                QDBusConnection::sessionBus().asyncCall(QDBusMessage::createMethodCall(History::DBusService, reply.value(),
+                                                                                       History::ThreadViewInterface, "Destroy"));
+            }
+            watcher->deleteLater();
+        });
+    } else if (d->valid) {
+        QDBusConnection::sessionBus().asyncCall(d->viewCall("Destroy"));
     }
 }
 
+/**
+ * @brief Fetches the next page of threads, blocking until the service replies
+ */
 Threads ThreadView::nextPage()
 {
-    Threads threads;
     Q_D(ThreadView);
+    d->waitForQuery();
     if (!d->valid) {
-        return threads;
+        return Threads();
     }
 
-    QDBusReply<QList<QVariantMap> > reply = d->dbus->call("NextPage");
+    return d->pageFromReply(QDBusConnection::sessionBus().call(d->pageCall(d->pageWireFormat)), d->pageWireFormat);
+}
 
-    if (!reply.isValid()) {
-        qDebug() << "Error:" << reply.error();
-        d->valid = false;
-        Q_EMIT invalidated();
-        return threads;
+/**
+ * @brief Requests the next page of threads without blocking
+ * @param callback Called with the threads once the service replies; an empty page means
+ * there are no more threads
+ *
+ * Pages are delivered in the order they were requested. The callback is not called if the
+ * view is destroyed before the reply arrives.
+ */
+void ThreadView::nextPage(const PageCallback &callback)
+{
+    Q_D(ThreadView);
+    if (d->queryWatcher || d->versionWatcher) {
+        d->pendingPages << callback;
+        return;
     }
 
-    QList<QVariantMap> threadsProperties = reply.value();
-    Q_FOREACH(const QVariantMap &properties, threadsProperties) {
-        Thread thread = Thread::fromProperties(properties);
-        if (!thread.isNull()) {
-            threads << thread;
-        }
+    d->requestPage(callback);
+}
+
+/**
+ * @brief Sets the number of threads returned by each of the next pages
+ *
+ * The pages requested before this call keep the previous size. Sizes above
+ * MaxPageSize are clamped to it.
+ */
+void ThreadView::setPageSize(int size)
+{
+    Q_D(ThreadView);
+    if (size <= 0 || size == d->pageSize) {
+        return;
     }
 
-    return threads;
+    size = qMin(size, MaxPageSize);
+    d->pageSize = size;
+    if (!d->queryWatcher && d->valid) {
+        QDBusConnection::sessionBus().asyncCall(d->viewCall("SetPageSize") << size);
+    }
 }
 
 bool ThreadView::isValid() const
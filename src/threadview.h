@@ -26,7 +26,9 @@
 #include "filter.h"
 #include "sort.h"
 #include "thread.h"
+#include <QDBusMessage>
 #include <QObject>
+#include <functional>
 
 namespace History
 {
@@ -39,6 +41,8 @@ class ThreadView : public QObject
     Q_DECLARE_PRIVATE(ThreadView)
 
 public:
+    typedef std::function<void(const History::Threads &threads)> PageCallback;
+
     ThreadView(History::EventType type,
                const History::Sort &sort,
                const History::Filter &filter,
@@ -46,6 +50,8 @@ public:
     ~ThreadView();
 
     Threads nextPage();
+    void nextPage(const PageCallback &callback);
+    void setPageSize(int size);
     bool isValid() const;
 
 Q_SIGNALS:
@@ -59,9 +65,8 @@ Q_SIGNALS:
     void invalidated();
 
 private:
-    Q_PRIVATE_SLOT(d_func(), void _d_threadsAdded(const History::Threads &threads))
-    Q_PRIVATE_SLOT(d_func(), void _d_threadsModified(const History::Threads &threads))
-    Q_PRIVATE_SLOT(d_func(), void _d_threadsRemoved(const History::Threads &threads))
+    Q_PRIVATE_SLOT(d_func(), void _d_queryChanged(const QDBusMessage &message))
+    Q_PRIVATE_SLOT(d_func(), void _d_viewChanged(const QDBusMessage &message))
     Q_PRIVATE_SLOT(d_func(), void _d_threadParticipantsChanged(const History::Thread &thread,
                                    const History::Participants &added,
                                    const History::Participants &removed,
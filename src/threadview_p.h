@@ -23,7 +23,9 @@
 #define THREADVIEW_P_H
 
 #include "types.h"
-#include <QDBusInterface>
+#include "threadview.h"
+#include <QDBusMessage>
+#include <QDBusPendingCallWatcher>
 
 namespace History
 {
@@ -42,14 +44,31 @@ namespace History
         Filter filter;
         QString objectPath;
         bool valid;
-        QDBusInterface *dbus;
+        int pageSize;
+        QDBusPendingCallWatcher *queryWatcher;
+        QList<ThreadView::PageCallback> pendingPages;
+        int pageWireFormat;
+        QDBusPendingCallWatcher *versionWatcher;
+        bool subscribed;
+        QList<QDBusMessage> queryChanges;
 
         Threads filteredThreads(const Threads &threads);
+        Threads threadsFromProperties(const QList<QVariantMap> &threadsProperties);
+        QDBusMessage viewCall(const QString &method) const;
+        QDBusMessage pageCall(int wireFormat) const;
+        void waitForQuery();
+        void requestPage(const ThreadView::PageCallback &callback);
+        Threads pageFromReply(const QDBusMessage &reply, int wireFormat);
+        void connectChanges(const QString &path, const char *slot, bool connect);
+        void changeSignalled(const QDBusMessage &message);
+        void flushPendingPages();
 
         // private slots
-        void _d_threadsAdded(const History::Threads &threads);
-        void _d_threadsModified(const History::Threads &threads);
-        void _d_threadsRemoved(const History::Threads &threads);
+        void _d_queryFinished();
+        void _d_versionFinished();
+        void _d_subscribed();
+        void _d_queryChanged(const QDBusMessage &message);
+        void _d_viewChanged(const QDBusMessage &message);
         void _d_threadParticipantsChanged(const History::Thread &thread,
                                    const History::Participants &added,
                                    const History::Participants &removed,
@@ -141,6 +141,11 @@ static const char* DBusInterface = "com.canonical.HistoryService";
 static const char* ThreadViewInterface = "com.canonical.HistoryService.ThreadView";
 static const char* EventViewInterface = "com.canonical.HistoryService.EventView";
 
+// number of items in each page of a view, unless its client asks for another size
+static const int DefaultPageSize = 15;
+// and the largest size a client can ask for, so that a single page cannot stall the service
+static const int MaxPageSize = 1000;
+
 // fields
 static const char* FieldAccountId = "accountId";
 static const char* FieldThreadId = "threadId";
@@ -0,0 +1,386 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * Authors:
+ *  Gustavo Pichorim Boiko <gustavo.boiko@canonical.com>
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "wireformat_p.h"
+#include "participant.h"
+#include "textevent.h"
+#include "texteventattachment.h"
+#include "voiceevent.h"
+#include <QDataStream>
+#include <QDateTime>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+#include <QDebug>
+#include <QTime>
+#include <limits>
+
+Q_DECLARE_METATYPE(QList< QVariantMap >)
+
+namespace History {
+
+static const qint64 InvalidTimestamp = std::numeric_limits<qint64>::min();
+static const QDataStream::Version StreamVersion = QDataStream::Qt_5_0;
+
+static qint64 timestampToWire(const QVariant &value)
+{
+    QDateTime timestamp = value.type() == QVariant::DateTime ? value.toDateTime()
+                                                             : QDateTime::fromString(value.toString(), Qt::ISODate);
+    return timestamp.isValid() ? timestamp.toMSecsSinceEpoch() : InvalidTimestamp;
+}
+
+static QDateTime timestampFromWire(qint64 value)
+{
+    return value == InvalidTimestamp ? QDateTime() : QDateTime::fromMSecsSinceEpoch(value);
+}
+
+static QList<QVariantMap> mapListFromVariant(const QVariant &value)
+{
+    if (value.userType() == qMetaTypeId<QList<QVariantMap> >()) {
+        return value.value<QList<QVariantMap> >();
+    }
+    if (value.userType() == qMetaTypeId<QDBusArgument>()) {
+        return qdbus_cast<QList<QVariantMap> >(value);
+    }
+
+    QList<QVariantMap> list;
+    Q_FOREACH(const QVariant &entry, value.toList()) {
+        list << entry.toMap();
+    }
+    return list;
+}
+
+static QVariantMap mapFromVariant(const QVariant &value)
+{
+    if (value.userType() == qMetaTypeId<QDBusArgument>()) {
+        return qdbus_cast<QVariantMap>(value);
+    }
+    return value.toMap();
+}
+
+// ------------- encoding --------------------------------------------------------
+
+static void writeParticipants(QDataStream &stream, const QVariant &value)
+{
+    QList<QVariantMap> participants;
+    if (value.type() == QVariant::List) {
+        participants = mapListFromVariant(value);
+    } else {
+        Q_FOREACH(const Participant &participant, Participants::fromVariant(value)) {
+            participants << participant.properties();
+        }
+    }
+
+    stream << (quint32) participants.count();
+    Q_FOREACH(const QVariantMap &participant, participants) {
+        stream << participant[FieldAccountId].toString()
+               << participant[FieldIdentifier].toString()
+               << participant[FieldContactId].toString()
+               << participant[FieldAlias].toString()
+               << participant[FieldAvatar].toString()
+               << (quint32) participant[FieldParticipantState].toUInt()
+               << (quint32) participant[FieldParticipantRoles].toUInt()
+               << mapFromVariant(participant[FieldDetailProperties]);
+    }
+}
+
+static void writeEventDetails(QDataStream &stream, EventType type, const QVariantMap &properties)
+{
+    switch (type) {
+    case EventTypeText: {
+        stream << properties[FieldMessage].toString()
+               << (qint32) properties[FieldMessageType].toInt()
+               << (qint32) properties[FieldMessageStatus].toInt()
+               << timestampToWire(properties[FieldReadTimestamp])
+               << properties[FieldSubject].toString()
+               << (qint32) properties[FieldInformationType].toInt();
+
+        QList<QVariantMap> attachments = mapListFromVariant(properties[FieldAttachments]);
+        stream << (quint32) attachments.count();
+        Q_FOREACH(const QVariantMap &attachment, attachments) {
+            stream << attachment[FieldAttachmentId].toString()
+                   << attachment[FieldContentType].toString()
+                   << attachment[FieldFilePath].toString()
+                   << (qint32) attachment[FieldStatus].toInt();
+        }
+        break;
+    }
+    case EventTypeVoice:
+        stream << properties[FieldMissed].toBool()
+               << (qint32) properties[FieldDuration].toInt()
+               << properties[FieldRemoteParticipant].toString();
+        break;
+    default:
+        break;
+    }
+}
+
+static void writeThread(QDataStream &stream, const QVariantMap &properties)
+{
+    EventType type = (EventType) properties[FieldType].toInt();
+    stream << properties[FieldAccountId].toString()
+           << properties[FieldThreadId].toString()
+           << (qint32) type
+           << (qint32) properties[FieldChatType].toInt();
+    writeParticipants(stream, properties[FieldParticipants]);
+    stream << timestampToWire(properties[FieldTimestamp])
+           << (qint32) properties[FieldCount].toInt()
+           << (qint32) properties[FieldUnreadCount].toInt()
+           << mapFromVariant(properties[FieldChatRoomInfo]);
+
+    // the last event shares the thread account, id, participants and timestamp
+    stream << properties[FieldEventId].toString()
+           << properties[FieldSenderId].toString()
+           << properties[FieldNewEvent].toBool();
+    writeEventDetails(stream, type, properties);
+
+    QList<QVariantMap> groupedThreads = mapListFromVariant(properties[FieldGroupedThreads]);
+    stream << (quint32) groupedThreads.count();
+    Q_FOREACH(const QVariantMap &groupedThread, groupedThreads) {
+        writeThread(stream, groupedThread);
+    }
+}
+
+static void writeEvent(QDataStream &stream, const QVariantMap &properties)
+{
+    EventType type = (EventType) properties[FieldType].toInt();
+    stream << (qint32) type
+           << properties[FieldAccountId].toString()
+           << properties[FieldThreadId].toString()
+           << properties[FieldEventId].toString()
+           << properties[FieldSenderId].toString()
+           << timestampToWire(properties[FieldTimestamp])
+           << properties[FieldNewEvent].toBool();
+    writeParticipants(stream, properties[FieldParticipants]);
+    writeEventDetails(stream, type, properties);
+}
+
+// ------------- decoding --------------------------------------------------------
+
+static Participants readParticipants(QDataStream &stream)
+{
+    Participants participants;
+    quint32 count = 0;
+    stream >> count;
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; ++i) {
+        QString accountId, identifier, contactId, alias, avatar;
+        quint32 state = 0, roles = 0;
+        QVariantMap detailProperties;
+        stream >> accountId >> identifier >> contactId >> alias >> avatar >> state >> roles >> detailProperties;
+        participants << Participant(accountId, identifier, contactId, alias, avatar, state, roles, detailProperties);
+    }
+    return participants;
+}
+
+static Event readEventDetails(QDataStream &stream,
+                              EventType type,
+                              const QString &accountId,
+                              const QString &threadId,
+                              const QString &eventId,
+                              const QString &senderId,
+                              const QDateTime &timestamp,
+                              bool newEvent,
+                              const Participants &participants)
+{
+    switch (type) {
+    case EventTypeText: {
+        QString message, subject;
+        qint32 messageType = 0, messageStatus = 0, informationType = 0;
+        qint64 readTimestamp = InvalidTimestamp;
+        quint32 attachmentCount = 0;
+        stream >> message >> messageType >> messageStatus >> readTimestamp >> subject >> informationType >> attachmentCount;
+
+        TextEventAttachments attachments;
+        for (quint32 i = 0; i < attachmentCount && stream.status() == QDataStream::Ok; ++i) {
+            QString attachmentId, contentType, filePath;
+            qint32 status = 0;
+            stream >> attachmentId >> contentType >> filePath >> status;
+            TextEventAttachment attachment(accountId, threadId, eventId, attachmentId, contentType, filePath,
+                                           (AttachmentFlags) status);
+            if (!attachment.isNull()) {
+                attachments << attachment;
+            }
+        }
+        return TextEvent(accountId, threadId, eventId, senderId, timestamp, newEvent, message,
+                         (MessageType) messageType, (MessageStatus) messageStatus, timestampFromWire(readTimestamp),
+                         subject, (InformationType) informationType, attachments, participants);
+    }
+    case EventTypeVoice: {
+        bool missed = false;
+        qint32 duration = 0;
+        QString remoteParticipant;
+        stream >> missed >> duration >> remoteParticipant;
+        return VoiceEvent(accountId, threadId, eventId, senderId, timestamp, newEvent,
+                          missed, QTime(0,0,0).addSecs(duration), remoteParticipant, participants);
+    }
+    default:
+        return Event();
+    }
+}
+
+static Thread readThread(QDataStream &stream)
+{
+    QString accountId, threadId;
+    qint32 type = 0, chatType = 0, count = 0, unreadCount = 0;
+    qint64 timestamp = InvalidTimestamp;
+    QVariantMap chatRoomInfo;
+    stream >> accountId >> threadId >> type >> chatType;
+    Participants participants = readParticipants(stream);
+    stream >> timestamp >> count >> unreadCount >> chatRoomInfo;
+
+    QString eventId, senderId;
+    bool newEvent = false;
+    stream >> eventId >> senderId >> newEvent;
+    QDateTime threadTimestamp = timestampFromWire(timestamp);
+    Event event = readEventDetails(stream, (EventType) type, accountId, threadId, eventId, senderId,
+                                   threadTimestamp, newEvent, participants);
+
+    Threads groupedThreads;
+    quint32 groupedCount = 0;
+    stream >> groupedCount;
+    for (quint32 i = 0; i < groupedCount && stream.status() == QDataStream::Ok; ++i) {
+        groupedThreads << readThread(stream);
+    }
+
+    if (accountId.isEmpty() || threadId.isEmpty()) {
+        return Thread();
+    }
+    return Thread(accountId, threadId, (EventType) type, participants, threadTimestamp, event,
+                  count, unreadCount, groupedThreads, (ChatType) chatType, chatRoomInfo);
+}
+
+static Event readEvent(QDataStream &stream)
+{
+    qint32 type = 0;
+    QString accountId, threadId, eventId, senderId;
+    qint64 timestamp = InvalidTimestamp;
+    bool newEvent = false;
+    stream >> type >> accountId >> threadId >> eventId >> senderId >> timestamp >> newEvent;
+    Participants participants = readParticipants(stream);
+    return readEventDetails(stream, (EventType) type, accountId, threadId, eventId, senderId,
+                            timestampFromWire(timestamp), newEvent, participants);
+}
+
+/**
+ * @brief Read the page header and check it can be decoded.
+ * @param stream The stream to read the header from.
+ * @param count Receives the number of records in the page.
+ * @return Whether the records that follow can be read.
+ */
+static bool readHeader(QDataStream &stream, quint32 &count)
+{
+    stream.setVersion(StreamVersion);
+    quint32 version = 0;
+    stream >> version >> count;
+    if (stream.status() != QDataStream::Ok || version != WireFormat::VersionBinary1) {
+        qWarning() << "Unsupported wire format version:" << version;
+        return false;
+    }
+    return true;
+}
+
+// ------------- WireFormat ------------------------------------------------------
+
+WireFormat::WireFormat()
+{
+}
+
+bool WireFormat::isSupported(int version)
+{
+    return version == VersionMap || version == VersionBinary1;
+}
+
+QByteArray WireFormat::encodeThreads(const QList<QVariantMap> &threads, int version)
+{
+    QByteArray data;
+    if (version != VersionBinary1) {
+        return data;
+    }
+
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << (quint32) version << (quint32) threads.count();
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        writeThread(stream, thread);
+    }
+    return data;
+}
+
+Threads WireFormat::decodeThreads(const QByteArray &data)
+{
+    Threads threads;
+    QDataStream stream(data);
+    quint32 count = 0;
+    if (!readHeader(stream, count)) {
+        return threads;
+    }
+
+    for (quint32 i = 0; i < count; ++i) {
+        Thread thread = readThread(stream);
+        if (stream.status() != QDataStream::Ok) {
+            qWarning() << "Failed to decode threads page at record" << i;
+            break;
+        }
+        if (!thread.isNull()) {
+            threads << thread;
+        }
+    }
+    return threads;
+}
+
+QByteArray WireFormat::encodeEvents(const QList<QVariantMap> &events, int version)
+{
+    QByteArray data;
+    if (version != VersionBinary1) {
+        return data;
+    }
+
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream.setVersion(StreamVersion);
+    stream << (quint32) version << (quint32) events.count();
+    Q_FOREACH(const QVariantMap &event, events) {
+        writeEvent(stream, event);
+    }
+    return data;
+}
+
+Events WireFormat::decodeEvents(const QByteArray &data)
+{
+    Events events;
+    QDataStream stream(data);
+    quint32 count = 0;
+    if (!readHeader(stream, count)) {
+        return events;
+    }
+
+    for (quint32 i = 0; i < count; ++i) {
+        Event event = readEvent(stream);
+        if (stream.status() != QDataStream::Ok) {
+            qWarning() << "Failed to decode events page at record" << i;
+            break;
+        }
+        if (!event.isNull()) {
+            events << event;
+        }
+    }
+    return events;
+}
+
+}
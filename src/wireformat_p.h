@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * Authors:
+ *  Gustavo Pichorim Boiko <gustavo.boiko@canonical.com>
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef WIREFORMAT_P_H
+#define WIREFORMAT_P_H
+
+#include <QByteArray>
+#include <QVariantMap>
+#include "types.h"
+#include "event.h"
+#include "thread.h"
+
+namespace History {
+
+/**
+ * @brief Compact encoding of threads and events pages sent over DBus.
+ *
+ * Instead of one a{sv} map per item, a page is serialized into a single
+ * byte array: a version header followed by records with a fixed field
+ * order and timestamps stored as milliseconds since the epoch.
+ * Version 0 means the map form, which is always supported.
+ */
+class WireFormat
+{
+public:
+    enum Version {
+        VersionMap = 0,
+        VersionBinary1 = 1
+    };
+
+    static const int CurrentVersion = VersionBinary1;
+
+    static bool isSupported(int version);
+
+    static QByteArray encodeThreads(const QList<QVariantMap> &threads, int version = CurrentVersion);
+    static Threads decodeThreads(const QByteArray &data);
+
+    static QByteArray encodeEvents(const QList<QVariantMap> &events, int version = CurrentVersion);
+    static Events decodeEvents(const QByteArray &data);
+
+private:
+    WireFormat();
+};
+
+}
+
+#endif // WIREFORMAT_P_H
@@ -0,0 +1,29 @@
+import QtQuick 2.0
+
+Item {
+    width: 480
+    height: 800
+
+    ListView {
+        anchors.fill: parent
+        model: eventModel
+        delegate: Text {
+            width: ListView.view.width
+            height: 40
+            text: eventId + ": " + textMessage
+        }
+    }
+
+    // keeps the window rendering frames, so that stalls show up in the frame times
+    Rectangle {
+        width: 40
+        height: 40
+        color: "red"
+        RotationAnimation on rotation {
+            from: 0
+            to: 360
+            duration: 1000
+            loops: Animation.Infinite
+        }
+    }
+}
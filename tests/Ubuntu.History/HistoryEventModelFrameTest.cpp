@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QQmlContext>
+#include <QQuickView>
+#include "liveeventmodel.h"
+#include "textevent.h"
+
+class HistoryEventModelFrameTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testRangeChanges();
+    void benchmarkBurstFrameTime_data();
+    void benchmarkBurstFrameTime();
+
+private:
+    void setUpModel(LiveEventModel &model);
+    History::TextEvent frameEvent(int number);
+    History::Events burst(int first, int count);
+
+    QDateTime mTimestamp;
+};
+
+void HistoryEventModelFrameTest::initTestCase()
+{
+    mTimestamp = QDateTime::currentDateTime();
+}
+
+void HistoryEventModelFrameTest::setUpModel(LiveEventModel &model)
+{
+    model.classBegin();
+    HistoryQmlFilter *filter = new HistoryQmlFilter(&model);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue("frameThread");
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(&model);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+    model.componentComplete();
+}
+
+History::TextEvent HistoryEventModelFrameTest::frameEvent(int number)
+{
+    return History::TextEvent("frameAccount", "frameThread", QString("frameEvent%1").arg(number),
+                              "frameSender", mTimestamp.addSecs(number), false,
+                              QString("Message %1").arg(number), History::MessageTypeText,
+                              History::MessageStatusRead);
+}
+
+/// events newer than all the ones from the previous bursts, arriving out of order
+History::Events HistoryEventModelFrameTest::burst(int first, int count)
+{
+    History::Events events;
+    for (int i = 0; i < count; ++i) {
+        events << frameEvent(first + (i * 7) % count);
+    }
+    return events;
+}
+
+void HistoryEventModelFrameTest::testRangeChanges()
+{
+    LiveEventModel model;
+    setUpModel(model);
+    QSignalSpy rowsInserted(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy rowsRemoved(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy dataChanged(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    History::Events older = burst(0, 200);
+    model.onEventsAdded(older);
+    QCOMPARE(rowsInserted.count(), 1);
+    QCOMPARE(model.rowCount(), 200);
+
+    // a burst of newer events goes to the top in a single range
+    History::Events newer = burst(200, 200);
+    model.onEventsAdded(newer);
+    QCOMPARE(rowsInserted.count(), 2);
+    QCOMPARE(rowsInserted.last()[1].toInt(), 0);
+    QCOMPARE(rowsInserted.last()[2].toInt(), 199);
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(),
+                 QString("frameEvent%1").arg(399 - row));
+    }
+
+    // events already in the model are not added again
+    model.onEventsAdded(newer.mid(0, 10));
+    QCOMPARE(rowsInserted.count(), 2);
+
+    // contiguous rows are removed and changed in one go
+    History::Events removed;
+    History::Events modified;
+    for (int i = 0; i < 50; ++i) {
+        removed << frameEvent(399 - i);
+        History::TextEvent event = frameEvent(i);
+        event.setMessageStatus(History::MessageStatusDelivered);
+        modified << event;
+    }
+    model.onEventsRemoved(removed);
+    QCOMPARE(rowsRemoved.count(), 1);
+    QCOMPARE(model.rowCount(), 350);
+
+    dataChanged.clear();
+    model.onEventsModified(modified);
+    QCOMPARE(dataChanged.count(), 1);
+    QCOMPARE(dataChanged.last()[0].value<QModelIndex>().row(), 300);
+    QCOMPARE(dataChanged.last()[1].value<QModelIndex>().row(), 349);
+    QCOMPARE(model.index(349).data(HistoryEventModel::TextMessageStatusRole).toInt(), (int)History::MessageStatusDelivered);
+}
+
+void HistoryEventModelFrameTest::benchmarkBurstFrameTime_data()
+{
+    QTest::addColumn<int>("batchSize");
+
+    QTest::newRow("one event at a time") << 1;
+    QTest::newRow("whole burst") << 200;
+}
+
+void HistoryEventModelFrameTest::benchmarkBurstFrameTime()
+{
+    QFETCH(int, batchSize);
+
+    LiveEventModel model;
+    setUpModel(model);
+
+    QQuickView view;
+    view.rootContext()->setContextProperty("eventModel", &model);
+    view.setSource(QUrl::fromLocalFile(QFINDTESTDATA("EventList.qml")));
+    QCOMPARE(view.status(), QQuickView::Ready);
+    view.show();
+    QVERIFY(QTest::qWaitForWindowExposed(&view));
+
+    // frames are timed on the GUI thread, which is where inserting the rows blocks them
+    QElapsedTimer clock;
+    clock.start();
+    QList<qint64> frameTimes;
+    qint64 lastFrame = 0;
+    connect(&view, &QQuickWindow::frameSwapped, &view, [&]() {
+        qint64 now = clock.nsecsElapsed();
+        frameTimes << now - lastFrame;
+        lastFrame = now;
+    });
+
+    QList<History::Events> bursts;
+    for (int i = 0; i < 10; ++i) {
+        bursts << burst(i * 200, 200);
+    }
+
+    QBENCHMARK_ONCE {
+        frameTimes.clear();
+        lastFrame = clock.nsecsElapsed();
+        Q_FOREACH(const History::Events &events, bursts) {
+            for (int i = 0; i < events.count(); i += batchSize) {
+                model.onEventsAdded(events.mid(i, batchSize));
+            }
+            QTest::qWait(100);
+        }
+    }
+
+    QCOMPARE(model.rowCount(), 2000);
+    QVERIFY(!frameTimes.isEmpty());
+    std::sort(frameTimes.begin(), frameTimes.end());
+    qDebug() << "Frame time p50:" << frameTimes[frameTimes.count() / 2] / 1000 << "us,"
+             << "p95:" << frameTimes[frameTimes.count() * 95 / 100] / 1000 << "us,"
+             << "max:" << frameTimes.last() / 1000 << "us";
+}
+
+QTEST_MAIN(HistoryEventModelFrameTest)
+#include "HistoryEventModelFrameTest.moc"
@@ -20,7 +20,42 @@
 #include "telepathytest.h"
 #include "manager.h"
 #include "textevent.h"
-#include "historyeventmodel.h"
+#include "liveeventmodel.h"
+#include <cstdlib>
+#include <new>
+
+// counts every allocation made by the test, so that the benchmarks can report
+// how much memory traffic the models generate and not just the wall time
+static QAtomicInt allocationCount(0);
+
+void *operator new(std::size_t size)
+{
+    allocationCount.ref();
+    void *ptr = std::malloc(size ? size : 1);
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+// records the pages shown by the model
+class PagedEventModel : public HistoryEventModel
+{
+public:
+    QList<History::Events> pages;
+
+protected:
+    void onPageFetched(const History::Events &events)
+    {
+        pages << events;
+        HistoryEventModel::onPageFetched(events);
+    }
+};
 
 class HistoryEventModelTest : public TelepathyTest
 {
@@ -29,8 +64,21 @@ class HistoryEventModelTest : public TelepathyTest
 private Q_SLOTS:
     void initTestCase();
     void testTelepathyInitializedCorrectly();
+    void testRowsFollowChanges();
+    void testContactLookupKey_data();
+    void testContactLookupKey();
+    void testContactChanges();
+    void testPrefetchedPageConsumed();
+    void testPrefetchDroppedOnQueryChange();
+    void testPrefetchDroppedOnRemoval();
+    void testNoDuplicateFetches();
+    void benchmarkLiveInsertion();
+    void benchmarkPageAllocations();
 
 private:
+    History::Events writePagingEvents(const QString &accountName, const QString &participant, int count);
+    void setUpPagedModel(PagedEventModel &model, const QString &threadId, HistoryQmlSort::SortOrder order);
+    QList<int> changedRows(LiveEventModel &model, const QString &accountId, const QString &identifier);
     History::Manager *mManager;
 };
 
@@ -92,5 +140,396 @@ void HistoryEventModelTest::testTelepathyInitializedCorrectly()
     QTRY_COMPARE(model.rowCount(), 0);
 }
 
+void HistoryEventModelTest::testRowsFollowChanges()
+{
+    Tp::AccountPtr account = addAccount("mock", "ofono", "Another Account");
+    QVERIFY(!account.isNull());
+
+    QString participant("rowsParticipant");
+    History::Thread textThread = mManager->threadForParticipants(account->uniqueIdentifier(),
+                                                             History::EventTypeText,
+                                                             QStringList() << participant,
+                                                             History::MatchCaseSensitive, true);
+
+    QDateTime timestamp = QDateTime::currentDateTime();
+    History::Events events;
+    for (int i = 0; i < 10; ++i) {
+        events << History::TextEvent(textThread.accountId(),
+                                     textThread.threadId(),
+                                     QString("rowsEvent%1").arg(i),
+                                     participant,
+                                     timestamp.addSecs(i),
+                                     false,
+                                     QString("Message %1").arg(i),
+                                     History::MessageTypeText,
+                                     History::MessageStatusRead,
+                                     timestamp,
+                                     QString(),
+                                     History::InformationTypeNone,
+                                     History::TextEventAttachments(),
+                                     textThread.participants());
+    }
+    QVERIFY(mManager->writeEvents(events));
+
+    HistoryEventModel model;
+    HistoryQmlFilter *filter = new HistoryQmlFilter(this);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue(textThread.threadId());
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(this);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+    QTRY_COMPARE(model.rowCount(), 10);
+
+    // removing events from the middle moves the rows below them up
+    QVERIFY(mManager->removeEvents(History::Events() << events[2] << events[7] << events[5]));
+    QTRY_COMPARE(model.rowCount(), 7);
+    QStringList expectedIds;
+    expectedIds << "rowsEvent9" << "rowsEvent8" << "rowsEvent6" << "rowsEvent4"
+                << "rowsEvent3" << "rowsEvent1" << "rowsEvent0";
+    for (int row = 0; row < expectedIds.count(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), expectedIds[row]);
+    }
+
+    // and the moved rows are still found when they change
+    History::TextEvent modified = events[0];
+    modified.setMessageStatus(History::MessageStatusDelivered);
+    QVERIFY(mManager->writeEvents(History::Events() << modified));
+    QTRY_COMPARE(model.index(6).data(HistoryEventModel::TextMessageStatusRole).toInt(), (int)History::MessageStatusDelivered);
+
+    // writing an event already in the model does not add it again
+    QVERIFY(mManager->writeEvents(History::Events() << events[9]));
+    QTest::qWait(500);
+    QCOMPARE(model.rowCount(), 7);
+
+    mManager->removeThreads(History::Threads() << textThread);
+    QTRY_COMPARE(model.rowCount(), 0);
+}
+
+void HistoryEventModelTest::testContactLookupKey_data()
+{
+    QTest::addColumn<QString>("identifier");
+    QTest::addColumn<QString>("key");
+
+    QTest::newRow("phone number") << "+15551234567" << "1234567";
+    QTest::newRow("formatted phone number") << "+1 (555) 123-4567" << "1234567";
+    QTest::newRow("sip uri") << "sip:+15551234567@sip.example.com" << "1234567";
+    QTest::newRow("short number") << "1234" << "";
+    QTest::newRow("name") << "Alice" << "alice";
+}
+
+void HistoryEventModelTest::testContactLookupKey()
+{
+    QFETCH(QString, identifier);
+    QFETCH(QString, key);
+
+    QCOMPARE(LiveEventModel::contactLookupKey(identifier), key);
+}
+
+void HistoryEventModelTest::testContactChanges()
+{
+    Tp::AccountPtr account = addAccount("mock", "ofono", "Contacts Account");
+    QVERIFY(!account.isNull());
+    QString accountId = account->uniqueIdentifier();
+
+    LiveEventModel model;
+    model.classBegin();
+    model.setMatchContacts(true);
+    HistoryQmlFilter *filter = new HistoryQmlFilter(&model);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue("contactsThread");
+    model.setFilter(filter);
+    HistoryQmlSort *sort = new HistoryQmlSort(&model);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+    model.componentComplete();
+
+    // the newest event goes on the first row
+    QStringList senders = QStringList() << "+15551234567" << "alice" << "+15559876543";
+    QDateTime timestamp = QDateTime::currentDateTime();
+    History::Events events;
+    for (int i = 0; i < 7; ++i) {
+        QString sender = senders[i % senders.count()];
+        events << History::TextEvent(accountId, "contactsThread", QString("contactsEvent%1").arg(i), sender,
+                                     timestamp.addSecs(i), false, "Hi", History::MessageTypeText, History::MessageStatusRead,
+                                     timestamp, QString(), History::InformationTypeNone, History::TextEventAttachments(),
+                                     History::Participants() << History::Participant(accountId, sender));
+    }
+    model.onEventsAdded(events.mid(0, 6));
+    QCOMPARE(model.rowCount(), 6);
+
+    // only the rows of the changed contact are notified, matching phone numbers in any format
+    QCOMPARE(changedRows(model, accountId, "5551234567"), QList<int>() << 2 << 5);
+    QCOMPARE(changedRows(model, accountId, "alice"), QList<int>() << 1 << 4);
+
+    // rows removed from the model are removed from the index too
+    model.onEventsRemoved(History::Events() << events[3]);
+    QCOMPARE(model.rowCount(), 5);
+    QCOMPARE(changedRows(model, accountId, "5551234567"), QList<int>() << 4);
+
+    // and inserted rows are added to it
+    model.onEventsAdded(History::Events() << events[6]);
+    QCOMPARE(model.rowCount(), 6);
+    QCOMPARE(changedRows(model, accountId, "+1 555 123 4567"), QList<int>() << 0 << 5);
+
+    // a contact nobody in the model has touches nothing
+    QCOMPARE(changedRows(model, accountId, "+15550000000"), QList<int>());
+}
+
+void HistoryEventModelTest::testPrefetchedPageConsumed()
+{
+    History::Events events = writePagingEvents("Prefetch Account", "prefetchParticipant", 30);
+    PagedEventModel model;
+    model.setPageSize(10);
+    model.setPrefetchPages(1);
+    setUpPagedModel(model, events.first().threadId(), HistoryQmlSort::DescendingOrder);
+    QTRY_COMPARE(model.rowCount(), 10);
+
+    // let the page read ahead arrive, it is then shown without waiting for the service
+    QTest::qWait(500);
+    QCOMPARE(model.pages.count(), 1);
+    model.fetchMore(QModelIndex());
+    QCOMPARE(model.rowCount(), 20);
+    QCOMPARE(model.pages.count(), 2);
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), events[29 - row].eventId());
+    }
+
+    mManager->removeThreads(History::Threads() << mManager->getSingleThread(History::EventTypeText, events.first().accountId(),
+                                                                             events.first().threadId()));
+}
+
+void HistoryEventModelTest::testPrefetchDroppedOnQueryChange()
+{
+    History::Events events = writePagingEvents("Query Change Account", "queryChangeParticipant", 30);
+    PagedEventModel model;
+    model.setPageSize(10);
+    model.setPrefetchPages(1);
+    setUpPagedModel(model, events.first().threadId(), HistoryQmlSort::DescendingOrder);
+    QTRY_COMPARE(model.rowCount(), 10);
+    QTest::qWait(500);
+
+    // the page read ahead for the descending order is not shown once the order changes
+    model.pages.clear();
+    model.sort()->setSortOrder(HistoryQmlSort::AscendingOrder);
+    QTRY_COMPARE(model.rowCount(), 10);
+    QTest::qWait(500);
+    model.fetchMore(QModelIndex());
+    QTRY_COMPARE(model.rowCount(), 20);
+    QCOMPARE(model.pages.count(), 2);
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), events[row].eventId());
+    }
+
+    // and neither is the one read ahead for the previous filter
+    model.pages.clear();
+    model.filter()->setFilterValue("someOtherThread");
+    QTRY_COMPARE(model.rowCount(), 0);
+    QTest::qWait(500);
+    model.fetchMore(QModelIndex());
+    QTest::qWait(500);
+    QCOMPARE(model.rowCount(), 0);
+    QVERIFY(model.pages.isEmpty());
+
+    mManager->removeThreads(History::Threads() << mManager->getSingleThread(History::EventTypeText, events.first().accountId(),
+                                                                             events.first().threadId()));
+}
+
+void HistoryEventModelTest::testPrefetchDroppedOnRemoval()
+{
+    History::Events events = writePagingEvents("Removal Account", "removalParticipant", 30);
+    PagedEventModel model;
+    model.setPageSize(10);
+    model.setPrefetchPages(1);
+    setUpPagedModel(model, events.first().threadId(), HistoryQmlSort::DescendingOrder);
+    QTRY_COMPARE(model.rowCount(), 10);
+    QTest::qWait(500);
+
+    // events removed while their page was read ahead do not show up when it is inserted
+    QVERIFY(mManager->removeEvents(History::Events() << events[15] << events[12]));
+    QTest::qWait(500);
+    model.fetchMore(QModelIndex());
+    QCOMPARE(model.rowCount(), 18);
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QString eventId = model.index(row).data(HistoryEventModel::EventIdRole).toString();
+        QVERIFY(eventId != events[15].eventId() && eventId != events[12].eventId());
+    }
+
+    mManager->removeThreads(History::Threads() << mManager->getSingleThread(History::EventTypeText, events.first().accountId(),
+                                                                             events.first().threadId()));
+}
+
+void HistoryEventModelTest::testNoDuplicateFetches()
+{
+    History::Events events = writePagingEvents("Duplicate Account", "duplicateParticipant", 35);
+    PagedEventModel model;
+    model.setPageSize(10);
+    model.setPrefetchPages(2);
+    setUpPagedModel(model, events.first().threadId(), HistoryQmlSort::DescendingOrder);
+    QTRY_COMPARE(model.rowCount(), 10);
+
+    // asking for more while a page is on its way or read ahead does not request it again
+    while (model.canFetchMore()) {
+        model.fetchMore(QModelIndex());
+        model.fetchMore(QModelIndex());
+        QTest::qWait(100);
+    }
+    QCOMPARE(model.rowCount(), 35);
+    QCOMPARE(model.pages.count(), 4);
+
+    QSet<QString> eventIds;
+    Q_FOREACH(const History::Events &page, model.pages) {
+        Q_FOREACH(const History::Event &event, page) {
+            QVERIFY(!eventIds.contains(event.eventId()));
+            eventIds << event.eventId();
+        }
+    }
+    QCOMPARE(eventIds.count(), 35);
+
+    mManager->removeThreads(History::Threads() << mManager->getSingleThread(History::EventTypeText, events.first().accountId(),
+                                                                             events.first().threadId()));
+}
+
+void HistoryEventModelTest::benchmarkLiveInsertion()
+{
+    LiveEventModel model;
+    model.classBegin();
+    HistoryQmlFilter *filter = new HistoryQmlFilter(this);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue("liveThread");
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(this);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp, eventId");
+    model.setSort(sort);
+    model.componentComplete();
+
+    // events arrive out of order and several share the same timestamp
+    QDateTime timestamp = QDateTime::currentDateTime();
+    QList<History::Events> batches;
+    for (int i = 0; i < 10000; ++i) {
+        if (i % 100 == 0) {
+            batches << History::Events();
+        }
+        int second = (i * 7919) % 5000;
+        batches.last() << History::TextEvent("liveAccount", "liveThread", QString("liveEvent%1").arg(i, 5, 10, QChar('0')),
+                                             "liveSender", timestamp.addSecs(second), false, "Hi",
+                                             History::MessageTypeText, History::MessageStatusRead);
+    }
+
+    QBENCHMARK_ONCE {
+        Q_FOREACH(const History::Events &batch, batches) {
+            model.onEventsAdded(batch);
+        }
+    }
+
+    QCOMPARE(model.rowCount(), 10000);
+    for (int row = 1; row < model.rowCount(); ++row) {
+        QDateTime previous = model.index(row - 1).data(HistoryEventModel::TimestampRole).toDateTime();
+        QDateTime current = model.index(row).data(HistoryEventModel::TimestampRole).toDateTime();
+        QVERIFY(previous >= current);
+        if (previous == current) {
+            QVERIFY(model.index(row - 1).data(HistoryEventModel::EventIdRole).toString() >
+                    model.index(row).data(HistoryEventModel::EventIdRole).toString());
+        }
+    }
+}
+
+void HistoryEventModelTest::benchmarkPageAllocations()
+{
+    LiveEventModel model;
+    model.classBegin();
+    HistoryQmlFilter *filter = new HistoryQmlFilter(this);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue("pageThread");
+    model.setFilter(filter);
+    model.componentComplete();
+
+    // a full page as delivered by the view: all events of the same thread
+    // share their participants, so inserting them should not copy any of it
+    History::Participants participants;
+    participants << History::Participant("pageAccount", "pageSender");
+    QDateTime timestamp = QDateTime::currentDateTime();
+    History::Events page;
+    for (int i = 0; i < 10000; ++i) {
+        page << History::TextEvent("pageAccount", "pageThread", QString("pageEvent%1").arg(i, 5, 10, QChar('0')),
+                                   "pageSender", timestamp.addSecs(-i), false, "Hi",
+                                   History::MessageTypeText, History::MessageStatusRead,
+                                   QDateTime(), QString(), History::InformationTypeNone,
+                                   History::TextEventAttachments(), participants);
+    }
+
+    int allocations = allocationCount.load();
+    QElapsedTimer timer;
+    timer.start();
+    model.onPageFetched(page);
+    qint64 elapsed = timer.elapsed();
+    allocations = allocationCount.load() - allocations;
+
+    QCOMPARE(model.rowCount(), page.count());
+    qDebug() << "Inserting a page of" << page.count() << "events took" << elapsed << "ms and made"
+             << allocations << "allocations," << qreal(allocations) / page.count() << "per event";
+    QTest::setBenchmarkResult(allocations, QTest::Events);
+}
+
+/// writes events to a new thread, from the oldest to the newest
+History::Events HistoryEventModelTest::writePagingEvents(const QString &accountName, const QString &participant, int count)
+{
+    Tp::AccountPtr account = addAccount("mock", "ofono", accountName);
+    History::Thread thread = mManager->threadForParticipants(account->uniqueIdentifier(),
+                                                         History::EventTypeText,
+                                                         QStringList() << participant,
+                                                         History::MatchCaseSensitive, true);
+
+    QDateTime timestamp = QDateTime::currentDateTime();
+    History::Events events;
+    for (int i = 0; i < count; ++i) {
+        events << History::TextEvent(thread.accountId(), thread.threadId(), QString("pagingEvent%1").arg(i, 2, 10, QChar('0')),
+                                     participant, timestamp.addSecs(i), false, QString("Message %1").arg(i),
+                                     History::MessageTypeText, History::MessageStatusRead, timestamp, QString(),
+                                     History::InformationTypeNone, History::TextEventAttachments(), thread.participants());
+    }
+    mManager->writeEvents(events);
+    return events;
+}
+
+void HistoryEventModelTest::setUpPagedModel(PagedEventModel &model, const QString &threadId, HistoryQmlSort::SortOrder order)
+{
+    HistoryQmlFilter *filter = new HistoryQmlFilter(&model);
+    filter->setFilterProperty(History::FieldThreadId);
+    filter->setFilterValue(threadId);
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(&model);
+    sort->setSortOrder(order);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+}
+
+/// the rows notified after the contact info of the given identifier changes
+QList<int> HistoryEventModelTest::changedRows(LiveEventModel &model, const QString &accountId, const QString &identifier)
+{
+    // let the contact lookups started when the rows were added settle first
+    QTest::qWait(300);
+    QSignalSpy dataChanged(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+    model.onContactInfoChanged(accountId, identifier, QVariantMap());
+    QTest::qWait(300);
+
+    QList<int> rows;
+    for (int i = 0; i < dataChanged.count(); ++i) {
+        QModelIndex first = dataChanged[i][0].value<QModelIndex>();
+        QModelIndex last = dataChanged[i][1].value<QModelIndex>();
+        for (int row = first.row(); row <= last.row(); ++row) {
+            rows << row;
+        }
+    }
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
 QTEST_MAIN(HistoryEventModelTest)
 #include "HistoryEventModelTest.moc"
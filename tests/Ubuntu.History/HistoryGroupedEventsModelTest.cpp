@@ -0,0 +1,221 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include "liveeventmodel.h"
+#include "textevent.h"
+
+class HistoryGroupedEventsModelTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testRangeInsertion();
+    void testRangeUpdates();
+    void testRangeRemoval();
+
+private:
+    void setUpModel(LiveGroupedEventsModel &model);
+    History::TextEvent groupedEvent(int thread, int offset = 0);
+    History::Events conversations(int first, int count);
+
+    QDateTime mTimestamp;
+};
+
+void HistoryGroupedEventsModelTest::initTestCase()
+{
+    mTimestamp = QDateTime::currentDateTime();
+}
+
+/// groups the events by thread, the most recent conversation first
+void HistoryGroupedEventsModelTest::setUpModel(LiveGroupedEventsModel &model)
+{
+    model.classBegin();
+    HistoryQmlFilter *filter = new HistoryQmlFilter(&model);
+    filter->setFilterProperty(History::FieldAccountId);
+    filter->setFilterValue("groupedAccount");
+    model.setFilter(filter);
+
+    HistoryQmlSort *sort = new HistoryQmlSort(&model);
+    sort->setSortOrder(HistoryQmlSort::DescendingOrder);
+    sort->setSortField("timestamp");
+    model.setSort(sort);
+    model.setGroupingProperties(QStringList() << History::FieldThreadId);
+    model.componentComplete();
+}
+
+/// an event of the given thread, the threads being ten seconds apart from each other
+History::TextEvent HistoryGroupedEventsModelTest::groupedEvent(int thread, int offset)
+{
+    return History::TextEvent("groupedAccount", QString("groupedThread%1").arg(thread),
+                              QString("groupedEvent%1-%2").arg(thread).arg(offset), "groupedSender",
+                              mTimestamp.addSecs(thread * 10 + offset), false, "Hi",
+                              History::MessageTypeText, History::MessageStatusRead);
+}
+
+/// the first event of each of the given threads, arriving out of order
+History::Events HistoryGroupedEventsModelTest::conversations(int first, int count)
+{
+    History::Events events;
+    for (int i = 0; i < count; ++i) {
+        events << groupedEvent(first + (i * 7) % count);
+    }
+    return events;
+}
+
+void HistoryGroupedEventsModelTest::testRangeInsertion()
+{
+    LiveGroupedEventsModel model;
+    setUpModel(model);
+    QSignalSpy rowsInserted(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+
+    model.onEventsAdded(conversations(0, 10));
+    QCOMPARE(rowsInserted.count(), 1);
+    QCOMPARE(model.rowCount(), 10);
+
+    // newer conversations go to the top in a single range
+    model.onEventsAdded(conversations(10, 5));
+    QCOMPARE(rowsInserted.count(), 2);
+    QCOMPARE(rowsInserted.last()[1].toInt(), 0);
+    QCOMPARE(rowsInserted.last()[2].toInt(), 4);
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), groupedEvent(14 - row).eventId());
+        QCOMPARE(model.index(row).data(HistoryGroupedEventsModel::EventCountRole).toInt(), 1);
+    }
+
+    // events of a conversation arriving together make a single group
+    History::Events events;
+    events << groupedEvent(20) << groupedEvent(20, 2) << groupedEvent(20, 1);
+    model.onEventsAdded(events);
+    QCOMPARE(rowsInserted.count(), 3);
+    QCOMPARE(model.rowCount(), 16);
+    QCOMPARE(model.index(0).data(HistoryGroupedEventsModel::EventCountRole).toInt(), 3);
+    QCOMPARE(model.index(0).data(HistoryEventModel::EventIdRole).toString(), groupedEvent(20, 2).eventId());
+
+    // and events already in the model are not added again
+    model.onEventsAdded(conversations(10, 5));
+    QCOMPARE(rowsInserted.count(), 3);
+    QCOMPARE(model.rowCount(), 16);
+}
+
+void HistoryGroupedEventsModelTest::testRangeUpdates()
+{
+    LiveGroupedEventsModel model;
+    setUpModel(model);
+    model.onEventsAdded(conversations(0, 15));
+    QSignalSpy rowsInserted(&model, SIGNAL(rowsInserted(QModelIndex,int,int)));
+    QSignalSpy dataChanged(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    // newer events of the conversations in rows 10 to 14 change them in one go
+    History::Events newer;
+    for (int thread = 0; thread < 5; ++thread) {
+        newer << groupedEvent(thread, 5);
+    }
+    model.onEventsAdded(newer);
+    QCOMPARE(rowsInserted.count(), 0);
+    QCOMPARE(dataChanged.count(), 1);
+    QCOMPARE(dataChanged.last()[0].value<QModelIndex>().row(), 10);
+    QCOMPARE(dataChanged.last()[1].value<QModelIndex>().row(), 14);
+    for (int row = 10; row < 15; ++row) {
+        QCOMPARE(model.index(row).data(HistoryGroupedEventsModel::EventCountRole).toInt(), 2);
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), groupedEvent(14 - row, 5).eventId());
+    }
+
+    // modified events are updated in their groups, displayed or not
+    History::Events modified;
+    for (int thread = 10; thread < 15; ++thread) {
+        History::TextEvent event = groupedEvent(thread);
+        event.setMessageStatus(History::MessageStatusDelivered);
+        modified << event;
+    }
+    History::TextEvent hidden = groupedEvent(0);
+    hidden.setMessageStatus(History::MessageStatusDelivered);
+    modified << hidden;
+
+    dataChanged.clear();
+    model.onEventsModified(modified);
+    QCOMPARE(rowsInserted.count(), 0);
+    QCOMPARE(dataChanged.count(), 2);
+    QCOMPARE(dataChanged[0][0].value<QModelIndex>().row(), 0);
+    QCOMPARE(dataChanged[0][1].value<QModelIndex>().row(), 4);
+    QCOMPARE(dataChanged[1][0].value<QModelIndex>().row(), 14);
+    QCOMPARE(dataChanged[1][1].value<QModelIndex>().row(), 14);
+    for (int row = 0; row < 5; ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::TextMessageStatusRole).toInt(), (int)History::MessageStatusDelivered);
+    }
+    QVariantList events = model.index(14).data(HistoryGroupedEventsModel::EventsRole).toList();
+    QCOMPARE(events.count(), 2);
+    QCOMPARE(events[1].toMap()[History::FieldMessageStatus].toInt(), (int)History::MessageStatusDelivered);
+}
+
+void HistoryGroupedEventsModelTest::testRangeRemoval()
+{
+    LiveGroupedEventsModel model;
+    setUpModel(model);
+    model.onEventsAdded(conversations(0, 15));
+    History::Events newer;
+    for (int thread = 0; thread < 5; ++thread) {
+        newer << groupedEvent(thread, 5);
+    }
+    model.onEventsAdded(newer);
+    QSignalSpy rowsRemoved(&model, SIGNAL(rowsRemoved(QModelIndex,int,int)));
+    QSignalSpy dataChanged(&model, SIGNAL(dataChanged(QModelIndex,QModelIndex)));
+
+    // removing the displayed events brings the previous ones back, in a single change
+    model.onEventsRemoved(newer);
+    QCOMPARE(rowsRemoved.count(), 0);
+    QCOMPARE(dataChanged.count(), 1);
+    QCOMPARE(dataChanged.last()[0].value<QModelIndex>().row(), 10);
+    QCOMPARE(dataChanged.last()[1].value<QModelIndex>().row(), 14);
+    for (int row = 10; row < 15; ++row) {
+        QCOMPARE(model.index(row).data(HistoryGroupedEventsModel::EventCountRole).toInt(), 1);
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), groupedEvent(14 - row).eventId());
+    }
+
+    // contiguous groups left empty are removed together, and the groups
+    // that only lost some events are notified at their new rows
+    History::Events removed;
+    for (int thread = 9; thread < 14; ++thread) {
+        removed << groupedEvent(thread);
+    }
+    model.onEventsAdded(History::Events() << groupedEvent(0, 5));
+    removed << groupedEvent(0, 5);
+    dataChanged.clear();
+    model.onEventsRemoved(removed);
+    QCOMPARE(rowsRemoved.count(), 1);
+    QCOMPARE(rowsRemoved.last()[1].toInt(), 1);
+    QCOMPARE(rowsRemoved.last()[2].toInt(), 5);
+    QCOMPARE(model.rowCount(), 10);
+    QCOMPARE(dataChanged.count(), 1);
+    QCOMPARE(dataChanged.last()[0].value<QModelIndex>().row(), 9);
+    QCOMPARE(dataChanged.last()[1].value<QModelIndex>().row(), 9);
+
+    QStringList expectedIds;
+    expectedIds << groupedEvent(14).eventId();
+    for (int thread = 8; thread >= 0; --thread) {
+        expectedIds << groupedEvent(thread).eventId();
+    }
+    for (int row = 0; row < model.rowCount(); ++row) {
+        QCOMPARE(model.index(row).data(HistoryEventModel::EventIdRole).toString(), expectedIds[row]);
+    }
+}
+
+QTEST_MAIN(HistoryGroupedEventsModelTest)
+#include "HistoryGroupedEventsModelTest.moc"
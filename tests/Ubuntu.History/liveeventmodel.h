@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIVEEVENTMODEL_H
+#define LIVEEVENTMODEL_H
+
+#include "historyeventmodel.h"
+#include "historygroupedeventsmodel.h"
+
+// gives access to the slots receiving the events from the view, so that the
+// tests can feed the models without going through the service
+template <class Model>
+class LiveModel : public Model
+{
+public:
+    using Model::onEventsAdded;
+    using Model::onEventsModified;
+    using Model::onEventsRemoved;
+    using Model::onContactInfoChanged;
+    using Model::onPageFetched;
+    using Model::contactLookupKey;
+};
+
+typedef LiveModel<HistoryEventModel> LiveEventModel;
+typedef LiveModel<HistoryGroupedEventsModel> LiveGroupedEventsModel;
+
+#endif // LIVEEVENTMODEL_H
@@ -64,11 +64,23 @@ private Q_SLOTS:
     void testOutgoingCall();
     void testDeliveryReport_data();
     void testDeliveryReport();
+    void testSignalCoalescing();
+    void testSignalReplacedInPlace();
+    void testSignalAddedThenModified();
+    void testSignalAddedThenRemoved();
+    void testSignalThreadModifiedOnce();
+    void testWriteQueueOrder();
+    void testWriteQueueInterval();
+    void testWriteQueueFlushedBeforeRead();
 
     // helper slots
     void onPendingContactsFinished(Tp::PendingOperation*);
 
 private:
+    History::TextEvent modifiedEvent(const History::TextEvent &event, const QString &message);
+    void placeIncomingMessages(const QString &sender, const QStringList &messages);
+    int writeQueueInterval() const;
+    int writeQueueMaxBatch() const;
     Approver *mApprover;
     Handler *mHandler;
     MockController *mMockController;
@@ -436,6 +448,256 @@ void DaemonTest::testDeliveryReport()
     channel->requestClose();
 }
 
+void DaemonTest::testSignalCoalescing()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "burstParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy eventsModifiedSpy(History::Manager::instance(), SIGNAL(eventsModified(History::Events)));
+
+    // a burst of new messages
+    History::Events events;
+    for (int i = 0; i < 1000; ++i) {
+        events << History::TextEvent(thread.accountId(), thread.threadId(), QString("burstEvent%1").arg(i),
+                                     "burstParticipant", QDateTime::currentDateTime(), true, QString("Burst %1").arg(i),
+                                     History::MessageTypeText, History::MessageStatusUnknown);
+    }
+    QVERIFY(History::Manager::instance()->writeEvents(events));
+
+    auto receivedCount = [&]() {
+        int count = 0;
+        for (int i = 0; i < eventsAddedSpy.count(); ++i) {
+            count += eventsAddedSpy[i].first().value<History::Events>().count();
+        }
+        return count;
+    };
+    QTRY_COMPARE_WITH_TIMEOUT(receivedCount(), 1000, 10000);
+
+    // every event is sent once, in payloads of bounded size
+    QSet<QString> eventIds;
+    for (int i = 0; i < eventsAddedSpy.count(); ++i) {
+        History::Events received = eventsAddedSpy[i].first().value<History::Events>();
+        QVERIFY(received.count() <= 200);
+        Q_FOREACH(const History::Event &event, received) {
+            eventIds << event.eventId();
+        }
+    }
+    QCOMPARE(eventIds.count(), 1000);
+    QCOMPARE(eventsModifiedSpy.count(), 0);
+}
+
+void DaemonTest::testSignalReplacedInPlace()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "replacedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    History::TextEvent event(thread.accountId(), thread.threadId(), "replacedEvent", "replacedParticipant",
+                             QDateTime::currentDateTime(), true, "First", History::MessageTypeText);
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << event));
+    QTRY_COMPARE(eventsAddedSpy.count(), 1);
+
+    // two modifications of the same event are sent once, with the latest data
+    QSignalSpy eventsModifiedSpy(History::Manager::instance(), SIGNAL(eventsModified(History::Events)));
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << modifiedEvent(event, "Second")));
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << modifiedEvent(event, "Third")));
+    QTRY_COMPARE(eventsModifiedSpy.count(), 1);
+    QTest::qWait(500);
+    QCOMPARE(eventsModifiedSpy.count(), 1);
+
+    History::Events events = eventsModifiedSpy.first().first().value<History::Events>();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(History::TextEvent(events.first()).message(), QString("Third"));
+}
+
+void DaemonTest::testSignalAddedThenModified()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "foldedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy eventsModifiedSpy(History::Manager::instance(), SIGNAL(eventsModified(History::Events)));
+
+    // an event modified before it was signalled is only sent as added, with the latest data
+    History::TextEvent event(thread.accountId(), thread.threadId(), "foldedEvent", "foldedParticipant",
+                             QDateTime::currentDateTime(), true, "First", History::MessageTypeText);
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << event));
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << modifiedEvent(event, "Second")));
+    QTRY_COMPARE(eventsAddedSpy.count(), 1);
+    QTest::qWait(500);
+    QCOMPARE(eventsAddedSpy.count(), 1);
+    QCOMPARE(eventsModifiedSpy.count(), 0);
+
+    History::Events events = eventsAddedSpy.first().first().value<History::Events>();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(History::TextEvent(events.first()).message(), QString("Second"));
+}
+
+void DaemonTest::testSignalAddedThenRemoved()
+{
+    QSignalSpy threadsAddedSpy(History::Manager::instance(), SIGNAL(threadsAdded(History::Threads)));
+    QSignalSpy threadsRemovedSpy(History::Manager::instance(), SIGNAL(threadsRemoved(History::Threads)));
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy eventsRemovedSpy(History::Manager::instance(), SIGNAL(eventsRemoved(History::Events)));
+
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "droppedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+
+    // an event removed before it was signalled is only sent as removed
+    History::TextEvent event(thread.accountId(), thread.threadId(), "droppedEvent", "droppedParticipant",
+                             QDateTime::currentDateTime(), true, "Dropped", History::MessageTypeText);
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << event));
+    QVERIFY(History::Manager::instance()->removeEvents(History::Events() << event));
+
+    // and so is a thread, even though the removed thread has no last event anymore
+    QVERIFY(History::Manager::instance()->removeThreads(History::Threads() << thread));
+
+    QTRY_COMPARE(eventsRemovedSpy.count(), 1);
+    QTRY_COMPARE(threadsRemovedSpy.count(), 1);
+    QTest::qWait(500);
+    QCOMPARE(eventsAddedSpy.count(), 0);
+    QCOMPARE(threadsAddedSpy.count(), 0);
+}
+
+void DaemonTest::testSignalThreadModifiedOnce()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "modifiedParticipant",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+    QTest::qWait(500);
+
+    // every write carries a different last event, but the thread is sent once
+    QSignalSpy threadsModifiedSpy(History::Manager::instance(), SIGNAL(threadsModified(History::Threads)));
+    for (int i = 0; i < 3; ++i) {
+        History::TextEvent event(thread.accountId(), thread.threadId(), QString("modifiedEvent%1").arg(i), "modifiedParticipant",
+                                 QDateTime::currentDateTime(), true, QString("Message %1").arg(i), History::MessageTypeText);
+        QVERIFY(History::Manager::instance()->writeEvents(History::Events() << event));
+    }
+    QTRY_COMPARE(threadsModifiedSpy.count(), 1);
+    QTest::qWait(500);
+    QCOMPARE(threadsModifiedSpy.count(), 1);
+
+    History::Threads threads = threadsModifiedSpy.first().first().value<History::Threads>();
+    QCOMPARE(threads.count(), 1);
+    QCOMPARE(threads.first().lastEvent().eventId(), QString("modifiedEvent2"));
+}
+
+void DaemonTest::testWriteQueueOrder()
+{
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy handlerSpy(mHandler, SIGNAL(textChannelAvailable(Tp::TextChannelPtr)));
+
+    // a full batch is written without waiting for the flush interval
+    QStringList messages;
+    for (int i = 0; i < writeQueueMaxBatch(); ++i) {
+        messages << QString("Queued %1").arg(i);
+    }
+    QElapsedTimer timer;
+    timer.start();
+    placeIncomingMessages("queueOrderSender", messages);
+    QTRY_COMPARE_WITH_TIMEOUT(eventsAddedSpy.count(), 1, writeQueueInterval() / 2);
+    QVERIFY(timer.elapsed() < writeQueueInterval());
+
+    // and the queued messages keep the order they arrived in
+    History::Events events = eventsAddedSpy.first().first().value<History::Events>();
+    QCOMPARE(events.count(), messages.count());
+    for (int i = 0; i < events.count(); ++i) {
+        QCOMPARE(History::TextEvent(events[i]).message(), messages[i]);
+    }
+
+    QTRY_COMPARE(handlerSpy.count(), 1);
+    handlerSpy.first().first().value<Tp::TextChannelPtr>()->requestClose();
+}
+
+void DaemonTest::testWriteQueueInterval()
+{
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy handlerSpy(mHandler, SIGNAL(textChannelAvailable(Tp::TextChannelPtr)));
+
+    // a single message stays queued until the flush interval expires
+    placeIncomingMessages("queueIntervalSender", QStringList() << "Waiting");
+    QTRY_COMPARE(handlerSpy.count(), 1);
+    QTest::qWait(writeQueueInterval() / 4);
+    QCOMPARE(eventsAddedSpy.count(), 0);
+    QTRY_COMPARE_WITH_TIMEOUT(eventsAddedSpy.count(), 1, writeQueueInterval() * 2);
+
+    History::Events events = eventsAddedSpy.first().first().value<History::Events>();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(History::TextEvent(events.first()).message(), QString("Waiting"));
+
+    handlerSpy.first().first().value<Tp::TextChannelPtr>()->requestClose();
+}
+
+void DaemonTest::testWriteQueueFlushedBeforeRead()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants(mAccount->uniqueIdentifier(),
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "queueReadSender",
+                                                                                 History::MatchCaseSensitive, true);
+    QVERIFY(!thread.isNull());
+    QTest::qWait(500);
+
+    QSignalSpy eventsAddedSpy(History::Manager::instance(), SIGNAL(eventsAdded(History::Events)));
+    QSignalSpy handlerSpy(mHandler, SIGNAL(textChannelAvailable(Tp::TextChannelPtr)));
+    QElapsedTimer timer;
+    timer.start();
+    placeIncomingMessages("queueReadSender", QStringList() << "Read me");
+
+    // reading the thread writes the queued message first, and it is signalled right away
+    QTRY_COMPARE_WITH_TIMEOUT(History::Manager::instance()->getSingleThread(History::EventTypeText, thread.accountId(),
+                                                                            thread.threadId()).count(), 1,
+                              writeQueueInterval() / 2);
+    QTRY_COMPARE_WITH_TIMEOUT(eventsAddedSpy.count(), 1, writeQueueInterval() / 2);
+    QVERIFY(timer.elapsed() < writeQueueInterval());
+    QCOMPARE(History::TextEvent(eventsAddedSpy.first().first().value<History::Events>().first()).message(), QString("Read me"));
+
+    QTRY_COMPARE(handlerSpy.count(), 1);
+    handlerSpy.first().first().value<Tp::TextChannelPtr>()->requestClose();
+}
+
+History::TextEvent DaemonTest::modifiedEvent(const History::TextEvent &event, const QString &message)
+{
+    return History::TextEvent(event.accountId(), event.threadId(), event.eventId(), event.senderId(),
+                              event.timestamp(), event.newEvent(), message, event.messageType());
+}
+
+void DaemonTest::placeIncomingMessages(const QString &sender, const QStringList &messages)
+{
+    QVariantMap properties;
+    properties["Sender"] = sender;
+    properties["SentTime"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    properties["Recipients"] = QStringList() << sender;
+    Q_FOREACH(const QString &message, messages) {
+        mMockController->placeIncomingMessage(message, properties);
+    }
+}
+
+/// the daemon runs with the write queue settings from tests/daemon/CMakeLists.txt
+int DaemonTest::writeQueueInterval() const
+{
+    return qgetenv("HISTORY_WRITE_QUEUE_INTERVAL").toInt();
+}
+
+int DaemonTest::writeQueueMaxBatch() const
+{
+    return qgetenv("HISTORY_WRITE_QUEUE_MAX_BATCH").toInt();
+}
+
 void DaemonTest::onPendingContactsFinished(Tp::PendingOperation *op)
 {
     Tp::PendingContacts *pc = qobject_cast<Tp::PendingContacts*>(op);
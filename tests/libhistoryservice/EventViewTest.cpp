@@ -29,6 +29,7 @@
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_METATYPE(History::Events)
 
 #define EVENT_COUNT 50
 
@@ -39,9 +40,11 @@ class EventViewTest : public QObject
 private Q_SLOTS:
     void initTestCase();
     void testNextPage();
+    void testPageSize();
     void testFilter_data();
     void testFilter();
     void testSort();
+    void testFilteredSignals();
 
 private:
     void populate();
@@ -51,6 +54,7 @@ void EventViewTest::initTestCase()
 {
     qRegisterMetaType<History::EventType>();
     qRegisterMetaType<History::MatchFlags>();
+    qRegisterMetaType<History::Events>();
 
     populate();
 }
@@ -73,6 +77,20 @@ void EventViewTest::testNextPage()
     }
 }
 
+void EventViewTest::testPageSize()
+{
+    History::EventViewPtr view = History::Manager::instance()->queryEvents(History::EventTypeText);
+    view->setPageSize(40);
+    QVERIFY(view->isValid());
+    QCOMPARE(view->nextPage().count(), 40);
+
+    // the size can also be changed between pages
+    view->setPageSize(50);
+    QCOMPARE(view->nextPage().count(), 50);
+    QCOMPARE(view->nextPage().count(), EVENT_COUNT * 2 + 1 - 90);
+    QVERIFY(view->nextPage().isEmpty());
+}
+
 void EventViewTest::testFilter_data()
 {
     QTest::addColumn<QVariantMap>("filterProperties");
@@ -161,6 +179,41 @@ void EventViewTest::testSort()
     QCOMPARE(allEvents.last().eventId(), QString("event00"));
 }
 
+void EventViewTest::testFilteredSignals()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants("account0",
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "participant0",
+                                                                                 History::MatchCaseSensitive);
+    History::Thread otherThread = History::Manager::instance()->threadForParticipants("account1",
+                                                                                      History::EventTypeText,
+                                                                                      QStringList() << "participant1",
+                                                                                      History::MatchCaseSensitive);
+    QVERIFY(!thread.isNull());
+    QVERIFY(!otherThread.isNull());
+
+    History::EventViewPtr view = History::Manager::instance()->queryEvents(History::EventTypeText, History::Sort(),
+                                                                           History::Filter(History::FieldThreadId, thread.threadId()));
+    QVERIFY(view->isValid());
+    // the first page makes sure the view got created on the service
+    QVERIFY(!view->nextPage().isEmpty());
+    QSignalSpy eventsAdded(view.data(), SIGNAL(eventsAdded(History::Events)));
+
+    // events written to other threads are not sent to the view
+    History::TextEvent otherEvent(otherThread.accountId(), otherThread.threadId(), "filteredSignalsEvent", "participant1",
+                                  QDateTime::currentDateTime(), true, "Not for this view",
+                                  History::MessageTypeText, History::MessageStatusDelivered);
+    History::TextEvent event(thread.accountId(), thread.threadId(), "filteredSignalsEvent", "participant0",
+                             QDateTime::currentDateTime(), true, "For this view",
+                             History::MessageTypeText, History::MessageStatusDelivered);
+    QVERIFY(History::Manager::instance()->writeEvents(History::Events() << otherEvent << event));
+
+    QTRY_COMPARE(eventsAdded.count(), 1);
+    History::Events events = eventsAdded.first().first().value<History::Events>();
+    QCOMPARE(events.count(), 1);
+    QCOMPARE(events.first().threadId(), thread.threadId());
+}
+
 void EventViewTest::populate()
 {
     // create two threads of each type
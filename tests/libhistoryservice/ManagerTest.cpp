@@ -45,6 +45,7 @@ private Q_SLOTS:
     void testWriteEvents();
     void testRemoveEvents();
     void testGetSingleEvent();
+    void testAsyncCalls();
     void testRemoveThreads();
     void cleanupTestCase();
 
@@ -336,6 +337,98 @@ void ManagerTest::testGetSingleEvent()
     QCOMPARE(retrievedVoiceEvent.duration(), voiceEvent.duration());
 }
 
+void ManagerTest::testAsyncCalls()
+{
+    History::Thread thread;
+    mManager->threadForParticipantsAsync("asyncAccountId",
+                                         History::EventTypeText,
+                                         QStringList() << "asyncParticipant",
+                                         History::MatchCaseSensitive, true, this,
+                                         [&](const History::Thread &result) { thread = result; });
+    QTRY_VERIFY(!thread.isNull());
+    QCOMPARE(thread.accountId(), QString("asyncAccountId"));
+
+    History::Thread sameThread;
+    mManager->getSingleThreadAsync(thread.type(), thread.accountId(), thread.threadId(), QVariantMap(), this,
+                                   [&](const History::Thread &result) { sameThread = result; });
+    QTRY_VERIFY(!sameThread.isNull());
+    QVERIFY(sameThread == thread);
+
+    History::TextEvent textEvent(thread.accountId(),
+                                 thread.threadId(),
+                                 "asyncEventId",
+                                 "asyncParticipant",
+                                 QDateTime::currentDateTime(),
+                                 true,
+                                 "Hello async world",
+                                 History::MessageTypeText,
+                                 History::MessageStatusAccepted);
+    bool finished = false;
+    bool written = false;
+    mManager->writeEventsAsync(History::Events() << textEvent, this, [&](bool success) {
+        finished = true;
+        written = success;
+    });
+    QTRY_VERIFY(finished);
+    QVERIFY(written);
+
+    History::Event retrievedEvent;
+    mManager->getSingleEventAsync(History::EventTypeText, textEvent.accountId(), textEvent.threadId(), textEvent.eventId(), this,
+                                  [&](const History::Event &result) { retrievedEvent = result; });
+    QTRY_VERIFY(!retrievedEvent.isNull());
+    QVERIFY(retrievedEvent == textEvent);
+
+    History::Threads participantThreads;
+    mManager->requestThreadParticipantsAsync(History::Threads() << thread, this,
+                                             [&](const History::Threads &result) { participantThreads = result; });
+    QTRY_COMPARE(participantThreads.count(), 1);
+    QCOMPARE(participantThreads.first().participants().identifiers(), QStringList() << "asyncParticipant");
+
+    finished = false;
+    bool marked = false;
+    mManager->markThreadsAsReadAsync(History::Threads() << thread, this, [&](bool success) {
+        finished = true;
+        marked = success;
+    });
+    QTRY_VERIFY(finished);
+    QVERIFY(marked);
+    QCOMPARE(mManager->getSingleThread(thread.type(), thread.accountId(), thread.threadId()).unreadCount(), 0);
+
+    finished = false;
+    bool removed = false;
+    mManager->removeEventsAsync(History::Events() << textEvent, this, [&](bool success) {
+        finished = true;
+        removed = success;
+    });
+    QTRY_VERIFY(finished);
+    QVERIFY(removed);
+    QVERIFY(mManager->getSingleEvent(History::EventTypeText, textEvent.accountId(), textEvent.threadId(), textEvent.eventId()).isNull());
+
+    // a thread of its own, the one above might have gone away with its only event
+    History::Thread removalThread = mManager->threadForParticipants("asyncRemovalAccountId", History::EventTypeText,
+                                                                    QStringList() << "asyncParticipant",
+                                                                    History::MatchCaseSensitive, true);
+    QVERIFY(!removalThread.isNull());
+    finished = false;
+    removed = false;
+    mManager->removeThreadsAsync(History::Threads() << removalThread, this, [&](bool success) {
+        finished = true;
+        removed = success;
+    });
+    QTRY_VERIFY(finished);
+    QVERIFY(removed);
+    QVERIFY(mManager->getSingleThread(removalThread.type(), removalThread.accountId(), removalThread.threadId()).isNull());
+
+    // the callback is not called if its context goes away before the reply arrives
+    bool called = false;
+    QObject *context = new QObject();
+    mManager->getSingleThreadAsync(thread.type(), thread.accountId(), thread.threadId(), QVariantMap(), context,
+                                   [&](const History::Thread &) { called = true; });
+    delete context;
+    QTest::qWait(100);
+    QVERIFY(!called);
+}
+
 void ManagerTest::testRemoveThreads()
 {
     // create two threads, one for voice and one for text
@@ -31,6 +31,11 @@ private Q_SLOTS:
     void testIsPhoneNumber();
     void testComparePhoneNumbers_data();
     void testComparePhoneNumbers();
+    void testPhoneNumberMatchKey_data();
+    void testPhoneNumberMatchKey();
+    void testCacheStatistics();
+    void benchmarkNormalizePhoneNumber_data();
+    void benchmarkNormalizePhoneNumber();
 };
 
 void PhoneUtilsTest::testIsPhoneNumber_data()
@@ -85,5 +90,94 @@ void PhoneUtilsTest::testComparePhoneNumbers()
     QCOMPARE(result, expectedResult);
 }
 
+void PhoneUtilsTest::testPhoneNumberMatchKey_data()
+{
+    testComparePhoneNumbers_data();
+}
+
+void PhoneUtilsTest::testPhoneNumberMatchKey()
+{
+    QFETCH(QString, number1);
+    QFETCH(QString, number2);
+    QFETCH(bool, expectedResult);
+
+    QString key1 = History::PhoneUtils::phoneNumberMatchKey(History::PhoneUtils::normalizePhoneNumber(number1));
+    QString key2 = History::PhoneUtils::phoneNumberMatchKey(History::PhoneUtils::normalizePhoneNumber(number2));
+
+    // numbers without a full key are always compared one by one, the others need to share the key
+    if (expectedResult && !key1.isEmpty() && !key2.isEmpty()) {
+        QCOMPARE(key1, key2);
+    }
+}
+
+void PhoneUtilsTest::testCacheStatistics()
+{
+    History::PhoneUtils::clearCache();
+    QCOMPARE(History::PhoneUtils::cacheHits(), 0);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 0);
+
+    QCOMPARE(History::PhoneUtils::normalizePhoneNumber("(555) 123-4567"), QString("5551234567"));
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 1);
+
+    // the same identifier must be served from the cache with the same results
+    QCOMPARE(History::PhoneUtils::normalizePhoneNumber("(555) 123-4567"), QString("5551234567"));
+    QVERIFY(History::PhoneUtils::isPhoneNumber("(555) 123-4567"));
+    QCOMPARE(History::PhoneUtils::cacheHits(), 2);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 1);
+
+    QCOMPARE(History::PhoneUtils::normalizePhoneNumber("abcdefg"), QString("abcdefg"));
+    QVERIFY(!History::PhoneUtils::isPhoneNumber("abcdefg"));
+    QCOMPARE(History::PhoneUtils::cacheHits(), 3);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 2);
+
+    // the match keys use the same parse, so the models do not parse a number for every row again
+    QCOMPARE(History::PhoneUtils::phoneNumberMatchKey("5551234567"), QString("1234567"));
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 3);
+    QCOMPARE(History::PhoneUtils::phoneNumberMatchKey("5551234567"), QString("1234567"));
+    QCOMPARE(History::PhoneUtils::cacheHits(), 4);
+    QCOMPARE(History::PhoneUtils::cacheMisses(), 3);
+}
+
+void PhoneUtilsTest::benchmarkNormalizePhoneNumber_data()
+{
+    QTest::addColumn<bool>("cached");
+
+    QTest::newRow("without cache") << false;
+    QTest::newRow("with cache") << true;
+}
+
+void PhoneUtilsTest::benchmarkNormalizePhoneNumber()
+{
+    QFETCH(bool, cached);
+
+    // simulate the identifiers seen when loading a conversation list: a few hundred contacts,
+    // each of them showing up several times and written in different formats
+    QStringList identifiers;
+    for (int i = 0; i < 2000; ++i) {
+        int contact = (i * 7) % 300;
+        switch (i % 3) {
+        case 0:
+            identifiers << QString("+1555%1").arg(contact, 7, 10, QChar('0'));
+            break;
+        case 1:
+            identifiers << QString("(555) %1").arg(contact, 7, 10, QChar('0'));
+            break;
+        default:
+            identifiers << QString("555%1").arg(contact, 7, 10, QChar('0'));
+            break;
+        }
+    }
+
+    History::PhoneUtils::clearCache();
+    QBENCHMARK {
+        Q_FOREACH(const QString &identifier, identifiers) {
+            if (!cached) {
+                History::PhoneUtils::clearCache();
+            }
+            History::PhoneUtils::normalizePhoneNumber(identifier);
+        }
+    }
+}
+
 QTEST_MAIN(PhoneUtilsTest)
 #include "PhoneUtilsTest.moc"
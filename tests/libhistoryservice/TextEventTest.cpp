@@ -35,6 +35,8 @@ private Q_SLOTS:
     void testProperties_data();
     void testProperties();
     void testSetProperties();
+    void testDetachOnWrite();
+    void benchmarkCopyEvents();
 
 private:
     History::Participants participantsFromIdentifiers(const QString &accountId, const QStringList &identifiers);
@@ -333,6 +335,53 @@ void TextEventTest::testSetProperties()
     QCOMPARE(textEvent.newEvent(), newEvent);
 }
 
+void TextEventTest::testDetachOnWrite()
+{
+    History::TextEvent textEvent("oneAccountId", "oneThreadId", "oneEventId", "oneSender", QDateTime::currentDateTime(),
+                                 true, "Hello", History::MessageTypeText, History::MessageStatusPending);
+
+    // copies share the data until one of them is modified
+    History::Event event = textEvent;
+    History::TextEvent copy = event;
+    copy.setMessageStatus(History::MessageStatusDelivered);
+    copy.setNewEvent(false);
+
+    QCOMPARE(textEvent.messageStatus(), History::MessageStatusPending);
+    QCOMPARE(textEvent.newEvent(), true);
+    QCOMPARE(History::TextEvent(event).messageStatus(), History::MessageStatusPending);
+    QCOMPARE(copy.messageStatus(), History::MessageStatusDelivered);
+    QCOMPARE(copy.newEvent(), false);
+    QCOMPARE(copy.message(), textEvent.message());
+}
+
+void TextEventTest::benchmarkCopyEvents()
+{
+    History::Participants participants = participantsFromIdentifiers("oneAccountId", QStringList() << "first" << "second");
+    History::Events events;
+    for (int i = 0; i < 10000; ++i) {
+        events << History::TextEvent("oneAccountId", "oneThreadId", QString("event%1").arg(i), "first",
+                                     QDateTime::currentDateTime(), true, "Hello", History::MessageTypeText,
+                                     History::MessageStatusUnknown, QDateTime(), QString(), History::InformationTypeNone,
+                                     History::TextEventAttachments(), participants);
+    }
+
+    // this is what happens to a page of events on its way to the models: it gets filtered
+    // into a new list, converted back to the specific type and stored
+    QBENCHMARK {
+        History::Events filteredEvents;
+        Q_FOREACH(const History::Event &event, events) {
+            if (!event.isNull()) {
+                filteredEvents << event;
+            }
+        }
+        QList<History::TextEvent> textEvents;
+        Q_FOREACH(const History::Event &event, filteredEvents) {
+            textEvents << History::TextEvent(event);
+        }
+        QCOMPARE(textEvents.count(), events.count());
+    }
+}
+
 History::Participants TextEventTest::participantsFromIdentifiers(const QString &accountId, const QStringList &identifiers)
 {
     History::Participants participants;
@@ -45,6 +45,7 @@ private Q_SLOTS:
     void testEqualsOperator();
     void testCopyConstructor();
     void testAssignmentOperator();
+    void testDetachOnWrite();
 
 private:
     History::Participants participantsFromIdentifiers(const QString &accountId, const QStringList &identifiers);
@@ -314,6 +315,21 @@ void ThreadTest::testAssignmentOperator()
     QVERIFY(other == thread);
 }
 
+void ThreadTest::testDetachOnWrite()
+{
+    History::Thread thread("OneAccountId", "OneThreadId", History::EventTypeText, participantsFromIdentifiers("OneAccountId", QStringList() << "Foo" << "Bar"));
+    History::Thread copy(thread);
+    copy.addParticipants(participantsFromIdentifiers("OneAccountId", QStringList() << "Baz"));
+    QCOMPARE(thread.participants().identifiers(), QStringList() << "Foo" << "Bar");
+    QCOMPARE(copy.participants().identifiers(), QStringList() << "Foo" << "Bar" << "Baz");
+
+    History::Thread other;
+    other = thread;
+    other.removeParticipants(participantsFromIdentifiers("OneAccountId", QStringList() << "Foo"));
+    QCOMPARE(thread.participants().identifiers(), QStringList() << "Foo" << "Bar");
+    QCOMPARE(other.participants().identifiers(), QStringList() << "Bar");
+}
+
 History::Participants ThreadTest::participantsFromIdentifiers(const QString &accountId, const QStringList &identifiers)
 {
     History::Participants participants;
@@ -40,8 +40,12 @@ class ThreadViewTest : public QObject
 private Q_SLOTS:
     void initTestCase();
     void testNextPage();
+    void testNextPageAsync();
     void testFilter();
     void testSort();
+    void testFilteredSignals();
+    void benchmarkFrameStall_data();
+    void benchmarkFrameStall();
 
 private:
     void populate();
@@ -76,6 +80,39 @@ void ThreadViewTest::testNextPage()
     }
 }
 
+void ThreadViewTest::testNextPageAsync()
+{
+    History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeText);
+    History::Threads allThreads;
+    bool done = false;
+
+    // pages requested before the view got created on the service are sent once it is
+    std::function<void(const History::Threads&)> onPage = [&](const History::Threads &threads) {
+        if (threads.isEmpty()) {
+            done = true;
+            return;
+        }
+        allThreads << threads;
+        view->nextPage(onPage);
+    };
+    view->nextPage(onPage);
+    QVERIFY(allThreads.isEmpty());
+    QTRY_VERIFY(done);
+
+    QCOMPARE(allThreads.count(), THREAD_COUNT);
+    Q_FOREACH(const History::Thread &thread, allThreads) {
+        QCOMPARE(thread.type(), History::EventTypeText);
+    }
+
+    // destroying the view with a page still pending drops the callback
+    bool called = false;
+    view = History::Manager::instance()->queryThreads(History::EventTypeText);
+    view->nextPage([&](const History::Threads &) { called = true; });
+    view.clear();
+    QTest::qWait(100);
+    QVERIFY(!called);
+}
+
 void ThreadViewTest::testFilter()
 {
     History::UnionFilter filter;
@@ -124,6 +161,116 @@ void ThreadViewTest::testSort()
     QCOMPARE(allThreads.last().accountId(), QString("account00"));
 }
 
+void ThreadViewTest::testFilteredSignals()
+{
+    History::Thread thread = History::Manager::instance()->threadForParticipants("account10",
+                                                                                 History::EventTypeText,
+                                                                                 QStringList() << "participant10",
+                                                                                 History::MatchCaseSensitive);
+    History::Thread otherThread = History::Manager::instance()->threadForParticipants("account11",
+                                                                                      History::EventTypeText,
+                                                                                      QStringList() << "participant11",
+                                                                                      History::MatchCaseSensitive);
+    QVERIFY(!thread.isNull());
+    QVERIFY(!otherThread.isNull());
+
+    // the changes written right after the query, before the view path is known, are not lost
+    History::ThreadViewPtr view = History::Manager::instance()->queryThreads(History::EventTypeText, History::Sort(),
+                                                                             History::Filter(History::FieldAccountId, thread.accountId()));
+    QSignalSpy threadsModified(view.data(), SIGNAL(threadsModified(History::Threads)));
+    for (int i = 0; i < 2; ++i) {
+        // and only the threads matching the filter of the view are sent to it
+        History::TextEvent otherEvent(otherThread.accountId(), otherThread.threadId(), QString("filteredSignalsEvent%1").arg(i),
+                                      "participant11", QDateTime::currentDateTime(), true, "Not for this view",
+                                      History::MessageTypeText, History::MessageStatusDelivered);
+        History::TextEvent event(thread.accountId(), thread.threadId(), QString("filteredSignalsEvent%1").arg(i),
+                                 "participant10", QDateTime::currentDateTime(), true, "For this view",
+                                 History::MessageTypeText, History::MessageStatusDelivered);
+        QVERIFY(History::Manager::instance()->writeEvents(History::Events() << otherEvent << event));
+        QTRY_COMPARE(threadsModified.count(), i + 1);
+
+        History::Threads threads = threadsModified.last().first().value<History::Threads>();
+        QCOMPARE(threads.count(), 1);
+        QCOMPARE(threads.first().threadId(), thread.threadId());
+        QCOMPARE(threads.first().accountId(), thread.accountId());
+
+        // the second change is written once the view got created on the service
+        if (i == 0) {
+            QVERIFY(!view->nextPage().isEmpty());
+        }
+    }
+
+    // each change is only sent once, even when it arrived while switching to the view path
+    QTest::qWait(100);
+    QCOMPARE(threadsModified.count(), 2);
+}
+
+void ThreadViewTest::benchmarkFrameStall_data()
+{
+    QTest::addColumn<bool>("async");
+
+    QTest::newRow("blocking pages") << false;
+    QTest::newRow("asynchronous pages") << true;
+}
+
+void ThreadViewTest::benchmarkFrameStall()
+{
+    QFETCH(bool, async);
+
+    // a 60fps frame clock asking for one page per frame, like a list scrolling through a model;
+    // the longest gap between two frames is how long the UI thread got stuck
+    QTimer frameTimer;
+    frameTimer.setInterval(16);
+    QElapsedTimer clock;
+    qint64 lastFrame = 0;
+    qint64 longestFrame = 0;
+    int droppedFrames = 0;
+
+    History::ThreadViewPtr view;
+    int views = 0;
+    bool fetching = false;
+    bool exhausted = false;
+    std::function<void(const History::Threads&)> onPage = [&](const History::Threads &threads) {
+        fetching = false;
+        exhausted = threads.isEmpty();
+    };
+
+    connect(&frameTimer, &QTimer::timeout, [&]() {
+        qint64 now = clock.elapsed();
+        longestFrame = qMax(longestFrame, now - lastFrame);
+        droppedFrames += (now - lastFrame) / 17;
+        lastFrame = now;
+
+        if (exhausted) {
+            view.clear();
+            exhausted = false;
+        }
+
+        if (view.isNull()) {
+            if (views++ == 20) {
+                frameTimer.stop();
+                return;
+            }
+            view = History::Manager::instance()->queryThreads(History::EventTypeText);
+        }
+
+        if (!async) {
+            onPage(view->nextPage());
+        } else if (!fetching) {
+            fetching = true;
+            view->nextPage(onPage);
+        }
+    });
+
+    QBENCHMARK_ONCE {
+        clock.start();
+        frameTimer.start();
+        QTRY_VERIFY_WITH_TIMEOUT(!frameTimer.isActive(), 60000);
+    }
+
+    qDebug() << "Longest frame:" << longestFrame << "ms, dropped frames:" << droppedFrames;
+}
+
 void ThreadViewTest::populate()
 {
     // create voice threads
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QDBusArgument>
+#include <QDBusMetaType>
+
+#include "thread.h"
+#include "textevent.h"
+#include "voiceevent.h"
+#include "wireformat_p.h"
+
+Q_DECLARE_METATYPE(QList< QVariantMap >)
+
+class WireFormatTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testThreadsRoundTrip();
+    void testEventsRoundTrip();
+    void testStringTimestamps();
+    void testUnsupportedVersion();
+    void benchmarkThreadsPage_data();
+    void benchmarkThreadsPage();
+
+private:
+    History::Participants participants(const QString &accountId, int count);
+    History::Thread thread(int index, const History::Threads &groupedThreads = History::Threads());
+};
+
+void WireFormatTest::initTestCase()
+{
+    qDBusRegisterMetaType<QList<QVariantMap> >();
+}
+
+void WireFormatTest::testThreadsRoundTrip()
+{
+    History::Thread grouped = thread(1);
+    History::Thread original = thread(0, History::Threads() << grouped);
+
+    History::Threads threads = History::WireFormat::decodeThreads(
+                History::WireFormat::encodeThreads(QList<QVariantMap>() << original.properties()));
+    QCOMPARE(threads.count(), 1);
+
+    History::Thread decoded = threads.first();
+    QCOMPARE(decoded.accountId(), original.accountId());
+    QCOMPARE(decoded.threadId(), original.threadId());
+    QCOMPARE(decoded.type(), original.type());
+    QCOMPARE(decoded.chatType(), original.chatType());
+    QCOMPARE(decoded.timestamp(), original.timestamp());
+    QCOMPARE(decoded.count(), original.count());
+    QCOMPARE(decoded.unreadCount(), original.unreadCount());
+    QCOMPARE(decoded.chatRoomInfo(), original.chatRoomInfo());
+    QCOMPARE(decoded.participants().count(), original.participants().count());
+    for (int i = 0; i < original.participants().count(); ++i) {
+        QCOMPARE(decoded.participants()[i].properties(), original.participants()[i].properties());
+    }
+
+    History::TextEvent lastEvent = decoded.lastEvent();
+    History::TextEvent originalEvent = original.lastEvent();
+    QCOMPARE(lastEvent.eventId(), originalEvent.eventId());
+    QCOMPARE(lastEvent.senderId(), originalEvent.senderId());
+    QCOMPARE(lastEvent.message(), originalEvent.message());
+    QCOMPARE(lastEvent.messageStatus(), originalEvent.messageStatus());
+    QCOMPARE(lastEvent.readTimestamp(), originalEvent.readTimestamp());
+    QCOMPARE(lastEvent.attachments().count(), originalEvent.attachments().count());
+    QCOMPARE(lastEvent.attachments().first().filePath(), originalEvent.attachments().first().filePath());
+
+    QCOMPARE(decoded.groupedThreads().count(), 1);
+    QCOMPARE(decoded.groupedThreads().first().threadId(), grouped.threadId());
+    QCOMPARE(decoded.groupedThreads().first().lastEvent().eventId(), grouped.lastEvent().eventId());
+}
+
+void WireFormatTest::testEventsRoundTrip()
+{
+    History::TextEvent textEvent("oneAccountId", "oneThreadId", "oneEventId", "oneSender", QDateTime::currentDateTime(),
+                                 true, "Hello", History::MessageTypeText, History::MessageStatusDelivered,
+                                 QDateTime::currentDateTime(), "Subject", History::InformationTypeNone,
+                                 History::TextEventAttachments(), participants("oneAccountId", 2));
+    History::VoiceEvent voiceEvent("oneAccountId", "oneThreadId", "twoEventId", "oneSender", QDateTime::currentDateTime(),
+                                   false, true, QTime(0, 1, 30), "remote", participants("oneAccountId", 1));
+
+    History::Events events = History::WireFormat::decodeEvents(
+                History::WireFormat::encodeEvents(QList<QVariantMap>() << textEvent.properties() << voiceEvent.properties()));
+    QCOMPARE(events.count(), 2);
+
+    // the result needs to match what the map form produces
+    QVariantMap decodedText = events[0].properties();
+    QVariantMap mappedText = History::TextEvent::fromProperties(textEvent.properties()).properties();
+    QCOMPARE(events[0].type(), History::EventTypeText);
+    QCOMPARE(History::TextEvent(events[0]).attachments().count(), 0);
+    decodedText.remove(History::FieldAttachments);
+    mappedText.remove(History::FieldAttachments);
+    QCOMPARE(decodedText, mappedText);
+
+    QCOMPARE(events[1].type(), History::EventTypeVoice);
+    QCOMPARE(events[1].properties(), History::VoiceEvent::fromProperties(voiceEvent.properties()).properties());
+}
+
+void WireFormatTest::testStringTimestamps()
+{
+    // plugins return the timestamps as strings, they need to be sent as integers
+    QDateTime timestamp = QDateTime::currentDateTime();
+    QVariantMap properties = thread(0).properties();
+    properties[History::FieldTimestamp] = timestamp.toString("yyyy-MM-ddTHH:mm:ss.zzz");
+
+    History::Threads threads = History::WireFormat::decodeThreads(
+                History::WireFormat::encodeThreads(QList<QVariantMap>() << properties));
+    QCOMPARE(threads.count(), 1);
+    QCOMPARE(threads.first().timestamp(), timestamp);
+    QCOMPARE(threads.first().lastEvent().timestamp(), timestamp);
+}
+
+void WireFormatTest::testUnsupportedVersion()
+{
+    QList<QVariantMap> page = QList<QVariantMap>() << thread(0).properties();
+    QVERIFY(History::WireFormat::encodeThreads(page, History::WireFormat::VersionMap).isEmpty());
+    QVERIFY(History::WireFormat::encodeThreads(page, 42).isEmpty());
+    QVERIFY(!History::WireFormat::isSupported(42));
+
+    QByteArray data;
+    QDataStream stream(&data, QIODevice::WriteOnly);
+    stream << (quint32) 42 << (quint32) 1;
+    QTest::ignoreMessage(QtWarningMsg, "Unsupported wire format version: 42");
+    QVERIFY(History::WireFormat::decodeThreads(data).isEmpty());
+}
+
+void WireFormatTest::benchmarkThreadsPage_data()
+{
+    QTest::addColumn<bool>("binary");
+    QTest::newRow("map") << false;
+    QTest::newRow("binary") << true;
+}
+
+void WireFormatTest::benchmarkThreadsPage()
+{
+    QFETCH(bool, binary);
+
+    // a page of threads as the service returns it
+    QList<QVariantMap> page;
+    for (int i = 0; i < 15; ++i) {
+        page << thread(i).properties();
+    }
+
+    QBENCHMARK {
+        QDBusArgument argument;
+        History::Threads threads;
+        if (binary) {
+            QByteArray data = History::WireFormat::encodeThreads(page);
+            argument << data;
+            threads = History::WireFormat::decodeThreads(data);
+        } else {
+            argument << page;
+            Q_FOREACH(const QVariantMap &properties, page) {
+                threads << History::Thread::fromProperties(properties);
+            }
+        }
+        QCOMPARE(threads.count(), page.count());
+    }
+}
+
+History::Participants WireFormatTest::participants(const QString &accountId, int count)
+{
+    History::Participants participants;
+    for (int i = 0; i < count; ++i) {
+        QVariantMap detailProperties;
+        detailProperties["phoneNumberSubTypes"] = QVariantList() << 1 << 2;
+        participants << History::Participant(accountId, QString("+1555123%1").arg(i, 4, 10, QChar('0')),
+                                             QString("contact%1").arg(i), QString("Contact %1").arg(i),
+                                             QString("file:///avatar%1.png").arg(i),
+                                             History::ParticipantStateRegular, History::ParticipantRoleMember,
+                                             detailProperties);
+    }
+    return participants;
+}
+
+History::Thread WireFormatTest::thread(int index, const History::Threads &groupedThreads)
+{
+    QString accountId("ofono/ofono/account0");
+    QString threadId = QString("thread%1").arg(index);
+    History::Participants threadParticipants = participants(accountId, 3);
+    QDateTime timestamp = QDateTime::currentDateTime().addSecs(-index);
+
+    History::TextEventAttachments attachments;
+    attachments << History::TextEventAttachment(accountId, threadId, "event", "attachment", "image/png",
+                                                "/tmp/attachment.png");
+    History::TextEvent lastEvent(accountId, threadId, "event", threadParticipants.first().identifier(), timestamp,
+                                 true, "Hello world", History::MessageTypeMultiPart, History::MessageStatusRead,
+                                 timestamp, QString(), History::InformationTypeNone, attachments, threadParticipants);
+
+    QVariantMap chatRoomInfo;
+    chatRoomInfo[History::FieldChatRoomName] = "room";
+    chatRoomInfo[History::FieldChatRoomTitle] = "Some room";
+    chatRoomInfo[History::FieldChatRoomCreator] = "creator";
+    chatRoomInfo[History::FieldChatRoomJoined] = true;
+    chatRoomInfo[History::FieldChatRoomSelfRoles] = 3;
+    chatRoomInfo[History::FieldChatRoomParticipantLimit] = 100;
+
+    return History::Thread(accountId, threadId, History::EventTypeText, threadParticipants, timestamp, lastEvent,
+                           10 + index, index, groupedThreads, History::ChatTypeRoom, chatRoomInfo);
+}
+
+QTEST_MAIN(WireFormatTest)
+#include "WireFormatTest.moc"
@@ -24,6 +24,7 @@
 #include "textevent.h"
 #include "voiceevent.h"
 #include "intersectionfilter.h"
+#include <QSqlQuery>
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
@@ -40,6 +41,7 @@ private Q_SLOTS:
     void testFilter();
     void testSort();
     void testSortWithMultipleFields();
+    void testKeysetPaging();
 
 private:
     SQLiteHistoryPlugin *mPlugin;
@@ -151,6 +153,41 @@ void SqliteEventViewTest::testSortWithMultipleFields()
     delete view;
 }
 
+void SqliteEventViewTest::testKeysetPaging()
+{
+    // all the events share a few timestamps, so make sure the pages don't skip or repeat any of them
+    History::Sort sort(QString("%1, %2").arg(History::FieldTimestamp).arg(History::FieldEventId), Qt::DescendingOrder);
+    History::PluginEventView *view = mPlugin->queryEvents(History::EventTypeText, sort);
+    QVERIFY(view->IsValid());
+
+    // keyset paging should not materialize the results in a temporary table
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec("SELECT count(*) FROM sqlite_temp_master WHERE type='table'"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 0);
+    query.finish();
+
+    QList<QVariantMap> allEvents;
+    QSet<QString> keys;
+    QList<QVariantMap> events = view->NextPage();
+    while (!events.isEmpty()) {
+        Q_FOREACH(const QVariantMap &event, events) {
+            keys << event[History::FieldAccountId].toString() + event[History::FieldThreadId].toString() + event[History::FieldEventId].toString();
+        }
+        allEvents << events;
+        events = view->NextPage();
+    }
+
+    QCOMPARE(allEvents.count(), EVENT_COUNT * 2);
+    QCOMPARE(keys.count(), EVENT_COUNT * 2);
+    for (int i = 1; i < allEvents.count(); ++i) {
+        QDateTime previous = QDateTime::fromString(allEvents[i-1][History::FieldTimestamp].toString(), Qt::ISODate);
+        QDateTime current = QDateTime::fromString(allEvents[i][History::FieldTimestamp].toString(), Qt::ISODate);
+        QVERIFY(previous >= current);
+    }
+    delete view;
+}
+
 void SqliteEventViewTest::populateDatabase()
 {
     mPlugin->beginBatchOperation();
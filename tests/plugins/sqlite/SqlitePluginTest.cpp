@@ -20,6 +20,7 @@
 #include <QtTest/QtTest>
 #include "sqlitehistoryplugin.h"
 #include "sqlitedatabase.h"
+#include "phoneutils_p.h"
 #include "sqlitehistorythreadview.h"
 #include "sqlitehistoryeventview.h"
 #include "textevent.h"
@@ -27,9 +28,44 @@
 #include "voiceevent.h"
 #include "intersectionfilter.h"
 #include "unionfilter.h"
+#include "utils_p.h"
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_METATYPE(SQLiteDatabase::StorageProfile)
+
+// commits one message per transaction on its own connection, like the daemon does during a burst
+class BurstWriter : public QThread
+{
+public:
+    BurstWriter(const QString &databasePath, SQLiteDatabase::StorageProfile profile)
+        : mDatabasePath(databasePath), mProfile(profile) { }
+
+protected:
+    void run()
+    {
+        {
+            QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", "writer");
+            database.setDatabaseName(mDatabasePath);
+            database.open();
+            SQLiteDatabase::applyStorageProfile(database, mProfile);
+
+            QSqlQuery query(database);
+            query.prepare("INSERT INTO messages (message) VALUES (:message)");
+            for (int i = 0; i < 500; ++i) {
+                database.transaction();
+                query.bindValue(":message", QString("message %1").arg(i));
+                query.exec();
+                database.commit();
+            }
+        }
+        QSqlDatabase::removeDatabase("writer");
+    }
+
+private:
+    QString mDatabasePath;
+    SQLiteDatabase::StorageProfile mProfile;
+};
 
 class SqlitePluginTest : public QObject
 {
@@ -42,15 +78,32 @@ private Q_SLOTS:
     void testThreadForParticipants_data();
     void testThreadForParticipants();
     void testEmptyThreadForParticipants();
+    void testUpdateRoomParticipantsHash();
+    void benchmarkThreadForParticipants_data();
+    void benchmarkThreadForParticipants();
+    void benchmarkGroupedThreadsCache_data();
+    void benchmarkGroupedThreadsCache();
+    void benchmarkFirstGroupedPage_data();
+    void benchmarkFirstGroupedPage();
+    void benchmarkBulkWrite_data();
+    void benchmarkBulkWrite();
+    void testStorageProfileFromName();
+    void benchmarkReadWhileWriting_data();
+    void benchmarkReadWhileWriting();
+    void testThreadGroups();
+    void testThreadGroupsWithoutMatchKey();
+    void testThreadGroupsMaintenance();
     void testGetSingleThread();
     void testRemoveThread();
     void testBatchOperation();
     void testRollback();
+    void testRollbackWrittenEvents();
     void testQueryThreads();
     void testQueryEvents();
     void testWriteTextEvent_data();
     void testWriteTextEvent();
     void testModifyTextEvent();
+    void benchmarkWriteTextEvent();
     void testRemoveTextEvent();
     void testWriteVoiceEvent_data();
     void testWriteVoiceEvent();
@@ -65,6 +118,8 @@ private Q_SLOTS:
     void testEscapeFilterValue();
 
 private:
+    void populateGroupedThreads(int threadCount);
+    QString threadGroup(const QString &accountId, const QString &threadId);
     SQLiteHistoryPlugin *mPlugin;
 };
 
@@ -164,6 +219,11 @@ void SqlitePluginTest::testThreadForParticipants_data()
                                                                    << (QStringList() << "12345678" << "+19999999999")
                                                                    << History::MatchFlags(History::MatchPhoneNumber)
                                                                    << (QStringList() << "+554112345678" << "9999999");
+    QTest::newRow("phone number exact match with multiple participants") << "phoneAccount"
+                                                                         << History::EventTypeText
+                                                                         << (QStringList() << "+12345678901" << "+19999999999")
+                                                                         << History::MatchFlags(History::MatchPhoneNumber)
+                                                                         << (QStringList() << "+19999999999" << "+12345678901");
 }
 
 void SqlitePluginTest::testThreadForParticipants()
@@ -197,6 +257,397 @@ void SqlitePluginTest::testEmptyThreadForParticipants()
     QVERIFY(thread.isEmpty());
 }
 
+void SqlitePluginTest::testUpdateRoomParticipantsHash()
+{
+    SQLiteDatabase::instance()->reopen();
+
+    QString accountId("ofono/ofono/account0");
+    QVariantMap thread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText, QStringList() << "+15550001000");
+    QString threadId = thread[History::FieldThreadId].toString();
+    QVERIFY(!threadId.isEmpty());
+
+    QVariantMap participant;
+    participant["identifier"] = "+1 555-000-2000";
+    QVERIFY(mPlugin->updateRoomParticipants(accountId, threadId, History::EventTypeText, QVariantList() << participant));
+
+    // the hash is computed from the normalized ids, the same way it is when the thread is created
+    QString normalizedId = History::Utils::normalizeId(accountId, participant["identifier"].toString());
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec(QString("SELECT participantsHash FROM threads WHERE threadId='%1'").arg(threadId)));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), SQLiteDatabase::participantsHash(QStringList() << normalizedId));
+    QVERIFY(query.exec(QString("SELECT normalizedId FROM thread_participants WHERE threadId='%1'").arg(threadId)));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), normalizedId);
+
+    // and the thread is found by its new participants, whatever their format
+    thread = mPlugin->threadForParticipants(accountId, History::EventTypeText, QStringList() << "5550002000", History::MatchPhoneNumber);
+    QCOMPARE(thread[History::FieldThreadId].toString(), threadId);
+    QVERIFY(mPlugin->threadForParticipants(accountId, History::EventTypeText, QStringList() << "+15550001000", History::MatchPhoneNumber).isEmpty());
+}
+
+void SqlitePluginTest::benchmarkThreadForParticipants_data()
+{
+    QTest::addColumn<QString>("participant");
+    QTest::addColumn<QString>("threadId");
+
+    QTest::newRow("same format as stored") << "+15550005000" << "thread5000";
+    QTest::newRow("different format than stored") << "5550005000" << "thread5000";
+    QTest::newRow("new conversation") << "+15559995000" << QString();
+}
+
+void SqlitePluginTest::benchmarkThreadForParticipants()
+{
+    QFETCH(QString, participant);
+    QFETCH(QString, threadId);
+
+    SQLiteDatabase::instance()->reopen();
+
+    // insert the threads directly, bypassing the plugin's grouping cache
+    QString accountId("ofono/ofono/account0");
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    SQLiteDatabase::instance()->beginTransation();
+    for (int i = 0; i < 10000; ++i) {
+        QString phoneNumber = QString("+1555000%1").arg(i, 4, 10, QChar('0'));
+        QString threadId = QString("thread%1").arg(i);
+        query.prepare("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, participantsHash) "
+                      "VALUES (:accountId, :threadId, :type, 0, 0, :chatType, :participantsHash)");
+        query.bindValue(":accountId", accountId);
+        query.bindValue(":threadId", threadId);
+        query.bindValue(":type", (int) History::EventTypeText);
+        query.bindValue(":chatType", (int) History::ChatTypeContact);
+        query.bindValue(":participantsHash", SQLiteDatabase::participantsHash(QStringList() << phoneNumber));
+        QVERIFY(query.exec());
+        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, matchKey) "
+                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :matchKey)");
+        query.bindValue(":accountId", accountId);
+        query.bindValue(":threadId", threadId);
+        query.bindValue(":type", (int) History::EventTypeText);
+        query.bindValue(":participantId", phoneNumber);
+        query.bindValue(":normalizedId", phoneNumber);
+        query.bindValue(":matchKey", History::PhoneUtils::phoneNumberMatchKey(phoneNumber));
+        QVERIFY(query.exec());
+    }
+    SQLiteDatabase::instance()->finishTransaction();
+
+    QVariantMap thread;
+    QBENCHMARK {
+        thread = mPlugin->threadForParticipants(accountId, History::EventTypeText, QStringList() << participant, History::MatchPhoneNumber);
+    }
+    QCOMPARE(thread[History::FieldThreadId].toString(), threadId);
+}
+
+void SqlitePluginTest::benchmarkGroupedThreadsCache_data()
+{
+    QTest::addColumn<int>("threadCount");
+
+    QTest::newRow("5k threads") << 5000;
+    QTest::newRow("20k threads") << 20000;
+    QTest::newRow("100k threads") << 100000;
+}
+
+void SqlitePluginTest::benchmarkGroupedThreadsCache()
+{
+    QFETCH(int, threadCount);
+
+    populateGroupedThreads(threadCount);
+
+    // this is what the daemon does at startup
+    QBENCHMARK_ONCE {
+        SQLiteHistoryPlugin plugin;
+        plugin.updateGroupedThreadsCache();
+        while (!plugin.initialised()) {
+            QCoreApplication::processEvents();
+        }
+    }
+}
+
+void SqlitePluginTest::benchmarkFirstGroupedPage_data()
+{
+    benchmarkGroupedThreadsCache_data();
+}
+
+void SqlitePluginTest::benchmarkFirstGroupedPage()
+{
+    QFETCH(int, threadCount);
+
+    populateGroupedThreads(threadCount);
+
+    QVariantMap properties;
+    properties[History::FieldGroupingProperty] = History::FieldParticipants;
+
+    // the first page must not wait for the whole cache to be built
+    QList<QVariantMap> page;
+    SQLiteHistoryPlugin plugin;
+    QBENCHMARK_ONCE {
+        plugin.updateGroupedThreadsCache();
+        History::PluginThreadView *view = plugin.queryThreads(History::EventTypeText,
+                                                              History::Sort("timestamp", Qt::DescendingOrder),
+                                                              History::Filter(),
+                                                              properties);
+        page = view->NextPage();
+        delete view;
+    }
+    QVERIFY(!plugin.initialised());
+    QVERIFY(!page.isEmpty());
+
+    // and the conversations in it must already be complete
+    Q_FOREACH(const QVariantMap &thread, page) {
+        int index = thread[History::FieldThreadId].toString().mid(6).toInt();
+        bool grouped = (index % 10 == 9) || (index % 10 == 8 && index + 1 < threadCount);
+        QCOMPARE(thread[History::FieldGroupedThreads].toList().count(), grouped ? 2 : 1);
+    }
+}
+
+void SqlitePluginTest::benchmarkBulkWrite_data()
+{
+    QTest::addColumn<int>("eventCount");
+
+    QTest::newRow("1k events") << 1000;
+    QTest::newRow("10k events") << 10000;
+    QTest::newRow("100k events") << 100000;
+}
+
+void SqlitePluginTest::benchmarkBulkWrite()
+{
+    QFETCH(int, eventCount);
+
+    SQLiteDatabase::instance()->reopen();
+
+    // spread the events over a hundred threads, like importing a backup would
+    QString accountId("ofono/ofono/account0");
+    QStringList threadIds;
+    for (int i = 0; i < 100; ++i) {
+        QVariantMap thread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText,
+                                                                  QStringList() << QString("+1555000%1").arg(i, 4, 10, QChar('0')));
+        threadIds << thread[History::FieldThreadId].toString();
+    }
+
+    QList<QVariantMap> events;
+    QDateTime timestamp = QDateTime::currentDateTime();
+    for (int i = 0; i < eventCount; ++i) {
+        const QString &threadId = threadIds[i % threadIds.count()];
+        events << History::TextEvent(accountId, threadId, QString("event%1").arg(i), threadId, timestamp.addSecs(i),
+                                     false, "Hello world!", History::MessageTypeText).properties();
+    }
+
+    QElapsedTimer timer;
+    QBENCHMARK_ONCE {
+        timer.start();
+        QVERIFY(mPlugin->beginBatchOperation());
+        Q_FOREACH(const QVariantMap &event, events) {
+            QCOMPARE(mPlugin->writeTextEvent(event), History::EventWriteCreated);
+        }
+        QVERIFY(mPlugin->endBatchOperation());
+    }
+    qDebug() << "Wrote" << eventCount << "events at" << eventCount * 1000 / qMax<qint64>(timer.elapsed(), 1) << "rows per second";
+
+    QVariantMap thread = mPlugin->getSingleThread(History::EventTypeText, accountId, threadIds.first());
+    QCOMPARE(thread[History::FieldCount].toInt(), eventCount / threadIds.count());
+}
+
+void SqlitePluginTest::testStorageProfileFromName()
+{
+    // the write-ahead log is opt-in, existing databases keep their rollback journal
+    QCOMPARE(SQLiteDatabase::storageProfileFromName(QString()), SQLiteDatabase::ProfileRollbackJournal);
+    QCOMPARE(SQLiteDatabase::storageProfileFromName("wal"), SQLiteDatabase::ProfileWriteAheadLog);
+    QCOMPARE(SQLiteDatabase::storageProfileFromName("rollback"), SQLiteDatabase::ProfileRollbackJournal);
+    QCOMPARE(SQLiteDatabase::storageProfileFromName("unknown"), SQLiteDatabase::ProfileRollbackJournal);
+}
+
+void SqlitePluginTest::benchmarkReadWhileWriting_data()
+{
+    QTest::addColumn<SQLiteDatabase::StorageProfile>("profile");
+
+    QTest::newRow("rollback journal") << SQLiteDatabase::ProfileRollbackJournal;
+    QTest::newRow("write-ahead log") << SQLiteDatabase::ProfileWriteAheadLog;
+}
+
+void SqlitePluginTest::benchmarkReadWhileWriting()
+{
+    QFETCH(SQLiteDatabase::StorageProfile, profile);
+
+    // the journal modes only make a difference on a file
+    QTemporaryDir dir;
+    QString databasePath = dir.path() + "/history.sqlite";
+
+    int reads = 0;
+    int blockedReads = 0;
+    {
+        // readers should not wait for the writer, only report that the database was locked
+        QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", "reader");
+        database.setDatabaseName(databasePath);
+        database.setConnectOptions("QSQLITE_BUSY_TIMEOUT=0");
+        QVERIFY(database.open());
+        QVERIFY(SQLiteDatabase::applyStorageProfile(database, profile));
+
+        QSqlQuery query(database);
+        QVERIFY(query.exec("CREATE TABLE messages (id INTEGER PRIMARY KEY, message TEXT)"));
+
+        BurstWriter writer(databasePath, profile);
+        QBENCHMARK_ONCE {
+            writer.start();
+            while (!writer.isFinished()) {
+                if (query.exec("SELECT count(*) FROM messages") && query.next()) {
+                    ++reads;
+                } else {
+                    ++blockedReads;
+                }
+                query.finish();
+            }
+        }
+        writer.wait();
+
+        QVERIFY(query.exec("SELECT count(*) FROM messages") && query.next());
+        QCOMPARE(query.value(0).toInt(), 500);
+    }
+    QSqlDatabase::removeDatabase("reader");
+    qDebug() << "Completed" << reads << "reads while writing," << blockedReads << "were blocked by the writer";
+}
+
+void SqlitePluginTest::populateGroupedThreads(int threadCount)
+{
+    SQLiteDatabase::instance()->reopen();
+
+    // every tenth thread is on a second SIM and uses the national format of the previous
+    // thread's number, so that it gets grouped with it
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    SQLiteDatabase::instance()->beginTransation();
+    for (int i = 0; i < threadCount; ++i) {
+        bool secondSim = (i % 10 == 9);
+        QString accountId = secondSim ? "ofono/ofono/account1" : "ofono/ofono/account0";
+        QString phoneNumber = secondSim ? QString("555%1").arg(i - 1, 7, 10, QChar('0'))
+                                        : QString("+1555%1").arg(i, 7, 10, QChar('0'));
+        QString threadId = QString("thread%1").arg(i);
+        query.prepare("INSERT INTO threads (accountId, threadId, type, count, unreadCount, chatType, participantsHash) "
+                      "VALUES (:accountId, :threadId, :type, 0, 0, :chatType, :participantsHash)");
+        query.bindValue(":accountId", accountId);
+        query.bindValue(":threadId", threadId);
+        query.bindValue(":type", (int) History::EventTypeText);
+        query.bindValue(":chatType", (int) History::ChatTypeContact);
+        query.bindValue(":participantsHash", SQLiteDatabase::participantsHash(QStringList() << phoneNumber));
+        QVERIFY(query.exec());
+        query.prepare("INSERT INTO thread_participants (accountId, threadId, type, participantId, normalizedId, matchKey) "
+                      "VALUES (:accountId, :threadId, :type, :participantId, :normalizedId, :matchKey)");
+        query.bindValue(":accountId", accountId);
+        query.bindValue(":threadId", threadId);
+        query.bindValue(":type", (int) History::EventTypeText);
+        query.bindValue(":participantId", phoneNumber);
+        query.bindValue(":normalizedId", phoneNumber);
+        query.bindValue(":matchKey", History::PhoneUtils::phoneNumberMatchKey(phoneNumber));
+        QVERIFY(query.exec());
+    }
+    SQLiteDatabase::instance()->finishTransaction();
+}
+
+void SqlitePluginTest::testThreadGroups()
+{
+    SQLiteDatabase::instance()->reopen();
+
+    // the same phone number written in different formats gets grouped
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "+15557654321");
+    mPlugin->createThreadForParticipants("ofono/ofono/account1", History::EventTypeText, QStringList() << "5557654321");
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "+15557650000");
+
+    // and the groups are saved to the database
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec("SELECT COUNT(*), COUNT(DISTINCT groupAccountId || groupThreadId) FROM thread_groups"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 3);
+    QCOMPARE(query.value(1).toInt(), 2);
+    query.clear();
+
+    // a new instance restores the groups without rebuilding them and only lists one thread per conversation
+    SQLiteHistoryPlugin plugin;
+    plugin.updateGroupedThreadsCache();
+    QVERIFY(plugin.initialised());
+
+    QVariantMap properties;
+    properties[History::FieldGroupingProperty] = History::FieldParticipants;
+    History::PluginThreadView *view = plugin.queryThreads(History::EventTypeText,
+                                                          History::Sort("timestamp", Qt::DescendingOrder),
+                                                          History::Filter(),
+                                                          properties);
+    QList<QVariantMap> threads = view->NextPage();
+    delete view;
+    QCOMPARE(threads.count(), 2);
+
+    QList<int> groupSizes;
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        groupSizes << thread[History::FieldGroupedThreads].toList().count();
+    }
+    qSort(groupSizes);
+    QCOMPARE(groupSizes, QList<int>() << 1 << 2);
+}
+
+void SqlitePluginTest::testThreadGroupsWithoutMatchKey()
+{
+    SQLiteDatabase::instance()->reopen();
+
+    // short numbers and sender names have no phone number key, they are grouped only when identical
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "1234");
+    mPlugin->createThreadForParticipants("ofono/ofono/account1", History::EventTypeText, QStringList() << "1234");
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "4321");
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "1234" << "+15557654321");
+    mPlugin->createThreadForParticipants("ofono/ofono/account1", History::EventTypeText, QStringList() << "5557654321" << "1234");
+    mPlugin->createThreadForParticipants("ofono/ofono/account0", History::EventTypeText, QStringList() << "Operator");
+    mPlugin->createThreadForParticipants("ofono/ofono/account1", History::EventTypeText, QStringList() << "Operator");
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec("SELECT COUNT(*), COUNT(DISTINCT groupAccountId || groupThreadId) FROM thread_groups"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 7);
+    QCOMPARE(query.value(1).toInt(), 4);
+}
+
+void SqlitePluginTest::testThreadGroupsMaintenance()
+{
+    SQLiteDatabase::instance()->reopen();
+    SQLiteHistoryPlugin plugin;
+
+    QString firstThreadId = plugin.createThreadForParticipants("ofono/ofono/account0", History::EventTypeText,
+                                                               QStringList() << "+15557654321")[History::FieldThreadId].toString();
+    QString secondThreadId = plugin.createThreadForParticipants("ofono/ofono/account1", History::EventTypeText,
+                                                                QStringList() << "5557654321")[History::FieldThreadId].toString();
+    QString thirdThreadId = plugin.createThreadForParticipants("ofono/ofono/account1", History::EventTypeText,
+                                                               QStringList() << "5550001111")[History::FieldThreadId].toString();
+    QCOMPARE(threadGroup("ofono/ofono/account0", firstThreadId), threadGroup("ofono/ofono/account1", secondThreadId));
+    QCOMPARE(threadGroup("ofono/ofono/account1", thirdThreadId), thirdThreadId);
+
+    // a new event makes its thread the one displayed for the conversation
+    History::TextEvent event("ofono/ofono/account1", secondThreadId, "event0", "5557654321", QDateTime::currentDateTime(),
+                             false, "Hello world!", History::MessageTypeText);
+    QCOMPARE(plugin.writeTextEvent(event.properties()), History::EventWriteCreated);
+    QCOMPARE(threadGroup("ofono/ofono/account0", firstThreadId), secondThreadId);
+    QCOMPARE(threadGroup("ofono/ofono/account1", secondThreadId), secondThreadId);
+
+    // changing the participants moves the thread to the conversation they match
+    QVariantMap participant;
+    participant["identifier"] = "+15557654321";
+    QVERIFY(plugin.updateRoomParticipants("ofono/ofono/account1", thirdThreadId, History::EventTypeText, QVariantList() << participant));
+    QCOMPARE(threadGroup("ofono/ofono/account1", thirdThreadId), secondThreadId);
+
+    // and removing the displayed thread moves the others to a new one
+    QVERIFY(plugin.removeThread(plugin.getSingleThread(History::EventTypeText, "ofono/ofono/account1", secondThreadId)));
+    QVERIFY(threadGroup("ofono/ofono/account1", secondThreadId).isNull());
+    QString group = threadGroup("ofono/ofono/account0", firstThreadId);
+    QVERIFY(group == firstThreadId || group == thirdThreadId);
+    QCOMPARE(threadGroup("ofono/ofono/account1", thirdThreadId), group);
+}
+
+QString SqlitePluginTest::threadGroup(const QString &accountId, const QString &threadId)
+{
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    query.prepare("SELECT groupThreadId FROM thread_groups WHERE accountId=:accountId AND threadId=:threadId AND type=:type");
+    query.bindValue(":accountId", accountId);
+    query.bindValue(":threadId", threadId);
+    query.bindValue(":type", (int) History::EventTypeText);
+    if (!query.exec() || !query.next()) {
+        return QString::null;
+    }
+    return query.value(0).toString();
+}
+
 void SqlitePluginTest::testGetSingleThread()
 {
     // reset the database
@@ -278,6 +729,26 @@ void SqlitePluginTest::testRollback()
     QCOMPARE(query.value(0).toInt(), version);
 }
 
+void SqlitePluginTest::testRollbackWrittenEvents()
+{
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    QVariantMap thread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText, QStringList() << "theParticipant");
+    History::TextEvent textEvent(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString(), "theEventId",
+                                 "theParticipant", QDateTime::currentDateTime(), true, "Hi there!", History::MessageTypeText);
+
+    // the events written inside a batch operation must not be committed on their own
+    QVERIFY(mPlugin->beginBatchOperation());
+    QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+    QVERIFY(mPlugin->rollbackBatchOperation());
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec("SELECT count(*) FROM text_events"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toInt(), 0);
+}
+
 void SqlitePluginTest::testQueryThreads()
 {
     // just make sure the returned view is of the correct type. The views are going to be tested in their own tests
@@ -439,6 +910,22 @@ void SqlitePluginTest::testModifyTextEvent()
     QCOMPARE(count, 1);
 }
 
+void SqlitePluginTest::benchmarkWriteTextEvent()
+{
+    // clear the database
+    SQLiteDatabase::instance()->reopen();
+
+    // this is what happens for every incoming message: a new event is written on its own
+    QVariantMap thread = mPlugin->createThreadForParticipants("theAccountId", History::EventTypeText, QStringList() << "theParticipant");
+    int eventCount = 0;
+    QBENCHMARK {
+        History::TextEvent textEvent(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString(),
+                                     QString("event%1").arg(eventCount++), "theParticipant", QDateTime::currentDateTime(),
+                                     true, "Hi there!", History::MessageTypeText);
+        QCOMPARE(mPlugin->writeTextEvent(textEvent.properties()), History::EventWriteCreated);
+    }
+}
+
 void SqlitePluginTest::testRemoveTextEvent()
 {
     // clear the database
@@ -613,6 +1100,13 @@ void SqlitePluginTest::testEventsForThread()
         QCOMPARE(textEvent[History::FieldAccountId], textThread[History::FieldAccountId]);
         QCOMPARE(textEvent[History::FieldThreadId], textThread[History::FieldThreadId]);
         QCOMPARE(textEvent[History::FieldType], textThread[History::FieldType]);
+
+        // each event should get its own attachment back
+        QList<QVariantMap> attachments = textEvent[History::FieldAttachments].value<QList<QVariantMap> >();
+        QCOMPARE(attachments.count(), 1);
+        QCOMPARE(attachments[0][History::FieldEventId], textEvent[History::FieldEventId]);
+        QCOMPARE(attachments[0][History::FieldAttachmentId].toString(),
+                 textEvent[History::FieldEventId].toString().replace("textEventId", "attachment"));
     }
 
     // test voice events
@@ -0,0 +1,161 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QRegularExpression>
+#include <QSqlError>
+#include <QSqlQuery>
+#include "sqlitehistoryplugin.h"
+#include "sqlitehistoryeventview.h"
+#include "sqlitedatabase.h"
+#include "intersectionfilter.h"
+#include "textevent.h"
+#include "voiceevent.h"
+#include "types.h"
+
+// gives access to the queries the view runs for its pages
+class PlanEventView : public SQLiteHistoryEventView
+{
+public:
+    PlanEventView(SQLiteHistoryPlugin *plugin, History::EventType type, const History::Sort &sort, const History::Filter &filter)
+        : SQLiteHistoryEventView(plugin, type, sort, filter) { }
+    using SQLiteHistoryEventView::nextPageQuery;
+};
+
+class SqliteQueryPlanTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void testQueryPlan_data();
+    void testQueryPlan();
+
+private:
+    void addPageRows(History::EventType type, const QString &name);
+
+    SQLiteHistoryPlugin *mPlugin;
+    QVariantMap mTextThread;
+    QVariantMap mVoiceThread;
+    QVariantMap mTextEvent;
+    QVariantMap mVoiceEvent;
+};
+
+void SqliteQueryPlanTest::initTestCase()
+{
+    qputenv("HISTORY_SQLITE_DBPATH", ":memory:");
+    mPlugin = new SQLiteHistoryPlugin(this);
+
+    // the views only build the query for the next page once they returned one
+    mTextThread = mPlugin->createThreadForParticipants("planAccount", History::EventTypeText, QStringList() << "planParticipant");
+    mVoiceThread = mPlugin->createThreadForParticipants("planAccount", History::EventTypeVoice, QStringList() << "planParticipant");
+    mTextEvent = History::TextEvent("planAccount", mTextThread[History::FieldThreadId].toString(), "planTextEvent", "planParticipant",
+                                    QDateTime::currentDateTime(), true, "Hello", History::MessageTypeText).properties();
+    mVoiceEvent = History::VoiceEvent("planAccount", mVoiceThread[History::FieldThreadId].toString(), "planVoiceEvent", "planParticipant",
+                                      QDateTime::currentDateTime(), true, false).properties();
+    QCOMPARE(mPlugin->writeTextEvent(mTextEvent), History::EventWriteCreated);
+    QCOMPARE(mPlugin->writeVoiceEvent(mVoiceEvent), History::EventWriteCreated);
+}
+
+void SqliteQueryPlanTest::testQueryPlan_data()
+{
+    QTest::addColumn<QString>("queryText");
+
+    QString accountId("planAccount");
+    QString textThreadId = mTextThread[History::FieldThreadId].toString();
+    QString voiceThreadId = mVoiceThread[History::FieldThreadId].toString();
+    QVariantMap bindValues;
+
+    addPageRows(History::EventTypeText, "text events");
+    addPageRows(History::EventTypeVoice, "voice events");
+
+    // the thread list, as the thread views create their tables
+    QString threadOrder("ORDER BY lastEventTimestamp DESC");
+    QVariantMap grouping;
+    grouping[History::FieldGroupingProperty] = History::FieldParticipants;
+    QString accountCondition = mPlugin->filterToString(History::Filter(History::FieldAccountId, accountId), bindValues);
+    QTest::newRow("text threads") << mPlugin->sqlQueryForThreads(History::EventTypeText, QString::null, threadOrder);
+    QTest::newRow("voice threads") << mPlugin->sqlQueryForThreads(History::EventTypeVoice, QString::null, threadOrder);
+    QTest::newRow("text threads of an account") << mPlugin->sqlQueryForThreads(History::EventTypeText, accountCondition, threadOrder);
+    QTest::newRow("grouped text threads") << mPlugin->sqlQueryForThreads(History::EventTypeText,
+                                                                         mPlugin->groupedThreadsCondition(History::EventTypeText, grouping),
+                                                                         threadOrder);
+
+    QTest::newRow("single text event") << mPlugin->sqlQueryForSingleEvent(History::EventTypeText, accountId, textThreadId, "planTextEvent");
+    QTest::newRow("single voice event") << mPlugin->sqlQueryForSingleEvent(History::EventTypeVoice, accountId, voiceThreadId, "planVoiceEvent");
+    QTest::newRow("single text thread") << mPlugin->sqlQueryForSingleThread(History::EventTypeText, accountId, textThreadId);
+    QTest::newRow("single voice thread") << mPlugin->sqlQueryForSingleThread(History::EventTypeVoice, accountId, voiceThreadId);
+
+    QList<QVariantMap> threads = QList<QVariantMap>() << mTextThread << mVoiceThread;
+    QList<QVariantMap> events = QList<QVariantMap>() << mTextEvent << mTextEvent;
+    QTest::newRow("event attachments") << mPlugin->sqlQueryForAttachments(events, bindValues);
+    QTest::newRow("thread participants") << mPlugin->sqlQueryForParticipants(threads, bindValues);
+    QTest::newRow("chat room info") << mPlugin->sqlQueryForChatRoomInfo(threads, bindValues);
+
+    QTest::newRow("threads for participants hash") << mPlugin->sqlQueryForThreadsWithHash();
+    QTest::newRow("participants of a thread") << mPlugin->sqlQueryForThreadParticipantIds(false);
+    QTest::newRow("normalized participants of a thread") << mPlugin->sqlQueryForThreadParticipantIds(true);
+    QTest::newRow("threads sharing participants") << mPlugin->sqlQueryForThreadMatches();
+    QTest::newRow("thread unread count") << mPlugin->sqlQueryForUnreadCount();
+    QTest::newRow("mark thread as read") << mPlugin->sqlQueryForMarkThreadAsRead();
+    QTest::newRow("remove text event") << mPlugin->sqlQueryForRemoveEvent(History::EventTypeText);
+    QTest::newRow("remove voice event") << mPlugin->sqlQueryForRemoveEvent(History::EventTypeVoice);
+    QTest::newRow("remove thread") << mPlugin->sqlQueryForRemoveThread();
+}
+
+/// adds the queries of the first and the next page of the events of a thread, the way the views page them
+void SqliteQueryPlanTest::addPageRows(History::EventType type, const QString &name)
+{
+    const QVariantMap &thread = type == History::EventTypeText ? mTextThread : mVoiceThread;
+    History::IntersectionFilter filter;
+    filter.append(History::Filter(History::FieldAccountId, thread[History::FieldAccountId]));
+    filter.append(History::Filter(History::FieldThreadId, thread[History::FieldThreadId]));
+
+    PlanEventView view(mPlugin, type, History::Sort(History::FieldTimestamp, Qt::DescendingOrder), filter);
+    QVariantMap bindValues;
+    QTest::newRow(qPrintable(name + " of a thread")) << view.nextPageQuery(bindValues);
+    QCOMPARE(view.NextPage().count(), 1);
+    QTest::newRow(qPrintable("next page of " + name + " of a thread")) << view.nextPageQuery(bindValues);
+}
+
+void SqliteQueryPlanTest::testQueryPlan()
+{
+    QFETCH(QString, queryText);
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY2(query.prepare("EXPLAIN QUERY PLAN " + queryText), qPrintable(query.lastError().text()));
+
+    // the values don't matter for the query plan, but all placeholders need to be bound
+    QRegularExpressionMatchIterator it = QRegularExpression(":\\w+").globalMatch(queryText);
+    while (it.hasNext()) {
+        query.bindValue(it.next().captured(0), QString());
+    }
+    QVERIFY2(query.exec(), qPrintable(query.lastError().text()));
+
+    int steps = 0;
+    while (query.next()) {
+        QString detail = query.value(3).toString();
+        QVERIFY2(!detail.startsWith("SCAN"), qPrintable(QString("%1\n  %2").arg(detail, queryText)));
+        steps++;
+    }
+    QVERIFY(steps > 0);
+}
+
+QTEST_MAIN(SqliteQueryPlanTest)
+#include "SqliteQueryPlanTest.moc"
@@ -0,0 +1,181 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QSqlQuery>
+#include "sqlitedatabase.h"
+#include "sqlitereader.h"
+
+class SqliteReaderTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void testExecute();
+    void testReadOnly();
+    void testFunctions();
+    void testQueuedQueries();
+    void benchmarkIngestLatency_data();
+    void benchmarkIngestLatency();
+
+private:
+    QTemporaryDir *mDir;
+    QString mDatabasePath;
+};
+
+void SqliteReaderTest::init()
+{
+    mDir = new QTemporaryDir();
+    mDatabasePath = mDir->path() + "/history.sqlite";
+
+    // the writer connection, using the write-ahead log like the daemon does
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", "writer");
+    database.setDatabaseName(mDatabasePath);
+    QVERIFY(database.open());
+    QVERIFY(SQLiteDatabase::applyStorageProfile(database, SQLiteDatabase::ProfileWriteAheadLog));
+
+    QSqlQuery query(database);
+    QVERIFY(query.exec("CREATE TABLE messages (id INTEGER PRIMARY KEY, threadId TEXT, message TEXT)"));
+    QVERIFY(query.exec("INSERT INTO messages (threadId, message) VALUES ('oneThread', 'Hello')"));
+}
+
+void SqliteReaderTest::cleanup()
+{
+    QSqlDatabase::database("writer", false).close();
+    QSqlDatabase::removeDatabase("writer");
+    delete mDir;
+}
+
+void SqliteReaderTest::testExecute()
+{
+    SQLiteReader reader(mDatabasePath, SQLiteDatabase::ProfileWriteAheadLog);
+    QVariantMap bindValues;
+    bindValues[":threadId"] = "oneThread";
+    SQLiteReadResult result = reader.execute("SELECT message FROM messages WHERE threadId=:threadId", bindValues);
+    QVERIFY(result.success);
+    QCOMPARE(result.rows.count(), 1);
+    QCOMPARE(result.rows.first().value("message").toString(), QString("Hello"));
+
+    // and commits done after the reader was opened are seen by it
+    QSqlQuery query(QSqlDatabase::database("writer"));
+    QVERIFY(query.exec("INSERT INTO messages (threadId, message) VALUES ('oneThread', 'World')"));
+    result = reader.execute("SELECT message FROM messages WHERE threadId=:threadId", bindValues);
+    QCOMPARE(result.rows.count(), 2);
+}
+
+void SqliteReaderTest::testReadOnly()
+{
+    SQLiteReader reader(mDatabasePath, SQLiteDatabase::ProfileWriteAheadLog);
+    QTest::ignoreMessage(QtCriticalMsg, QRegularExpression("^Error:.*"));
+    QVERIFY(!reader.execute("INSERT INTO messages (threadId, message) VALUES ('oneThread', 'World')").success);
+
+    // temporary tables can still be created
+    QVERIFY(reader.execute("CREATE TEMP TABLE view AS SELECT * FROM messages").success);
+}
+
+void SqliteReaderTest::testFunctions()
+{
+    SQLiteReader reader(mDatabasePath, SQLiteDatabase::ProfileWriteAheadLog);
+    SQLiteReadResult result = reader.execute("SELECT comparePhoneNumbers('+1 (555) 123-4567', '5551234567')");
+    QVERIFY(result.success);
+    QCOMPARE(result.rows.first().value(0).toInt(), 1);
+}
+
+void SqliteReaderTest::testQueuedQueries()
+{
+    SQLiteReader reader(mDatabasePath, SQLiteDatabase::ProfileWriteAheadLog);
+    QSignalSpy spy(&reader, SIGNAL(finished(int,SQLiteReadResult)));
+
+    // queued queries run in order on the same connection, so the second one sees the table created by the first
+    int createJob = reader.enqueue("CREATE TEMP TABLE view AS SELECT * FROM messages");
+    int selectJob = reader.enqueue("SELECT * FROM view");
+    QTRY_COMPARE(spy.count(), 2);
+    QCOMPARE(spy[0][0].toInt(), createJob);
+    QCOMPARE(spy[1][0].toInt(), selectJob);
+    SQLiteReadResult result = spy[1][1].value<SQLiteReadResult>();
+    QVERIFY(result.success);
+    QCOMPARE(result.rows.count(), 1);
+}
+
+void SqliteReaderTest::benchmarkIngestLatency_data()
+{
+    QTest::addColumn<bool>("useReader");
+
+    QTest::newRow("queries on the writer connection") << false;
+    QTest::newRow("queries on a read connection") << true;
+}
+
+void SqliteReaderTest::benchmarkIngestLatency()
+{
+    QFETCH(bool, useReader);
+
+    QSqlDatabase database = QSqlDatabase::database("writer");
+    QSqlQuery query(database);
+    QVERIFY(database.transaction());
+    QVERIFY(query.prepare("INSERT INTO messages (threadId, message) VALUES (:threadId, :message)"));
+    for (int i = 0; i < 50000; ++i) {
+        query.bindValue(":threadId", QString("thread%1").arg(i % 500));
+        query.bindValue(":message", QString("message %1").arg(i));
+        QVERIFY(query.exec());
+    }
+    QVERIFY(database.commit());
+
+    // what a client creating a view does
+    QString heavyQuery("SELECT threadId, count(*), max(message) FROM messages GROUP BY threadId ORDER BY 3 DESC");
+
+    // messages arrive every two milliseconds while the clients keep querying
+    SQLiteReader reader(mDatabasePath, SQLiteDatabase::ProfileWriteAheadLog);
+    QList<qint64> latencies;
+    QBENCHMARK_ONCE {
+        if (useReader) {
+            for (int i = 0; i < 20; ++i) {
+                reader.enqueue(heavyQuery);
+            }
+        }
+
+        QElapsedTimer clock;
+        clock.start();
+        for (int i = 0; i < 500; ++i) {
+            qint64 arrival = i * 2000000;
+            while (clock.nsecsElapsed() < arrival) {
+                QThread::yieldCurrentThread();
+            }
+
+            if (!useReader && i % 25 == 0) {
+                QVERIFY(SQLiteReader::exec(database, heavyQuery).success);
+            }
+
+            database.transaction();
+            query.bindValue(":threadId", "oneThread");
+            query.bindValue(":message", QString("incoming %1").arg(i));
+            QVERIFY(query.exec());
+            database.commit();
+            latencies << clock.nsecsElapsed() - arrival;
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    qDebug() << "Ingest latency p50:" << latencies[latencies.count() / 2] / 1000 << "us,"
+             << "p99:" << latencies[latencies.count() * 99 / 100] / 1000 << "us";
+}
+
+QTEST_MAIN(SqliteReaderTest)
+#include "SqliteReaderTest.moc"
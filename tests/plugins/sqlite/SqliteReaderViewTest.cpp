@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2017 Canonical, Ltd.
+ *
+ * This file is part of history-service.
+ *
+ * history-service is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * history-service is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QtCore/QObject>
+#include <QtTest/QtTest>
+#include <QSqlQuery>
+#include "sqlitehistoryplugin.h"
+#include "sqlitehistoryeventview.h"
+#include "sqlitehistorythreadview.h"
+#include "sqlitedatabase.h"
+#include "textevent.h"
+
+Q_DECLARE_METATYPE(History::EventType)
+Q_DECLARE_METATYPE(History::MatchFlags)
+
+#define THREAD_COUNT 20
+#define EVENT_COUNT 40
+
+// the other sqlite tests use an in-memory database, which has no read connections and
+// never syncs; these run against a database file using the write-ahead log, like the daemon
+class SqliteReaderViewTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void cleanupTestCase();
+    void testStorageProfile();
+    void testCheckpoint();
+    void testReaders();
+    void testEventPages_data();
+    void testEventPages();
+    void testThreadPages();
+    void testReadersAfterPluginDeleted();
+    void benchmarkBurstIngest_data();
+    void benchmarkBurstIngest();
+
+private:
+    QTemporaryDir mDir;
+    SQLiteHistoryPlugin *mPlugin;
+
+    void populateDatabase();
+};
+
+void SqliteReaderViewTest::initTestCase()
+{
+    qRegisterMetaType<History::EventType>();
+    qRegisterMetaType<History::MatchFlags>();
+
+    QVERIFY(mDir.isValid());
+    qputenv("HISTORY_SQLITE_DBPATH", QString(mDir.path() + "/history.sqlite").toUtf8());
+    qputenv("HISTORY_SQLITE_PROFILE", "wal");
+    qputenv("HISTORY_SQLITE_CHECKPOINT_INTERVAL", "200");
+    mPlugin = new SQLiteHistoryPlugin(this);
+
+    populateDatabase();
+}
+
+void SqliteReaderViewTest::cleanupTestCase()
+{
+    delete mPlugin;
+}
+
+void SqliteReaderViewTest::testStorageProfile()
+{
+    QCOMPARE(SQLiteDatabase::instance()->storageProfile(), SQLiteDatabase::ProfileWriteAheadLog);
+
+    QSqlQuery query(SQLiteDatabase::instance()->database());
+    QVERIFY(query.exec("PRAGMA journal_mode"));
+    QVERIFY(query.next());
+    QCOMPARE(query.value(0).toString(), QString("wal"));
+
+    // without a limit the log file would keep the size of the biggest burst of writes
+    QVERIFY(query.exec("PRAGMA journal_size_limit"));
+    QVERIFY(query.next());
+    QVERIFY(query.value(0).toLongLong() > 0);
+}
+
+void SqliteReaderViewTest::testCheckpoint()
+{
+    QString walPath = mDir.path() + "/history.sqlite-wal";
+    QVariantMap thread = mPlugin->createThreadForParticipants("checkpointAccount", History::EventTypeText, QStringList() << "checkpointParticipant");
+    QVERIFY(!thread.isEmpty());
+
+    // the writes go to the log first, and it is copied back and truncated once the daemon is idle
+    QVERIFY(mPlugin->beginBatchOperation());
+    for (int i = 0; i < 100; ++i) {
+        History::TextEvent event("checkpointAccount", thread[History::FieldThreadId].toString(), QString("checkpointEvent%1").arg(i),
+                                 "checkpointParticipant", QDateTime::currentDateTime(), true, "Hello", History::MessageTypeText);
+        QCOMPARE(mPlugin->writeTextEvent(event.properties()), History::EventWriteCreated);
+    }
+    QVERIFY(mPlugin->endBatchOperation());
+    QVERIFY(QFileInfo(walPath).size() > 0);
+    QTRY_COMPARE(QFileInfo(walPath).size(), (qint64) 0);
+
+    // and the events are still there
+    QVariantMap updatedThread = mPlugin->getSingleThread(History::EventTypeText, "checkpointAccount", thread[History::FieldThreadId].toString());
+    QCOMPARE(updatedThread[History::FieldCount].toInt(), 100);
+}
+
+void SqliteReaderViewTest::testReaders()
+{
+    QVERIFY(SQLiteDatabase::instance()->reader() != 0);
+}
+
+void SqliteReaderViewTest::testEventPages_data()
+{
+    QTest::addColumn<QString>("sortField");
+
+    QTest::newRow("keyset paging") << History::FieldTimestamp;
+    QTest::newRow("temporary table") << History::FieldMessage;
+}
+
+void SqliteReaderViewTest::testEventPages()
+{
+    QFETCH(QString, sortField);
+
+    History::PluginEventView *view = mPlugin->queryEvents(History::EventTypeText,
+                                                          History::Sort(sortField),
+                                                          History::Filter(History::FieldAccountId, "eventAccount"));
+    QVERIFY(view->IsValid());
+
+    QList<QVariantMap> allEvents;
+    QList<QVariantMap> events = view->NextPage();
+    while (!events.isEmpty()) {
+        allEvents << events;
+        events = view->NextPage();
+    }
+    QVERIFY(view->IsValid());
+
+    // the attachments are fetched on a read connection too
+    QCOMPARE(allEvents.count(), EVENT_COUNT);
+    QSet<QString> eventIds;
+    Q_FOREACH(const QVariantMap &event, allEvents) {
+        eventIds << event[History::FieldEventId].toString();
+        QList<QVariantMap> attachments = event[History::FieldAttachments].value<QList<QVariantMap> >();
+        QCOMPARE(attachments.count(), 1);
+        QCOMPARE(attachments[0][History::FieldEventId], event[History::FieldEventId]);
+    }
+    QCOMPARE(eventIds.count(), EVENT_COUNT);
+    delete view;
+}
+
+void SqliteReaderViewTest::testThreadPages()
+{
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText,
+                                                            History::Sort(History::FieldThreadId),
+                                                            History::Filter(History::FieldAccountId, "roomAccount"));
+    QVERIFY(view->IsValid());
+
+    QList<QVariantMap> allThreads;
+    QList<QVariantMap> threads = view->NextPage();
+    while (!threads.isEmpty()) {
+        allThreads << threads;
+        threads = view->NextPage();
+    }
+    QVERIFY(view->IsValid());
+
+    QCOMPARE(allThreads.count(), THREAD_COUNT);
+    Q_FOREACH(const QVariantMap &thread, allThreads) {
+        QCOMPARE(thread[History::FieldChatRoomInfo].toMap()["RoomName"].toString(), thread[History::FieldThreadId].toString());
+        QCOMPARE(thread[History::FieldParticipants].toList().count(), 3);
+    }
+    delete view;
+}
+
+void SqliteReaderViewTest::testReadersAfterPluginDeleted()
+{
+    // deleting the plugin stops the reader threads, the next plugin gets new ones
+    delete mPlugin;
+    mPlugin = new SQLiteHistoryPlugin(this);
+    QVERIFY(SQLiteDatabase::instance()->reader() != 0);
+
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText,
+                                                            History::Sort(History::FieldThreadId),
+                                                            History::Filter(History::FieldAccountId, "roomAccount"));
+    QVERIFY(view->IsValid());
+    QVERIFY(!view->NextPage().isEmpty());
+    delete view;
+}
+
+void SqliteReaderViewTest::benchmarkBurstIngest_data()
+{
+    QTest::addColumn<int>("batchSize");
+
+    QTest::newRow("commit per message") << 1;
+    QTest::newRow("group commit of 10") << 10;
+    QTest::newRow("group commit of 100") << 100;
+}
+
+void SqliteReaderViewTest::benchmarkBurstIngest()
+{
+    QFETCH(int, batchSize);
+
+    // a group chat flood: a burst of incoming messages on a few threads,
+    // written the way the daemon's write queue flushes them
+    QString accountId = QString("burstAccount%1").arg(batchSize);
+    QStringList threadIds;
+    for (int i = 0; i < 5; ++i) {
+        QVariantMap thread = mPlugin->createThreadForParticipants(accountId, History::EventTypeText,
+                                                                  QStringList() << QString("+1555000%1").arg(i, 4, 10, QChar('0')));
+        threadIds << thread[History::FieldThreadId].toString();
+    }
+
+    QList<QVariantMap> events;
+    QDateTime timestamp = QDateTime::currentDateTime();
+    for (int i = 0; i < 1000; ++i) {
+        const QString &threadId = threadIds[i % threadIds.count()];
+        events << History::TextEvent(accountId, threadId, QString("event%1").arg(i), threadId, timestamp.addMSecs(i),
+                                     true, "Hello world!", History::MessageTypeText).properties();
+    }
+
+    QElapsedTimer timer;
+    QBENCHMARK_ONCE {
+        timer.start();
+        for (int i = 0; i < events.count(); i += batchSize) {
+            QVERIFY(mPlugin->beginBatchOperation());
+            for (int j = i; j < qMin(i + batchSize, events.count()); ++j) {
+                QCOMPARE(mPlugin->writeTextEvent(events[j]), History::EventWriteCreated);
+            }
+            QVERIFY(mPlugin->endBatchOperation());
+        }
+    }
+    qDebug() << "Ingested" << events.count() << "messages at" << events.count() * 1000 / qMax<qint64>(timer.elapsed(), 1) << "messages per second";
+
+    QVariantMap thread = mPlugin->getSingleThread(History::EventTypeText, accountId, threadIds.first());
+    QCOMPARE(thread[History::FieldCount].toInt(), events.count() / threadIds.count());
+    QCOMPARE(thread[History::FieldUnreadCount].toInt(), events.count() / threadIds.count());
+}
+
+void SqliteReaderViewTest::populateDatabase()
+{
+    mPlugin->beginBatchOperation();
+    for (int i = 0; i < THREAD_COUNT; ++i) {
+        QVariantMap chatRoomInfo;
+        chatRoomInfo["RoomName"] = QString("room%1").arg(i, 2, 10, QChar('0'));
+        chatRoomInfo["Joined"] = true;
+        QVariantMap properties;
+        properties[History::FieldChatType] = (int) History::ChatTypeRoom;
+        properties[History::FieldThreadId] = QString("room%1").arg(i, 2, 10, QChar('0'));
+        properties[History::FieldChatRoomInfo] = chatRoomInfo;
+        properties[History::FieldParticipantIds] = QStringList() << "first" << "second" << "third";
+        QVERIFY(!mPlugin->createThreadForProperties("roomAccount", History::EventTypeText, properties).isEmpty());
+    }
+
+    QVariantMap thread = mPlugin->createThreadForParticipants("eventAccount", History::EventTypeText, QStringList() << "theParticipant");
+    QVERIFY(!thread.isEmpty());
+    for (int i = 0; i < EVENT_COUNT; ++i) {
+        QString eventId = QString("eventId%1").arg(i);
+        History::TextEventAttachment attachment(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString(),
+                                                eventId, QString("attachment%1").arg(i), "text/plain", "/some/file/path");
+        History::TextEvent event(thread[History::FieldAccountId].toString(), thread[History::FieldThreadId].toString(),
+                                 eventId, "theParticipant", QDateTime::currentDateTime().addSecs(i), false,
+                                 QString("Message %1").arg(i, 2, 10, QChar('0')), History::MessageTypeMultiPart,
+                                 History::MessageStatusRead, QDateTime::currentDateTime(),
+                                 QString(), History::InformationTypeNone, History::TextEventAttachments() << attachment);
+        QCOMPARE(mPlugin->writeTextEvent(event.properties()), History::EventWriteCreated);
+    }
+    mPlugin->endBatchOperation();
+}
+
+QTEST_MAIN(SqliteReaderViewTest)
+#include "SqliteReaderViewTest.moc"
@@ -24,9 +24,15 @@
 #include "textevent.h"
 #include "voiceevent.h"
 #include "unionfilter.h"
+#include "sqlitereader.h"
+#include "sqlite3.h"
+#include <QSqlDriver>
+#include <functional>
 
 Q_DECLARE_METATYPE(History::EventType)
 Q_DECLARE_METATYPE(History::MatchFlags)
+Q_DECLARE_OPAQUE_POINTER(sqlite3*)
+Q_DECLARE_METATYPE(sqlite3*)
 
 #define THREAD_COUNT 50
 
@@ -39,11 +45,15 @@ private Q_SLOTS:
     void testNextPage();
     void testFilter();
     void testSort();
+    void testStatementsPerPage();
+    void benchmarkRoomThreadsPage();
 
 private:
     SQLiteHistoryPlugin *mPlugin;
 
     void populateDatabase();
+    void createRoomThreads(const QString &accountId);
+    int countStatements(const std::function<void()> &function);
 };
 
 void SqliteThreadViewTest::initTestCase()
@@ -128,6 +138,98 @@ void SqliteThreadViewTest::testSort()
     delete view;
 }
 
+void statementExecuted(void *counter, const char *)
+{
+    ++(*static_cast<int*>(counter));
+}
+
+void SqliteThreadViewTest::testStatementsPerPage()
+{
+    // room threads need chat room info and participants in addition to the thread data
+    createRoomThreads("roomAccount");
+
+    History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText,
+                                                            History::Sort(History::FieldThreadId),
+                                                            History::Filter(History::FieldAccountId, "roomAccount"));
+    QVERIFY(view->IsValid());
+
+    QList<QVariantMap> threads;
+    int pageStatements = countStatements([&]() { threads = view->NextPage(); });
+    QCOMPARE(threads.count(), 15);
+    Q_FOREACH(const QVariantMap &thread, threads) {
+        QCOMPARE(thread[History::FieldChatType].toInt(), (int) History::ChatTypeRoom);
+        QCOMPARE(thread[History::FieldChatRoomInfo].toMap()["RoomName"].toString(), thread[History::FieldThreadId].toString());
+        QCOMPARE(thread[History::FieldParticipants].toList().count(), 3);
+    }
+    delete view;
+
+    // parse the same rows in one go and one thread at a time, the way the page used to be assembled
+    QVariantMap bindValues;
+    QString condition = mPlugin->filterToString(History::Filter(History::FieldAccountId, "roomAccount"), bindValues);
+    QSqlDatabase database = SQLiteDatabase::instance()->database();
+    SQLiteReadResult result = SQLiteReader::exec(database, mPlugin->sqlQueryForThreads(History::EventTypeText, condition,
+                                                                                        "ORDER BY threadId ASC") + " LIMIT 15",
+                                                 bindValues);
+    QVERIFY(result.success);
+    QCOMPARE(result.rows.count(), 15);
+
+    int batched = countStatements([&]() { mPlugin->parseThreadResults(History::EventTypeText, result.rows); });
+    int unbatched = 0;
+    Q_FOREACH(const QSqlRecord &row, result.rows) {
+        unbatched += countStatements([&]() { mPlugin->parseThreadResults(History::EventTypeText, QList<QSqlRecord>() << row); });
+    }
+    qDebug() << "Statements executed for a page of" << threads.count() << "room threads:" << pageStatements
+             << "batched:" << batched << "one thread at a time:" << unbatched;
+
+    // one statement per auxiliary table, regardless of the number of threads in the page
+    QVERIFY(batched > 0);
+    QCOMPARE(unbatched, batched * result.rows.count());
+    QCOMPARE(pageStatements, batched + 1);
+}
+
+void SqliteThreadViewTest::benchmarkRoomThreadsPage()
+{
+    createRoomThreads("benchmarkRoomAccount");
+
+    QBENCHMARK {
+        History::PluginThreadView *view = mPlugin->queryThreads(History::EventTypeText,
+                                                                History::Sort(History::FieldThreadId),
+                                                                History::Filter(History::FieldAccountId, "benchmarkRoomAccount"));
+        QCOMPARE(view->NextPage().count(), 15);
+        delete view;
+    }
+}
+
+/// creates THREAD_COUNT room threads with chat room info and three participants each
+void SqliteThreadViewTest::createRoomThreads(const QString &accountId)
+{
+    mPlugin->beginBatchOperation();
+    for (int i = 0; i < THREAD_COUNT; ++i) {
+        QVariantMap chatRoomInfo;
+        chatRoomInfo["RoomName"] = QString("room%1").arg(i, 2, 10, QChar('0'));
+        chatRoomInfo["Title"] = QString("Room %1").arg(i);
+        chatRoomInfo["Joined"] = true;
+        QVariantMap properties;
+        properties[History::FieldChatType] = (int) History::ChatTypeRoom;
+        properties[History::FieldThreadId] = QString("room%1").arg(i, 2, 10, QChar('0'));
+        properties[History::FieldChatRoomInfo] = chatRoomInfo;
+        properties[History::FieldParticipantIds] = QStringList() << "first" << "second" << "third";
+        QVERIFY(!mPlugin->createThreadForProperties(accountId, History::EventTypeText, properties).isEmpty());
+    }
+    mPlugin->endBatchOperation();
+}
+
+/// returns the number of statements sqlite executed while running the function
+int SqliteThreadViewTest::countStatements(const std::function<void()> &function)
+{
+    int statements = 0;
+    sqlite3 *handle = SQLiteDatabase::instance()->database().driver()->handle().value<sqlite3*>();
+    sqlite3_trace(handle, &statementExecuted, &statements);
+    function();
+    sqlite3_trace(handle, NULL, NULL);
+    return statements;
+}
+
 void SqliteThreadViewTest::populateDatabase()
 {
     mPlugin->beginBatchOperation();